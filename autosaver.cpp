@@ -0,0 +1,168 @@
+#include <QSemaphore>
+#include <QTimer>
+#include "autosaver.h"
+#include "playlist.h"
+#include "storage.h"
+
+AutoSaver::AutoSaver(Storage *storage, QObject *parent)
+    : QObject(parent), storage(storage), timer(new QTimer(this))
+{
+    timer->setInterval(interval);
+    connect(timer, &QTimer::timeout,
+            this, [this]() { save(false); });
+    tabs.name = "playlists";
+}
+
+AutoSaver::~AutoSaver()
+{
+
+}
+
+void AutoSaver::addDocument(const QString &name, const Provider &provider)
+{
+    Document doc;
+    doc.name = name;
+    doc.provider = provider;
+    documents.append(doc);
+}
+
+void AutoSaver::setTabs(const Provider &provider)
+{
+    tabs.provider = provider;
+}
+
+void AutoSaver::start(bool playlistsStored)
+{
+    for (Document &doc : documents)
+        doc.written = doc.seen = doc.provider();
+
+    QVariant current = tabs.provider();
+    tabs.seen = current;
+    tabs.written = playlistsStored ? current : QVariant();
+    auto collection = PlaylistCollection::getSingleton();
+    QSet<QUuid> keep;
+    for (const QUuid &uuid : playlistsIn(current)) {
+        auto playlist = collection->playlistIfLoaded(uuid);
+        Tracked t;
+        if (playlist && playlistsStored)
+            t.saved = t.seen = playlist->revision();
+        else if (!playlist && collection->isDeferred(uuid))
+            t.deferred = true;
+        else if (!playlist)
+            continue;
+        playlists.insert(uuid, t);
+        keep.insert(uuid);
+    }
+
+    Storage *s = storage;
+    if (playlistsStored)
+        queue.post([s, keep]() { s->prunePlaylists(keep); });
+    else
+        save(true);
+    timer->start();
+}
+
+void AutoSaver::flush()
+{
+    save(true);
+    QSemaphore done;
+    queue.post([&done]() { done.release(); });
+    done.acquire();
+}
+
+QList<QUuid> AutoSaver::playlistsIn(const QVariant &tabs)
+{
+    // The quick playlist goes by the null uuid, and is saved like the rest.
+    QList<QUuid> uuids;
+    for (const QVariant &v : tabs.toList()) {
+        QVariantMap tab = v.toMap();
+        if (tab.contains("playlist"))
+            uuids.append(tab.value("playlist").toUuid());
+    }
+    return uuids;
+}
+
+bool AutoSaver::due(Document &doc, const QVariant &value, bool now)
+{
+    if (value == doc.written) {
+        doc.seen = value;
+        doc.waited = 0;
+        return false;
+    }
+    if (now || value == doc.seen || ++doc.waited >= patience) {
+        doc.written = doc.seen = value;
+        doc.waited = 0;
+        return true;
+    }
+    doc.seen = value;
+    return false;
+}
+
+void AutoSaver::save(bool now)
+{
+    Storage *s = storage;
+    QVariant current = tabs.provider();
+    bool tabsDue = due(tabs, current, now);
+    QList<QUuid> open = playlistsIn(current);
+
+    auto collection = PlaylistCollection::getSingleton();
+    for (const QUuid &uuid : open) {
+        auto playlist = collection->playlistIfLoaded(uuid);
+        if (!playlist)
+            continue;
+        Tracked &t = playlists[uuid];
+        if (t.deferred) {
+            t.deferred = false;
+            t.saved = t.seen = playlist->loadedRevision();
+        }
+        int revision = playlist->revision();
+        if (revision == t.saved) {
+            t.seen = revision;
+            t.waited = 0;
+            continue;
+        }
+        bool settled = revision == t.seen;
+        t.seen = revision;
+        // A playlist never written goes out with the first list of tabs
+        // that names it, however busy it is.
+        if (!now && !settled && ++t.waited < patience
+                && !(tabsDue && t.saved < 0))
+            continue;
+        // Should the playlist change before the task gets to it, the newer
+        // contents are written and the next pass writes them again.
+        t.saved = revision;
+        t.waited = 0;
+        queue.post([s, uuid, playlist]() {
+            s->writePlaylist(uuid, playlist);
+        });
+    }
+
+    if (tabsDue) {
+        QVariantList list = current.toList();
+        queue.post([s, list]() { s->writeVList("playlists", list); });
+        QSet<QUuid> stillOpen = open.toSet();
+        for (auto it = playlists.begin(); it != playlists.end();) {
+            if (stillOpen.contains(it.key())) {
+                ++it;
+                continue;
+            }
+            QUuid uuid = it.key();
+            queue.post([s, uuid]() { s->removePlaylist(uuid); });
+            it = playlists.erase(it);
+        }
+    }
+
+    for (Document &doc : documents) {
+        QVariant value = doc.provider();
+        if (!due(doc, value, now))
+            continue;
+        QString name = doc.name;
+        if (value.type() == QVariant::List) {
+            QVariantList list = value.toList();
+            queue.post([s, name, list]() { s->writeVList(name, list); });
+        } else {
+            QVariantMap map = value.toMap();
+            queue.post([s, name, map]() { s->writeVMap(name, map); });
+        }
+    }
+}
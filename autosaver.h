@@ -0,0 +1,87 @@
+#ifndef AUTOSAVER_H
+#define AUTOSAVER_H
+// Saves settings and playlists as they change, rather than all at once on
+// the way out.
+//
+// Every couple of seconds the saver looks over what it looks after and
+// picks out what changed since it was last written: documents (settings,
+// keys and the like) by comparing their value with what was written, and
+// playlists by their revision.  Something still changing is left until it
+// has settled for a pass, or until it has gone unsaved for a few passes in
+// a row, so that a burst of edits is written once.  The writing itself
+// happens in order on a SerialQueue, so the gui never waits on the disk,
+// and only what changed is written; a session with large playlists that
+// were not touched has nothing left to save when it ends.
+//
+// The playlists document is the list of tabs.  Each entry names the
+// playlist it shows by uuid, and that playlist is saved to a file of its
+// own.  Playlists are written before the list that refers to them, and
+// files are only removed after the list that dropped them, so whatever is
+// on disk after a crash hangs together.  Playlists the collection has not
+// loaded yet are left alone; once loaded, they count as saved as they were
+// loaded.
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QSet>
+#include <QUuid>
+#include <QVariant>
+#include <functional>
+#include "serialqueue.h"
+
+class QTimer;
+class Storage;
+
+class AutoSaver : public QObject {
+    Q_OBJECT
+public:
+    typedef std::function<QVariant()> Provider;
+
+    explicit AutoSaver(Storage *storage, QObject *parent = nullptr);
+    ~AutoSaver();
+
+    // name is written as a map or a list, whichever provider gives.
+    // Providers are only called on the gui thread.
+    void addDocument(const QString &name, const Provider &provider);
+    void setTabs(const Provider &provider);
+
+    // Takes what there is now to be what is on disk and starts watching
+    // for changes.  Unless playlistsStored, the playlists came from an
+    // older layout and are all written out again.
+    void start(bool playlistsStored);
+    // Writes whatever has changed and waits for it to be on disk.
+    void flush();
+
+private:
+    struct Document {
+        QString name;
+        Provider provider;
+        QVariant written;
+        QVariant seen;
+        int waited = 0;
+    };
+    struct Tracked {
+        int saved = -1;
+        int seen = -1;
+        int waited = 0;
+        // Still on disk, as the collection has not loaded it yet.
+        bool deferred = false;
+    };
+
+    static const int interval = 2000;
+    static const int patience = 5;
+
+    static QList<QUuid> playlistsIn(const QVariant &tabs);
+    bool due(Document &doc, const QVariant &value, bool now);
+    void save(bool now);
+
+    Storage *storage;
+    QTimer *timer = nullptr;
+    SerialQueue queue;
+    QList<Document> documents;
+    Document tabs;
+    QHash<QUuid, Tracked> playlists;
+};
+
+#endif // AUTOSAVER_H
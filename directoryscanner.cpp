@@ -0,0 +1,201 @@
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QSet>
+#include <QString>
+#include <functional>
+#ifndef Q_OS_WIN
+#include <sys/stat.h>
+#endif
+#include "directoryscanner.h"
+#include "helpers.h"
+#include "metadatacache.h"
+#include "paralleljobs.h"
+#include "playlist.h"
+
+// What a folder holds that is of interest: its media files and subfolders,
+// by name, and what it is on disk.
+struct FolderListing {
+    QString identity;
+    QList<QUrl> files;
+    QStringList folders;
+};
+
+// The device and inode of a folder, which are the same however it is
+// reached.  Windows has no inodes to hand, so the canonical path stands in.
+static QString folderIdentity(const QString &path)
+{
+#ifndef Q_OS_WIN
+    struct stat st;
+    if (::stat(QFile::encodeName(path).constData(), &st) == 0)
+        return QString("%1:%2").arg(quint64(st.st_dev)).arg(quint64(st.st_ino));
+#endif
+    return QFileInfo(path).canonicalFilePath();
+}
+
+static bool isMediaFile(const QFileInfo &info)
+{
+    return Helpers::fileExtensions.contains(info.suffix().toLower());
+}
+
+static FolderListing listFolder(const QString &path)
+{
+    FolderListing listing;
+    listing.identity = folderIdentity(path);
+    QDir dir(path);
+    for (const QFileInfo &i : dir.entryInfoList(QDir::NoDotAndDotDot | QDir::AllEntries,
+                                                QDir::Name | QDir::DirsLast)) {
+        if (i.isDir())
+            listing.folders.append(i.filePath());
+        else if (isMediaFile(i))
+            listing.files.append(QUrl::fromLocalFile(i.filePath()));
+    }
+    return listing;
+}
+
+// The walk itself, which hands out urls as it finds them.  sink returns
+// false to stop the walk, and is only ever called from the walking thread.
+class FolderWalk {
+public:
+    typedef std::function<bool(const QList<QUrl> &, int, int)> Sink;
+    typedef std::function<bool()> Stop;
+
+    FolderWalk(const Sink &sink, const Stop &stop) : sink(sink), stop(stop) {}
+
+    bool walk(const QList<QUrl> &urls)
+    {
+        for (const QUrl &u : urls) {
+            if (!u.isLocalFile()) {
+                if (!sink(QList<QUrl>() << u, done, found))
+                    return false;
+                continue;
+            }
+            QFileInfo info(u.toLocalFile());
+            if (info.isDir()) {
+                ++found;
+                if (!descend(listFolder(info.filePath())))
+                    return false;
+                continue;
+            }
+            if (isMediaFile(info) && !sink(QList<QUrl>() << u, done, found))
+                return false;
+        }
+        return true;
+    }
+
+private:
+    bool descend(const FolderListing &listing)
+    {
+        ++done;
+        if (stop())
+            return false;
+        if (!listing.identity.isEmpty()) {
+            if (seen.contains(listing.identity))
+                return true;
+            seen.insert(listing.identity);
+        }
+        if (!listing.files.isEmpty() && !sink(listing.files, done, found))
+            return false;
+
+        found += listing.folders.count();
+        QVector<FolderListing> listings(listing.folders.count());
+        ParallelJobs::run(listings.count(), [&](int i) {
+            if (!stop())
+                listings[i] = listFolder(listing.folders[i]);
+        });
+        for (const FolderListing &l : listings)
+            if (!descend(l))
+                return false;
+        return true;
+    }
+
+    Sink sink;
+    Stop stop;
+    QSet<QString> seen;
+    int done = 0;
+    int found = 0;
+};
+
+
+
+DirectoryScanner::DirectoryScanner() : QObject(),
+    cancelledBefore_(new QAtomicInt(0))
+{
+    qRegisterMetaType<QVector<ItemPointer>>("QVector<ItemPointer>");
+}
+
+int DirectoryScanner::nextScan()
+{
+    return nextScan_.fetchAndAddOrdered(1) + 1;
+}
+
+void DirectoryScanner::cancelAll()
+{
+    cancelledBefore_->storeRelease(nextScan_.loadAcquire() + 1);
+}
+
+bool DirectoryScanner::cancelled(int scan) const
+{
+    return scan < cancelledBefore_->loadAcquire();
+}
+
+void DirectoryScanner::scan(const QList<QUrl> &urls, int scan)
+{
+    // A slow share may take a while to fill a batch, so whatever has been
+    // found goes out at least every so often.
+    QVector<ItemPointer> batch;
+    QElapsedTimer sinceFlush;
+    sinceFlush.start();
+    int lastDone = 0;
+    int lastFound = 0;
+    auto flush = [&]() {
+        if (cancelled(scan))
+            return false;
+        if (!batch.isEmpty())
+            emit itemsFound(scan, batch, lastDone, lastFound);
+        batch.clear();
+        sinceFlush.restart();
+        return true;
+    };
+    // Files seen before come with what is known of them.  Looking them up
+    // costs a stat each, which an empty cache can do without.
+    auto cache = MetadataCache::getSingleton();
+    bool useCache = !cache->isEmpty();
+    FolderWalk walk([&](const QList<QUrl> &found, int foldersDone, int foldersFound) {
+        for (const QUrl &url : found) {
+            ItemPointer item(new Item(url));
+            QVariantMap metadata;
+            if (useCache && url.isLocalFile()
+                    && cache->lookup(url.toLocalFile(), &metadata)
+                    && !metadata.isEmpty())
+                item->setMetadata(metadata);
+            batch.append(item);
+        }
+        lastDone = foldersDone;
+        lastFound = foldersFound;
+        return (batch.count() < batchSize && sinceFlush.elapsed() < flushInterval)
+                || flush();
+    }, [&]() { return cancelled(scan); });
+    if (walk.walk(urls))
+        flush();
+    emit finished(scan);
+}
+
+bool DirectoryScanner::needsWalking(const QList<QUrl> &urls)
+{
+    for (const QUrl &u : urls)
+        if (u.isLocalFile() && QFileInfo(u.toLocalFile()).isDir())
+            return true;
+    return false;
+}
+
+QList<QUrl> DirectoryScanner::collect(const QList<QUrl> &urls)
+{
+    QList<QUrl> collected;
+    FolderWalk walk([&](const QList<QUrl> &found, int, int) {
+        collected.append(found);
+        return true;
+    }, []() { return false; });
+    walk.walk(urls);
+    return collected;
+}
@@ -0,0 +1,58 @@
+#ifndef DIRECTORYSCANNER_H
+#define DIRECTORYSCANNER_H
+// Walks dropped or opened folders for media files off the gui thread.
+//
+// Urls come out in the order the old recursive walk gave them: each url in
+// turn, with a folder's files by name before its subfolders.  While one
+// folder's files are handed out, all of its subfolders are listed at once
+// on the global thread pool, which is where the time goes on a network
+// share.  A folder reached a second time, through a symlink or a bind
+// mount, is skipped by its device and inode, so loops end.  Only files with
+// one of Helpers::fileExtensions are kept, and urls that are not local
+// files are passed through as they are.
+//
+// Scans are numbered by nextScan(), and cancelAll() stops every scan begun
+// before it at its next folder.
+
+#include <QAtomicInt>
+#include <QList>
+#include <QObject>
+#include <QSharedPointer>
+#include <QUrl>
+#include <QVector>
+#include "itempool.h"
+
+class Item;
+
+class DirectoryScanner : public QObject {
+    Q_OBJECT
+public:
+    static const int batchSize = 1000;
+    static const int flushInterval = 250;
+
+    DirectoryScanner();
+    int nextScan();
+    void cancelAll();
+    bool cancelled(int scan) const;
+
+    // May be called from any thread.
+    void scan(const QList<QUrl> &urls, int scan);
+
+    // Whether any of the urls is a local folder that needs walking.
+    static bool needsWalking(const QList<QUrl> &urls);
+    // Walks the urls in the calling thread, returning everything at once.
+    static QList<QUrl> collect(const QList<QUrl> &urls);
+
+signals:
+    // The items are not in the item collection or any playlist yet.  The
+    // number of folders found grows as the walk goes on.
+    void itemsFound(int scan, QVector<ItemPointer> items,
+                    int foldersDone, int foldersFound);
+    void finished(int scan);
+
+private:
+    QAtomicInt nextScan_;
+    QSharedPointer<QAtomicInt> cancelledBefore_;
+};
+
+#endif // DIRECTORYSCANNER_H
@@ -1,28 +1,41 @@
 #include <QApplication>
-#include <QThread>
 #include <QPainter>
 #include <QFontMetrics>
 #include <QMenu>
+#include <QMimeData>
+#include <QDrag>
+#include <QDropEvent>
 #include <QKeyEvent>
+#include <QDateTime>
+#include <QScrollBar>
+#include <QShowEvent>
+#include <QTimer>
 #include "drawnplaylist.h"
 #include "playlist.h"
 #include "helpers.h"
+#include "metadatacache.h"
+#include "thumbnailer.h"
 
-PlayPainter::PlayPainter(QObject *parent) : QAbstractItemDelegate(parent) {}
+PlayPainter::PlayPainter(QObject *parent) : QAbstractItemDelegate(parent)
+{
+    // Only the rows on screen need to be remembered, with room to spare for
+    // scrolling back and forth.
+    rows.setMaxCost(4096);
+}
 
 void PlayPainter::paint(QPainter *painter, const QStyleOptionViewItem &option,
                         const QModelIndex &index) const
 {
     auto playWidget = qobject_cast<DrawnPlaylist*>(parent());
-    auto p = playWidget->playlist();
-    if (p == nullptr)
+    auto model = qobject_cast<const PlaylistModel*>(index.model());
+    if (!model)
         return;
-    QSharedPointer<Item> i = p->itemOf(QUuid(index.data(Qt::DisplayRole).toString()));
+    ItemPointer i = model->itemAt(index.row());
     if (i == nullptr)
         return;
 
     QStyleOptionViewItem o2 = option;
-    if (playWidget->currentItemUuid() == i->uuid()) {
+    if (i == passCurrent) {
         // in some cases, the current item we want to highlight is not the
         // actual item that the list widget thinks is selected. i.e. during
         // searching the topmost item should be selected.
@@ -32,103 +45,283 @@ void PlayPainter::paint(QPainter *painter, const QStyleOptionViewItem &option,
     QApplication::style()->drawControl(QStyle::CE_ItemViewItem, &o2,
                                        painter);
     QRect rc = option.rect.adjusted(3,0,-3,0);
+    RowText *t = rowText(i.data(), playWidget->displayParser());
 
-    if (i->queuePosition() || i->extraPlayTimes()) {
-        QString extraText;
-        if (i->queuePosition())
-            extraText.append(QString::number(i->queuePosition()));
-        if (i->extraPlayTimes())
-            extraText.append(QString("+%1").arg(i->extraPlayTimes()));
-        int extraTextWidth = painter->fontMetrics().width(extraText);
-        QRect rc2(rc);
-        rc2.setLeft(rc.right() - extraTextWidth);
-        painter->drawText(rc2, Qt::AlignRight|Qt::AlignVCenter, extraText);
-        rc.adjust(0, 0, -(3 + extraTextWidth), 0);
+    if (ThumbnailCache *thumbnails = playWidget->thumbnails()) {
+        // A 16:9 box down the left, with the picture drawn only once it has
+        // been made, and the text beside it.
+        int height = option.rect.height() - 4;
+        QRect box(rc.left(), rc.top() + 2, height * 16 / 9, height);
+        const QPixmap *pixmap = nullptr;
+        if (!t->fileName.isEmpty())
+            pixmap = thumbnails->find(t->fileName, box.size(),
+                                      playWidget->devicePixelRatioF());
+        if (pixmap) {
+            QRect shown(QPoint(), pixmap->size() / pixmap->devicePixelRatio());
+            shown.moveCenter(box.center());
+            painter->drawPixmap(shown, *pixmap);
+        }
+        rc.setLeft(box.right() + 7);
     }
 
-    DisplayParser *dp = playWidget->displayParser();
-    QString text = i->toDisplayString();
-    if (dp) {
-        // TODO: detect what type of file is being played
-        text = dp->parseMetadata(i->metadata(), text, Helpers::VideoFile);
+    int queuePosition = queuePositions.value(i.data());
+    int extraPlayTimes = i->extraPlayTimes();
+    if (t->queuePosition != queuePosition
+            || t->extraPlayTimes != extraPlayTimes) {
+        t->queuePosition = queuePosition;
+        t->extraPlayTimes = extraPlayTimes;
+        t->badge.clear();
+        if (queuePosition)
+            t->badge.append(QString::number(queuePosition));
+        if (extraPlayTimes)
+            t->badge.append(QString("+%1").arg(extraPlayTimes));
+        t->badgeWidth = painter->fontMetrics().width(t->badge);
+    }
+    if (!t->badge.isEmpty()) {
+        QRect rc2(rc);
+        rc2.setLeft(rc.right() - t->badgeWidth);
+        painter->drawText(rc2, Qt::AlignRight|Qt::AlignVCenter, t->badge);
+        rc.adjust(0, 0, -(3 + t->badgeWidth), 0);
     }
 
     QFont f = playWidget->font();
-    f.setBold(i->uuid() == playWidget->nowPlayingItem());
+    bool bold = i == passNowPlaying;
+    f.setBold(bold);
+    if (t->elidedWidth != rc.width() || t->elidedBold != bold) {
+        t->elided = QFontMetrics(f).elidedText(t->text, Qt::ElideRight,
+                                               rc.width());
+        t->elidedWidth = rc.width();
+        t->elidedBold = bold;
+    }
     painter->setFont(f);
     painter->setPen(playWidget->palette().text().color());
     painter->drawText(rc, Qt::AlignLeft|Qt::AlignVCenter,
-                      text);
+                      t->elided);
     painter->setFont(playWidget->font());
 }
 
+void PlayPainter::beginPass(DrawnPlaylist *list)
+{
+    passCurrent = list->currentItem();
+    passNowPlaying = list->playingItem();
+
+    auto queue = PlaylistCollection::getSingleton()->queuePlaylist();
+    auto snapshot = queue->snapshot();
+    if (queueSnapshot && queueSnapshot->version() == snapshot->version())
+        return;
+    queueSnapshot = snapshot;
+    queuePositions.clear();
+    const QVector<ItemPointer> &items = snapshot->items();
+    queuePositions.reserve(items.count());
+    for (int i = 0; i < items.count(); i++)
+        queuePositions.insert(items[i].data(), i + 1);
+}
+
 QSize PlayPainter::sizeHint(const QStyleOptionViewItem &option,
                             const QModelIndex &index) const
 {
     Q_UNUSED(index);
-    return QApplication::style()->sizeFromContents(QStyle::CT_ItemViewItem,
-                                                   &option,
-                                                   option.rect.size());
+    QSize size = QApplication::style()->sizeFromContents(QStyle::CT_ItemViewItem,
+                                                         &option,
+                                                         option.rect.size());
+    auto playWidget = qobject_cast<DrawnPlaylist*>(parent());
+    if (playWidget && playWidget->thumbnails())
+        size.setHeight(qMax(size.height(), option.fontMetrics.height() * 3 + 4));
+    return size;
 }
 
-PlayItem::PlayItem(const QUuid &uuid, const QUuid &playlistUuid,
-                   QListWidget *parent)
-    : QListWidgetItem(parent, QListWidgetItem::UserType)
+void PlayPainter::invalidate()
 {
-    playlistUuid_ = playlistUuid;
-    uuid_ = uuid;
-    setData(Qt::DisplayRole, uuid.toString());
+    rows.clear();
 }
 
-PlayItem::~PlayItem()
+PlayPainter::RowText *PlayPainter::rowText(const Item *item,
+                                           DisplayParser *parser) const
 {
+    RowText *t = rows.object(item);
+    if (t && t->revision == item->revision())
+        return t;
 
+    t = new RowText;
+    t->revision = item->revision();
+    t->text = item->toDisplayString();
+    QUrl url = item->url();
+    if (url.isLocalFile())
+        t->fileName = url.toLocalFile();
+    if (parser) {
+        // TODO: detect what type of file is being played
+        t->text = parser->parseMetadata(item->metadata(), t->text,
+                                        Helpers::VideoFile);
+    }
+    rows.insert(item, t);
+    return t;
 }
 
-QUuid PlayItem::playlistUuid()
+
+
+PlaylistModel::PlaylistModel(QObject *parent) : QAbstractListModel(parent)
 {
-    return playlistUuid_;
+
 }
 
-QUuid PlayItem::uuid()
+int PlaylistModel::rowCount(const QModelIndex &parent) const
 {
-    return uuid_;
+    return parent.isValid() ? 0 : rows.count();
 }
 
-DrawnPlaylist::DrawnPlaylist(QWidget *parent) : QListWidget(parent),
-    displayParser_(nullptr), worker(nullptr), searcher(nullptr)
+QVariant PlaylistModel::data(const QModelIndex &index, int role) const
 {
-    worker = new QThread();
-    worker->start();
-    searcher = new PlaylistSearcher();
-    searcher->moveToThread(worker);
+    if (!index.isValid() || index.row() >= rows.count())
+        return QVariant();
+    const ItemPointer &item = rows.at(index.row());
+    if (role == Qt::DisplayRole)
+        return item->toDisplayString();
+    if (role == UuidRole)
+        return item->uuid();
+    return QVariant();
+}
+
+Qt::ItemFlags PlaylistModel::flags(const QModelIndex &index) const
+{
+    // Only the gaps between rows accept drops, not the rows themselves.
+    if (!index.isValid())
+        return Qt::ItemIsDropEnabled;
+    return Qt::ItemIsSelectable | Qt::ItemIsEnabled | Qt::ItemIsDragEnabled;
+}
+
+Qt::DropActions PlaylistModel::supportedDropActions() const
+{
+    return Qt::MoveAction;
+}
 
+bool PlaylistModel::moveRows(const QModelIndex &sourceParent, int sourceRow,
+                             int count, const QModelIndex &destinationParent,
+                             int destinationChild)
+{
+    if (count <= 0 || sourceRow < 0 || sourceRow + count > rows.count())
+        return false;
+    if (!beginMoveRows(sourceParent, sourceRow, sourceRow + count - 1,
+                       destinationParent, destinationChild))
+        return false;
+    QVector<ItemPointer> moving = rows.mid(sourceRow, count);
+    rows.remove(sourceRow, count);
+    int insertAt = destinationChild > sourceRow ? destinationChild - count
+                                                : destinationChild;
+    rows.insert(insertAt, count, ItemPointer());
+    std::copy(moving.constBegin(), moving.constEnd(), rows.begin() + insertAt);
+    endMoveRows();
+    return true;
+}
+
+bool PlaylistModel::removeRows(int row, int count, const QModelIndex &parent)
+{
+    if (parent.isValid() || count <= 0 || row < 0 || row + count > rows.count())
+        return false;
+    beginRemoveRows(parent, row, row + count - 1);
+    rows.remove(row, count);
+    endRemoveRows();
+    return true;
+}
+
+ItemPointer PlaylistModel::itemAt(int row) const
+{
+    return rows.value(row);
+}
+
+int PlaylistModel::rowOf(const ItemPointer &item, int hint) const
+{
+    if (item.isNull())
+        return -1;
+    if (hint >= 0 && hint < rows.count() && rows.at(hint) == item)
+        return hint;
+    return rows.indexOf(item);
+}
+
+void PlaylistModel::setRows(const QVector<ItemPointer> &rows)
+{
+    beginResetModel();
+    this->rows = rows;
+    endResetModel();
+}
+
+void PlaylistModel::appendRows(const QVector<ItemPointer> &rows)
+{
+    if (rows.isEmpty())
+        return;
+    beginInsertRows(QModelIndex(), this->rows.count(),
+                    this->rows.count() + rows.count() - 1);
+    this->rows += rows;
+    endInsertRows();
+}
+
+void PlaylistModel::insertItems(int row, const QList<ItemPointer> &items)
+{
+    if (items.isEmpty())
+        return;
+    row = qBound(0, row, rows.count());
+    beginInsertRows(QModelIndex(), row, row + items.count() - 1);
+    rows.insert(row, items.count(), ItemPointer());
+    std::copy(items.constBegin(), items.constEnd(), rows.begin() + row);
+    endInsertRows();
+}
+
+
+
+DrawnPlaylist::DrawnPlaylist(QWidget *parent) : QListView(parent),
+    displayParser_(nullptr)
+{
+    // Searches run on the shared pool and may outlive the tab, so the
+    // searcher goes away once the last of them lets go of it.
+    searcher = QSharedPointer<PlaylistSearcher>(new PlaylistSearcher(),
+                                                &QObject::deleteLater);
+    sorter = QSharedPointer<PlaylistSorter>(new PlaylistSorter(),
+                                            &QObject::deleteLater);
+
+    model_ = new PlaylistModel(this);
+    setModel(model_);
+    setUniformItemSizes(true);
     setSelectionMode(QAbstractItemView::ContiguousSelection);
     setDragDropMode(QAbstractItemView::InternalMove);
 
-    setItemDelegate(new PlayPainter(this));
+    painter_ = new PlayPainter(this);
+    setItemDelegate(painter_);
+
+    viewTimer = new QTimer(this);
+    viewTimer->setSingleShot(true);
+    viewTimer->setInterval(100);
+    connect(viewTimer, &QTimer::timeout, this, [this]() {
+        emit visibleRowsChanged(uuid_);
+    });
+    auto viewChanged = [this]() { viewTimer->start(); };
+    connect(verticalScrollBar(), &QScrollBar::valueChanged, this, viewChanged);
+    connect(model_, &PlaylistModel::rowsInserted, this, viewChanged);
+    connect(model_, &PlaylistModel::modelReset, this, viewChanged);
+    connect(model_, &PlaylistModel::layoutChanged, this, viewChanged);
 
-    connect(worker, &QThread::finished, searcher, &QObject::deleteLater);
-    connect(model(), SIGNAL(rowsAboutToBeMoved(QModelIndex,int,int,QModelIndex,int)),
-            this, SLOT(model_rowsMoved(QModelIndex,int,int,QModelIndex,int)));
-    connect(this, &DrawnPlaylist::searcher_filterPlaylist,
-            searcher, &PlaylistSearcher::filterPlaylist,
+    connect(searcher.data(), &PlaylistSearcher::rowsFiltered,
+            this, &DrawnPlaylist::searcher_rowsFiltered,
             Qt::QueuedConnection);
-    connect(searcher, &PlaylistSearcher::playlistFiltered,
-            this, &DrawnPlaylist::repopulateItems,
+    connect(searcher.data(), &PlaylistSearcher::filterFinished,
+            this, &DrawnPlaylist::searcher_filterFinished,
             Qt::QueuedConnection);
-    connect(this, &DrawnPlaylist::currentItemChanged,
-            this, &DrawnPlaylist::self_currentItemChanged);
-    connect(this, SIGNAL(itemDoubleClicked(QListWidgetItem*)),
-            this, SLOT(self_itemDoubleClicked(QListWidgetItem*)));
-    connect(this, SIGNAL(customContextMenuRequested(QPoint)),
-            this, SLOT(self_customContextMenuRequested(QPoint)));
+    connect(sorter.data(), &PlaylistSorter::sorted,
+            this, &DrawnPlaylist::sorter_sorted,
+            Qt::QueuedConnection);
+    connect(selectionModel(), &QItemSelectionModel::currentChanged,
+            this, &DrawnPlaylist::self_currentChanged);
+    connect(this, &DrawnPlaylist::doubleClicked,
+            this, &DrawnPlaylist::self_doubleClicked);
+    connect(this, &DrawnPlaylist::customContextMenuRequested,
+            this, &DrawnPlaylist::self_customContextMenuRequested);
     setContextMenuPolicy(Qt::CustomContextMenu);
 }
 
 DrawnPlaylist::~DrawnPlaylist()
 {
-    worker->deleteLater();
+    // Cancel whatever search or sort is still going on for this tab; the
+    // queue drops anything that has not started yet.
+    searcher->bump();
+    sorter->bump();
 }
 
 QSharedPointer<Playlist> DrawnPlaylist::playlist() const
@@ -141,11 +334,33 @@ QUuid DrawnPlaylist::uuid() const
     return uuid_;
 }
 
-QUuid DrawnPlaylist::currentItemUuid() const
+int DrawnPlaylist::count() const
+{
+    return model_->rowCount();
+}
+
+int DrawnPlaylist::currentRow() const
 {
-    PlayItem *item = reinterpret_cast<PlayItem*>(currentItem());
+    return currentIndex().row();
+}
+
+void DrawnPlaylist::setCurrentRow(int row)
+{
+    selectionModel()->setCurrentIndex(model_->index(row),
+                                      QItemSelectionModel::ClearAndSelect);
+}
+
+ItemPointer DrawnPlaylist::currentItem() const
+{
+    ItemPointer item = model_->itemAt(currentIndex().row());
     if (!item)
-        item = reinterpret_cast<PlayItem*>(QListWidget::item(0));
+        item = model_->itemAt(0);
+    return item;
+}
+
+QUuid DrawnPlaylist::currentItemUuid() const
+{
+    ItemPointer item = currentItem();
     if (item)
         return item->uuid();
     return QUuid();
@@ -154,33 +369,48 @@ QUuid DrawnPlaylist::currentItemUuid() const
 QList<QUuid> DrawnPlaylist::currentItemUuids() const
 {
     QList<QUuid> selected;
-    for (auto &i : selectedItems())
-        selected.append(QUuid(i->text()));
+    for (const ItemPointer &item : selectedItems())
+        selected.append(item->uuid());
     return selected;
 }
 
-void DrawnPlaylist::traverseSelected(std::function<void (QUuid)> callback)
+QVector<ItemPointer> DrawnPlaylist::selectedItems() const
 {
-    for (auto &i : selectedItems())
-        callback(QUuid(i->text()));
+    QVector<ItemPointer> selected;
+    QModelIndexList rows = selectionModel()->selectedRows();
+    std::sort(rows.begin(), rows.end());
+    selected.reserve(rows.count());
+    for (const QModelIndex &index : rows)
+        selected.append(model_->itemAt(index.row()));
+    return selected;
+}
+
+void DrawnPlaylist::traverseSelected(std::function<void (ItemPointer)> callback)
+{
+    for (const ItemPointer &item : selectedItems())
+        callback(item);
 }
 
 void DrawnPlaylist::setCurrentItem(QUuid itemUuid)
 {
-    QList<QListWidgetItem *> items = findItems(itemUuid.toString(), Qt::MatchExactly);
-    if (items.isEmpty())
-        setCurrentRow(-1);
-    else
-        QListWidget::setCurrentItem(items.first());
+    setCurrentRow(rowOf(itemUuid));
 }
 
 void DrawnPlaylist::scrollToItem(QUuid itemUuid)
 {
-    auto items = findItems(itemUuid.toString(), Qt::MatchExactly);
-    if (items.empty())
+    int row = rowOf(itemUuid);
+    if (row < 0)
         return;
-    auto item = items.first();
-    scrollTo(indexFromItem(item));
+    scrollTo(model_->index(row));
+}
+
+void DrawnPlaylist::revealItem(QUuid itemUuid)
+{
+    // Remembered as well as selected, so that it stays selected once any
+    // filter pass that is still running has finished.
+    lastSelectedItem = itemUuid;
+    setCurrentItem(itemUuid);
+    scrollToItem(itemUuid);
 }
 
 void DrawnPlaylist::setUuid(const QUuid &uuid)
@@ -189,46 +419,113 @@ void DrawnPlaylist::setUuid(const QUuid &uuid)
     repopulateItems();
 }
 
+QString DrawnPlaylist::title() const
+{
+    auto playlist = PlaylistCollection::getSingleton()->playlistIfLoaded(uuid_);
+    return playlist ? playlist->title() : deferredTitle_;
+}
+
+qint64 DrawnPlaylist::lastUsed() const
+{
+    return lastUsed_;
+}
+
+void DrawnPlaylist::populate()
+{
+    if (!populated_)
+        repopulateItems();
+}
+
 void DrawnPlaylist::addItem(QUuid uuid)
 {
-    PlayItem *playItem = new PlayItem(uuid, uuid_, this);
-    QListWidget::addItem(playItem);
+    addItems(QList<QUuid>() << uuid);
 }
 
 void DrawnPlaylist::addItems(const QList<QUuid> &items)
 {
-    for (const QUuid &item : items)
-        QListWidget::addItem(item.toString());
+    QSharedPointer<Playlist> p = playlist();
+    if (!p || !populated_)
+        return;
+    QList<ItemPointer> found;
+    for (const QUuid &uuid : items) {
+        ItemPointer item = p->itemOf(uuid);
+        if (item)
+            found.append(item);
+    }
+    model_->insertItems(model_->rowCount(), found);
 }
 
 void DrawnPlaylist::addItemsAfter(QUuid item, const QList<QUuid> &items)
 {
-    auto matchingRows = findItems(item.toString(), Qt::MatchExactly);
-    if (matchingRows.length() < 1)
+    QSharedPointer<Playlist> p = playlist();
+    int itemIndex = rowOf(item);
+    if (!p || !populated_ || itemIndex < 0)
+        return;
+    QList<ItemPointer> found;
+    for (const QUuid &uuid : items) {
+        ItemPointer i = p->itemOf(uuid);
+        if (i)
+            found.append(i);
+    }
+    model_->insertItems(itemIndex + 1, found);
+}
+
+void DrawnPlaylist::appendItems(const QList<ItemPointer> &items)
+{
+    if (!populated_)
+        return;
+    if (currentFilterText.isEmpty()) {
+        model_->insertItems(model_->rowCount(), items);
         return;
-    int itemIndex = row(matchingRows[0]) + 1;
-    for (auto i : items) {
-        PlayItem *playItem = new PlayItem(i);
-        QListWidget::insertItem(itemIndex++, playItem);
     }
+    QList<ItemPointer> visible;
+    for (const ItemPointer &item : items)
+        if (PlaylistSearcher::itemMatchesFilter(item, currentFilterList))
+            visible.append(item);
+    model_->insertItems(model_->rowCount(), visible);
 }
 
 void DrawnPlaylist::removeItem(QUuid uuid)
 {
     QSharedPointer<Playlist> playlist = this->playlist();
+    int row = rowOf(uuid);
     if (playlist && playlist->contains(uuid))
         playlist->removeItem(uuid);
-    auto matchingRows = findItems(uuid.toString(), Qt::MatchExactly);
-    if (matchingRows.length() > 0)
-        takeItem(row(matchingRows[0]));
+    if (populated_ && row >= 0)
+        model_->removeRows(row, 1);
 }
 
 void DrawnPlaylist::removeItems(const QList<int> &indicies)
 {
-    QListIterator<int> iterator(indicies);
-    iterator.toBack();
-    while (iterator.hasPrevious())
-        delete takeItem(iterator.previous());
+    // Remove from the back in runs of consecutive rows, so that the earlier
+    // indices stay valid and the view is told once per run.
+    if (!populated_)
+        return;
+    int i = indicies.count() - 1;
+    while (i >= 0) {
+        int last = indicies[i];
+        int first = last;
+        while (i > 0 && indicies[i - 1] == first - 1)
+            first = indicies[--i];
+        model_->removeRows(first, last - first + 1);
+        --i;
+    }
+}
+
+void DrawnPlaylist::removeSelected()
+{
+    QSharedPointer<Playlist> p = playlist();
+    if (!p)
+        return;
+    QList<int> rows;
+    QVector<ItemPointer> selected;
+    for (const QModelIndex &index : selectionModel()->selectedRows()) {
+        rows.append(index.row());
+        selected.append(model_->itemAt(index.row()));
+    }
+    p->removeMany(selected);
+    std::sort(rows.begin(), rows.end());
+    removeItems(rows);
 }
 
 void DrawnPlaylist::removeAll()
@@ -237,7 +534,72 @@ void DrawnPlaylist::removeAll()
     if (!p)
         return;
     p->clear();
-    clear();
+    model_->setRows(QVector<ItemPointer>());
+}
+
+bool DrawnPlaylist::reorder(const QVector<int> &permutation, int version)
+{
+    QSharedPointer<Playlist> p = playlist();
+    if (!p)
+        return false;
+    auto snapshot = p->snapshot();
+    if (version >= 0 && snapshot->version() != version)
+        return false;
+    // An order asked for outright overrides any sort still going on.
+    if (version < 0)
+        sorter->bump();
+    // Remember the order before this one, so that it can be restored.
+    int index = 0;
+    for (const ItemPointer &i : snapshot->items())
+        i->setOriginalPosition(index++);
+    if (!p->reorder(permutation, version))
+        return false;
+    repopulateItems();
+    return true;
+}
+
+bool DrawnPlaylist::undo()
+{
+    QSharedPointer<Playlist> p = playlist();
+    if (!p || !p->undo())
+        return false;
+    repopulateItems();
+    return true;
+}
+
+bool DrawnPlaylist::redo()
+{
+    QSharedPointer<Playlist> p = playlist();
+    if (!p || !p->redo())
+        return false;
+    repopulateItems();
+    return true;
+}
+
+void DrawnPlaylist::sortByText(PlaylistSorter::TextKey key)
+{
+    QSharedPointer<PlaylistSorter> sorter = this->sorter;
+    startSort([sorter, key](QSharedPointer<Playlist> list, int generation) {
+        sorter->sortByText(list, key, generation);
+    });
+}
+
+void DrawnPlaylist::sortByNumber(PlaylistSorter::NumberKey key)
+{
+    QSharedPointer<PlaylistSorter> sorter = this->sorter;
+    startSort([sorter, key](QSharedPointer<Playlist> list, int generation) {
+        sorter->sortByNumber(list, key, generation);
+    });
+}
+
+void DrawnPlaylist::startSort(const std::function<void(QSharedPointer<Playlist>, int)> &sort)
+{
+    sortJob = sort;
+    QSharedPointer<Playlist> list = playlist();
+    int generation = sorter->bump();
+    backgroundQueue.post([sort, list, generation]() {
+        sort(list, generation);
+    });
 }
 
 QPair<QUuid,QUuid> DrawnPlaylist::importUrl(QUrl url)
@@ -246,6 +608,13 @@ QPair<QUuid,QUuid> DrawnPlaylist::importUrl(QUrl url)
     QSharedPointer<Playlist> playlist = this->playlist();
     if (!playlist)  return info;
     auto item = playlist->addItem(url);
+    QVariantMap metadata;
+    if (url.isLocalFile()
+            && MetadataCache::getSingleton()->lookup(url.toLocalFile(), &metadata)
+            && !metadata.isEmpty()) {
+        item->setMetadata(metadata);
+        playlist->reindexItem(item);
+    }
     info.first = uuid_;
     info.second = item->uuid();
     if (currentFilterText.isEmpty() ||
@@ -267,6 +636,17 @@ QUuid DrawnPlaylist::nowPlayingItem()
     return nowPlayingItem_;
 }
 
+ItemPointer DrawnPlaylist::playingItem() const
+{
+    // Looked up by uuid without naming anything; an item that has never been
+    // given a uuid cannot be the one playing.
+    ItemPointer item;
+    QSharedPointer<Playlist> playlist = this->playlist();
+    if (playlist && !nowPlayingItem_.isNull())
+        item = playlist->itemOf(nowPlayingItem_);
+    return item ? item : currentItem();
+}
+
 void DrawnPlaylist::setNowPlayingItem(QUuid uuid)
 {
     QSharedPointer<Playlist> playlist = this->playlist();
@@ -278,21 +658,43 @@ void DrawnPlaylist::setNowPlayingItem(QUuid uuid)
 
 QVariantMap DrawnPlaylist::toVMap() const
 {
-    QSharedPointer<Playlist> playlist = this->playlist();
-    if (!playlist)
+    // The contents are saved separately, in a file of the playlist's own.
+    // The title goes with the tab, so that the tab can be shown next time
+    // without loading the playlist, and is taken from the tab itself while
+    // the playlist is still deferred.
+    auto collection = PlaylistCollection::getSingleton();
+    if (!collection->playlistIfLoaded(uuid_) && !collection->isDeferred(uuid_))
         return QVariantMap();
     QVariantMap qvm;
+    qvm.insert("playlist", uuid_);
+    qvm.insert("title", title());
     qvm.insert("nowplaying", nowPlayingItem_);
-    qvm.insert("contents", playlist->toVMap());
+    qvm.insert("used", lastUsed_);
     return qvm;
 }
 
 void DrawnPlaylist::fromVMap(const QVariantMap &qvm)
 {
-    QVariantMap contents = qvm.value("contents").toMap();
-    QSharedPointer<Playlist> p(new Playlist);
-    p->fromVMap(contents);
-    PlaylistCollection::getSingleton()->addPlaylist(p);
+    // The playlist has been loaded already or deferred, unless it came
+    // inline with the tab as older versions saved it.
+    auto collection = PlaylistCollection::getSingleton();
+    lastUsed_ = qvm.value("used").toLongLong();
+    QUuid uuid = qvm.value("playlist").toUuid();
+    if (!qvm.contains("contents") && collection->isDeferred(uuid)) {
+        uuid_ = uuid;
+        deferredTitle_ = qvm.value("title").toString();
+        nowPlayingItem_ = qvm.value("nowplaying").toUuid();
+        lastSelectedItem = nowPlayingItem_;
+        return;
+    }
+    QSharedPointer<Playlist> p;
+    if (!qvm.contains("contents"))
+        p = collection->playlistOf(uuid);
+    if (!p) {
+        p.reset(new Playlist);
+        p->fromVMap(qvm.value("contents").toMap());
+        collection->addPlaylist(p);
+    }
     setUuid(p->uuid());
     nowPlayingItem_ = qvm.value("nowplaying").toUuid();
     setCurrentItem(nowPlayingItem_);
@@ -308,6 +710,66 @@ DisplayParser *DrawnPlaylist::displayParser()
     return displayParser_;
 }
 
+void DrawnPlaylist::setThumbnails(ThumbnailCache *cache)
+{
+    if (thumbnails_ == cache)
+        return;
+    thumbnails_ = cache;
+    // The rows change height, and which of them are on screen with it.
+    scheduleDelayedItemsLayout();
+    viewport()->update();
+    viewTimer->start();
+}
+
+ThumbnailCache *DrawnPlaylist::thumbnails()
+{
+    return thumbnails_;
+}
+
+void DrawnPlaylist::invalidateDisplay()
+{
+    painter_->invalidate();
+    viewport()->update();
+}
+
+void DrawnPlaylist::refreshItem(QUuid itemUuid)
+{
+    int row = rowOf(itemUuid);
+    if (row < 0)
+        return;
+    QModelIndex index = model_->index(row);
+    emit model_->dataChanged(index, index);
+}
+
+void DrawnPlaylist::refreshItem(const Item *item)
+{
+    QModelIndex first = indexAt(viewport()->rect().topLeft());
+    if (!first.isValid())
+        return;
+    QModelIndex last = indexAt(viewport()->rect().bottomLeft());
+    int end = last.isValid() ? last.row() : model_->rowCount() - 1;
+    for (int row = first.row(); row <= end; ++row) {
+        if (model_->itemAt(row) == item) {
+            QModelIndex index = model_->index(row);
+            emit model_->dataChanged(index, index);
+            return;
+        }
+    }
+}
+
+QVector<ItemPointer> DrawnPlaylist::visibleItems() const
+{
+    QVector<ItemPointer> items;
+    QModelIndex first = indexAt(viewport()->rect().topLeft());
+    if (!first.isValid())
+        return items;
+    QModelIndex last = indexAt(viewport()->rect().bottomLeft());
+    int end = last.isValid() ? last.row() : model_->rowCount() - 1;
+    for (int row = first.row(); row <= end; ++row)
+        items.append(model_->itemAt(row));
+    return items;
+}
+
 void DrawnPlaylist::setFilter(QString needles)
 {
     if (currentFilterText == needles)
@@ -315,8 +777,8 @@ void DrawnPlaylist::setFilter(QString needles)
 
     currentFilterText = needles;
     currentFilterList = PlaylistSearcher::textToNeedles(needles);
-    searcher->bump();
-    emit searcher_filterPlaylist(playlist(), needles);
+    if (populated_)
+        startFilter();
 }
 
 bool DrawnPlaylist::event(QEvent *e)
@@ -331,65 +793,203 @@ bool DrawnPlaylist::event(QEvent *e)
         }
     }
     end:
-    return QListWidget::event(e);
+    return QListView::event(e);
 }
 
-void DrawnPlaylist::repopulateItems()
+void DrawnPlaylist::paintEvent(QPaintEvent *e)
+{
+    painter_->beginPass(this);
+    QListView::paintEvent(e);
+}
+
+void DrawnPlaylist::changeEvent(QEvent *e)
+{
+    if (e->type() == QEvent::FontChange)
+        painter_->invalidate();
+    QListView::changeEvent(e);
+}
+
+void DrawnPlaylist::showEvent(QShowEvent *e)
+{
+    lastUsed_ = QDateTime::currentMSecsSinceEpoch();
+    populate();
+    viewTimer->start();
+    QListView::showEvent(e);
+}
+
+void DrawnPlaylist::startDrag(Qt::DropActions supportedActions)
 {
-    clear();
+    // The stock implementation removes the dragged rows once a move is
+    // over.  The rows are moved in place by dropEvent instead, so all that
+    // is wanted here is to get the drag going.
+    QModelIndexList indexes = selectionModel()->selectedRows();
+    if (indexes.isEmpty())
+        return;
+    QMimeData *data = model_->mimeData(indexes);
+    if (!data)
+        return;
+    QDrag *drag = new QDrag(this);
+    drag->setMimeData(data);
+    drag->exec(supportedActions & Qt::MoveAction);
+}
+
+void DrawnPlaylist::dropEvent(QDropEvent *event)
+{
+    if (event->source() != this) {
+        QListView::dropEvent(event);
+        return;
+    }
+
+    // Selections are contiguous, so the dragged rows are one range.
+    QModelIndexList selected = selectionModel()->selectedRows();
+    if (selected.isEmpty()) {
+        event->ignore();
+        return;
+    }
+    std::sort(selected.begin(), selected.end());
+    int first = selected.first().row();
+    int count = selected.last().row() - first + 1;
 
+    int destination = model_->rowCount();
+    QModelIndex target = indexAt(event->pos());
+    if (target.isValid()) {
+        destination = target.row();
+        if (dropIndicatorPosition() == QAbstractItemView::BelowItem)
+            ++destination;
+    }
+    event->setDropAction(Qt::MoveAction);
+    event->accept();
+    stopAutoScroll();
+    setState(NoState);
+    moveItems(first, count, destination);
+}
+
+void DrawnPlaylist::repopulateItems()
+{
     auto playlist = this->playlist();
-    if (playlist == nullptr)
+    if (playlist == nullptr) {
+        model_->setRows(QVector<ItemPointer>());
+        return;
+    }
+    // Which rows a filter lets through is only known to the pass that
+    // worked it out, and the items are shared with other tabs, so a
+    // filtered tab has the pass run over the playlist as it is now.  So does
+    // one whose pass is still streaming rows in, as they would land on top
+    // of these.
+    populated_ = true;
+    if (filterRunning || !currentFilterText.isEmpty()) {
+        startFilter();
         return;
+    }
 
-    auto itemAdder = [&](QSharedPointer<Item> item) {
-        if (!item->hidden())
-            addItem(item->uuid());
-    };
-    playlist->iterateItems(itemAdder);
+    // Unfiltered, the snapshot's row vector is shared outright.
+    auto snapshot = playlist->snapshot();
+    model_->setRows(snapshot->items());
+    setCurrentItem(lastSelectedItem);
+}
+
+void DrawnPlaylist::searcher_rowsFiltered(int generation, int chunk,
+                                          const QVector<ItemPointer> &rows)
+{
+    // Chunks of a cancelled pass may still be in the event queue.
+    if (generation != filterGeneration)
+        return;
+    if (chunk == 0)
+        model_->setRows(rows);
+    else
+        model_->appendRows(rows);
+}
+
+void DrawnPlaylist::searcher_filterFinished(int generation)
+{
+    if (generation != filterGeneration)
+        return;
+    filterRunning = false;
     setCurrentItem(lastSelectedItem);
 }
 
-void DrawnPlaylist::model_rowsMoved(const QModelIndex &parent,
-                                     int start, int end,
-                                     const QModelIndex &destination, int row)
+void DrawnPlaylist::sorter_sorted(int generation, int version,
+                                  const QVector<int> &permutation)
+{
+    if (sorter->cancelled(generation))
+        return;
+    // The sort may have been handed an earlier version of the playlist, or
+    // the playlist may have been edited since.  Either way the permutation
+    // would scramble the current one, so sort that instead.
+    if (!playlist() || reorder(permutation, version)) {
+        sortJob = nullptr;
+        return;
+    }
+    auto sort = sortJob;
+    startSort(sort);
+}
+
+void DrawnPlaylist::startFilter()
+{
+    filterRunning = true;
+    filterGeneration = searcher->bump();
+    QSharedPointer<PlaylistSearcher> searcher = this->searcher;
+    QSharedPointer<Playlist> list = playlist();
+    QString text = currentFilterText;
+    int generation = filterGeneration;
+    backgroundQueue.post([searcher, list, text, generation]() {
+        searcher->filterPlaylist(list, text, generation);
+    });
+}
+
+int DrawnPlaylist::rowOf(const QUuid &itemUuid) const
 {
-    Q_UNUSED(parent);
-    Q_UNUSED(destination);
     QSharedPointer<Playlist> p = playlist();
+    if (!p)
+        return -1;
+    // Unfiltered views line up with the playlist, whose position lookup is
+    // cheap; use it as a hint before falling back to a scan.
+    int hint = currentFilterText.isEmpty() ? p->indexOf(itemUuid) : -1;
+    return model_->rowOf(p->itemOf(itemUuid), hint);
+}
+
+void DrawnPlaylist::moveItems(int first, int count, int destination)
+{
+    if (destination >= first && destination <= first + count)
+        return;
+    QSharedPointer<Playlist> p = playlist();
+    QList<ItemPointer> itemsToGrab;
+    for (int row = first; row < first + count; row++)
+        itemsToGrab.append(model_->itemAt(row));
+    ItemPointer destinationItem = model_->itemAt(destination);
+
+    model_->moveRows(QModelIndex(), first, count, QModelIndex(), destination);
     if (p.isNull())
         return;
-    QListWidgetItem *destinationItem = QListWidget::item(row);
-    QUuid destinationId = destinationItem ? QUuid(destinationItem->text())
-                                          : QUuid();
-    QList<QSharedPointer<Item>> itemsToGrab;
-    for (int index = start; index <= end; index++) {
-        QUuid itemUuid = QUuid(QListWidget::item(index)->text());
-        itemsToGrab.append(p->itemOf(itemUuid));
+    if (currentFilterText.isEmpty()) {
+        // Rows map one to one onto the playlist, so move them in one go.
+        p->moveRange(first, count,
+                     destination > first ? destination - count : destination);
+        return;
     }
-    p->takeItemsRaw(itemsToGrab);
-    p->addItems(destinationId, itemsToGrab);
+    p->moveItems(itemsToGrab, destinationItem);
 }
 
-void DrawnPlaylist::self_currentItemChanged(QListWidgetItem *current,
-                                             QListWidgetItem *previous)
+void DrawnPlaylist::self_currentChanged(const QModelIndex &current,
+                                        const QModelIndex &previous)
 {
     Q_UNUSED(previous);
-    QUuid uuid;
-    if (current && !(uuid=reinterpret_cast<PlayItem*>(current)->uuid()).isNull())
-        lastSelectedItem = uuid;
+    ItemPointer item = model_->itemAt(current.row());
+    if (item)
+        lastSelectedItem = item->uuid();
 }
 
-void DrawnPlaylist::self_itemDoubleClicked(QListWidgetItem *item)
+void DrawnPlaylist::self_doubleClicked(const QModelIndex &index)
 {
-    PlayItem *playItem = reinterpret_cast<PlayItem*>(item);
-    emit itemDesired(playItem->playlistUuid(), playItem->uuid());
+    ItemPointer item = model_->itemAt(index.row());
+    if (item)
+        emit itemDesired(item->playlistUuid(), item->uuid());
 }
 
 void DrawnPlaylist::self_customContextMenuRequested(const QPoint &p)
 {
-    PlayItem *playItem = reinterpret_cast<PlayItem*>(this->itemAt(p));
-    QUuid playItemUuid = playItem ? playItem->uuid() : QUuid();
+    ItemPointer item = model_->itemAt(indexAt(p).row());
+    QUuid playItemUuid = item ? item->uuid() : QUuid();
     emit contextMenuRequested(p, uuid_, playItemUuid);
 }
 
@@ -397,7 +997,7 @@ void DrawnPlaylist::self_customContextMenuRequested(const QPoint &p)
 
 class PlaylistSelectionPrivate {
 public:
-    QList<QSharedPointer<Item>> items;
+    QList<ItemPointer> items;
 };
 
 
@@ -435,7 +1035,7 @@ void PlaylistSelection::fromQueue(DrawnPlaylist *list)
     auto pl = PlaylistCollection::getSingleton()->playlistOf(list->uuid());
     if (Q_UNLIKELY(!pl))
         return;
-    auto itemAdder = [this](QSharedPointer<Item> item) {
+    auto itemAdder = [this](ItemPointer item) {
         d->items.append(item);
     };
     queue->iterateItems(itemAdder);
@@ -453,8 +1053,8 @@ void PlaylistSelection::fromSelected(DrawnPlaylist *list)
     auto pl = PlaylistCollection::getSingleton()->playlistOf(list->uuid());
     if (Q_UNLIKELY(!pl))
         return;
-    auto itemAdder = [this,pl](QUuid item) {
-        d->items.append(pl->itemOf(item));
+    auto itemAdder = [this](ItemPointer item) {
+        d->items.append(item);
     };
     list->traverseSelected(itemAdder);
 }
@@ -464,9 +1064,11 @@ void PlaylistSelection::appendToPlaylist(DrawnPlaylist *list)
     auto pl = PlaylistCollection::getSingleton()->playlistOf(list->uuid());
     if (Q_UNLIKELY(!pl))
         return;
+    pl->openUndoGroup();
     for (auto &i : d->items) {
         list->addItem(pl->addItemClone(i)->uuid());
     }
+    pl->closeUndoGroup();
     list->viewport()->update();
 }
 
@@ -476,11 +1078,15 @@ void PlaylistSelection::appendAndQuickQueue(DrawnPlaylist *list)
     auto pl = PlaylistCollection::getSingleton()->playlistOf(list->uuid());
     if (Q_UNLIKELY(!pl))
         return;
+    pl->openUndoGroup();
+    queue->openUndoGroup();
     for (auto &i : d->items) {
         QUuid uuid = pl->addItemClone(i)->uuid();
         list->addItem(uuid);
         queue->toggle(pl->uuid(), uuid);
     }
+    queue->closeUndoGroup();
+    pl->closeUndoGroup();
     list->viewport()->update();
 }
 
@@ -488,12 +1094,3 @@ QSharedPointer<Playlist> DrawnQueue::playlist() const
 {
     return PlaylistCollection::getSingleton()->queuePlaylist();
 }
-
-void DrawnQueue::addItem(QUuid uuid)
-{
-    auto actualItem = ItemCollection::getSingleton()->itemOf(uuid);
-    if (actualItem.isNull())
-        return;
-    PlayItem *playItem = new PlayItem(uuid, actualItem->playlistUuid(), this);
-    QListWidget::addItem(playItem);
-}
@@ -1,14 +1,22 @@
 #ifndef QDRAWNPLAYLIST_H
 #define QDRAWNPLAYLIST_H
 
-#include <QListWidget>
+#include <QListView>
+#include <QAbstractListModel>
+#include <QCache>
+#include <QHash>
 #include <QUuid>
+#include <algorithm>
 #include <functional>
 #include "playlist.h"
+#include "playlistsorter.h"
+#include "serialqueue.h"
 
 class DisplayParser;
-class QThread;
+class DrawnPlaylist;
 class PlaylistSearcher;
+class QTimer;
+class ThumbnailCache;
 
 class PlayPainter : public QAbstractItemDelegate {
     Q_OBJECT
@@ -18,27 +26,73 @@ public:
                const QModelIndex &index) const;
     QSize sizeHint(const QStyleOptionViewItem &option,
                    const QModelIndex &index) const;
+    void invalidate();
+    // Works out what the rows of a paint pass are compared against, once, so
+    // that painting a row takes no locks.
+    void beginPass(DrawnPlaylist *list);
+
+private:
+    // What a row looks like, worked out once and redrawn from until the item,
+    // the display format or the font changes.
+    struct RowText {
+        int revision = 0;
+        QString text;
+        QString elided;
+        int elidedWidth = -1;
+        bool elidedBold = false;
+        int queuePosition = 0;
+        int extraPlayTimes = 0;
+        QString badge;
+        int badgeWidth = 0;
+        // Empty unless the item is a local file.
+        QString fileName;
+    };
+    RowText *rowText(const Item *item, DisplayParser *parser) const;
+
+    mutable QCache<const Item *, RowText> rows;
+
+    // Held rather than compared by address alone, so that a freed item's
+    // slot cannot be mistaken for it.
+    ItemPointer passCurrent;
+    ItemPointer passNowPlaying;
+    // Rebuilt only when the queue changes.
+    std::shared_ptr<const PlaylistSnapshot> queueSnapshot;
+    QHash<const Item *, int> queuePositions;
 };
 
 
-class PlayItem : public QListWidgetItem {
+// PlaylistModel exposes the visible rows of a playlist to the view.  The rows
+// are the playlist's own item pointers; when nothing is filtered out the row
+// vector is shared with the playlist snapshot, so a tab costs no per-row
+// allocations no matter how large it is.
+class PlaylistModel : public QAbstractListModel {
+    Q_OBJECT
 public:
-    PlayItem(const QUuid &uuid = QUuid(), const QUuid &playlistUuid = QUuid(), QListWidget *parent = 0);
-    ~PlayItem();
+    enum Roles { UuidRole = Qt::UserRole };
 
-    QUuid playlistUuid();
-    QUuid uuid();
+    explicit PlaylistModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role) const;
+    Qt::ItemFlags flags(const QModelIndex &index) const;
+    Qt::DropActions supportedDropActions() const;
+    bool moveRows(const QModelIndex &sourceParent, int sourceRow, int count,
+                  const QModelIndex &destinationParent, int destinationChild);
+    bool removeRows(int row, int count,
+                    const QModelIndex &parent = QModelIndex());
+
+    ItemPointer itemAt(int row) const;
+    int rowOf(const ItemPointer &item, int hint = -1) const;
+    void setRows(const QVector<ItemPointer> &rows);
+    void appendRows(const QVector<ItemPointer> &rows);
+    void insertItems(int row, const QList<ItemPointer> &items);
 
 private:
-    QUuid playlistUuid_;
-    QUuid uuid_;
+    QVector<ItemPointer> rows;
 };
 
 
-// DrawnPlaylist abuses a ListWidget's items to store the uuid of playlist
-// items, which is decoded and looked up during drawing.  The alternative is a
-// subclass of QAbstractItemModel with about 1.5x the code.
-class DrawnPlaylist : public QListWidget {
+class DrawnPlaylist : public QListView {
     Q_OBJECT
 public:
     DrawnPlaylist(QWidget *parent = 0);
@@ -46,96 +100,139 @@ public:
     virtual QSharedPointer<Playlist> playlist() const;
     QUuid uuid() const;
     void setUuid(const QUuid &uuid);
+    QString title() const;
+    // When the tab was last shown, in ms since the epoch.
+    qint64 lastUsed() const;
+    // A tab restored with its playlist deferred has no rows until it is
+    // first shown or made current.  Until then, changes to the playlist
+    // leave the rows alone, and they are filled in all at once here.
+    void populate();
+    int count() const;
+    int currentRow() const;
+    void setCurrentRow(int row);
     QUuid currentItemUuid() const;
+    // Names the selected items, for handing to the queue.  What stays in
+    // this process should use selectedItems() instead.
     QList<QUuid> currentItemUuids() const;
-    void traverseSelected(std::function<void(QUuid)> callback);
+    // The selected items, in the order they are shown.
+    QVector<ItemPointer> selectedItems() const;
+    void traverseSelected(std::function<void(ItemPointer)> callback);
     void setCurrentItem(QUuid itemUuid);
     void scrollToItem(QUuid itemUuid);
-    virtual void addItem(QUuid uuid);
+    void revealItem(QUuid itemUuid);
+    void addItem(QUuid uuid);
     void addItems(const QList<QUuid> &items);
     void addItemsAfter(QUuid item, const QList<QUuid> &items);
+    // Shows items just appended to the playlist, without naming them.
+    void appendItems(const QList<ItemPointer> &items);
     void removeItem(QUuid uuid);
     void removeItems(const QList<int> &indicies);
+    void removeSelected();
     void removeAll();
-    template<class T>
-    void sort(std::function<T(QSharedPointer<Item>)> converter,
-              std::function<bool(const T &a, const T &b)> lessThan);
+    // Given a version, reorders only if the playlist is still at it.
+    bool reorder(const QVector<int> &permutation, int version = -1);
+    // Undo or redo the last edit to the playlist, and show the result.
+    bool undo();
+    bool redo();
+    // Sorting happens in the background, and the playlist is reordered
+    // when it is done.  If it changed in the meantime, it is sorted again.
+    void sortByText(PlaylistSorter::TextKey key);
+    void sortByNumber(PlaylistSorter::NumberKey key);
 
     QPair<QUuid,QUuid> importUrl(QUrl url);
     void currentToQueue();
 
     QUuid nowPlayingItem();
     void setNowPlayingItem(QUuid uuid);
+    // The highlighted and the playing rows, or null.  The first is the
+    // topmost row if none is current; the second, the first if the playing
+    // item is not in the list.
+    ItemPointer currentItem() const;
+    ItemPointer playingItem() const;
 
     QVariantMap toVMap() const;
     void fromVMap(const QVariantMap &qvm);
 
     void setDisplayParser(DisplayParser *parser);
     DisplayParser *displayParser();
+    // Rows are made tall enough for a thumbnail while there is a cache to
+    // draw them from.
+    void setThumbnails(ThumbnailCache *cache);
+    ThumbnailCache *thumbnails();
+    void invalidateDisplay();
+    void refreshItem(QUuid itemUuid);
+    // Redraws the item if it is on screen.  Rows off screen notice that
+    // their item changed when next drawn, so only these need looking at.
+    void refreshItem(const Item *item);
+    // The items of the rows on screen.
+    QVector<ItemPointer> visibleItems() const;
 
     void setFilter(QString needles);
 
 protected:
     bool event(QEvent *e);
+    void paintEvent(QPaintEvent *e);
+    void changeEvent(QEvent *e);
+    void showEvent(QShowEvent *e);
+    void startDrag(Qt::DropActions supportedActions);
+    void dropEvent(QDropEvent *event);
 
 private:
+    void startFilter();
+    void startSort(const std::function<void(QSharedPointer<Playlist>, int)> &sort);
+    int rowOf(const QUuid &itemUuid) const;
+    void moveItems(int first, int count, int destination);
+
     QUuid uuid_;
-    QHash <QUuid, PlayItem*> itemsByUuid;
+    QString deferredTitle_;
+    qint64 lastUsed_ = 0;
+    bool populated_ = false;
+    PlaylistModel *model_ = nullptr;
+    PlayPainter *painter_ = nullptr;
     QUuid lastSelectedItem;
     QUuid nowPlayingItem_;
     DisplayParser *displayParser_ = nullptr;
-    QThread *worker = nullptr;
-    PlaylistSearcher *searcher;
+    ThumbnailCache *thumbnails_ = nullptr;
+    QSharedPointer<PlaylistSearcher> searcher;
+    QSharedPointer<PlaylistSorter> sorter;
+    // The sort being worked on, kept to be run again should the playlist
+    // change before it is done.
+    std::function<void(QSharedPointer<Playlist>, int)> sortJob;
+    SerialQueue backgroundQueue;
     QString currentFilterText;
     QStringList currentFilterList;
+    int filterGeneration = 0;
+    bool filterRunning = false;
+    QTimer *viewTimer = nullptr;
 
 signals:
     // for lack of a better term that doesn't conflict with what we already
     // have, when an item is made hot by double clicking.
     void itemDesired(QUuid playlistUuid, QUuid itemUuid);
-    void searcher_filterPlaylist(QSharedPointer<Playlist>, QString text);
     void menuOpenItem(QUuid playlistUuid, QUuid itemUuid);
 
     void contextMenuRequested(QPoint p, QUuid playlistUuid, QUuid itemUuid);
+    // Once scrolling or changes to the rows settle down.
+    void visibleRowsChanged(QUuid playlistUuid);
 
 private slots:
     void repopulateItems();
-
-    void model_rowsMoved(const QModelIndex & parent, int start, int end,
-                         const QModelIndex & destination, int row);
-    void self_currentItemChanged(QListWidgetItem *current,
-                                 QListWidgetItem *previous);
-    void self_itemDoubleClicked(QListWidgetItem *item);
+    void searcher_rowsFiltered(int generation, int chunk,
+                               const QVector<ItemPointer> &rows);
+    void searcher_filterFinished(int generation);
+    void sorter_sorted(int generation, int version,
+                       const QVector<int> &permutation);
+
+    void self_currentChanged(const QModelIndex &current,
+                             const QModelIndex &previous);
+    void self_doubleClicked(const QModelIndex &index);
     void self_customContextMenuRequested(const QPoint &p);
 };
 
-template<class T>
-void DrawnPlaylist::sort(
-        std::function<T(QSharedPointer<Item>)> converter,
-        std::function<bool(const T &a, const T &b)> lessThan) {
-    QMap<QUuid,T> playlistMap;
-    QList<QSharedPointer<Item>> items;
-    auto pl = playlist();
-    int index = 0;
-    pl->iterateItems([&](QSharedPointer<Item> i) {
-        playlistMap.insertMulti(i->uuid(), converter(i));
-        items.append(i);
-        i->setOriginalPosition(index++);
-    });
-    qSort(items.begin(), items.end(), [&](const QSharedPointer<Item> &a, const QSharedPointer<Item> &b) {
-        return lessThan(playlistMap.value(a->uuid()), playlistMap.value(b->uuid()));
-    });
-    pl->takeItemsRaw(items);
-    pl->addItems(QUuid(), items);
-    repopulateItems();
-}
-
-
 class DrawnQueue : public DrawnPlaylist {
     Q_OBJECT
 public:
     virtual QSharedPointer<Playlist> playlist() const;
-    void addItem(QUuid uuid);
 };
 
 class PlaylistSelectionPrivate;
@@ -0,0 +1,269 @@
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+#include "editjournal.h"
+#include "playlist.h"
+
+// Every journal's edits, by serial number.  Serials are handed out as edits
+// are committed, so the first edit in the map is the oldest.
+struct EditLedger {
+    struct Entry {
+        EditJournal::Edit edit;
+        qint64 cost;
+    };
+
+    QMutex mutex;
+    qint64 budget = EditJournal::defaultBudget;
+    qint64 cost = 0;
+    quint64 nextSerial = 1;
+    QMap<quint64, Entry> entries;
+};
+
+static EditLedger &ledger()
+{
+    // Never destroyed, as journals may outlive anything destroyed at exit.
+    static EditLedger *theLedger = new EditLedger;
+    return *theLedger;
+}
+
+static qint64 costOf(const EditJournal::Edit &edit)
+{
+    // An estimate: the items are counted in full, as the journal may be all
+    // that keeps a removed item alive.  What an item's strings and metadata
+    // hold besides is left out.
+    const qint64 itemCost = sizeof(ItemPointer) + sizeof(Item);
+    qint64 total = sizeof(EditJournal::Edit);
+    for (const EditJournal::Step &step : edit) {
+        total += sizeof(EditJournal::Step);
+        total += step.positions.count() * qint64(sizeof(int));
+        total += step.items.count() * itemCost;
+        total += step.permutation.count() * qint64(sizeof(int));
+        if (step.kind == EditJournal::Step::Cleared)
+            total += step.count * (itemCost + PlaylistIndex::nodeSize());
+    }
+    return total;
+}
+
+// Called with the ledger's mutex held.  What is forgotten is moved out to be
+// let go of once the mutex is released, as that can take a while.
+static void trimLedger(QList<EditJournal::Edit> &dropped)
+{
+    EditLedger &l = ledger();
+    while (l.cost > l.budget && !l.entries.isEmpty()) {
+        auto it = l.entries.begin();
+        l.cost -= it->cost;
+        dropped.append(it->edit);
+        l.entries.erase(it);
+    }
+}
+
+static quint64 addToLedger(const EditJournal::Edit &edit)
+{
+    QList<EditJournal::Edit> dropped;
+    EditLedger &l = ledger();
+    QMutexLocker locker(&l.mutex);
+    quint64 serial = l.nextSerial++;
+    EditLedger::Entry entry;
+    entry.edit = edit;
+    entry.cost = costOf(edit);
+    l.cost += entry.cost;
+    l.entries.insert(serial, entry);
+    trimLedger(dropped);
+    return serial;
+}
+
+static void removeFromLedger(const QList<quint64> &serials)
+{
+    if (serials.isEmpty())
+        return;
+    QList<EditJournal::Edit> dropped;
+    EditLedger &l = ledger();
+    QMutexLocker locker(&l.mutex);
+    for (quint64 serial : serials) {
+        auto it = l.entries.find(serial);
+        if (it == l.entries.end())
+            continue;
+        l.cost -= it->cost;
+        dropped.append(it->edit);
+        l.entries.erase(it);
+    }
+}
+
+static bool stepHolds(const EditJournal::Step &step,
+                      const QSet<const Item *> &items)
+{
+    for (const ItemPointer &item : step.items)
+        if (items.contains(item.data()))
+            return true;
+    if (!step.cleared)
+        return false;
+    // Whichever is the smaller is walked, and looked for in the other.
+    if (step.cleared->count() < items.count()) {
+        for (const ItemPointer &item : *step.cleared)
+            if (items.contains(item.data()))
+                return true;
+    } else {
+        for (const Item *item : items)
+            if (step.cleared->indexOf(item) >= 0)
+                return true;
+    }
+    return false;
+}
+
+static bool ledgerHolds(const QList<quint64> &serials,
+                        const QSet<const Item *> &items)
+{
+    EditLedger &l = ledger();
+    QMutexLocker locker(&l.mutex);
+    for (quint64 serial : serials) {
+        auto it = l.entries.constFind(serial);
+        if (it == l.entries.constEnd())
+            continue;
+        for (const EditJournal::Step &step : it->edit)
+            if (stepHolds(step, items))
+                return true;
+    }
+    return false;
+}
+
+static bool inLedger(quint64 serial)
+{
+    EditLedger &l = ledger();
+    QMutexLocker locker(&l.mutex);
+    return l.entries.contains(serial);
+}
+
+static bool takeFromLedger(quint64 serial, EditJournal::Edit *edit)
+{
+    EditLedger &l = ledger();
+    QMutexLocker locker(&l.mutex);
+    auto it = l.entries.constFind(serial);
+    if (it == l.entries.constEnd())
+        return false;
+    *edit = it->edit;
+    return true;
+}
+
+
+
+EditJournal::EditJournal()
+{
+
+}
+
+EditJournal::~EditJournal()
+{
+    reset();
+}
+
+qint64 EditJournal::budget()
+{
+    EditLedger &l = ledger();
+    QMutexLocker locker(&l.mutex);
+    return l.budget;
+}
+
+void EditJournal::setBudget(qint64 bytes)
+{
+    QList<Edit> dropped;
+    EditLedger &l = ledger();
+    QMutexLocker locker(&l.mutex);
+    l.budget = qMax(qint64(0), bytes);
+    trimLedger(dropped);
+}
+
+void EditJournal::record(const Step &step)
+{
+    if (!redoable.isEmpty()) {
+        removeFromLedger(redoable);
+        redoable.clear();
+    }
+    pending.append(step);
+}
+
+void EditJournal::commit()
+{
+    if (depth > 0 || pending.isEmpty())
+        return;
+    undoable.append(addToLedger(pending));
+    pending.clear();
+}
+
+void EditJournal::open()
+{
+    ++depth;
+}
+
+void EditJournal::close()
+{
+    if (depth > 0 && --depth == 0)
+        commit();
+}
+
+void EditJournal::reset()
+{
+    pending.clear();
+    removeFromLedger(undoable + redoable);
+    undoable.clear();
+    redoable.clear();
+}
+
+bool EditJournal::canUndo() const
+{
+    // The oldest edits are forgotten first, so if the latest is still
+    // there, so is everything before it.
+    return !undoable.isEmpty() && inLedger(undoable.last());
+}
+
+bool EditJournal::canRedo() const
+{
+    return !redoable.isEmpty() && inLedger(redoable.last());
+}
+
+bool EditJournal::holdsAny(const QVector<ItemPointer> &items) const
+{
+    if (items.isEmpty() || (pending.isEmpty() && undoable.isEmpty()
+                            && redoable.isEmpty()))
+        return false;
+    QSet<const Item *> wanted;
+    wanted.reserve(items.count());
+    for (const ItemPointer &item : items)
+        wanted.insert(item.data());
+    for (const Step &step : pending)
+        if (stepHolds(step, wanted))
+            return true;
+    return ledgerHolds(undoable + redoable, wanted);
+}
+
+EditJournal::Edit EditJournal::takeUndo()
+{
+    Edit edit;
+    if (undoable.isEmpty())
+        return edit;
+    quint64 serial = undoable.takeLast();
+    if (!takeFromLedger(serial, &edit)) {
+        // Everything older has gone too.
+        undoable.clear();
+        return edit;
+    }
+    redoable.append(serial);
+    return edit;
+}
+
+EditJournal::Edit EditJournal::takeRedo()
+{
+    Edit edit;
+    if (redoable.isEmpty())
+        return edit;
+    quint64 serial = redoable.takeLast();
+    if (!takeFromLedger(serial, &edit)) {
+        // The edits further on are newer, and may still be there, but there
+        // is no reaching them without this one.
+        removeFromLedger(redoable);
+        redoable.clear();
+        return edit;
+    }
+    undoable.append(serial);
+    return edit;
+}
@@ -0,0 +1,99 @@
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+// The undo and redo history of a playlist.
+//
+// Nothing here keeps a copy of the list.  An edit is journalled as the
+// change it made (the items it put in or took out and where, the range it
+// moved, or the order it sorted the list into), and undoing it applies the
+// opposite change.  So an entry costs memory in proportion to what the edit
+// touched: removing one item from a list of millions costs one item, and
+// undoing it is a logarithmic insertion into the tree.
+//
+// Clearing the list hands its whole tree to the journal, so it is recorded
+// in constant time and holds nothing besides the items it keeps alive.
+// Undoing it hands the tree back, and only the lookups beside the tree are
+// built again.  Sorting is the one edit which still costs an int per item,
+// as any record of an arbitrary order has to say where each item went.
+//
+// The edits of every journal are held in one ledger, which is bounded by an
+// estimate of the memory they hold on to, and forgets the oldest edits first
+// once it goes over, whichever playlist they belong to.  The ledger has a
+// mutex of its own, so that it can forget a playlist's edits without waiting
+// on the playlist.  A journal has no lock; the playlist only uses it under
+// its own write lock.
+
+#include <QList>
+#include <QSharedPointer>
+#include <QVector>
+#include "itempool.h"
+
+class Item;
+class PlaylistIndex;
+
+class EditJournal {
+public:
+    struct Step {
+        enum Kind { Inserted, Removed, Moved, Reordered, Cleared };
+        Kind kind;
+        // Inserted and Removed: the items and their positions in the list
+        // which holds them, in ascending order.
+        QVector<int> positions;
+        QVector<ItemPointer> items;
+        // Moved: the items at [from, from+count) were moved to start at to.
+        // Cleared: count is how many items there were.
+        int from = 0;
+        int count = 0;
+        int to = 0;
+        // Reordered: the permutation given to PlaylistIndex::reorder.
+        QVector<int> permutation;
+        // Cleared: whichever of the list's trees is not in use, swapped
+        // with the list's own to undo or redo the step.
+        QSharedPointer<PlaylistIndex> cleared;
+    };
+    // The steps one mutation of the playlist took, in the order taken.
+    typedef QVector<Step> Edit;
+
+    static const qint64 defaultBudget = 128 * 1024 * 1024;
+
+    EditJournal();
+    ~EditJournal();
+
+    // Shared by every journal.
+    static qint64 budget();
+    static void setBudget(qint64 bytes);
+
+    // Steps recorded before the next commit() make up one edit.  Recording
+    // anything forgets what there was to redo.
+    void record(const Step &step);
+    void commit();
+    // Between open() and close(), commits are held back, so that a run of
+    // mutations (adding files one by one, say) is undone as one.
+    void open();
+    void close();
+    // Forgets everything, for when the list changed in a way the journal
+    // cannot follow.
+    void reset();
+
+    bool canUndo() const;
+    bool canRedo() const;
+    // Whether anything there is to undo or redo would put one of these
+    // items back.
+    bool holdsAny(const QVector<ItemPointer> &items) const;
+    // Move the latest edit from one side to the other and return it for the
+    // playlist to apply, backwards for undo and forwards for redo.  Empty if
+    // the ledger has forgotten it.
+    Edit takeUndo();
+    Edit takeRedo();
+
+private:
+    Q_DISABLE_COPY(EditJournal)
+
+    Edit pending;
+    int depth = 0;
+    // The ledger's serial numbers for the edits, in the order they are to
+    // be taken back from the end.
+    QList<quint64> undoable;
+    QList<quint64> redoable;
+};
+
+#endif // EDITJOURNAL_H
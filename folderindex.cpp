@@ -0,0 +1,155 @@
+#include <QCollator>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QMutex>
+#include <QStringList>
+#include <algorithm>
+#include "folderindex.h"
+#include "helpers.h"
+
+struct FolderListing {
+    QDateTime modified;
+    QStringList names;
+};
+
+// Natural order, with names that differ only in case kept apart so that
+// the order is total.
+class NaturalOrder {
+public:
+    NaturalOrder()
+    {
+        collator.setNumericMode(true);
+        collator.setCaseSensitivity(Qt::CaseInsensitive);
+    }
+
+    bool operator()(const QString &a, const QString &b) const
+    {
+        int result = collator.compare(a, b);
+        return result ? result < 0 : a < b;
+    }
+
+private:
+    QCollator collator;
+};
+
+class FolderIndexCache {
+public:
+    // The index of a folder as it is now, built in the calling thread if
+    // there is none or it has gone stale.
+    QSharedPointer<const FolderListing> listingOf(const QString &folder)
+    {
+        QDateTime modified = QFileInfo(folder).lastModified();
+        {
+            QMutexLocker locker(&mutex);
+            auto listing = listings.value(folder);
+            if (listing && listing->modified == modified) {
+                recent.removeOne(folder);
+                recent.append(folder);
+                return listing;
+            }
+        }
+        // The time is taken before reading, so that a change made while
+        // reading shows up as stale next time.
+        QSharedPointer<FolderListing> listing(new FolderListing);
+        listing->modified = modified;
+        for (const QString &name : QDir(folder).entryList(QDir::Files)) {
+            if (Helpers::fileExtensions.contains(QFileInfo(name).suffix().toLower()))
+                listing->names.append(name);
+        }
+        std::sort(listing->names.begin(), listing->names.end(), NaturalOrder());
+
+        QMutexLocker locker(&mutex);
+        listings.insert(folder, listing);
+        recent.removeOne(folder);
+        recent.append(folder);
+        while (recent.count() > FolderIndex::folderLimit)
+            listings.remove(recent.takeFirst());
+        return listing;
+    }
+
+    void forget(const QString &folder)
+    {
+        QMutexLocker locker(&mutex);
+        listings.remove(folder);
+        recent.removeOne(folder);
+    }
+
+    QStringList folders()
+    {
+        QMutexLocker locker(&mutex);
+        return recent;
+    }
+
+private:
+    QMutex mutex;
+    QHash<QString, QSharedPointer<const FolderListing>> listings;
+    // From the least to the most recently used.
+    QStringList recent;
+};
+
+
+
+FolderIndex::FolderIndex(QObject *parent) : QObject(parent),
+    watcher(new QFileSystemWatcher(this)), cache(new FolderIndexCache)
+{
+    connect(watcher, &QFileSystemWatcher::directoryChanged,
+            this, &FolderIndex::watcher_directoryChanged);
+}
+
+QString FolderIndex::fileAfter(const QString &fileName)
+{
+    return neighbour(fileName, 1);
+}
+
+QString FolderIndex::fileBefore(const QString &fileName)
+{
+    return neighbour(fileName, -1);
+}
+
+void FolderIndex::prefetch(const QString &fileName)
+{
+    QString folder = QFileInfo(fileName).absolutePath();
+    QSharedPointer<FolderIndexCache> cache = this->cache;
+    queue.clear();
+    queue.post([cache, folder]() {
+        cache->listingOf(folder);
+    });
+}
+
+QString FolderIndex::neighbour(const QString &fileName, int step)
+{
+    QFileInfo info(fileName);
+    QString folder = info.absolutePath();
+    auto listing = cache->listingOf(folder);
+
+    // Watch just the folders still indexed.
+    QStringList indexed = cache->folders();
+    QStringList watched = watcher->directories();
+    for (const QString &path : watched)
+        if (!indexed.contains(path))
+            watcher->removePath(path);
+    if (indexed.contains(folder) && !watched.contains(folder))
+        watcher->addPath(folder);
+
+    // Whether or not the file is still there, its neighbours are the last
+    // name before it and the first name after it.
+    const QStringList &names = listing->names;
+    int index;
+    if (step > 0)
+        index = std::upper_bound(names.begin(), names.end(), info.fileName(),
+                                 NaturalOrder()) - names.begin();
+    else
+        index = std::lower_bound(names.begin(), names.end(), info.fileName(),
+                                 NaturalOrder()) - names.begin() - 1;
+    if (index < 0 || index >= names.count())
+        return QString();
+    return QDir(folder).filePath(names[index]);
+}
+
+void FolderIndex::watcher_directoryChanged(const QString &path)
+{
+    cache->forget(path);
+}
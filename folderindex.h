@@ -0,0 +1,50 @@
+#ifndef FOLDERINDEX_H
+#define FOLDERINDEX_H
+// Remembers the media files of the folders recently played from, so that
+// playing the next or previous file of a folder need not read it again.
+//
+// A folder's index is its media files, in the natural order Sort by Label
+// uses, and finding a file's neighbour in it is a binary search.  An index
+// is dropped when the file system watcher says the folder changed, and
+// since watchers see nothing on most network mounts, it is also checked
+// against the folder's modification time before each use.  prefetch()
+// builds an index on the global thread pool ahead of the first time it is
+// wanted.
+
+#include <QObject>
+#include <QSharedPointer>
+#include <QString>
+#include "serialqueue.h"
+
+class FolderIndexCache;
+class QFileSystemWatcher;
+
+class FolderIndex : public QObject {
+    Q_OBJECT
+public:
+    static const int folderLimit = 8;
+
+    explicit FolderIndex(QObject *parent = nullptr);
+
+    // The full path of the media file after or before the given one in its
+    // folder, or an empty string at either end.  The file itself need not
+    // still be there.
+    QString fileAfter(const QString &fileName);
+    QString fileBefore(const QString &fileName);
+    // May be called from any thread.
+    void prefetch(const QString &fileName);
+
+private:
+    QString neighbour(const QString &fileName, int step);
+
+private slots:
+    void watcher_directoryChanged(const QString &path);
+
+private:
+    QFileSystemWatcher *watcher = nullptr;
+    SerialQueue queue;
+    // Shared with prefetches, which may still be running when this goes.
+    QSharedPointer<FolderIndexCache> cache;
+};
+
+#endif // FOLDERINDEX_H
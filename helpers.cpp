@@ -13,6 +13,7 @@
 #include <cmath>
 #include <QRegularExpression>
 #include "helpers.h"
+#include "directoryscanner.h"
 
 QSet<QString> Helpers::fileExtensions {
     // DVD/Blu-ray audio formats
@@ -376,29 +377,7 @@ QString Helpers::subsOpenFilter()
 
 QList<QUrl> Helpers::filterUrls(const QList<QUrl> &urls)
 {
-    QList<QUrl> filtered;
-    for (const QUrl &u : urls) {
-        if (!u.isLocalFile()) {
-            filtered << u;
-            continue;
-        }
-        QFileInfo info(u.toLocalFile());
-        if (info.isDir()) {           
-            // FIXME: detect circular symlinks
-            QDir dir(info.filePath());
-            QList<QUrl> children;
-            for (auto &i : dir.entryInfoList(QDir::NoDotAndDotDot | QDir::AllEntries,
-                                             QDir::Name | QDir::DirsLast))
-               children << QUrl::fromLocalFile(i.filePath());
-            filtered.append(filterUrls(children));
-            continue;
-        }
-        if (fileExtensions.contains(info.suffix().toLower())) {
-            filtered << u;
-            continue;
-        }
-    }
-    return filtered;
+    return DirectoryScanner::collect(urls);
 }
 
 QRect Helpers::vmapToRect(const QVariantMap &m) {
@@ -825,17 +804,17 @@ void DisplayParser::takeFormatString(QString fmt)
     dumpGatheredData(gathered, current, true);
 }
 
-QString DisplayParser::parseMetadata(QVariantMap metaData,
-                                     QString displayString,
+QString DisplayParser::parseMetadata(const QVariantMap &metaData,
+                                     const QString &displayString,
                                      Helpers::FileType fileType)
 {
-    if (metaData.isEmpty()) {
+    if (metaData.isEmpty())
         return displayString;
-    } else {
-        if (!metaData.contains("title"))
-            metaData["title"] = displayString;
+    if (metaData.contains("title"))
         return node->output(metaData, displayString, fileType);
-    }
+    QVariantMap titled = metaData;
+    titled["title"] = displayString;
+    return node->output(titled, displayString, fileType);
 }
 
 
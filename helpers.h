@@ -43,6 +43,7 @@ namespace Helpers {
                         double timeEnd);
     QString fileOpenFilter();
     QString subsOpenFilter();
+    // Media files among the urls, walking any folders in the calling thread.
     QList<QUrl> filterUrls(const QList<QUrl> &urls);
     QRect vmapToRect(const QVariantMap &m);
     QVariantMap rectToVmap(const QRect &r);
@@ -122,7 +123,8 @@ public:
     ~DisplayParser();
 
     void takeFormatString(QString fmt);
-    QString parseMetadata(QVariantMap metaData, QString displayString,
+    QString parseMetadata(const QVariantMap &metaData,
+                          const QString &displayString,
                           Helpers::FileType fileType);
 private:
     DisplayNode *node = nullptr;
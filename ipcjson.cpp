@@ -9,6 +9,7 @@
 #include "mainwindow.h"
 #include "manager.h"
 #include "mpvwidget.h"
+#include "playlist.h"
 #include "ipcjson.h"
 
 
@@ -315,6 +316,56 @@ QVariant MpcQtServer::ipc_doMpvCommand(const QVariantMap &map)
     return mainWindow->mpvObject()->blockingMpvCommand(QVariant(command));
 }
 
+QVariant MpcQtServer::ipc_search(const QVariantMap &map)
+{
+    QString text = map.value("text").toString();
+    int limit = map.value("limit", 50).toInt();
+    if (text.isEmpty() || limit <= 0)
+        return QVariant::fromValue(MpvErrorCode(-0xdedbeef));
+
+    auto collection = PlaylistCollection::getSingleton();
+    QVariantList results;
+    for (const PlaylistCollection::SearchResult &r : collection->search(text, limit)) {
+        auto list = collection->playlistOf(r.playlist);
+        auto item = list ? list->itemOf(r.item) : ItemPointer();
+        if (!item)
+            continue;
+        results.append(QVariantMap({{"playlist", r.playlist}, {"item", r.item},
+                                    {"url", item->url()}, {"score", r.score}}));
+    }
+    return results;
+}
+
+QVariant MpcQtServer::ipc_undo(const QVariantMap &map)
+{
+    PlaylistWindow *window = mainWindow->playlistWindow();
+    bool done;
+    if (map.value("queue").toBool())
+        done = window->undoQueue();
+    else
+        done = window->undoPlaylist(map.contains("playlist")
+                                    ? map["playlist"].toUuid()
+                                    : window->currentPlaylistUuid());
+    if (!done)
+        return QVariant::fromValue(MpvErrorCode(-0xdedbeef));
+    return true;
+}
+
+QVariant MpcQtServer::ipc_redo(const QVariantMap &map)
+{
+    PlaylistWindow *window = mainWindow->playlistWindow();
+    bool done;
+    if (map.value("queue").toBool())
+        done = window->redoQueue();
+    else
+        done = window->redoPlaylist(map.contains("playlist")
+                                    ? map["playlist"].toUuid()
+                                    : window->currentPlaylistUuid());
+    if (!done)
+        return QVariant::fromValue(MpvErrorCode(-0xdedbeef));
+    return true;
+}
+
 
 MpvServer::MpvServer(QObject *parent)
     : JsonServer(QCoreApplication::organizationDomain() + ".mpv", parent)
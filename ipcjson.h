@@ -72,6 +72,9 @@ private slots:
     QVariant ipc_setMpvProperty(const QVariantMap &map);
     QVariant ipc_setMpvOption(const QVariantMap &map);
     QVariant ipc_doMpvCommand(const QVariantMap &map);
+    QVariant ipc_search(const QVariantMap &map);
+    QVariant ipc_undo(const QVariantMap &map);
+    QVariant ipc_redo(const QVariantMap &map);
 
 private:
     PlaybackManager *playbackManager = nullptr;
@@ -0,0 +1,148 @@
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+#include <QVector>
+#include <algorithm>
+#include <new>
+#include "itempool.h"
+#include "playlist.h"
+
+// Both pools are created on first use and deliberately never destroyed, as
+// items held by static singletons are still being released at exit.
+
+// The strings are spread across shards by hash, each with a lock of its
+// own, so that the threads loading and scanning rarely wait on each other.
+// A shard that has doubled since it was last purged drops the strings only
+// it still holds, so what a closed playlist interned does not stay forever,
+// and a purge costs no more per intern than growing the set does.
+class StringPoolData {
+public:
+    static const int shardCount = 16;
+    static const int minimumPurge = 1024;
+
+    struct Shard {
+        QMutex mutex;
+        QSet<QString> strings;
+        int purgeAt = minimumPurge;
+    };
+
+    Shard shards[shardCount];
+};
+
+static StringPoolData *stringPool()
+{
+    static StringPoolData *pool = new StringPoolData;
+    return pool;
+}
+
+static void purgeShard(StringPoolData::Shard &shard)
+{
+    for (auto it = shard.strings.begin(); it != shard.strings.end(); ) {
+        // The set's copy is shared with every item using the string, so
+        // an unshared one is held by nothing else.
+        if (it->isDetached())
+            it = shard.strings.erase(it);
+        else
+            ++it;
+    }
+    shard.purgeAt = qMax(int(StringPoolData::minimumPurge),
+                         shard.strings.count() * 2);
+}
+
+QString StringPool::intern(const QString &text)
+{
+    if (text.isEmpty())
+        return QString();
+    StringPoolData::Shard &shard =
+            stringPool()->shards[qHash(text) % StringPoolData::shardCount];
+    QMutexLocker locker(&shard.mutex);
+    auto it = shard.strings.constFind(text);
+    if (it != shard.strings.constEnd())
+        return *it;
+    if (shard.strings.count() >= shard.purgeAt)
+        purgeShard(shard);
+    shard.strings.insert(text);
+    return text;
+}
+
+
+
+// Slots of one size, handed out from slabs of slabSlots at a time.  Free
+// slots are chained through their own first bytes.  Slabs are never given
+// back; a library that shrinks reuses them for the next items it loads.
+class SlotAllocator {
+public:
+    static const int slabSlots = 4096;
+
+    explicit SlotAllocator(size_t size)
+        : slotSize(std::max(size, sizeof(FreeSlot))) {}
+
+    void *allocate()
+    {
+        QMutexLocker locker(&mutex);
+        if (!freeList) {
+            char *slab = static_cast<char*>(::operator new(slotSize * slabSlots));
+            for (int i = slabSlots - 1; i >= 0; --i) {
+                FreeSlot *s = reinterpret_cast<FreeSlot*>(slab + i * slotSize);
+                s->next = freeList;
+                freeList = s;
+            }
+        }
+        FreeSlot *s = freeList;
+        freeList = s->next;
+        return s;
+    }
+
+    void release(void *p)
+    {
+        QMutexLocker locker(&mutex);
+        FreeSlot *s = static_cast<FreeSlot*>(p);
+        s->next = freeList;
+        freeList = s;
+    }
+
+private:
+    struct FreeSlot {
+        FreeSlot *next;
+    };
+
+    const size_t slotSize;
+    QMutex mutex;
+    FreeSlot *freeList = nullptr;
+};
+
+static SlotAllocator *itemSlots()
+{
+    static SlotAllocator *slots = new SlotAllocator(sizeof(Item));
+    return slots;
+}
+
+void *ItemPool::allocate(size_t size)
+{
+    if (size != sizeof(Item))
+        return ::operator new(size);
+    return itemSlots()->allocate();
+}
+
+void ItemPool::release(void *p, size_t size)
+{
+    if (!p)
+        return;
+    if (size != sizeof(Item))
+        ::operator delete(p);
+    else
+        itemSlots()->release(p);
+}
+
+
+
+void ItemPointer::retain(Item *item)
+{
+    item->refCount_.ref();
+}
+
+void ItemPointer::release(Item *item)
+{
+    if (!item->refCount_.deref())
+        delete item;
+}
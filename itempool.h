@@ -0,0 +1,101 @@
+#ifndef ITEMPOOL_H
+#define ITEMPOOL_H
+// Storage helpers that keep large libraries small.
+//
+// StringPool hands out one shared copy of strings that many items repeat,
+// like the directory a file is in or the artist it is by, so that a million
+// items from a few thousand folders hold a few thousand copies of their
+// paths rather than a million.
+//
+// ItemPool carves items out of large slabs instead of allocating each one on
+// its own, which saves the allocator's per-block overhead and keeps items
+// that were created together close together in memory.
+//
+// ItemPointer is how items are held.  It counts its references in the item
+// itself, so an item and its count take one slot of the pool between them,
+// where QSharedPointer would add a separately allocated control block.
+
+#include <QHash>
+#include <QString>
+#include <QtGlobal>
+#include <cstddef>
+#include <utility>
+
+class Item;
+
+class StringPool {
+public:
+    // The pool lets go of strings nothing else holds as it grows, but only
+    // strings which are likely to come up again are worth interning.
+    static QString intern(const QString &text);
+};
+
+class ItemPool {
+public:
+    static void *allocate(size_t size);
+    static void release(void *p, size_t size);
+};
+
+class ItemPointer {
+public:
+    ItemPointer() : d(nullptr) {}
+    ItemPointer(std::nullptr_t) : d(nullptr) {}
+    explicit ItemPointer(Item *item) : d(item) { if (d) retain(d); }
+    ItemPointer(const ItemPointer &other) : d(other.d) { if (d) retain(d); }
+    ItemPointer(ItemPointer &&other) noexcept : d(other.d) { other.d = nullptr; }
+    ~ItemPointer() { if (d) release(d); }
+
+    ItemPointer &operator=(const ItemPointer &other)
+    {
+        ItemPointer copy(other);
+        swap(copy);
+        return *this;
+    }
+    ItemPointer &operator=(ItemPointer &&other) noexcept
+    {
+        ItemPointer moved(std::move(other));
+        swap(moved);
+        return *this;
+    }
+
+    Item *data() const { return d; }
+    Item *operator->() const { return d; }
+    Item &operator*() const { return *d; }
+    bool isNull() const { return !d; }
+    bool operator!() const { return !d; }
+    // As QSharedPointer does, so that a pointer tests as a bool but does
+    // not turn into a number.
+    typedef Item *ItemPointer::*RestrictedBool;
+    operator RestrictedBool() const { return d ? &ItemPointer::d : nullptr; }
+
+    void reset() { ItemPointer().swap(*this); }
+    void reset(Item *item) { ItemPointer(item).swap(*this); }
+    void clear() { reset(); }
+    void swap(ItemPointer &other) noexcept { std::swap(d, other.d); }
+
+    friend bool operator==(const ItemPointer &a, const ItemPointer &b) { return a.d == b.d; }
+    friend bool operator!=(const ItemPointer &a, const ItemPointer &b) { return a.d != b.d; }
+    friend bool operator==(const ItemPointer &a, const Item *b) { return a.d == b; }
+    friend bool operator!=(const ItemPointer &a, const Item *b) { return a.d != b; }
+    friend bool operator==(const Item *a, const ItemPointer &b) { return a == b.d; }
+    friend bool operator!=(const Item *a, const ItemPointer &b) { return a != b.d; }
+    friend bool operator==(const ItemPointer &a, std::nullptr_t) { return !a.d; }
+    friend bool operator!=(const ItemPointer &a, std::nullptr_t) { return a.d; }
+    friend bool operator==(std::nullptr_t, const ItemPointer &b) { return !b.d; }
+    friend bool operator!=(std::nullptr_t, const ItemPointer &b) { return b.d; }
+
+private:
+    // Out of line, so that headers can hold items without seeing Item.
+    static void retain(Item *item);
+    static void release(Item *item);
+
+    Item *d;
+};
+Q_DECLARE_TYPEINFO(ItemPointer, Q_MOVABLE_TYPE);
+
+inline uint qHash(const ItemPointer &item, uint seed = 0)
+{
+    return ::qHash(item.data(), seed);
+}
+
+#endif // ITEMPOOL_H
@@ -14,9 +14,12 @@
 #include <QTranslator>
 #include <QLibraryInfo>
 #include "main.h"
+#include "autosaver.h"
+#include "playlist.h"
 #include "storage.h"
 #include "mainwindow.h"
 #include "manager.h"
+#include "metadatacache.h"
 #include "settingswindow.h"
 #include "mpvwidget.h"
 #include "propertieswindow.h"
@@ -84,9 +87,15 @@ Flow::~Flow()
         delete mpvServer;
         mpvServer = nullptr;
     }
+    if (autoSaver) {
+        // Whatever changed since the last pass, while there are still
+        // windows to ask.
+        autoSaver->flush();
+        delete autoSaver;
+        autoSaver = nullptr;
+    }
+    MetadataCache::getSingleton()->save();
     if (mainWindow) {
-        if (!freestanding)
-            storage.writeVList("playlists", mainWindow->playlistWindow()->tabsToVList());
         delete mainWindow;
         mainWindow = nullptr;
     }
@@ -132,6 +141,7 @@ void Flow::parseArgs()
     parser.process(QCoreApplication::arguments());
 
     freestanding = parser.isSet(freestandingOpt);
+    MetadataCache::getSingleton()->setReadOnly(freestanding);
     validCliSize = parser.isSet(sizeOpt) && Helpers::sizeFromString(cliSize, parser.value(sizeOpt));
     validCliPos = parser.isSet(posOpt) && Helpers::pointFromString(cliPos, parser.value(posOpt));
     customFiles = parser.positionalArguments();
@@ -376,6 +386,10 @@ void Flow::init() {
             mainWindow->playlistWindow(), &PlaylistWindow::setHideFullscreen);
     connect(settingsWindow, &SettingsWindow::playlistFormat,
             mainWindow->playlistWindow(), &PlaylistWindow::setDisplayFormatSpecifier);
+    connect(settingsWindow, &SettingsWindow::playlistUndoBudget,
+            mainWindow->playlistWindow(), &PlaylistWindow::setUndoBudget);
+    connect(settingsWindow, &SettingsWindow::playlistThumbnails,
+            mainWindow->playlistWindow(), &PlaylistWindow::setShowThumbnails);
 
     // playlistWindow -> settings
     connect(mainWindow->playlistWindow(), &PlaylistWindow::hideFullscreenChanged,
@@ -519,8 +533,47 @@ void Flow::init() {
 
 int Flow::run()
 {
-    mainWindow->playlistWindow()->tabsFromVList(storage.readVList("playlists"));
+    // Tabs name their playlists, which are each kept in a file of their
+    // own.  Tabs that still carry their contents with them, and playlists
+    // still kept as JSON, are from before then, and are saved in the new way
+    // once loaded.  Tabs that know their title have what they need to be
+    // shown, so their playlists are left on disk until they are first used,
+    // apart from the quick playlist, which the collection always has.
+    auto collection = PlaylistCollection::getSingleton();
+    Storage *s = &storage;
+    collection->setLoader([s](const QUuid &uuid) {
+        return s->readPlaylist(uuid);
+    });
+    QVariantList tabs = storage.readVList("playlists");
+    bool playlistsStored = true;
+    for (int i = 0; i < tabs.count(); ++i) {
+        QVariantMap tab = tabs[i].toMap();
+        if (tab.contains("contents")) {
+            playlistsStored = false;
+            continue;
+        }
+        QUuid uuid = tab.value("playlist").toUuid();
+        if (!uuid.isNull() && tab.contains("title")
+                && storage.isPlaylistStored(uuid)) {
+            collection->addDeferred(uuid);
+            continue;
+        }
+        bool migrated = false;
+        auto playlist = storage.readPlaylist(uuid, &migrated);
+        if (!playlist) {
+            // The quick playlist starts empty instead.
+            if (!uuid.isNull())
+                tabs.removeAt(i--);
+            continue;
+        }
+        if (migrated)
+            playlistsStored = false;
+        collection->addPlaylist(playlist);
+    }
+    mainWindow->playlistWindow()->tabsFromVList(tabs);
     restoreWindows(storage.readVMap("geometry"));
+    if (!freestanding)
+        setupAutoSaver(playlistsStored);
     return qApp->exec();
 }
 
@@ -579,6 +632,27 @@ void Flow::setupMpris()
 #endif
 }
 
+void Flow::setupAutoSaver(bool playlistsStored)
+{
+    autoSaver = new AutoSaver(&storage, this);
+    autoSaver->addDocument("settings", [this]() {
+        return QVariant(settings);
+    });
+    autoSaver->addDocument("keys", [this]() {
+        return QVariant(keyMap);
+    });
+    autoSaver->addDocument("recent", [this]() {
+        return QVariant(recentToVList());
+    });
+    autoSaver->addDocument("favorites", [this]() {
+        return QVariant(favoritesToVMap());
+    });
+    autoSaver->setTabs([this]() {
+        return QVariant(mainWindow->playlistWindow()->tabsToVList());
+    });
+    autoSaver->start(playlistsStored);
+}
+
 QByteArray Flow::makePayload() const
 {
     QVariantMap map({
@@ -818,7 +892,12 @@ void Flow::mainwindow_optionsOpenRequested()
 
 void Flow::manager_nowPlayingChanged(QUrl url, QUuid listUuid, QUuid itemUuid)
 {
-    TrackInfo track(url, listUuid, itemUuid, QString(), 0, 0);
+    // A file played before is known by its title and length.
+    QVariantMap metadata;
+    if (url.isLocalFile())
+        MetadataCache::getSingleton()->lookup(url.toLocalFile(), &metadata);
+    TrackInfo track(url, listUuid, itemUuid, metadata.value("title").toString(),
+                    metadata.value("duration").toDouble(), 0);
     if (recentFiles.contains(track)) {
         recentFiles.removeAll(track);
     }
@@ -912,20 +991,18 @@ void Flow::favoriteswindow_favoriteTracks(const QList<TrackInfo> &files, const Q
 
 void Flow::endProgram()
 {
-    if (!freestanding) {
-        storage.writeVMap("settings", settings);
-        storage.writeVMap("keys", keyMap);
-        storage.writeVList("recent", recentToVList());
-        storage.writeVMap("favorites", favoritesToVMap());
+    // Everything else has been saved as it changed, so there is little
+    // left to write.
+    if (autoSaver)
+        autoSaver->flush();
+    if (!freestanding)
         storage.writeVMap("geometry", saveWindows());
-    }
     qApp->quit();
 }
 
 void Flow::importPlaylist(QString fname)
 {
-    //CHECKME: addSimplePlaylist should be a slot?
-    mainWindow->playlistWindow()->addSimplePlaylist(storage.readM3U(fname));
+    mainWindow->playlistWindow()->importPlaylistFile(fname);
 }
 
 void Flow::exportPlaylist(QString fname, QStringList items)
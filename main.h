@@ -13,6 +13,7 @@
 #include "platform/screensaver.h"
 #include "platform/devicemanager.h"
 
+class AutoSaver;
 class MprisInstance;
 
 // a simple class to control program exection and own application objects
@@ -33,6 +34,7 @@ signals:
 
 private:
     void setupMpris();
+    void setupAutoSaver(bool playlistsStored);
     QByteArray makePayload() const;
     QString pictureTemplate(Helpers::DisabledTrack tracks, Helpers::Subtitles subs) const;
     QVariantList recentToVList() const;
@@ -73,6 +75,7 @@ private:
     MpcQtServer *server = nullptr;
     MpvServer *mpvServer = nullptr;
     MprisInstance *mpris = nullptr;
+    AutoSaver *autoSaver = nullptr;
     ScreenSaver *screenSaver = nullptr;
     MainWindow *mainWindow = nullptr;
     PlaybackManager *playbackManager = nullptr;
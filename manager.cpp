@@ -3,6 +3,7 @@
 #include "manager.h"
 #include "mainwindow.h"
 #include "mpvwidget.h"
+#include "playlist.h"
 #include "helpers.h"
 
 using namespace Helpers;
@@ -69,6 +70,8 @@ void PlaybackManager::setPlaylistWindow(PlaylistWindow *playlistWindow)
     playlistWindow_ = playlistWindow;
     connect(playlistWindow, &PlaylistWindow::itemDesired,
             this, &PlaybackManager::playItem);
+    connect(playlistWindow, &PlaylistWindow::itemsScanned,
+            this, &PlaybackManager::playlistWindow_itemsScanned);
     connect(this, &PlaybackManager::nowPlayingChanged,
             playlistWindow, &PlaylistWindow::changePlaylistSelection);
 }
@@ -93,9 +96,13 @@ void PlaybackManager::openSeveralFiles(QList<QUrl> what, bool important)
                          && (important || nowPlayingItem == QUuid()))
                         || !playlistWindow_->isVisible();
     auto info = playlistWindow_->addToCurrentPlaylist(what);
+    playWhenScanned = false;
     if (playAfterAdd && !info.second.isNull()) {
         QUrl urlToPlay = playlistWindow_->getUrlOf(info.first, info.second);
         startPlayWithUuid(urlToPlay, info.first, info.second, false);
+    } else if (playAfterAdd && playlistWindow_->isScanning(info.first)) {
+        playWhenScanned = true;
+        scannedPlaylist = info.first;
     }
 }
 
@@ -409,6 +416,9 @@ void PlaybackManager::startPlayWithUuid(QUrl what, QUuid playlistUuid,
         // configured in the settings dialog.
         playlistWindow_->setExtraPlayTimes(playlistUuid, itemUuid, playbackPlayTimes - 1);
     }
+    // Have the folder ready for when next or previous falls back on it.
+    if (folderFallback && what.isLocalFile())
+        folderIndex.prefetch(what.toLocalFile());
     emit nowPlayingChanged(nowPlaying_, nowPlayingList, nowPlayingItem);
 }
 
@@ -513,64 +523,28 @@ void PlaybackManager::playPrevTrack()
 
 void PlaybackManager::playNextFile()
 {
-    QUrl url;
-    QFileInfo info;
-    QDir dir;
-    QStringList files;
-    int index;
-    QString nextFile;
-
-    url = playlistWindow_->getUrlOfFirst(nowPlayingList);
-    if (url.isEmpty())
-        goto stop;
-    info = QFileInfo(url.toLocalFile());
-    if (!info.exists())
-        goto stop;
-    dir = info.dir();
-    files = dir.entryList(QDir::Files, QDir::Name);
-    index = files.indexOf(info.fileName()) + 1;
-    if (index <= 0 || index >= files.count())
-        goto stop;
-    nextFile = dir.filePath(files.value(index));
-    url = QUrl::fromLocalFile(nextFile);
-    playlistWindow_->replaceItem(nowPlayingList, nowPlayingItem, { url });
-    startPlayWithUuid(url, nowPlayingList, nowPlayingItem, false);
-    return;
-
-stop:
-    playHalt();
-    return;
+    playSiblingFile(1);
 }
 
 void PlaybackManager::playPrevFile()
 {
-    QUrl url;
-    QFileInfo info;
-    QDir dir;
-    QStringList files;
-    int index;
-    QString nextFile;
-
-    url = playlistWindow_->getUrlOfFirst(nowPlayingList);
-    if (url.isEmpty())
-        goto stop;
-    info = QFileInfo(url.toLocalFile());
-    if (!info.exists())
-        goto stop;
-    dir = info.dir();
-    files = dir.entryList(QDir::Files, QDir::Name);
-    index = files.indexOf(info.fileName()) - 1;
-    if (index < 0)
-        goto stop;
-    nextFile = dir.filePath(files.value(index));
-    url = QUrl::fromLocalFile(nextFile);
+    playSiblingFile(-1);
+}
+
+void PlaybackManager::playSiblingFile(int step)
+{
+    QUrl url = playlistWindow_->getUrlOfFirst(nowPlayingList);
+    QString sibling;
+    if (url.isLocalFile())
+        sibling = step > 0 ? folderIndex.fileAfter(url.toLocalFile())
+                           : folderIndex.fileBefore(url.toLocalFile());
+    if (sibling.isEmpty()) {
+        playHalt();
+        return;
+    }
+    url = QUrl::fromLocalFile(sibling);
     playlistWindow_->replaceItem(nowPlayingList, nowPlayingItem, { url });
     startPlayWithUuid(url, nowPlayingList, nowPlayingItem, false);
-    return;
-
-stop:
-    playHalt();
-    return;
 }
 
 void PlaybackManager::playHalt()
@@ -756,6 +730,15 @@ void PlaybackManager::mpvw_videoBitrateChanged(double bitrate)
     emit videoBitrateChanged(bitrate);
 }
 
+void PlaybackManager::playlistWindow_itemsScanned(QUuid playlistUuid, ItemPointer item)
+{
+    if (!playWhenScanned || playlistUuid != scannedPlaylist)
+        return;
+    playWhenScanned = false;
+    // Only the item played is named.
+    startPlayWithUuid(item->url(), playlistUuid, item->uuid(), false);
+}
+
 void PlaybackManager::mpvw_metadataChanged(QVariantMap metadata)
 {
     playlistWindow_->setMetadata(nowPlayingList, nowPlayingItem, metadata);
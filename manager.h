@@ -11,7 +11,9 @@
 #include <QUuid>
 #include <QSize>
 #include <QVariant>
+#include "folderindex.h"
 #include "helpers.h"
+#include "itempool.h"
 
 class MpvObject;
 class PlaylistWindow;
@@ -129,6 +131,7 @@ private:
     void playPrevTrack();
     void playNextFile();
     void playPrevFile();
+    void playSiblingFile(int step);
     void playHalt();
 
 private slots:
@@ -152,14 +155,19 @@ private slots:
     void mpvw_playlistChanged(const QVariantList &playlist);
     void mpvw_audioBitrateChanged(double bitrate);
     void mpvw_videoBitrateChanged(double bitrate);
+    void playlistWindow_itemsScanned(QUuid playlistUuid, ItemPointer item);
 
 private:
     MpvObject *mpvObject_ = nullptr;
     PlaylistWindow *playlistWindow_ = nullptr;
+    FolderIndex folderIndex;
     QUrl  nowPlaying_;
     QUuid nowPlayingList;
     QUuid nowPlayingItem;
     QString nowPlayingTitle;
+    // Set when opening folders should play the first file found in them.
+    bool playWhenScanned = false;
+    QUuid scannedPlaylist;
 
     double mpvStartTime = -1.0;
     double mpvTime = 0.0;
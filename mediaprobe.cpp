@@ -0,0 +1,297 @@
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+#include "mediaprobe.h"
+#include "metadatacache.h"
+#include "playlist.h"
+
+// Probes until there is nothing left, then hands its mpv handle back.
+class MediaProbeRunner : public QRunnable {
+public:
+    explicit MediaProbeRunner(const QSharedPointer<MediaProbe> &probe)
+        : probe(probe) {}
+
+    void run()
+    {
+        probe->work();
+    }
+
+private:
+    QSharedPointer<MediaProbe> probe;
+};
+
+// Whether a probe has been here already.  Playing a file tells us its tags
+// but not its tracks, so what it leaves behind does not count.
+static bool isProbed(const QVariantMap &metadata)
+{
+    return metadata.contains("video-tracks") || metadata.contains("audio-tracks");
+}
+
+static mpv::qt::Handle createHandle()
+{
+    mpv_handle *raw = mpv_create();
+    if (!raw)
+        return mpv::qt::Handle();
+    mpv::qt::Handle mpv = mpv::qt::Handle::FromRawHandle(raw);
+    // Nothing is shown, heard, decoded or looked for besides the file.
+    static const char *options[][2] = {
+        { "config", "no" }, { "terminal", "no" }, { "idle", "yes" },
+        { "pause", "yes" }, { "vo", "null" }, { "ao", "null" },
+        { "vid", "no" }, { "aid", "no" }, { "sid", "no" },
+        { "load-scripts", "no" }, { "ytdl", "no" }, { "osc", "no" },
+        { "input-default-bindings", "no" }, { "sub-auto", "no" },
+        { "audio-file-auto", "no" }, { "cache", "no" },
+    };
+    for (auto &option : options)
+        mpv_set_option_string(mpv, option[0], option[1]);
+    if (mpv_initialize(mpv) < 0)
+        return mpv::qt::Handle();
+    return mpv;
+}
+
+static QVariant propertyOf(mpv_handle *mpv, const char *name)
+{
+    mpv_node node;
+    if (mpv_get_property(mpv, name, MPV_FORMAT_NODE, &node) < 0)
+        return QVariant();
+    QVariant v = mpv::qt::node_to_variant(&node);
+    mpv_free_node_contents(&node);
+    return v;
+}
+
+// Waits for an event, returning it, or MPV_EVENT_NONE if the time runs out
+// or the probe is stopping.  END_FILE ends the wait too, as the file is not
+// going to load after that.
+static mpv_event_id waitFor(mpv_handle *mpv, mpv_event_id wanted,
+                            const QAtomicInt &stopping)
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+    while (!stopping.loadAcquire() && elapsed.elapsed() < MediaProbe::timeout) {
+        mpv_event_id id = mpv_wait_event(mpv, 0.1)->event_id;
+        if (id == wanted || id == MPV_EVENT_SHUTDOWN
+                || (id == MPV_EVENT_END_FILE && wanted == MPV_EVENT_FILE_LOADED))
+            return id;
+    }
+    return MPV_EVENT_NONE;
+}
+
+// What a loaded file says about itself: its tags, in lower case as when it
+// is played, and how long it is, what tracks it has and how big a picture.
+static QVariantMap loadedMetadata(mpv_handle *mpv)
+{
+    QVariantMap metadata;
+    QVariantMap tags = propertyOf(mpv, "metadata").toMap();
+    for (auto it = tags.constBegin(); it != tags.constEnd(); ++it)
+        metadata.insert(it.key().toLower(), it.value());
+    double duration = propertyOf(mpv, "duration").toDouble();
+    if (duration > 0)
+        metadata.insert("duration", duration);
+
+    int video = 0, audio = 0, subtitles = 0;
+    for (const QVariant &v : propertyOf(mpv, "track-list").toList()) {
+        QVariantMap track = v.toMap();
+        QString type = track.value("type").toString();
+        if (type == "audio") {
+            ++audio;
+        } else if (type == "sub") {
+            ++subtitles;
+        } else if (type == "video" && !track.value("albumart").toBool()) {
+            if (!video++ && track.contains("demux-w")) {
+                metadata.insert("width", track.value("demux-w").toInt());
+                metadata.insert("height", track.value("demux-h").toInt());
+            }
+        }
+    }
+    metadata.insert("video-tracks", video);
+    metadata.insert("audio-tracks", audio);
+    metadata.insert("subtitle-tracks", subtitles);
+    return metadata;
+}
+
+// False if there is no telling what the file is, as when it took too long
+// to open, which a slow share may not another time.  A file that mpv gave
+// up on is known to have nothing.
+static bool probeFile(mpv_handle *mpv, const QString &fileName,
+                      const QAtomicInt &stopping, QVariantMap *metadata)
+{
+    // Whatever is left over from the last file goes first.
+    while (mpv_wait_event(mpv, 0)->event_id != MPV_EVENT_NONE) {}
+
+    metadata->clear();
+    QByteArray file = fileName.toUtf8();
+    const char *load[] = { "loadfile", file.constData(), nullptr };
+    if (mpv_command(mpv, load) < 0)
+        return false;
+    mpv_event_id id = waitFor(mpv, MPV_EVENT_FILE_LOADED, stopping);
+    if (id == MPV_EVENT_FILE_LOADED)
+        *metadata = loadedMetadata(mpv);
+    if (id != MPV_EVENT_END_FILE && id != MPV_EVENT_SHUTDOWN) {
+        const char *stop[] = { "stop", nullptr };
+        mpv_command(mpv, stop);
+        waitFor(mpv, MPV_EVENT_IDLE, stopping);
+    }
+    return id == MPV_EVENT_FILE_LOADED || id == MPV_EVENT_END_FILE;
+}
+
+
+
+MediaProbe::MediaProbe() : QObject()
+{
+    qRegisterMetaType<ItemPointer>("ItemPointer");
+    pool.setMaxThreadCount(handleCount);
+}
+
+void MediaProbe::request(const QUuid &playlist,
+                         const QVector<ItemPointer> &items)
+{
+    QMutexLocker locker(&mutex);
+    for (int i = 0; i < waiting.count(); ++i) {
+        if (waiting[i].playlist == playlist) {
+            waiting.removeAt(i);
+            break;
+        }
+    }
+    Pending pending;
+    pending.playlist = playlist;
+    pending.items = items;
+    waiting.append(pending);
+    schedule();
+}
+
+void MediaProbe::append(const QUuid &playlist,
+                        const QVector<ItemPointer> &items)
+{
+    QMutexLocker locker(&mutex);
+    Pending pending;
+    pending.playlist = playlist;
+    for (int i = 0; i < waiting.count(); ++i) {
+        if (waiting[i].playlist == playlist) {
+            pending = waiting.takeAt(i);
+            break;
+        }
+    }
+    pending.items.append(items);
+    waiting.append(pending);
+    schedule();
+}
+
+void MediaProbe::prioritise(const QUuid &playlist,
+                            const QVector<ItemPointer> &items)
+{
+    QMutexLocker locker(&mutex);
+    urgent.playlist = playlist;
+    urgent.items = items;
+    urgent.next = 0;
+    schedule();
+}
+
+void MediaProbe::forget(const QUuid &playlist)
+{
+    QMutexLocker locker(&mutex);
+    if (urgent.playlist == playlist)
+        urgent = Pending();
+    for (int i = 0; i < waiting.count(); ++i) {
+        if (waiting[i].playlist == playlist) {
+            waiting.removeAt(i);
+            break;
+        }
+    }
+}
+
+void MediaProbe::stop()
+{
+    stopping.storeRelease(1);
+    QMutexLocker locker(&mutex);
+    urgent = Pending();
+    waiting.clear();
+    idle.clear();
+}
+
+void MediaProbe::work()
+{
+    QUuid playlist;
+    ItemPointer item;
+    mpv::qt::Handle mpv;
+    {
+        QMutexLocker locker(&mutex);
+        if (!idle.isEmpty())
+            mpv = idle.takeLast();
+    }
+    if (!mpv)
+        mpv = createHandle();
+
+    while (takeNext(playlist, item, mpv)) {
+        QUrl url = item->url();
+        if (!url.isLocalFile() || isProbed(item->metadata()))
+            continue;
+        QFileInfo info(url.toLocalFile());
+        if (!info.isFile())
+            continue;
+
+        QVariantMap metadata;
+        auto cache = MetadataCache::getSingleton();
+        if (!(cache->lookup(info.absoluteFilePath(), &metadata)
+                  && isProbed(metadata)) && mpv) {
+            QVariantMap found;
+            bool known = probeFile(mpv, info.absoluteFilePath(), stopping,
+                                   &found);
+            if (stopping.loadAcquire() || !known)
+                continue;
+            // Files that would not open are kept too, as having no tracks,
+            // so that they are not tried again.  Those that timed out are
+            // not.  What playing the file told us stays as it is.
+            if (found.isEmpty()) {
+                found.insert("video-tracks", 0);
+                found.insert("audio-tracks", 0);
+            }
+            for (auto it = metadata.constBegin(); it != metadata.constEnd(); ++it)
+                found.insert(it.key(), it.value());
+            metadata = found;
+            cache->store(info.absoluteFilePath(), metadata);
+        }
+        if (!metadata.isEmpty())
+            emit probed(playlist, item, metadata);
+    }
+}
+
+void MediaProbe::schedule()
+{
+    // Called with the mutex held.
+    bool pending = urgent.next < urgent.items.count() || !waiting.isEmpty();
+    if (stopping.loadAcquire() || !pending || running >= handleCount)
+        return;
+    ++running;
+    pool.start(new MediaProbeRunner(sharedFromThis()));
+}
+
+bool MediaProbe::takeNext(QUuid &playlist, ItemPointer &item,
+                          mpv::qt::Handle &handle)
+{
+    QMutexLocker locker(&mutex);
+    if (!stopping.loadAcquire()) {
+        if (urgent.next < urgent.items.count()) {
+            playlist = urgent.playlist;
+            item = urgent.items[urgent.next++];
+            schedule();
+            return true;
+        }
+        while (!waiting.isEmpty()) {
+            Pending &pending = waiting.last();
+            if (pending.next < pending.items.count()) {
+                playlist = pending.playlist;
+                item = pending.items[pending.next++];
+                schedule();
+                return true;
+            }
+            waiting.removeLast();
+        }
+    }
+    // Out of work.  The handle is kept for next time, unless stopping.
+    if (handle && !stopping.loadAcquire())
+        idle.append(handle);
+    handle = mpv::qt::Handle();
+    --running;
+    return false;
+}
@@ -0,0 +1,81 @@
+#ifndef MEDIAPROBE_H
+#define MEDIAPROBE_H
+// Finds out what a playlist's files are without playing them.
+//
+// A few headless mpv handles, with no video or audio output and nothing
+// decoded, open local files one at a time and read their duration, tags,
+// tracks and picture size into the items' metadata.  They run on a pool of
+// their own, as a slow file can keep a thread waiting for seconds, and the
+// shared pool is there for searching, sorting and loading.  The rows on
+// screen are probed first, then the rest of the playlists asked for, most
+// recent first.  Items that already know their tracks are skipped, and what
+// a probe finds goes into the MetadataCache, so a file is opened at most
+// once however often it is added.
+
+#include <QAtomicInt>
+#include <QEnableSharedFromThis>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QThreadPool>
+#include <QUuid>
+#include <QVariantMap>
+#include <QVector>
+#include <mpv/qthelper.hpp>
+#include "itempool.h"
+
+class Item;
+
+class MediaProbe : public QObject, public QEnableSharedFromThis<MediaProbe> {
+    Q_OBJECT
+public:
+    static const int handleCount = 2;
+    // How long a file may take to open, in ms.
+    static const int timeout = 10000;
+
+    MediaProbe();
+
+    // Probes the items of a playlist, in order, in place of those asked
+    // for before.
+    void request(const QUuid &playlist, const QVector<ItemPointer> &items);
+    // Probes these items after those already asked for in the playlist, as
+    // when they have just been added to it.
+    void append(const QUuid &playlist, const QVector<ItemPointer> &items);
+    // Probes these items ahead of everything else, in place of those shown
+    // before.
+    void prioritise(const QUuid &playlist, const QVector<ItemPointer> &items);
+    void forget(const QUuid &playlist);
+    // Finishes up with the files being probed, and leaves the rest.
+    void stop();
+
+    // Called on the pool.
+    void work();
+
+signals:
+    // The metadata is only what the probe found, and is left to the
+    // receiver to merge with what the item already has.
+    void probed(QUuid playlist, ItemPointer item, QVariantMap metadata);
+
+private:
+    struct Pending {
+        QUuid playlist;
+        QVector<ItemPointer> items;
+        int next = 0;
+    };
+
+    void schedule();
+    bool takeNext(QUuid &playlist, ItemPointer &item,
+                  mpv::qt::Handle &handle);
+
+    QThreadPool pool;
+    QMutex mutex;
+    Pending urgent;
+    // The most recently requested last.
+    QList<Pending> waiting;
+    QList<mpv::qt::Handle> idle;
+    int running = 0;
+    QAtomicInt stopping;
+};
+
+#endif // MEDIAPROBE_H
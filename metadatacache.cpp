@@ -0,0 +1,368 @@
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QUuid>
+#include <cstring>
+#ifdef Q_OS_WIN
+#include <QCryptographicHash>
+#include <QDateTime>
+#else
+#include <sys/stat.h>
+#endif
+#include "metadatacache.h"
+#include "playliststore.h"
+#include "storage.h"
+
+// 'MPML' and 'MPMI' when read in the byte order they were written in, and
+// the start of every entry.
+static const quint32 logMagic = 0x4c4d504d;
+static const quint32 indexMagic = 0x494d504d;
+static const quint32 entryMagic = 0x544e454d;
+// How many superseded entries there must be before the log is compacted,
+// besides their outnumbering the live ones.
+static const qint64 compactAfter = 1000;
+
+struct LogHeader {
+    quint32 magic;
+    quint32 version;
+    // Made afresh whenever the log is, so that an index can tell whether
+    // it was written for this log.
+    quint64 id;
+};
+
+struct LogEntry {
+    quint32 magic;
+    quint32 size;
+    FileIdentity key;
+};
+
+struct IndexHeader {
+    quint32 magic;
+    quint32 version;
+    quint64 logId;
+    quint64 logSize;
+    quint64 count;
+    quint64 stale;
+};
+
+struct IndexEntry {
+    FileIdentity key;
+    qint64 offset;
+};
+
+static_assert(sizeof(FileIdentity) == 32, "identity has padding");
+static_assert(sizeof(LogHeader) % 8 == 0, "log header breaks alignment");
+static_assert(sizeof(LogEntry) % 8 == 0, "log entry breaks alignment");
+static_assert(sizeof(IndexHeader) % 8 == 0, "index header breaks alignment");
+static_assert(sizeof(IndexEntry) % 8 == 0, "index entry breaks alignment");
+
+static qint64 paddedTo8(qint64 size)
+{
+    return (size + 7) & ~qint64(7);
+}
+
+bool identifyFile(const QString &fileName, FileIdentity *id)
+{
+    std::memset(id, 0, sizeof(*id));
+#ifndef Q_OS_WIN
+    struct stat st;
+    if (::stat(QFile::encodeName(fileName).constData(), &st) != 0
+            || !S_ISREG(st.st_mode))
+        return false;
+    id->device = quint64(st.st_dev);
+    id->inode = quint64(st.st_ino);
+    id->size = quint64(st.st_size);
+    id->modified = qint64(st.st_mtime);
+#else
+    // There are no inodes to hand, so where the file is stands in for them.
+    QFileInfo info(fileName);
+    if (!info.isFile())
+        return false;
+    QByteArray where = QCryptographicHash::hash(
+            info.canonicalFilePath().toLower().toUtf8(), QCryptographicHash::Sha1);
+    std::memcpy(&id->inode, where.constData(), sizeof(id->inode));
+    id->size = quint64(info.size());
+    id->modified = info.lastModified().toMSecsSinceEpoch() / 1000;
+#endif
+    return true;
+}
+
+static QByteArray newLogHeader()
+{
+    LogHeader header;
+    header.magic = logMagic;
+    header.version = MetadataCache::version;
+    std::memcpy(&header.id, QUuid::createUuid().toRfc4122().constData(),
+                sizeof(header.id));
+    return QByteArray(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+bool operator==(const FileIdentity &a, const FileIdentity &b)
+{
+    return a.device == b.device && a.inode == b.inode
+            && a.size == b.size && a.modified == b.modified;
+}
+
+uint qHash(const FileIdentity &key, uint seed)
+{
+    return qHash(QByteArray::fromRawData(reinterpret_cast<const char *>(&key),
+                                         sizeof(key)), seed);
+}
+
+
+
+QSharedPointer<MetadataCache> MetadataCache::cache;
+
+MetadataCache::MetadataCache()
+{
+}
+
+MetadataCache::~MetadataCache()
+{
+}
+
+QSharedPointer<MetadataCache> MetadataCache::getSingleton()
+{
+    if (cache.isNull())
+        cache.reset(new MetadataCache());
+    return cache;
+}
+
+void MetadataCache::setReadOnly(bool yes)
+{
+    QMutexLocker locker(&mutex);
+    readOnly = yes;
+}
+
+bool MetadataCache::isReadOnly()
+{
+    QMutexLocker locker(&mutex);
+    return readOnly;
+}
+
+bool MetadataCache::isEmpty()
+{
+    QMutexLocker locker(&mutex);
+    open();
+    return offsets.isEmpty();
+}
+
+bool MetadataCache::lookup(const QString &fileName, QVariantMap *metadata)
+{
+    FileIdentity key;
+    if (!identifyFile(fileName, &key))
+        return false;
+    QMutexLocker locker(&mutex);
+    open();
+    auto it = offsets.constFind(key);
+    if (it == offsets.constEnd())
+        return false;
+    QByteArray bytes = recordAt(*it);
+    *metadata = PlaylistStore::decodeMetadata(bytes.constData(), bytes.size());
+    return true;
+}
+
+void MetadataCache::store(const QString &fileName, const QVariantMap &metadata)
+{
+    FileIdentity key;
+    if (!identifyFile(fileName, &key))
+        return;
+    QByteArray bytes = PlaylistStore::encodeMetadata(metadata);
+    QMutexLocker locker(&mutex);
+    open();
+    if (readOnly || !log.isOpen())
+        return;
+    auto it = offsets.constFind(key);
+    if (it != offsets.constEnd()) {
+        // Playing a file tells us the same things every time.
+        if (recordAt(*it) == bytes)
+            return;
+        ++stale;
+    }
+
+    LogEntry entry;
+    entry.magic = entryMagic;
+    entry.size = quint32(bytes.size());
+    entry.key = key;
+    qint64 offset = log.size();
+    bytes.append(QByteArray(int(paddedTo8(bytes.size()) - bytes.size()), '\0'));
+    log.seek(offset);
+    if (log.write(reinterpret_cast<const char *>(&entry), sizeof(entry)) != sizeof(entry)
+            || log.write(bytes) != bytes.size()) {
+        log.resize(offset);
+        return;
+    }
+    log.flush();
+    offsets.insert(key, offset);
+    changed = true;
+}
+
+void MetadataCache::save()
+{
+    QMutexLocker locker(&mutex);
+    if (!opened || readOnly || !log.isOpen())
+        return;
+    if (stale > compactAfter && stale > offsets.count())
+        compact();
+    if (!changed)
+        return;
+
+    LogHeader logHeader;
+    log.seek(0);
+    if (log.read(reinterpret_cast<char *>(&logHeader), sizeof(logHeader)) != sizeof(logHeader))
+        return;
+    IndexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = indexMagic;
+    header.version = version;
+    header.logId = logHeader.id;
+    header.logSize = quint64(log.size());
+    header.count = quint64(offsets.count());
+    header.stale = quint64(stale);
+    QByteArray entries;
+    entries.reserve(offsets.count() * int(sizeof(IndexEntry)));
+    for (auto it = offsets.constBegin(); it != offsets.constEnd(); ++it) {
+        IndexEntry entry;
+        entry.key = it.key();
+        entry.offset = it.value();
+        entries.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+    }
+    QSaveFile file(indexFile());
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(entries);
+    if (file.commit())
+        changed = false;
+}
+
+void MetadataCache::open()
+{
+    // Called with the mutex held.
+    if (opened)
+        return;
+    opened = true;
+
+    log.setFileName(logFile());
+    if (!log.open(readOnly ? QIODevice::ReadOnly : QIODevice::ReadWrite))
+        return;
+    LogHeader logHeader;
+    if (log.read(reinterpret_cast<char *>(&logHeader), sizeof(logHeader)) != sizeof(logHeader)
+            || logHeader.magic != logMagic || logHeader.version != version) {
+        // New, or not something this understands.
+        if (readOnly) {
+            log.close();
+            return;
+        }
+        log.resize(0);
+        log.seek(0);
+        log.write(newLogHeader());
+        log.flush();
+        return;
+    }
+
+    qint64 from = sizeof(LogHeader);
+    QFile index(indexFile());
+    if (index.open(QIODevice::ReadOnly)) {
+        QByteArray bytes = index.readAll();
+        IndexHeader header;
+        if (bytes.size() >= int(sizeof(header))) {
+            std::memcpy(&header, bytes.constData(), sizeof(header));
+            quint64 room = quint64(bytes.size() - int(sizeof(header))) / sizeof(IndexEntry);
+            if (header.magic == indexMagic && header.version == version
+                    && header.logId == logHeader.id
+                    && header.logSize <= quint64(log.size())
+                    && header.count <= room) {
+                auto entries = reinterpret_cast<const IndexEntry *>(bytes.constData()
+                                                                    + sizeof(header));
+                offsets.reserve(int(header.count));
+                for (quint64 i = 0; i < header.count; ++i)
+                    if (entries[i].offset >= from
+                            && quint64(entries[i].offset) < header.logSize)
+                        offsets.insert(entries[i].key, entries[i].offset);
+                from = qint64(header.logSize);
+                stale = qint64(header.stale);
+            }
+        }
+    }
+    replay(from);
+}
+
+void MetadataCache::replay(qint64 from)
+{
+    // Whatever was appended since the index was written.  A write cut short
+    // leaves a partial entry at the end, which goes.
+    qint64 offset = from;
+    qint64 size = log.size();
+    LogEntry entry;
+    while (offset + qint64(sizeof(entry)) <= size) {
+        log.seek(offset);
+        if (log.read(reinterpret_cast<char *>(&entry), sizeof(entry)) != sizeof(entry)
+                || entry.magic != entryMagic)
+            break;
+        qint64 next = offset + qint64(sizeof(entry)) + paddedTo8(entry.size);
+        if (next > size)
+            break;
+        if (offsets.contains(entry.key))
+            ++stale;
+        offsets.insert(entry.key, offset);
+        changed = true;
+        offset = next;
+    }
+    if (offset < size && !readOnly)
+        log.resize(offset);
+}
+
+void MetadataCache::compact()
+{
+    // Called with the mutex held.  The new log is put together in memory,
+    // as the old one has to be closed before it can be replaced.
+    QByteArray compacted = newLogHeader();
+    QHash<FileIdentity, qint64> moved;
+    moved.reserve(offsets.count());
+    for (auto it = offsets.constBegin(); it != offsets.constEnd(); ++it) {
+        QByteArray bytes = recordAt(it.value());
+        LogEntry entry;
+        entry.magic = entryMagic;
+        entry.size = quint32(bytes.size());
+        entry.key = it.key();
+        moved.insert(it.key(), compacted.size());
+        compacted.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+        compacted.append(bytes);
+        compacted.append(QByteArray(int(paddedTo8(bytes.size()) - bytes.size()), '\0'));
+    }
+
+    log.close();
+    QSaveFile file(logFile());
+    bool written = file.open(QIODevice::WriteOnly)
+            && file.write(compacted) == compacted.size()
+            && file.commit();
+    log.open(QIODevice::ReadWrite);
+    if (!written)
+        return;
+    offsets = moved;
+    stale = 0;
+    changed = true;
+}
+
+QByteArray MetadataCache::recordAt(qint64 offset)
+{
+    LogEntry entry;
+    log.seek(offset);
+    if (log.read(reinterpret_cast<char *>(&entry), sizeof(entry)) != sizeof(entry)
+            || entry.magic != entryMagic
+            || offset + qint64(sizeof(entry)) + qint64(entry.size) > log.size())
+        return QByteArray();
+    return log.read(entry.size);
+}
+
+QString MetadataCache::logFile()
+{
+    return QDir(Storage::fetchConfigPath()).absoluteFilePath("metadata.log");
+}
+
+QString MetadataCache::indexFile()
+{
+    return QDir(Storage::fetchConfigPath()).absoluteFilePath("metadata.index");
+}
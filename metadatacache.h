@@ -0,0 +1,78 @@
+#ifndef METADATACACHE_H
+#define METADATACACHE_H
+// What is known about media files, kept across sessions and shared by
+// every playlist, the recent list and favorites.
+//
+// Entries are keyed by a file's identity rather than its path: its device
+// and inode, size and modification time, so that a file renamed or moved
+// on the same disk is still known, and one changed in place is not.  They
+// are appended to a log as they are learnt, superseding any earlier entry
+// for the same file, and an index of where the latest entry for each file
+// starts is written out when the program ends.  Opening reads the index
+// and replays only the part of the log written since, so a lookup is a
+// hash lookup and one read.  Once most of the log is superseded entries it
+// is rewritten with just the latest ones.
+//
+// Lookups and stores may come from any thread.
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+#include <QVariantMap>
+
+struct FileIdentity {
+    quint64 device;
+    quint64 inode;
+    quint64 size;
+    qint64 modified;
+};
+bool operator==(const FileIdentity &a, const FileIdentity &b);
+uint qHash(const FileIdentity &key, uint seed = 0);
+// False if the file is not there or is not a regular file.
+bool identifyFile(const QString &fileName, FileIdentity *id);
+
+class MetadataCache {
+private:
+    MetadataCache();
+    static QSharedPointer<MetadataCache> cache;
+
+public:
+    static const quint32 version = 1;
+
+    ~MetadataCache();
+    static QSharedPointer<MetadataCache> getSingleton();
+
+    // Nothing is written when read only, as when the program is started
+    // without saving data.
+    void setReadOnly(bool yes);
+    bool isReadOnly();
+    // Whether anything at all is known, which callers about to look up a
+    // great many files can check first.
+    bool isEmpty();
+    // Whether the file, as it is now, is known.  What is known may be only
+    // the tags it had when played, without what a probe would find.
+    bool lookup(const QString &fileName, QVariantMap *metadata);
+    void store(const QString &fileName, const QVariantMap &metadata);
+    // Writes the index, first compacting the log if it is mostly stale.
+    void save();
+
+private:
+    void open();
+    void replay(qint64 from);
+    void compact();
+    QByteArray recordAt(qint64 offset);
+    static QString logFile();
+    static QString indexFile();
+
+    QMutex mutex;
+    bool opened = false;
+    bool readOnly = false;
+    QFile log;
+    QHash<FileIdentity, qint64> offsets;
+    qint64 stale = 0;
+    bool changed = false;
+};
+
+#endif // METADATACACHE_H
@@ -138,10 +138,26 @@ SOURCES += main.cpp\
     mpvwidget.cpp \
     mainwindow.cpp \
     playlist.cpp \
+    playliststore.cpp \
+    playlistreader.cpp \
+    directoryscanner.cpp \
+    folderindex.cpp \
+    mediaprobe.cpp \
+    metadatacache.cpp \
+    thumbnailer.cpp \
+    editjournal.cpp \
+    playlistindex.cpp \
+    itempool.cpp \
+    paralleljobs.cpp \
+    playlistsorter.cpp \
+    searchindex.cpp \
+    serialqueue.cpp \
+    shuffleengine.cpp \
     manager.cpp \
     helpers.cpp \
     playlistwindow.cpp \
     storage.cpp \
+    autosaver.cpp \
     settingswindow.cpp \
     ipcjson.cpp \
     openfiledialog.cpp \
@@ -160,11 +176,28 @@ HEADERS  += \
     mpvwidget.h \
     mainwindow.h \
     playlist.h \
+    playliststore.h \
+    playlistreader.h \
+    directoryscanner.h \
+    folderindex.h \
+    mediaprobe.h \
+    metadatacache.h \
+    thumbnailer.h \
+    editjournal.h \
+    playlistindex.h \
+    itempool.h \
+    paralleljobs.h \
+    playlistsorter.h \
+    searchindex.h \
+    serialqueue.h \
+    shardedhash.h \
+    shuffleengine.h \
     manager.h \
     main.h \
     helpers.h \
     playlistwindow.h \
     storage.h \
+    autosaver.h \
     settingswindow.h \
     ipcjson.h \
     openfiledialog.h \
@@ -0,0 +1,55 @@
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <algorithm>
+#include "paralleljobs.h"
+
+class ParallelHelper : public QRunnable {
+public:
+    explicit ParallelHelper(const QSharedPointer<ParallelJobs> &jobs)
+        : jobs(jobs) {}
+    void run() { jobs->work(); }
+
+private:
+    QSharedPointer<ParallelJobs> jobs;
+};
+
+
+
+ParallelJobs::ParallelJobs(int count, const std::function<void(int)> &job)
+    : count(count), job(job)
+{
+
+}
+
+void ParallelJobs::work()
+{
+    int index;
+    while ((index = next.fetchAndAddRelaxed(1)) < count) {
+        job(index);
+        QMutexLocker locker(&mutex);
+        if (++finished == count)
+            allDone.wakeAll();
+    }
+}
+
+void ParallelJobs::wait()
+{
+    QMutexLocker locker(&mutex);
+    while (finished < count)
+        allDone.wait(&mutex);
+}
+
+void ParallelJobs::run(int count, const std::function<void(int)> &job)
+{
+    // Helpers that only get going once everything is done find nothing
+    // left to claim, and never touch the job.
+    QSharedPointer<ParallelJobs> jobs(new ParallelJobs(count, job));
+    int helpers = std::min(count - 1,
+                           QThreadPool::globalInstance()->maxThreadCount());
+    for (int i = 0; i < helpers; ++i)
+        QThreadPool::globalInstance()->start(new ParallelHelper(jobs));
+    jobs->work();
+    jobs->wait();
+}
@@ -0,0 +1,33 @@
+#ifndef PARALLELJOBS_H
+#define PARALLELJOBS_H
+// Runs a number of independent jobs on the global thread pool, with the
+// calling thread taking its share, and waits for all of them.  Since the
+// caller works through the jobs as well, a busy pool only slows this down,
+// and it is safe to call from a pool thread.
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QWaitCondition>
+#include <functional>
+
+class ParallelJobs {
+public:
+    ParallelJobs(int count, const std::function<void(int)> &job);
+
+    void work();
+    void wait();
+
+    static void run(int count, const std::function<void(int)> &job);
+
+private:
+    Q_DISABLE_COPY(ParallelJobs)
+
+    const int count;
+    const std::function<void(int)> job;
+    QAtomicInt next;
+    int finished = 0;
+    QMutex mutex;
+    QWaitCondition allDone;
+};
+
+#endif // PARALLELJOBS_H
@@ -1,27 +1,121 @@
-#include <QFileInfo>
-#include <QMutableListIterator>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <algorithm>
 #include <cmath>
 #include "playlist.h"
+#include "itempool.h"
+#include "paralleljobs.h"
+#include "playliststore.h"
+
+// Metadata whose values tend to repeat across a library, and so are worth
+// interning.  Keys are always interned.
+static const QSet<QString> sharedMetadataKeys = {
+    "album", "album_artist", "artist", "composer", "date", "genre",
+    "performer", "year"
+};
+
+// Serializes the naming of items, so that an item asked for its uuid by two
+// threads at once still only gets the one.
+static QMutex itemNamingLock;
+
+// Serializes reading an item's metadata with decoding or replacing it.  The
+// locks are striped by address, so that threads reading different items,
+// as the searcher, the sorter and the probe do, rarely wait on each other.
+static QMutex itemMetadataLocks[64];
+
+static QMutex *metadataLockOf(const Item *item)
+{
+    return &itemMetadataLocks[qHash(item) % 64];
+}
+
+static QVariantMap internedMetadata(const QVariantMap &qvm)
+{
+    QVariantMap interned;
+    for (auto it = qvm.constBegin(); it != qvm.constEnd(); ++it) {
+        QString key = StringPool::intern(it.key());
+        const QVariant &value = it.value();
+        if (value.type() == QVariant::String
+                && sharedMetadataKeys.contains(key.toLower()))
+            interned.insert(key, StringPool::intern(value.toString()));
+        else
+            interned.insert(key, value);
+    }
+    return interned;
+}
+
+// The journal step for items which went into a list as one run.
+static EditJournal::Step insertedStep(int index,
+                                      const QList<ItemPointer> &inserted)
+{
+    EditJournal::Step step;
+    step.kind = EditJournal::Step::Inserted;
+    step.positions.reserve(inserted.count());
+    step.items.reserve(inserted.count());
+    for (const ItemPointer &item : inserted) {
+        step.positions.append(index++);
+        step.items.append(item);
+    }
+    return step;
+}
+
+static EditJournal::Step removedStep(const QVector<int> &positions,
+                                     const QVector<ItemPointer> &removed)
+{
+    EditJournal::Step step;
+    step.kind = EditJournal::Step::Removed;
+    step.positions = positions;
+    step.items = removed;
+    return step;
+}
 
 Item::Item(QUrl url)
 {
-    static int globalCounter = 0;
+    static QAtomicInt globalCounter;
+    static QAtomicInteger<quint64> globalId;
+    id_ = globalId.fetchAndAddRelaxed(1) + 1;
     setUrl(url);
-    setUuid(QUuid::createUuid());
-    setOriginalPosition(globalCounter++);   // Preserve order on first restore
-    setQueuePosition(0);
+    setOriginalPosition(globalCounter.fetchAndAddRelaxed(1));   // Preserve order on first restore
     setExtraPlayTimes(0);
-    setHidden(false);
+}
+
+Item::~Item()
+{
+    delete uuid_.loadAcquire();
+}
+
+void *Item::operator new(size_t size)
+{
+    return ItemPool::allocate(size);
+}
+
+void Item::operator delete(void *p, size_t size)
+{
+    ItemPool::release(p, size);
+}
+
+quint64 Item::id() const
+{
+    return id_;
 }
 
 QUuid Item::uuid() const
 {
-    return uuid_;
+    if (!uuid_.loadAcquire())
+        assignUuid(QUuid());
+    return *uuid_.loadAcquire();
 }
 
 void Item::setUuid(const QUuid &uuid)
 {
-    uuid_ = uuid;
+    assignUuid(uuid.isNull() ? QUuid::createUuid() : uuid);
+}
+
+bool Item::hasUuid(const QUuid &uuid) const
+{
+    const QUuid *named = uuid_.loadAcquire();
+    return named && *named == uuid;
 }
 
 QUuid Item::playlistUuid() const
@@ -36,22 +130,42 @@ void Item::setPlaylistUuid(const QUuid &uuid)
 
 QUrl Item::url() const
 {
-    return url_;
+    if (localFile_)
+        return QUrl::fromLocalFile(urlPrefix_ + urlName_);
+    return QUrl::fromEncoded((urlPrefix_ + urlName_).toUtf8());
 }
 
 void Item::setUrl(const QUrl &url)
 {
-    url_ = url;
+    // Files share their directory with their neighbours, and streams from
+    // one site share everything up to the last slash, so the part up to and
+    // including the last slash is interned.
+    localFile_ = url.isLocalFile();
+    QString location = localFile_ ? url.toLocalFile()
+                                  : QString::fromUtf8(url.toEncoded());
+    int slash = location.lastIndexOf('/');
+    urlPrefix_ = StringPool::intern(location.left(slash + 1));
+    urlName_ = location.mid(slash + 1);
+    touch();
 }
 
 QVariantMap Item::metadata() const
 {
+    QMutexLocker locker(metadataLockOf(this));
+    if (metadataImage_)
+        decodeMetadata();
     return metadata_;
 }
 
 void Item::setMetadata(const QVariantMap &qvm)
 {
-    metadata_ = qvm;
+    QVariantMap interned = internedMetadata(qvm);
+    {
+        QMutexLocker locker(metadataLockOf(this));
+        metadata_ = interned;
+        metadataImage_.reset();
+    }
+    touch();
 }
 
 int Item::originalPosition()
@@ -64,22 +178,6 @@ void Item::setOriginalPosition(int i)
     originalPosition_ = i;
 }
 
-int Item::queuePosition() const
-{
-    return queuePosition_;
-}
-
-void Item::setQueuePosition(int num)
-{
-    queuePosition_ = num;
-}
-
-void Item::decQueuePosition()
-{
-    if (queuePosition_ > 0)
-        queuePosition_--;
-}
-
 int Item::extraPlayTimes() const
 {
     return extraPlayTimes_;
@@ -100,48 +198,97 @@ int Item::decExtraPlayTimes()
     return extraPlayTimes_ > 0 ? --extraPlayTimes_ : 0;
 }
 
-void Item::setHidden(bool yes)
-{
-    hidden_ = yes;
-}
-
-bool Item::hidden()
-{
-    return hidden_;
-}
-
 QString Item::toDisplayString() const
 {
-    if (url().isLocalFile())
-        return QFileInfo(url().toLocalFile()).completeBaseName();
+    if (localFile_) {
+        // The file name without its last suffix, as completeBaseName gives.
+        int dot = urlName_.lastIndexOf('.');
+        return dot < 0 ? urlName_ : urlName_.left(dot);
+    }
     return url().toDisplayString(QUrl::FullyDecoded);
 }
 
 QString Item::toString() const
 {
-    return url_.isLocalFile() ? url_.toLocalFile() : url_.url();
+    return localFile_ ? urlPrefix_ + urlName_ : url().url();
 }
 
 void Item::fromString(QString input)
 {
-    setUuid(QUuid::createUuid());
     setUrl(QUrl::fromUserInput(input));
 }
 
 QVariantMap Item::toVMap() const
 {
+    // Items nothing has referred to by uuid are saved without one, and
+    // stay nameless when they are loaded again.
     QVariantMap v;
     v.insert("url", url());
-    v.insert("uuid", uuid());
+    if (const QUuid *named = uuid_.loadAcquire())
+        v.insert("uuid", *named);
     v.insert("metadata", metadata());
     return v;
 }
 
 void Item::fromVMap(const QVariantMap &qvm)
 {
-    url_ = qvm.contains("url") ? qvm.value("url").toUrl() : QUrl();
-    uuid_ = qvm.contains("uuid") ? qvm.value("uuid").toUuid() : QUuid::createUuid();
-    metadata_ = qvm.contains("metadata") ? qvm.value("metadata").toMap() : QVariantMap();
+    setUrl(qvm.contains("url") ? qvm.value("url").toUrl() : QUrl());
+    QUuid uuid = qvm.value("uuid").toUuid();
+    if (!uuid.isNull())
+        setUuid(uuid);
+    setMetadata(qvm.contains("metadata") ? qvm.value("metadata").toMap() : QVariantMap());
+}
+
+int Item::revision() const
+{
+    return revision_;
+}
+
+void Item::touch()
+{
+    static QAtomicInt globalRevision;
+    revision_ = globalRevision.fetchAndAddRelaxed(1) + 1;
+}
+
+void Item::decodeMetadata() const
+{
+    metadata_ = internedMetadata(PlaylistStore::decodeMetadata(
+            metadataImage_->data() + metadataOffset_, int(metadataSize_)));
+    // Letting go of the file once the last of its items has done so.
+    metadataImage_.reset();
+}
+
+QByteArray Item::encodedMetadata() const
+{
+    QMutexLocker locker(metadataLockOf(this));
+    if (metadataImage_)
+        return QByteArray(metadataImage_->data() + metadataOffset_,
+                          int(metadataSize_));
+    return PlaylistStore::encodeMetadata(metadata_);
+}
+
+void Item::assignUuid(const QUuid &uuid) const
+{
+    {
+        // The first uuid given is kept, as it is read without the lock from
+        // other threads.  A null uuid asks for a fresh one.  Only items in
+        // the collection are found by uuid; one named before it is stored
+        // is entered then.
+        QMutexLocker locker(&itemNamingLock);
+        if (uuid_.load())
+            return;
+        QUuid *named = new QUuid(uuid.isNull() ? QUuid::createUuid() : uuid);
+        uuid_.storeRelease(named);
+        auto collection = ItemCollection::getSingleton();
+        if (collection->items.contains(id_))
+            collection->idsByUuid.insert(*named, id_);
+    }
+    // A named item is saved with its uuid, so its playlist has changed.
+    // A playlist still being loaded is saved as it is loaded, and cannot be
+    // asked for without loading it a second time.
+    auto playlist = PlaylistCollection::getSingleton()->playlistIfLoaded(playlistUuid_);
+    if (playlist)
+        playlist->touch();
 }
 
 QSharedPointer<ItemCollection> ItemCollection::collection;
@@ -163,34 +310,113 @@ QSharedPointer<ItemCollection> ItemCollection::getSingleton()
     return collection;
 }
 
-QSharedPointer<Item> ItemCollection::addItem(const QUrl url)
+ItemPointer ItemCollection::addItem(const QUrl url)
 {
-    auto item = QSharedPointer<Item>::create(url);
-    items.insert(item->uuid(), item);
+    ItemPointer item(new Item(url));
+    items.insert(item->id(), item);
     return item;
 }
 
-QSharedPointer<Item> ItemCollection::addItem(const QUuid &itemUuid, const QUrl &url)
+ItemPointer ItemCollection::addItem(const QUuid &itemUuid, const QUrl &url)
 {
-    QSharedPointer<Item> item(new Item(url));
+    ItemPointer item(new Item(url));
+    items.insert(item->id(), item);
     item->setUuid(itemUuid);
-    items.insert(item->uuid(), item);
     return item;
 }
 
-QSharedPointer<Item> ItemCollection::itemOf(const QUuid &itemUuid)
+ItemPointer ItemCollection::itemOf(quint64 itemId)
+{
+    return items.value(itemId);
+}
+
+ItemPointer ItemCollection::itemOf(const QUuid &itemUuid)
+{
+    return items.value(idOf(itemUuid));
+}
+
+quint64 ItemCollection::idOf(const QUuid &itemUuid)
+{
+    return idsByUuid.value(itemUuid, 0);
+}
+
+QList<quint64> ItemCollection::idsOf(const QList<QUuid> &itemUuids)
+{
+    QList<quint64> ids;
+    ids.reserve(itemUuids.count());
+    for (const QUuid &uuid : itemUuids)
+        ids.append(idsByUuid.value(uuid, 0));
+    return ids;
+}
+
+void ItemCollection::removeItem(quint64 itemId)
+{
+    ItemPointer item = items.take(itemId);
+    if (!item)
+        return;
+    QMutexLocker locker(&itemNamingLock);
+    if (const QUuid *named = item->uuid_.load())
+        idsByUuid.remove(*named);
+}
+
+void ItemCollection::storeItem(const ItemPointer &item)
+{
+    items.insert(item->id(), item);
+    // An item brought back, as by undo, answers to its uuid again.
+    QMutexLocker locker(&itemNamingLock);
+    if (const QUuid *named = item->uuid_.load())
+        idsByUuid.insert(*named, item->id());
+}
+
+
+
+int PlaylistSnapshot::version() const
+{
+    return version_;
+}
+
+QUuid PlaylistSnapshot::uuid() const
 {
-    return items.value(itemUuid, QSharedPointer<Item>());
+    return uuid_;
 }
 
-void ItemCollection::removeItem(const QUuid &itemUuid)
+QString PlaylistSnapshot::title() const
 {
-    items.remove(itemUuid);
+    return title_;
 }
 
-void ItemCollection::storeItem(const QSharedPointer<Item> &item)
+int PlaylistSnapshot::count() const
 {
-    items.insert(item->uuid(), item);
+    return items_.count();
+}
+
+bool PlaylistSnapshot::isEmpty() const
+{
+    return items_.isEmpty();
+}
+
+ItemPointer PlaylistSnapshot::itemAt(int index) const
+{
+    return items_.value(index);
+}
+
+const QVector<ItemPointer> &PlaylistSnapshot::items() const
+{
+    return items_;
+}
+
+
+
+Playlist::WriteLocker::WriteLocker(Playlist *list)
+    : list(list), locker(&list->listLock)
+{
+
+}
+
+Playlist::WriteLocker::~WriteLocker()
+{
+    list->journal.commit();
+    list->version_.ref();
 }
 
 
@@ -207,95 +433,130 @@ Playlist::~Playlist()
     items.clear();
 }
 
-QSharedPointer<Item> Playlist::addItem(const QUrl &url)
+ItemPointer Playlist::addItem(const QUrl &url)
 {
-    QWriteLocker locker(&listLock);
-    QSharedPointer<Item> i(ItemCollection::getSingleton()->addItem(url));
+    WriteLocker locker(this);
+    ItemPointer i(ItemCollection::getSingleton()->addItem(url));
     i->setPlaylistUuid(uuid_);
     items.append(i);
-    itemsByUuid.insert(i->uuid(), i);
+    itemsById.insert(i->id(), i);
+    searchIndex.insert(i);
+    shuffler.insert(i);
+    journal.record(insertedStep(items.count() - 1, { i }));
     return i;
 }
 
-QSharedPointer<Item> Playlist::addItem(const QUuid &uuid, const QUrl &url)
+ItemPointer Playlist::addItem(const QUuid &uuid, const QUrl &url)
 {
-    QWriteLocker locker(&listLock);
-    QSharedPointer<Item> i(ItemCollection::getSingleton()->addItem(uuid, url));
+    WriteLocker locker(this);
+    ItemPointer i(ItemCollection::getSingleton()->addItem(uuid, url));
     i->setPlaylistUuid(uuid_);
-    i->setUrl(url);
-    i->setUuid(uuid);
     items.append(i);
-    itemsByUuid.insert(uuid, i);
+    itemsById.insert(i->id(), i);
+    searchIndex.insert(i);
+    shuffler.insert(i);
+    journal.record(insertedStep(items.count() - 1, { i }));
     return i;
 }
 
-QSharedPointer<Item> Playlist::addItemClone(const QSharedPointer<Item> &item)
+ItemPointer Playlist::addItemClone(const ItemPointer &item)
 {
-    QSharedPointer<Item> i = addItem(item->url());
+    ItemPointer i = addItem(item->url());
     i->setPlaylistUuid(uuid_);
     i->setMetadata(item->metadata());
+    searchIndex.refresh(i);
     return i;
 }
 
-void Playlist::addItemRaw(const QSharedPointer<Item> &item)
+void Playlist::addItemRaw(const ItemPointer &item)
 {
-    QWriteLocker locker(&listLock);
+    WriteLocker locker(this);
     items.append(item);
-    itemsByUuid.insert(item->uuid(), item);
+    itemsById.insert(item->id(), item);
+    searchIndex.insert(item);
+    shuffler.insert(item);
+    journal.record(insertedStep(items.count() - 1, { item }));
 }
 
-QSharedPointer<Item> Playlist::itemAt(int index)
+ItemPointer Playlist::itemAt(int index)
 {
     QReadLocker locker(&listLock);
     if (index < 0 || index >= items.count())
-        return QSharedPointer<Item>();
+        return ItemPointer();
     return items.value(index);
 }
 
-QSharedPointer<Item> Playlist::itemOf(const QUuid &uuid)
+ItemPointer Playlist::itemOf(quint64 id)
 {
     QReadLocker locker(&listLock);
-    return itemsByUuid.value(uuid, QSharedPointer<Item>());
+    return itemsById.value(id);
 }
 
-QSharedPointer<Item> Playlist::itemAfter(const QUuid &uuid)
+ItemPointer Playlist::itemOf(const QUuid &uuid)
 {
+    return itemOf(ItemCollection::getSingleton()->idOf(uuid));
+}
+
+ItemPointer Playlist::itemAfter(const QUuid &uuid)
+{
+    quint64 id = ItemCollection::getSingleton()->idOf(uuid);
     QReadLocker locker(&listLock);
-    if (!itemsByUuid.contains(uuid))
-        return QSharedPointer<Item>();
-    int index = items.indexOf(itemsByUuid[uuid]);
-    if (index < 0 || index + 1 >= items.length())
-        return QSharedPointer<Item>();
-    return items[index + 1];
+    return items.after(itemsById.value(id));
 }
 
-QSharedPointer<Item> Playlist::itemBefore(const QUuid &uuid)
+ItemPointer Playlist::itemBefore(const QUuid &uuid)
 {
+    quint64 id = ItemCollection::getSingleton()->idOf(uuid);
     QReadLocker locker(&listLock);
-    if (!itemsByUuid.contains(uuid))
-        return QSharedPointer<Item>();
-    int index = items.indexOf(itemsByUuid[uuid]);
-    if (index <= 0)
-        return QSharedPointer<Item>();
-    return items[index - 1];
+    return items.before(itemsById.value(id));
+}
+
+ItemPointer Playlist::shuffledItemAfter(const QUuid &uuid)
+{
+    quint64 id = ItemCollection::getSingleton()->idOf(uuid);
+    // Drawing moves the shuffle along, so it is a write, even if the
+    // order of the playlist is left alone.
+    QWriteLocker locker(&listLock);
+    if (!itemsById.contains(id))
+        id = 0;
+    touch();
+    return shuffler.next(items, itemsById, id);
+}
+
+ItemPointer Playlist::shuffledItemBefore(const QUuid &uuid)
+{
+    quint64 id = ItemCollection::getSingleton()->idOf(uuid);
+    // A write, as above.
+    QWriteLocker locker(&listLock);
+    if (!itemsById.contains(id))
+        id = 0;
+    touch();
+    return shuffler.previous(itemsById, id);
 }
 
-QSharedPointer<Item> Playlist::itemFirst()
+ItemPointer Playlist::itemFirst()
 {
     QReadLocker locker(&listLock);
     if (items.isEmpty())
-        return QSharedPointer<Item>();
+        return ItemPointer();
     return items.first();
 }
 
-QSharedPointer<Item> Playlist::itemLast()
+ItemPointer Playlist::itemLast()
 {
     QReadLocker locker(&listLock);
     if (items.isEmpty())
-        return QSharedPointer<Item>();
+        return ItemPointer();
     return items.last();
 }
 
+int Playlist::indexOf(const QUuid &uuid)
+{
+    quint64 id = ItemCollection::getSingleton()->idOf(uuid);
+    QReadLocker locker(&listLock);
+    return items.indexOf(itemsById.value(id));
+}
+
 int Playlist::count()
 {
     QReadLocker lock(&listLock);
@@ -310,11 +571,12 @@ bool Playlist::isEmpty()
 
 bool Playlist::contains(const QUuid &uuid)
 {
+    quint64 id = ItemCollection::getSingleton()->idOf(uuid);
     QReadLocker lock(&listLock);
-    return itemsByUuid.contains(uuid);
+    return itemsById.contains(id);
 }
 
-void Playlist::iterateItems(const std::function<void(QSharedPointer<Item>)> &callback)
+void Playlist::iterateItems(const std::function<void(ItemPointer)> &callback)
 {
     QReadLocker locker(&listLock);
     for (auto &item : items)
@@ -322,67 +584,399 @@ void Playlist::iterateItems(const std::function<void(QSharedPointer<Item>)> &cal
 }
 
 void Playlist::addItems(const QUuid &where,
-                        const QList<QSharedPointer<Item>> &itemsToAdd)
+                        const QList<ItemPointer> &itemsToAdd)
 {
-    QWriteLocker locker(&listLock);
+    quint64 whereId = ItemCollection::getSingleton()->idOf(where);
+    WriteLocker locker(this);
 
-    int indexWhere = items.indexOf(itemsByUuid[where]);
+    int indexWhere = items.indexOf(itemsById.value(whereId));
     if (indexWhere < 0)
         indexWhere = items.size();
-    for (int i = 0; i < itemsToAdd.count(); ++i) {
-        QSharedPointer<Item> item = itemsToAdd.at(i);
-        item->setPlaylistUuid(uuid_);
-        items.insert(indexWhere + i, item);
-        itemsByUuid.insert(item->uuid(), item);
-    }
+    insertMany_(indexWhere, itemsToAdd);
 }
 
 void Playlist::removeItem(const QUuid &uuid)
 {
-    QWriteLocker locker(&listLock);
-    PlaylistCollection::getSingleton()->queuePlaylist()->removeItem(uuid);
-    items.removeAll(itemsByUuid.take(uuid));
-    ItemCollection::getSingleton()->removeItem(uuid);
+    quint64 id = ItemCollection::getSingleton()->idOf(uuid);
+    WriteLocker locker(this);
+    ItemPointer item = itemsById.value(id);
+    if (!item)
+        return;
+    QVector<int> positions { items.indexOf(item) };
+    journal.record(removedStep(positions, discard_(positions)));
 }
 
-void Playlist::takeItemsRaw(const QList<QSharedPointer<Item>> &itemsToRemove)
+void Playlist::takeItemsRaw(const QList<ItemPointer> &itemsToRemove)
 {
     // "takeItemsRaw", because we don't check if it's in a queue or whatever,
     // it's just taken raw, potentially damaging everything.  Only use if you
     // may know what you're doing.
-    for (const QSharedPointer<Item> &item: itemsToRemove) {
-        itemsByUuid.remove(item->uuid());
-        items.removeAll(item);
+    WriteLocker locker(this);
+    for (const ItemPointer &item: itemsToRemove) {
+        itemsById.remove(item->id());
+        items.removeOne(item);
+    }
+    searchIndex.remove(itemsToRemove);
+    shuffler.remove(itemsToRemove);
+    // Wherever the items went, undoing this could not bring them back.
+    journal.reset();
+}
+
+void Playlist::insertMany(int index,
+                          const QList<ItemPointer> &itemsToAdd)
+{
+    WriteLocker locker(this);
+    insertMany_(index, itemsToAdd);
+}
+
+void Playlist::moveRange(int from, int count, int to)
+{
+    WriteLocker locker(this);
+    int total = items.count();
+    if (from < 0 || count <= 0 || from + count > total)
+        return;
+    to = qBound(0, to, total - count);
+    if (to == from)
+        return;
+    items.moveRange(from, count, to);
+
+    EditJournal::Step step;
+    step.kind = EditJournal::Step::Moved;
+    step.from = from;
+    step.count = count;
+    step.to = to;
+    journal.record(step);
+}
+
+void Playlist::removeMany(const QList<int> &indices)
+{
+    WriteLocker locker(this);
+    QVector<int> positions;
+    positions.reserve(indices.count());
+    for (int index : indices)
+        if (index >= 0 && index < items.count())
+            positions.append(index);
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()),
+                    positions.end());
+    if (positions.isEmpty())
+        return;
+    journal.record(removedStep(positions, discard_(positions)));
+}
+
+void Playlist::removeMany(const QVector<ItemPointer> &itemsToRemove)
+{
+    WriteLocker locker(this);
+    QVector<int> positions;
+    positions.reserve(itemsToRemove.count());
+    for (const ItemPointer &item : itemsToRemove) {
+        int index = items.indexOf(item.data());
+        if (index >= 0)
+            positions.append(index);
+    }
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()),
+                    positions.end());
+    if (positions.isEmpty())
+        return;
+    journal.record(removedStep(positions, discard_(positions)));
+}
+
+bool Playlist::reorder(const QVector<int> &permutation, int version)
+{
+    WriteLocker locker(this);
+    if (version >= 0 && version != version_.load())
+        return false;
+    if (!items.reorder(permutation))
+        return false;
+
+    EditJournal::Step step;
+    step.kind = EditJournal::Step::Reordered;
+    step.permutation = permutation;
+    journal.record(step);
+    return true;
+}
+
+void Playlist::moveItems(const QList<ItemPointer> &itemsToMove,
+                         const ItemPointer &before)
+{
+    // Moved one at a time, so that each move is journalled as a small step
+    // rather than as a new order for the whole list.
+    WriteLocker locker(this);
+    for (const ItemPointer &item : itemsToMove) {
+        int from = items.indexOf(item);
+        if (from < 0 || item == before)
+            continue;
+        int to = before ? items.indexOf(before) : -1;
+        if (to < 0)
+            to = items.count() - 1;
+        else if (to > from)
+            --to;
+        if (to == from)
+            continue;
+        items.moveRange(from, 1, to);
+
+        EditJournal::Step step;
+        step.kind = EditJournal::Step::Moved;
+        step.from = from;
+        step.count = 1;
+        step.to = to;
+        journal.record(step);
     }
 }
 
 QList<QUuid> Playlist::replaceItem(const QUuid &where, const QList<QUrl> &urls)
 {
-    QWriteLocker lock(&listLock);
-    if (!itemsByUuid.contains(where))
+    quint64 whereId = ItemCollection::getSingleton()->idOf(where);
+    WriteLocker lock(this);
+    ItemPointer replaced = itemsById.value(whereId);
+    if (!replaced)
         return QList<QUuid>();
 
-    itemsByUuid[where]->setUrl(urls[0]);
+    replaced->setUrl(urls[0]);
+    searchIndex.refresh(replaced);
 
     QList<QUuid> addedItems;
     // essentially insertAfter(where, urls[1..end]);
-    int insertIndex = items.indexOf(itemsByUuid[where]);
+    int insertIndex = items.indexOf(replaced);
+    QList<ItemPointer> newItems;
+    auto collection = ItemCollection::getSingleton();
     for (int urlIndex = 1; urlIndex < urls.count(); urlIndex++) {
-        QSharedPointer<Item> i(new Item(urls[urlIndex]));
+        ItemPointer i(collection->addItem(urls[urlIndex]));
         i->setPlaylistUuid(uuid_);
-        items.insert(insertIndex + urlIndex, i);
-        itemsByUuid.insert(i->uuid(), i);
+        newItems.append(i);
+        itemsById.insert(i->id(), i);
         addedItems.append(i->uuid());
     }
+    items.insert(insertIndex + 1, newItems);
+    searchIndex.insert(newItems);
+    shuffler.insert(newItems);
+    // Playback expanding an item is not an edit to take back, and the
+    // journal's positions no longer hold after it.
+    if (!newItems.isEmpty())
+        journal.reset();
     return addedItems;
 }
 
 void Playlist::clear()
 {
-    QWriteLocker locker(&listLock);
-    PlaylistCollection::getSingleton()->queuePlaylist()->removeItems(itemsByUuid.keys());
+    // The items leave the collection and the queue as with any removal, and
+    // come back should the clear be undone.
+    WriteLocker locker(this);
+    QVector<ItemPointer> discarded = items.toList().toVector();
+    journalClear_();
     items.clear();
-    itemsByUuid.clear();
+    itemsById.clear();
+    searchIndex.clear();
+    shuffler.clear();
+    itemsDiscarded_(discarded);
+}
+
+void Playlist::insertMany_(int index,
+                           const QList<ItemPointer> &itemsToAdd)
+{
+    itemsById.reserve(itemsById.size() + itemsToAdd.count());
+    for (const ItemPointer &item : itemsToAdd) {
+        item->setPlaylistUuid(uuid_);
+        itemsById.insert(item->id(), item);
+    }
+    int before = items.count();
+    index = qBound(0, index, before);
+    items.insert(index, itemsToAdd);
+    searchIndex.insert(itemsToAdd);
+    shuffler.insert(itemsToAdd);
+    // Items already in the list are moved rather than inserted, which the
+    // journal is not told the details of.
+    if (items.count() == before + itemsToAdd.count())
+        journal.record(insertedStep(index, itemsToAdd));
+    else
+        journal.reset();
+}
+
+void Playlist::restore_(const QVector<int> &positions,
+                        const QVector<ItemPointer> &restored)
+{
+    // The positions ascend, so putting the items back in order lands each
+    // one where it was.  Consecutive positions go back as one run.
+    int i = 0;
+    while (i < positions.count()) {
+        int first = i;
+        QList<ItemPointer> run;
+        do {
+            run.append(restored[i]);
+            ++i;
+        } while (i < positions.count() && positions[i] == positions[i - 1] + 1);
+        items.insert(positions[first], run);
+    }
+    QList<ItemPointer> list = restored.toList();
+    for (const ItemPointer &item : list)
+        itemsById.insert(item->id(), item);
+    searchIndex.insert(list);
+    shuffler.insert(list);
+    itemsRestored_(restored);
+}
+
+QVector<ItemPointer> Playlist::discard_(const QVector<int> &positions)
+{
+    // Taking items one by one costs a walk down the tree each, removeMany a
+    // pass over the whole list; pick whichever is less.
+    QVector<ItemPointer> discarded;
+    if (positions.count() > items.count() / 16) {
+        discarded = items.removeMany(positions.toList()).toVector();
+    } else {
+        discarded.resize(positions.count());
+        for (int i = positions.count() - 1; i >= 0; --i)
+            discarded[i] = items.takeAt(positions[i]);
+    }
+    QList<ItemPointer> list = discarded.toList();
+    for (const ItemPointer &item : list)
+        itemsById.remove(item->id());
+    searchIndex.remove(list);
+    shuffler.remove(list);
+    itemsDiscarded_(discarded);
+    return discarded;
+}
+
+void Playlist::adopt_(const QList<ItemPointer> &newItems,
+                      const QVariantMap &shuffleState)
+{
+    auto collection = ItemCollection::getSingleton();
+    for (const ItemPointer &i : newItems) {
+        itemsById.insert(i->id(), i);
+        collection->storeItem(i);
+    }
+    items.insert(items.count(), newItems);
+    searchIndex.insert(newItems);
+    if (shuffle_)
+        shuffler.fromVMap(shuffleState, newItems);
+    journal.reset();
+}
+
+void Playlist::journalClear_()
+{
+    // The tree itself goes into the journal, leaving the list empty, so
+    // that clearing costs the same to record however long the list is.
+    if (items.isEmpty())
+        return;
+    EditJournal::Step step;
+    step.kind = EditJournal::Step::Cleared;
+    step.count = items.count();
+    step.cleared = QSharedPointer<PlaylistIndex>(new PlaylistIndex());
+    step.cleared->swap(items);
+    journal.record(step);
+}
+
+void Playlist::apply_(const EditJournal::Step &step, bool forwards)
+{
+    switch (step.kind) {
+    case EditJournal::Step::Inserted:
+    case EditJournal::Step::Removed:
+        if (forwards == (step.kind == EditJournal::Step::Inserted))
+            restore_(step.positions, step.items);
+        else
+            discard_(step.positions);
+        break;
+    case EditJournal::Step::Moved:
+        if (forwards)
+            items.moveRange(step.from, step.count, step.to);
+        else
+            items.moveRange(step.to, step.count, step.from);
+        break;
+    case EditJournal::Step::Reordered:
+        if (forwards) {
+            items.reorder(step.permutation);
+        } else {
+            QVector<int> inverse(step.permutation.count());
+            for (int index = 0; index < step.permutation.count(); ++index)
+                inverse[step.permutation[index]] = index;
+            items.reorder(inverse);
+        }
+        break;
+    case EditJournal::Step::Cleared:
+        if (forwards) {
+            QVector<ItemPointer> discarded = items.toList().toVector();
+            items.swap(*step.cleared);
+            itemsById.clear();
+            searchIndex.clear();
+            shuffler.clear();
+            itemsDiscarded_(discarded);
+        } else {
+            items.swap(*step.cleared);
+            QList<ItemPointer> list = items.toList();
+            itemsById.reserve(list.count());
+            for (const ItemPointer &item : list)
+                itemsById.insert(item->id(), item);
+            searchIndex.insert(list);
+            shuffler.insert(list);
+            itemsRestored_(list.toVector());
+        }
+        break;
+    }
+}
+
+void Playlist::itemsDiscarded_(const QVector<ItemPointer> &discarded)
+{
+    PlaylistCollection::getSingleton()->queuePlaylist()->forgetItems(discarded);
+    for (const ItemPointer &item : discarded)
+        ItemCollection::getSingleton()->removeItem(item->id());
+}
+
+void Playlist::itemsRestored_(const QVector<ItemPointer> &restored)
+{
+    for (const ItemPointer &item : restored)
+        ItemCollection::getSingleton()->storeItem(item);
+}
+
+bool Playlist::undo()
+{
+    WriteLocker locker(this);
+    if (!journal.canUndo())
+        return false;
+    EditJournal::Edit edit = journal.takeUndo();
+    for (int i = edit.count() - 1; i >= 0; --i)
+        apply_(edit[i], false);
+    return true;
+}
+
+bool Playlist::redo()
+{
+    WriteLocker locker(this);
+    if (!journal.canRedo())
+        return false;
+    EditJournal::Edit edit = journal.takeRedo();
+    for (const EditJournal::Step &step : edit)
+        apply_(step, true);
+    return true;
+}
+
+bool Playlist::canUndo()
+{
+    QReadLocker locker(&listLock);
+    return journal.canUndo();
+}
+
+bool Playlist::canRedo()
+{
+    QReadLocker locker(&listLock);
+    return journal.canRedo();
+}
+
+void Playlist::clearUndoHistory()
+{
+    QWriteLocker locker(&listLock);
+    journal.reset();
+}
+
+void Playlist::openUndoGroup()
+{
+    QWriteLocker locker(&listLock);
+    journal.open();
+}
+
+void Playlist::closeUndoGroup()
+{
+    QWriteLocker locker(&listLock);
+    journal.close();
 }
 
 QString Playlist::title()
@@ -393,18 +987,24 @@ QString Playlist::title()
 
 void Playlist::setTitle(const QString &title)
 {
-    QWriteLocker locker(&listLock);
+    WriteLocker locker(this);
     title_ = title;
 }
 
 bool Playlist::shuffle()
 {
+    QReadLocker locker(&listLock);
     return shuffle_;
 }
 
 void Playlist::setShuffle(bool shuffling)
 {
+    // Turning shuffle back on starts a fresh run.
+    QWriteLocker locker(&listLock);
+    if (shuffling != shuffle_)
+        shuffler.clear();
     shuffle_ = shuffling;
+    touch();
 }
 
 QUuid Playlist::uuid()
@@ -415,7 +1015,7 @@ QUuid Playlist::uuid()
 
 void Playlist::setUuid(const QUuid &uuid)
 {
-    QWriteLocker locker(&listLock);
+    WriteLocker locker(this);
     uuid_ = uuid;
 }
 
@@ -430,24 +1030,35 @@ QStringList Playlist::toStringList()
 
 void Playlist::fromStringList(QStringList sl)
 {
-    QWriteLocker locker(&listLock);
+    WriteLocker locker(this);
+    QVector<ItemPointer> discarded = items.toList().toVector();
     items.clear();
-    itemsByUuid.clear();
+    itemsById.clear();
+    searchIndex.clear();
+    shuffler.clear();
+    itemsDiscarded_(discarded);
+    QList<ItemPointer> newItems;
+    auto collection = ItemCollection::getSingleton();
     for (QString &s : sl) {
-        QSharedPointer<Item> item(new Item());
+        ItemPointer item(collection->addItem());
         item->setPlaylistUuid(uuid_);
         item->fromString(s);
-        items.append(item);
-        itemsByUuid.insert(item->uuid(), item);
+        newItems.append(item);
+        itemsById.insert(item->id(), item);
     }
+    items.insert(0, newItems);
+    searchIndex.insert(newItems);
+    journal.reset();
 }
 
 QVariantMap Playlist::toVMap()
 {
-    QWriteLocker locker(&listLock);
+    QReadLocker locker(&listLock);
     QVariantMap qvm;
     qvm.insert("title", title_);
     qvm.insert("shuffle", shuffle_);
+    if (shuffle_)
+        qvm.insert("shuffleState", shuffler.toVMap(items, itemsById));
     qvm.insert("uuid", uuid_);
 
     QVariantList qvl;
@@ -460,21 +1071,86 @@ QVariantMap Playlist::toVMap()
 
 void Playlist::fromVMap(const QVariantMap &qvm)
 {
-    QReadLocker locker(&listLock);
+    WriteLocker locker(this);
     title_ = qvm.contains("title") ? qvm["title"].toString() : QString();
     shuffle_ = qvm.contains("shuffle") ? qvm["shuffle"].toBool() : false;
     uuid_ = qvm.contains("uuid") ? qvm["uuid"].toUuid() : QUuid::createUuid();
-    if (qvm.contains("items")) {
-        auto items = qvm["items"].toList();
-        for (const QVariant &v : items) {
-            QSharedPointer<Item> i(new Item());
-            i->setPlaylistUuid(uuid_);
-            i->fromVMap(v.toMap());
-            this->items.append(i);
-            this->itemsByUuid.insert(i->uuid(), i);
-            ItemCollection::getSingleton()->storeItem(i);
-        }
+    QList<ItemPointer> newItems;
+    for (const QVariant &v : qvm.value("items").toList()) {
+        ItemPointer i(new Item());
+        i->setPlaylistUuid(uuid_);
+        i->fromVMap(v.toMap());
+        newItems.append(i);
     }
+    adopt_(newItems, qvm.value("shuffleState").toMap());
+}
+
+std::shared_ptr<const PlaylistSnapshot> Playlist::snapshot()
+{
+    auto current = std::atomic_load(&snapshot_);
+    if (current && current->version_ == version_.load())
+        return current;
+
+    // Rebuild lazily, so that a burst of writes costs one copy.  If a writer
+    // is busy, hand out the last published version rather than wait on it.
+    if (!listLock.tryLockForRead()) {
+        if (current)
+            return current;
+        listLock.lockForRead();
+    }
+    auto fresh = std::make_shared<PlaylistSnapshot>();
+    fresh->version_ = version_.load();
+    fresh->uuid_ = uuid_;
+    fresh->title_ = title_;
+    fresh->items_.reserve(items.count());
+    for (const ItemPointer &item : items)
+        fresh->items_.append(item);
+    // The id hash stays behind: sharing it would make the next insert or
+    // remove detach a full copy.  Rows carry their own Item::id().
+    listLock.unlock();
+
+    std::shared_ptr<const PlaylistSnapshot> published(fresh);
+    std::atomic_store(&snapshot_, published);
+    return published;
+}
+
+QSet<const Item *> Playlist::search(const QStringList &needles)
+{
+    // The index keeps its own lock, so searching never holds up writers.
+    return searchIndex.find(needles);
+}
+
+QVector<SearchIndex::Match> Playlist::fuzzySearch(const QString &text,
+                                                  int limit)
+{
+    return searchIndex.fuzzyFind(text, limit);
+}
+
+void Playlist::reindexItem(const ItemPointer &item)
+{
+    searchIndex.refresh(item);
+    touch();
+}
+
+int Playlist::revision()
+{
+    return version_.load() + touched_.load();
+}
+
+int Playlist::loadedRevision()
+{
+    return loadedRevision_;
+}
+
+void Playlist::markLoaded()
+{
+    loadedRevision_ = revision();
+}
+
+void Playlist::touch()
+{
+    // Unlike a mutation, this leaves the current snapshot standing.
+    touched_.ref();
 }
 
 
@@ -495,52 +1171,54 @@ QPair<QUuid,QUuid> QueuePlaylist::first()
 
 QPair<QUuid,QUuid> QueuePlaylist::takeFirst()
 {
-    QWriteLocker lock(&listLock);
+    WriteLocker lock(this);
     if (items.isEmpty())
         return { QUuid(), QUuid() };
-    QSharedPointer<Item> item = items.takeFirst();
-    itemsByUuid.remove(item->uuid());
-    item->setQueuePosition(0);
-    int i = 1;
-    for (auto &item : items)
-        item->setQueuePosition(i++);
+    ItemPointer item = items.takeFirst();
+    itemsById.remove(item->id());
+    searchIndex.remove(item);
+    // Playing from the queue is not an edit to take back.
+    journal.reset();
     return { item->playlistUuid(), item->uuid() };
 
 }
 
 int QueuePlaylist::toggle(const QUuid &playlistUuid, const QUuid &itemUuid, bool always)
 {
-    QWriteLocker lock(&listLock);
-    return toggle_(playlistUuid, itemUuid, always);
+    quint64 itemId = ItemCollection::getSingleton()->idOf(itemUuid);
+    WriteLocker lock(this);
+    return toggle_(playlistUuid, itemId, always);
 }
 
 void QueuePlaylist::toggle(const QUuid &playlistUuid, const QList<QUuid> &uuids, QList<QUuid> &added, QList<int> &removed)
 {
-    QWriteLocker lock(&listLock);
-    int numberPresent = contains_(uuids);
-    if (numberPresent == uuids.count()) {
-        removed.append(removeItems_(uuids));
+    QList<quint64> ids = ItemCollection::getSingleton()->idsOf(uuids);
+    WriteLocker lock(this);
+    int numberPresent = contains_(ids);
+    if (numberPresent == ids.count()) {
+        removed.append(removeItems_(ids));
         return;
     }
-    for (const QUuid &item : uuids)
-        if (toggle_(playlistUuid, item, true) > 0)
-            added.append(item);
+    for (int index = 0; index < ids.count(); ++index)
+        if (toggle_(playlistUuid, ids[index], true) > 0)
+            added.append(uuids[index]);
 }
 
 void QueuePlaylist::toggleFromPlaylist(const QUuid &playlistUuid, QList<QUuid> &added, QList<int> &removedIndices)
 {
-    QWriteLocker lock(&listLock);
+    WriteLocker lock(this);
     auto pl = PlaylistCollection::getSingleton()->playlistOf(playlistUuid);
     QReadLocker plLock(&pl->listLock);
-    if (contains_(pl->itemsByUuid.keys()) == pl->itemsByUuid.count()) {
+    if (contains_(pl->itemsById.keys()) == pl->itemsById.count()) {
         // remove all items from playlist
-        removedIndices.append(removeItems_(pl->itemsByUuid.keys()));
+        removedIndices.append(removeItems_(pl->itemsById.keys()));
     } else {
-        for (QSharedPointer<Item> &item : pl->items) {
-            if (!itemsByUuid.contains(item->uuid())) {
+        for (const ItemPointer &item : pl->items) {
+            if (!itemsById.contains(item->id())) {
                 items.append(item);
-                itemsByUuid.insert(item->uuid(), item);
-                item->setQueuePosition(items.count());
+                itemsById.insert(item->id(), item);
+                searchIndex.insert(item);
+                journal.record(insertedStep(items.count() - 1, { item }));
                 added.append(item->uuid());
             }
         }
@@ -549,61 +1227,108 @@ void QueuePlaylist::toggleFromPlaylist(const QUuid &playlistUuid, QList<QUuid> &
 
 void QueuePlaylist::appendItems(const QUuid &playlistUuid, const QList<QUuid> &itemsToAdd)
 {
-    QWriteLocker lock(&listLock);
-    for (QUuid item : itemsToAdd)
+    QList<quint64> ids = ItemCollection::getSingleton()->idsOf(itemsToAdd);
+    WriteLocker lock(this);
+    for (quint64 item : ids)
         toggle_(playlistUuid, item, true);
 }
 
-void QueuePlaylist::addItems(const QUuid &where, const QList<QSharedPointer<Item> > &itemsToAdd)
+void QueuePlaylist::addItems(const QUuid &where, const QList<ItemPointer> &itemsToAdd)
 {
-    QWriteLocker lock(&listLock);
-    int index = items.indexOf(itemsByUuid[where]);
+    quint64 whereId = ItemCollection::getSingleton()->idOf(where);
+    WriteLocker lock(this);
+    int index = items.indexOf(itemsById.value(whereId));
     if (index < 0)
         index = 0;
 
-    int count = itemsToAdd.count();
-    for (int i = 0; i < count; i++) {
-        QSharedPointer<Item> item = itemsToAdd[i];
-        items.insert(index + i, item);
-        itemsByUuid.insert(item->uuid(), item);
-    }
-    count = items.count();
-    for (int i = index; i < count; i++)
-        items[i]->setQueuePosition(i+1);
+    for (const ItemPointer &item : itemsToAdd)
+        itemsById.insert(item->id(), item);
+    int before = items.count();
+    items.insert(index, itemsToAdd);
+    searchIndex.insert(itemsToAdd);
+    if (items.count() == before + itemsToAdd.count())
+        journal.record(insertedStep(index, itemsToAdd));
+    else
+        journal.reset();
 }
 
 void QueuePlaylist::removeItem(const QUuid &uuid)
 {
-    QWriteLocker lock(&listLock);
-    removeItem_(uuid);
+    removeItem(ItemCollection::getSingleton()->idOf(uuid));
+}
+
+void QueuePlaylist::removeItem(quint64 id)
+{
+    WriteLocker lock(this);
+    removeItem_(id);
 }
 
 void QueuePlaylist::removeItems(const QList<QUuid> &itemsToRemove)
 {
-    QWriteLocker lock(&listLock);
+    removeItems(ItemCollection::getSingleton()->idsOf(itemsToRemove));
+}
+
+void QueuePlaylist::removeItems(const QList<quint64> &itemsToRemove)
+{
+    WriteLocker lock(this);
     removeItems_(itemsToRemove);
 }
 
+void QueuePlaylist::forgetItems(const QVector<ItemPointer> &itemsToRemove)
+{
+    // Undoing the removal from the playlist does not queue the items again,
+    // so the queue's journal no longer lines up with it.  Nor may the queue
+    // put back an item that is gone from its playlist, though it was taken
+    // out of the queue before then.
+    QList<quint64> ids;
+    ids.reserve(itemsToRemove.count());
+    for (const ItemPointer &item : itemsToRemove)
+        ids.append(item->id());
+    WriteLocker lock(this);
+    if (!removeItems_(ids).isEmpty() || journal.holdsAny(itemsToRemove))
+        journal.reset();
+}
+
 void QueuePlaylist::clear()
 {
-    QWriteLocker lock(&listLock);
-    for (QSharedPointer<Item> &item : items)
-        item->setQueuePosition(0);
+    WriteLocker lock(this);
+    journalClear_();
     items.clear();
-    itemsByUuid.clear();
+    itemsById.clear();
+    searchIndex.clear();
+}
+
+int QueuePlaylist::queuePosition(const Item *item)
+{
+    // Positions are not stored on the items, because keeping them current
+    // meant renumbering the whole queue on every mutation.
+    QReadLocker lock(&listLock);
+    return items.indexOf(item) + 1;
 }
 
 int QueuePlaylist::contains(const QList<QUuid> &itemsToCheck)
 {
+    QList<quint64> ids = ItemCollection::getSingleton()->idsOf(itemsToCheck);
     QReadLocker lock(&listLock);
-    return contains_(itemsToCheck);
+    return contains_(ids);
 }
 
-int QueuePlaylist::toggle_(const QUuid &playlistUuid, const QUuid &itemUuid, bool always)
+void QueuePlaylist::itemsDiscarded_(const QVector<ItemPointer> &discarded)
 {
-    if (itemsByUuid.contains(itemUuid)) {
+    // The items still belong to their playlists.
+    Q_UNUSED(discarded);
+}
+
+void QueuePlaylist::itemsRestored_(const QVector<ItemPointer> &restored)
+{
+    Q_UNUSED(restored);
+}
+
+int QueuePlaylist::toggle_(const QUuid &playlistUuid, quint64 itemId, bool always)
+{
+    if (itemsById.contains(itemId)) {
         if (!always) {
-            removeItem_(itemUuid);
+            removeItem_(itemId);
             return -1;
         }
         return 0;
@@ -611,57 +1336,50 @@ int QueuePlaylist::toggle_(const QUuid &playlistUuid, const QUuid &itemUuid, boo
     auto pl = PlaylistCollection::getSingleton()->playlistOf(playlistUuid);
     if (!pl)
         return 0;
-    QSharedPointer<Item> item = pl->itemOf(itemUuid);
+    ItemPointer item = pl->itemOf(itemId);
     if (!item)
         return 0;
     items.append(item);
-    itemsByUuid.insert(itemUuid, item);
-    item->setQueuePosition(items.count());
+    itemsById.insert(itemId, item);
+    searchIndex.insert(item);
+    journal.record(insertedStep(items.count() - 1, { item }));
     return 1;
 }
 
-int QueuePlaylist::contains_(const QList<QUuid> &itemsToCheck) const
+int QueuePlaylist::contains_(const QList<quint64> &itemsToCheck) const
 {
     int count = 0;
-    for (QUuid item : itemsToCheck)
-        if (itemsByUuid.contains(item))
+    for (quint64 item : itemsToCheck)
+        if (itemsById.contains(item))
             count++;
     return count;
 }
 
-void QueuePlaylist::removeItem_(const QUuid &uuid)
+void QueuePlaylist::removeItem_(quint64 id)
 {
-    if (!itemsByUuid.contains(uuid))
+    ItemPointer item = itemsById.value(id);
+    if (!item)
         return;
-    QSharedPointer<Item> item = itemsByUuid[uuid];
-    int index = items.indexOf(item);
-    items.removeOne(item);
-    itemsByUuid.remove(uuid);
-    item->setQueuePosition(0);
-    int count = items.count();
-    for (int i = index; i < count; i++)
-        items[i]->setQueuePosition(i+1);
-}
-
-QList<int> QueuePlaylist::removeItems_(const QList<QUuid> &itemsToRemove)
-{
-    QList<int> removedIndices;
-    QSet<QUuid> removalSet(itemsToRemove.toSet());
-    QMutableListIterator<QSharedPointer<Item>> i(items);
-    int index = 0;
-    while (i.hasNext()) {
-        QSharedPointer<Item> item = i.next();
-        if (removalSet.contains(item->uuid())) {
-            itemsByUuid.remove(item->uuid());
-            item->setQueuePosition(0);
-            i.remove();
-            removedIndices.append(index);
-        }
-        index++;
+    QVector<int> positions { items.indexOf(item) };
+    journal.record(removedStep(positions, discard_(positions)));
+}
+
+QList<int> QueuePlaylist::removeItems_(const QList<quint64> &itemsToRemove)
+{
+    QVector<int> positions;
+    for (quint64 id : itemsToRemove) {
+        ItemPointer item = itemsById.value(id);
+        if (!item.isNull())
+            positions.append(items.indexOf(item));
     }
-    for (int i = 0; i < items.count(); i++)
-        items[i]->setQueuePosition(i+1);
-    return removedIndices;
+    // Indices are taken before anything is removed, so that they refer to
+    // the rows the view still has.
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()),
+                    positions.end());
+    if (!positions.isEmpty())
+        journal.record(removedStep(positions, discard_(positions)));
+    return positions.toList();
 }
 
 
@@ -669,15 +1387,15 @@ QList<int> QueuePlaylist::removeItems_(const QList<QUuid> &itemsToRemove)
 QSharedPointer<PlaylistCollection> PlaylistCollection::collection;
 
 PlaylistCollection::PlaylistCollection()
-    : queuePlaylist_(new QueuePlaylist("Queue"))
+    : registry_(std::make_shared<Registry>()),
+      queuePlaylist_(new QueuePlaylist("Queue"))
 {
     doNewPlaylist(tr("Quick playlist"), QUuid());
 }
 
 PlaylistCollection::~PlaylistCollection()
 {
-    playlists.clear();
-    playlistsByUuid.clear();
+    publish(std::make_shared<Registry>());
 }
 
 QSharedPointer<PlaylistCollection> PlaylistCollection::getSingleton()
@@ -694,24 +1412,34 @@ QSharedPointer<Playlist> PlaylistCollection::newPlaylist(const QString &title)
 
 QSharedPointer<Playlist> PlaylistCollection::clonePlaylist(const QUuid &uuid)
 {
-    if (!playlistsByUuid.contains(uuid))
+    auto origin = playlistOf(uuid);
+    if (!origin)
         return QSharedPointer<Playlist>();
-    auto origin = playlistsByUuid[uuid];
-    auto remote = newPlaylist(origin->title());
-    auto cloner = [remote](QSharedPointer<Item> i) {
+    auto snapshot = origin->snapshot();
+    auto remote = newPlaylist(snapshot->title());
+    for (const ItemPointer &i : snapshot->items())
         remote->addItemClone(i);
-    };
-    origin->iterateItems(cloner);
+    remote->clearUndoHistory();
     return remote;
 }
 
+void PlaylistCollection::setUndoBudget(qint64 bytes)
+{
+    EditJournal::setBudget(bytes);
+}
+
 void PlaylistCollection::removePlaylist(const QUuid &uuid)
 {
-    if (!playlistsByUuid.contains(uuid))
+    QMutexLocker locker(&registryLock);
+    auto current = registry();
+    QSharedPointer<Playlist> p = current->playlistsByUuid.value(uuid);
+    if (!p && !current->deferred.contains(uuid))
         return;
-    QSharedPointer<Playlist> p = playlistsByUuid.value(uuid);
-    playlists.removeAll(p);
-    playlistsByUuid.remove(uuid);
+    auto fresh = std::make_shared<Registry>(*current);
+    fresh->playlists.removeAll(p);
+    fresh->playlistsByUuid.remove(uuid);
+    fresh->deferred.remove(uuid);
+    publish(fresh);
 }
 
 void PlaylistCollection::removePlaylist(const QSharedPointer<Playlist> &p)
@@ -723,12 +1451,21 @@ void PlaylistCollection::removePlaylist(const QSharedPointer<Playlist> &p)
 
 QSharedPointer<Playlist> PlaylistCollection::playlistAt(int col) const
 {
-    return (col < playlists.count()) ? playlists.at(col) : QSharedPointer<Playlist>();
+    return registry()->playlists.value(col);
 }
 
-QSharedPointer<Playlist> PlaylistCollection::playlistOf(const QUuid &uuid) const
+QSharedPointer<Playlist> PlaylistCollection::playlistOf(const QUuid &uuid)
 {
-    return playlistsByUuid.value(uuid);
+    auto current = registry();
+    QSharedPointer<Playlist> p = current->playlistsByUuid.value(uuid);
+    if (p || !current->deferred.contains(uuid))
+        return p;
+    return load(uuid);
+}
+
+QSharedPointer<Playlist> PlaylistCollection::playlistIfLoaded(const QUuid &uuid) const
+{
+    return registry()->playlistsByUuid.value(uuid);
 }
 
 QSharedPointer<QueuePlaylist> PlaylistCollection::queuePlaylist() const
@@ -736,17 +1473,121 @@ QSharedPointer<QueuePlaylist> PlaylistCollection::queuePlaylist() const
     return queuePlaylist_;
 }
 
+QList<PlaylistCollection::SearchResult>
+PlaylistCollection::search(const QString &text, int limit)
+{
+    const QSet<QUuid> deferred = registry()->deferred;
+    for (const QUuid &uuid : deferred)
+        playlistOf(uuid);
+
+    // Every playlist is searched for its own best few in parallel, and those
+    // are then merged.  The queue only holds items of other playlists.
+    QList<QSharedPointer<Playlist>> lists = registry()->playlists;
+    QVector<QVector<SearchIndex::Match>> found(lists.count());
+    ParallelJobs::run(lists.count(), [&lists, &found, &text, limit](int index) {
+        found[index] = lists[index]->fuzzySearch(text, limit);
+    });
+
+    struct Candidate {
+        int list;
+        quint64 item;
+        int score;
+    };
+    QVector<Candidate> candidates;
+    for (int index = 0; index < lists.count(); ++index)
+        for (const SearchIndex::Match &match : found[index])
+            candidates.append({ index, match.item, match.score });
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const Candidate &a, const Candidate &b) {
+        return a.score > b.score;
+    });
+
+    // Only the items which make the cut are named.
+    QList<SearchResult> results;
+    for (const Candidate &c : candidates) {
+        if (results.count() == limit)
+            break;
+        ItemPointer item = lists[c.list]->itemOf(c.item);
+        if (item)
+            results.append({ lists[c.list]->uuid(), item->uuid(), c.score });
+    }
+    return results;
+}
+
 void PlaylistCollection::addPlaylist(const QSharedPointer<Playlist> &playlist)
 {
     if (!playlist)
         return;
-    if (playlistsByUuid.contains(playlist->uuid())) {
-        QSharedPointer<Playlist> old = playlistsByUuid[playlist->uuid()];
-        playlistsByUuid.remove(playlist->uuid());
-        playlists.removeOne(old);
-    }
-    playlists.append(playlist);
-    playlistsByUuid.insert(playlist->uuid(), playlist);
+    QMutexLocker locker(&registryLock);
+    auto fresh = std::make_shared<Registry>(*registry());
+    QSharedPointer<Playlist> old = fresh->playlistsByUuid.take(playlist->uuid());
+    if (old)
+        fresh->playlists.removeOne(old);
+    fresh->playlists.append(playlist);
+    fresh->playlistsByUuid.insert(playlist->uuid(), playlist);
+    publish(fresh);
+}
+
+void PlaylistCollection::setLoader(const Loader &loader)
+{
+    this->loader = loader;
+}
+
+void PlaylistCollection::addDeferred(const QUuid &uuid)
+{
+    // Like addPlaylist, this replaces whatever went by the uuid, as the
+    // quick playlist does.
+    QMutexLocker locker(&registryLock);
+    auto fresh = std::make_shared<Registry>(*registry());
+    QSharedPointer<Playlist> old = fresh->playlistsByUuid.take(uuid);
+    if (old)
+        fresh->playlists.removeOne(old);
+    fresh->deferred.insert(uuid);
+    publish(fresh);
+}
+
+bool PlaylistCollection::isDeferred(const QUuid &uuid) const
+{
+    return registry()->deferred.contains(uuid);
+}
+
+QSharedPointer<Playlist> PlaylistCollection::load(const QUuid &uuid)
+{
+    // Whoever asks for a playlist another thread is loading waits for that
+    // load rather than starting one of their own.
+    QMutexLocker loadLocker(&loadLock);
+    auto current = registry();
+    if (!current->deferred.contains(uuid))
+        return current->playlistsByUuid.value(uuid);
+
+    QSharedPointer<Playlist> p;
+    if (loader)
+        p = loader(uuid);
+    if (!p)
+        p.reset(new Playlist);
+    if (p->uuid() != uuid)
+        p->setUuid(uuid);
+    if (p->thread() != thread())
+        p->moveToThread(thread());
+    p->markLoaded();
+
+    QMutexLocker locker(&registryLock);
+    auto fresh = std::make_shared<Registry>(*registry());
+    fresh->deferred.remove(uuid);
+    fresh->playlists.append(p);
+    fresh->playlistsByUuid.insert(uuid, p);
+    publish(fresh);
+    return p;
+}
+
+std::shared_ptr<const PlaylistCollection::Registry> PlaylistCollection::registry() const
+{
+    return std::atomic_load(&registry_);
+}
+
+void PlaylistCollection::publish(const std::shared_ptr<const Registry> &fresh)
+{
+    std::atomic_store(&registry_, fresh);
 }
 
 QSharedPointer<Playlist> PlaylistCollection::doNewPlaylist(const QString &title,
@@ -754,91 +1595,177 @@ QSharedPointer<Playlist> PlaylistCollection::doNewPlaylist(const QString &title,
 {
     QSharedPointer<Playlist> p(new Playlist(title));
     p->setUuid(uuid);
-    playlists.append(p);
-    playlistsByUuid.insert(p->uuid(), p);
+    QMutexLocker locker(&registryLock);
+    auto fresh = std::make_shared<Registry>(*registry());
+    fresh->playlists.append(p);
+    fresh->playlistsByUuid.insert(p->uuid(), p);
+    publish(fresh);
     return p;
 }
 
-void PlaylistSearcher::bump()
+
+
+// The rows of one filter pass, shared between the searcher and the pool
+// threads helping it.  Chunks are claimed in order from a counter, so the
+// first rows are always worked on first.
+class FilterPass {
+public:
+    static const int chunkSize = 8192;
+
+    FilterPass(const QSharedPointer<QAtomicInt> &generation, int token,
+               const QVector<ItemPointer> &items,
+               const QSet<const Item *> &found)
+        : generation(generation), token(token), items(items), found(found),
+          chunkCount(std::max(1, int((items.count() + chunkSize - 1) / chunkSize))),
+          results(chunkCount), done(chunkCount, false) {}
+
+    bool cancelled() const
+    {
+        return generation->load() != token;
+    }
+
+    bool runChunk()
+    {
+        int chunk = nextChunk.fetchAndAddRelaxed(1);
+        if (chunk >= chunkCount)
+            return false;
+        QVector<ItemPointer> visible;
+        if (!cancelled()) {
+            int end = std::min(items.count(), (chunk + 1) * chunkSize);
+            for (int index = chunk * chunkSize; index < end; ++index) {
+                const ItemPointer &item = items[index];
+                if (found.contains(item.data()))
+                    visible.append(item);
+            }
+        }
+        QMutexLocker locker(&mutex);
+        results[chunk] = visible;
+        done[chunk] = true;
+        chunkDone.wakeAll();
+        return true;
+    }
+
+    QVector<ItemPointer> takeResult(int chunk)
+    {
+        QMutexLocker locker(&mutex);
+        while (!done[chunk])
+            chunkDone.wait(&mutex);
+        QVector<ItemPointer> result;
+        result.swap(results[chunk]);
+        return result;
+    }
+
+    bool isDone(int chunk)
+    {
+        QMutexLocker locker(&mutex);
+        return done[chunk];
+    }
+
+    const QSharedPointer<QAtomicInt> generation;
+    const int token;
+    const QVector<ItemPointer> items;
+    const QSet<const Item *> found;
+    const int chunkCount;
+
+private:
+    QAtomicInt nextChunk;
+    QVector<QVector<ItemPointer>> results;
+    QVector<bool> done;
+    QMutex mutex;
+    QWaitCondition chunkDone;
+};
+
+class FilterHelper : public QRunnable {
+public:
+    explicit FilterHelper(const QSharedPointer<FilterPass> &pass)
+        : pass(pass) {}
+    void run()
+    {
+        // Chunks claimed after a cancel are marked done without any work,
+        // so this winds down quickly either way.
+        while (pass->runChunk()) {}
+    }
+
+private:
+    QSharedPointer<FilterPass> pass;
+};
+
+
+
+PlaylistSearcher::PlaylistSearcher() : QObject(),
+    generation_(new QAtomicInt(0))
 {
-    QWriteLocker locker(&bumpLock);
-    ++bumps_;
+    qRegisterMetaType<QVector<ItemPointer>>("QVector<ItemPointer>");
 }
 
-void PlaylistSearcher::unbump()
+int PlaylistSearcher::bump()
 {
-    QWriteLocker locker(&bumpLock);
-    --bumps_;
+    return generation_->fetchAndAddOrdered(1) + 1;
 }
 
-int PlaylistSearcher::bumps()
+bool PlaylistSearcher::cancelled(int generation) const
 {
-    QReadLocker locker(&bumpLock);
-    return bumps_;
+    return generation_->load() != generation;
 }
 
-bool PlaylistSearcher::itemMatchesFilter(const QSharedPointer<Item> &item,
+bool PlaylistSearcher::itemMatchesFilter(const ItemPointer &item,
                                          const QStringList &needles)
 {
-    QSet<QString> found;
-    findNeedles(item->toDisplayString(), needles, found);
-    if (found.count() == needles.count())
-        return true;
-
-    // OPTIMIZE: don't run the metadata through toLower every search
-    for (const QVariant &v : item->metadata())
-        findNeedles(v.toString(), needles, found);
-    return found.count() == needles.count();
+    return SearchIndex::matches(SearchIndex::haystackOf(item.data()), needles);
 }
 
-void PlaylistSearcher::filterPlaylist(QSharedPointer<Playlist> list, QString text)
+void PlaylistSearcher::filterPlaylist(QSharedPointer<Playlist> list,
+                                      QString text, int generation)
 {
-    // Limit response - only reply if last in event queue
-    bool bumpLimited = bumps() > 1;
-    unbump();
-    if (bumpLimited)
+    // Requests that were overtaken while queued are dropped outright.
+    if (cancelled(generation) || list.isNull())
         return;
 
     QStringList needles = textToNeedles(text);
     if (needles.isEmpty()) {
-        clearPlaylistFilter(list);
+        clearPlaylistFilter(list, generation);
         return;
     }
 
-    if (list.isNull())
+    auto snapshot = list->snapshot();
+    QSet<const Item *> found = list->search(needles);
+    if (cancelled(generation))
         return;
 
-    auto marker = [&needles](QSharedPointer<Item> item) {
-        item->setHidden(!itemMatchesFilter(item, needles));
-    };
-    list->iterateItems(marker);
-    emit playlistFiltered(list->uuid());
+    QSharedPointer<FilterPass> pass(new FilterPass(generation_, generation,
+                                                   snapshot->items(), found));
+    int helpers = std::min(pass->chunkCount - 1,
+                           QThreadPool::globalInstance()->maxThreadCount());
+    for (int i = 0; i < helpers; ++i)
+        QThreadPool::globalInstance()->start(new FilterHelper(pass));
+
+    // Work alongside the helpers rather than just wait on them, so that a
+    // busy pool only slows a pass down instead of stalling it, and hand out
+    // each chunk as soon as it and everything before it is finished.
+    int nextToSend = 0;
+    while (nextToSend < pass->chunkCount) {
+        if (pass->cancelled())
+            return;
+        if (!pass->isDone(nextToSend) && pass->runChunk())
+            continue;
+        emit rowsFiltered(generation, nextToSend,
+                          pass->takeResult(nextToSend));
+        ++nextToSend;
+    }
+    emit filterFinished(generation);
 }
 
-void PlaylistSearcher::clearPlaylistFilter(QSharedPointer<Playlist> &list)
+void PlaylistSearcher::clearPlaylistFilter(const QSharedPointer<Playlist> &list,
+                                           int generation)
 {
-    if (list.isNull())
+    auto snapshot = list->snapshot();
+    if (cancelled(generation))
         return;
-
-    auto clearer = [](QSharedPointer<Item> item) {
-        item->setHidden(false);
-    };
-    list->iterateItems(clearer);
-    emit playlistFiltered(list->uuid());
+    emit rowsFiltered(generation, 0, snapshot->items());
+    emit filterFinished(generation);
 }
 
 QStringList PlaylistSearcher::textToNeedles(QString text)
 {
     return text.toLower().split(QString(" "), QString::SkipEmptyParts);
 }
-
-void PlaylistSearcher::findNeedles(const QString &text,
-                                   const QStringList &needles,
-                                   QSet<QString> &found)
-{
-    QString haystack = text.toLower();
-    for (const QString &needle : needles) {
-        if (haystack.contains(needle))
-            found.insert(needle);
-    }
-}
@@ -14,13 +14,48 @@
 #include <QStringList>
 #include <QVariantMap>
 #include <QReadWriteLock>
-
+#include <QMutex>
+#include <QVector>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QExplicitlySharedDataPointer>
+#include <memory>
+#include "editjournal.h"
+#include "itempool.h"
+#include "playlistindex.h"
+#include "searchindex.h"
+#include "shardedhash.h"
+#include "shuffleengine.h"
+
+class PlaylistImage;
+
+// Items are laid out to be small, since a library may hold millions of
+// them: the url is kept as an interned prefix (the directory, for files) and
+// the remainder, and is only rebuilt into a QUrl when asked for.  Items are
+// allocated from ItemPool and held through ItemPointer, which keeps the
+// count of their references in the item.
+//
+// Within the process an item is known by its id, a number handed out in
+// sequence.  A uuid is only made up for an item once something outside the
+// process has to refer to it (a saved playlist, an ipc client, mpris), or
+// once the gui passes it around, and is then kept for good.
+//
+// Items loaded by PlaylistStore leave their metadata in the file it was
+// loaded from until something first asks for it.
 class Item {
 public:
     Item(QUrl url = QUrl());
+    ~Item();
+
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
 
+    quint64 id() const;
     QUuid uuid() const;
+    // Does nothing to an item already named, which keeps its uuid.
     void setUuid(const QUuid &uuid);
+    // Whether the item goes by this uuid, without naming it if it has none.
+    bool hasUuid(const QUuid &uuid) const;
     QUuid playlistUuid() const;
     void setPlaylistUuid(const QUuid &uuid);
     QUrl url() const;
@@ -31,18 +66,11 @@ public:
     int originalPosition();
     void setOriginalPosition(int i);
 
-    int queuePosition() const;
-    void setQueuePosition(int num);
-    void decQueuePosition();
-
     int extraPlayTimes() const;
     void setExtraPlayTimes(int amount);
     int incExtraPlayTimes();
     int decExtraPlayTimes();
 
-    void setHidden(bool yes);
-    bool hidden();
-
     QString toDisplayString() const;
     QString toString() const;
     void fromString(QString input);
@@ -50,17 +78,48 @@ public:
     QVariantMap toVMap() const;
     void fromVMap(const QVariantMap &qvm);
 
+    // Changes whenever something the item is displayed from changes.  The
+    // values are unique across all items, so a cache keyed on the item's
+    // address cannot confuse a new item with a deleted one.
+    int revision() const;
+
 private:
-    QUuid uuid_;
-    QUuid playlistUuid_;
-    QUrl url_;
-    QVariantMap metadata_;
+    void touch();
+    void assignUuid(const QUuid &uuid) const;
+    // Called with the item's metadata lock held.
+    void decodeMetadata() const;
+    // The metadata as PlaylistStore saves it, copied straight out of the
+    // file it was loaded from if it has not been decoded since.
+    QByteArray encodedMetadata() const;
+
+    Q_DISABLE_COPY(Item)
+
+    quint64 id_;
+    // Counted by ItemPointer.
+    mutable QAtomicInt refCount_;
     int originalPosition_;
-    int queuePosition_ = 0;
+    // Null until the item is named; few items ever are, so the uuid is kept
+    // out of line.
+    mutable QAtomicPointer<QUuid> uuid_;
+    QUuid playlistUuid_;
+    QString urlPrefix_;
+    QString urlName_;
+    mutable QVariantMap metadata_;
+    // The file the metadata is still to be decoded from, if it is.
+    mutable QExplicitlySharedDataPointer<PlaylistImage> metadataImage_;
+    quint64 metadataOffset_ = 0;
+    quint32 metadataSize_ = 0;
     int extraPlayTimes_ = 0;
-    bool hidden_ = false;
+    int revision_ = 0;
+    bool localFile_ = false;
+
+    friend class ItemCollection;
+    friend class ItemPointer;
+    friend class PlaylistStore;
 };
 
+// Every item by id, whichever playlist holds it, and the ids of the items
+// which have been given a uuid.  Lookups may come from any thread.
 class ItemCollection : public QObject {
     Q_OBJECT
 private:
@@ -71,44 +130,102 @@ public:
     ~ItemCollection();
     static QSharedPointer<ItemCollection> getSingleton();
 
-    QSharedPointer<Item> addItem(const QUrl url = QUrl());
-    QSharedPointer<Item> addItem(const QUuid &itemUuid, const QUrl &url);
-    QSharedPointer<Item> itemOf(const QUuid &itemUuid);
-    void removeItem(const QUuid &itemUuid);
-    void storeItem(const QSharedPointer<Item> &item);
+    ItemPointer addItem(const QUrl url = QUrl());
+    ItemPointer addItem(const QUuid &itemUuid, const QUrl &url);
+    ItemPointer itemOf(quint64 itemId);
+    ItemPointer itemOf(const QUuid &itemUuid);
+    // 0, which no item has, if no item goes by the uuid.
+    quint64 idOf(const QUuid &itemUuid);
+    QList<quint64> idsOf(const QList<QUuid> &itemUuids);
+    void removeItem(quint64 itemId);
+    void storeItem(const ItemPointer &item);
 
 private:
-    QHash<QUuid, QSharedPointer<Item>> items;
+    ShardedHash<quint64, ItemPointer> items;
+    ShardedHash<QUuid, quint64> idsByUuid;
+
+    friend class Item;
 };
 
 
 
+// An immutable view of a playlist at some version.  Readers that must never
+// wait on a writer (painting, searching, ipc queries) take one of these from
+// Playlist::snapshot() and work on it without holding any lock.
+class PlaylistSnapshot {
+public:
+    int version() const;
+    QUuid uuid() const;
+    QString title() const;
+    int count() const;
+    bool isEmpty() const;
+    ItemPointer itemAt(int index) const;
+    const QVector<ItemPointer> &items() const;
+
+private:
+    int version_ = 0;
+    QUuid uuid_;
+    QString title_;
+    QVector<ItemPointer> items_;
+
+    friend class Playlist;
+};
+
 class Playlist : public QObject {
     Q_OBJECT
 public:
     Playlist(const QString &title = QString());
     ~Playlist();
-    QSharedPointer<Item> addItem(const QUrl &url = QUrl());
-    QSharedPointer<Item> addItem(const QUuid &uuid, const QUrl &url);
-    QSharedPointer<Item> addItemClone(const QSharedPointer<Item> &item);
-    void addItemRaw(const QSharedPointer<Item> &item);
-
-    QSharedPointer<Item> itemAt(int index);
-    QSharedPointer<Item> itemOf(const QUuid &uuid);
-    QSharedPointer<Item> itemAfter(const QUuid &uuid);
-    QSharedPointer<Item> itemBefore(const QUuid &uuid);
-    QSharedPointer<Item> itemFirst();
-    QSharedPointer<Item> itemLast();
+    ItemPointer addItem(const QUrl &url = QUrl());
+    ItemPointer addItem(const QUuid &uuid, const QUrl &url);
+    ItemPointer addItemClone(const ItemPointer &item);
+    void addItemRaw(const ItemPointer &item);
+
+    ItemPointer itemAt(int index);
+    ItemPointer itemOf(quint64 id);
+    ItemPointer itemOf(const QUuid &uuid);
+    ItemPointer itemAfter(const QUuid &uuid);
+    ItemPointer itemBefore(const QUuid &uuid);
+    ItemPointer shuffledItemAfter(const QUuid &uuid);
+    ItemPointer shuffledItemBefore(const QUuid &uuid);
+    ItemPointer itemFirst();
+    ItemPointer itemLast();
+    int indexOf(const QUuid &uuid);
     int count();
     bool isEmpty();
     bool contains(const QUuid &uuid);
-    void iterateItems(const std::function<void(QSharedPointer<Item>)> &callback);
-    virtual void addItems(const QUuid &where, const QList<QSharedPointer<Item> > &itemsToAdd);
+    void iterateItems(const std::function<void(ItemPointer)> &callback);
+    virtual void addItems(const QUuid &where, const QList<ItemPointer> &itemsToAdd);
     virtual void removeItem(const QUuid &uuid);
-    void takeItemsRaw(const QList<QSharedPointer<Item>> &itemsToRemove);
+    void takeItemsRaw(const QList<ItemPointer> &itemsToRemove);
+    void insertMany(int index, const QList<ItemPointer> &itemsToAdd);
+    void moveRange(int from, int count, int to);
+    void removeMany(const QList<int> &indices);
+    // Removes the items that are in the list, found by where they sit
+    // rather than by uuid.
+    void removeMany(const QVector<ItemPointer> &itemsToRemove);
+    // Given a version, reorders only a playlist still at it, as the
+    // permutation may have been worked out for another.
+    bool reorder(const QVector<int> &permutation, int version = -1);
+    // Moves the items, in order, to just before another item, or to the end
+    // if it is null or not in the list.
+    void moveItems(const QList<ItemPointer> &itemsToMove,
+                   const ItemPointer &before);
     QList<QUuid> replaceItem(const QUuid &where, const QList<QUrl> &urls);
     virtual void clear();
 
+    // Edits to the list can be undone and redone again, until the list is
+    // loaded from elsewhere.  These return whether there was an edit to undo
+    // or redo.
+    bool undo();
+    bool redo();
+    bool canUndo();
+    bool canRedo();
+    void clearUndoHistory();
+    // Mutations made between these are undone as one edit.
+    void openUndoGroup();
+    void closeUndoGroup();
+
     QString title();
     void setTitle(const QString &title);
     bool shuffle();
@@ -122,17 +239,68 @@ public:
     QVariantMap toVMap();
     void fromVMap(const QVariantMap &qvm);
 
+    std::shared_ptr<const PlaylistSnapshot> snapshot();
+    QSet<const Item *> search(const QStringList &needles);
+    QVector<SearchIndex::Match> fuzzySearch(const QString &text, int limit);
+    void reindexItem(const ItemPointer &item);
+
+    // Goes up whenever what toVMap() would save changes: with every
+    // mutation, and with touch() for changes that leave the list itself as
+    // it was, such as an item's metadata or the shuffle moving on.
+    int revision();
+    void touch();
+    // The revision the list had when PlaylistCollection read it in, or -1
+    // if it was made some other way.
+    int loadedRevision();
+    void markLoaded();
+
 protected:
-    QList<QSharedPointer<Item>> items;
-    QHash<QUuid, QSharedPointer<Item>> itemsByUuid;
+    void insertMany_(int index, const QList<ItemPointer> &itemsToAdd);
+    // Put items back at, or take them out of, the given ascending positions,
+    // keeping everything that tracks the list's items in step.
+    void restore_(const QVector<int> &positions,
+                  const QVector<ItemPointer> &restored);
+    QVector<ItemPointer> discard_(const QVector<int> &positions);
+    // Moves the whole tree into the journal, leaving the list empty.  The
+    // caller clears what else tracks the items.
+    void journalClear_();
+    // Takes on freshly loaded items as the whole of the list.
+    void adopt_(const QList<ItemPointer> &newItems,
+                const QVariantMap &shuffleState);
+    void apply_(const EditJournal::Step &step, bool forwards);
+    // What else has to happen when items leave the list or come back to it.
+    virtual void itemsDiscarded_(const QVector<ItemPointer> &discarded);
+    virtual void itemsRestored_(const QVector<ItemPointer> &restored);
+
+    // Takes the write lock, and when the mutation is over, closes its entry
+    // in the journal and marks the current snapshot as stale.
+    class WriteLocker {
+    public:
+        explicit WriteLocker(Playlist *list);
+        ~WriteLocker();
+    private:
+        Playlist *list;
+        QWriteLocker locker;
+    };
+
+    PlaylistIndex items;
+    QHash<quint64, ItemPointer> itemsById;
     //QList<QUuid> queue;
     QString title_;
     bool shuffle_ = false;
     QUuid uuid_;
 
     QReadWriteLock listLock;
+    SearchIndex searchIndex;
+    ShuffleEngine shuffler;
+    EditJournal journal;
+    QAtomicInt version_;
+    QAtomicInt touched_;
+    int loadedRevision_ = -1;
+    std::shared_ptr<const PlaylistSnapshot> snapshot_;
 
     friend class QueuePlaylist;
+    friend class PlaylistStore;
 };
 
 class QueuePlaylist : public Playlist {
@@ -146,17 +314,26 @@ public:
     void toggle(const QUuid &playlistUuid, const QList<QUuid> &uuids, QList<QUuid> &added, QList<int> &removed);
     void toggleFromPlaylist(const QUuid &playlistUuid, QList<QUuid> &added, QList<int> &removedIndices);
     void appendItems(const QUuid &playlistUuid, const QList<QUuid> &itemsToAdd);
-    void addItems(const QUuid &where, const QList<QSharedPointer<Item> > &itemsToAdd);
+    void addItems(const QUuid &where, const QList<ItemPointer> &itemsToAdd);
     void removeItem(const QUuid &uuid);
+    void removeItem(quint64 id);
     void removeItems(const QList<QUuid> &itemsToRemove);
+    void removeItems(const QList<quint64> &itemsToRemove);
+    // Removes items which left their playlist.
+    void forgetItems(const QVector<ItemPointer> &itemsToRemove);
     void clear();
+    int queuePosition(const Item *item);
     int contains(const QList<QUuid> &itemsToCheck);
 
+protected:
+    void itemsDiscarded_(const QVector<ItemPointer> &discarded);
+    void itemsRestored_(const QVector<ItemPointer> &restored);
+
 private:
-    int toggle_(const QUuid &playlistUuid, const QUuid &itemUuid, bool always = false);
-    int contains_(const QList<QUuid> &itemsToCheck) const;
-    void removeItem_(const QUuid &uuid);
-    QList<int> removeItems_(const QList<QUuid> &itemsToRemove);
+    int toggle_(const QUuid &playlistUuid, quint64 itemId, bool always = false);
+    int contains_(const QList<quint64> &itemsToCheck) const;
+    void removeItem_(quint64 id);
+    QList<int> removeItems_(const QList<quint64> &itemsToRemove);
 };
 
 class PlaylistCollection : public QObject {
@@ -166,54 +343,100 @@ private:
     static QSharedPointer<PlaylistCollection> collection;
 
 public:
+    struct SearchResult {
+        QUuid playlist;
+        QUuid item;
+        int score;
+    };
+    typedef std::function<QSharedPointer<Playlist>(const QUuid &)> Loader;
+
     ~PlaylistCollection();
     static QSharedPointer<PlaylistCollection> getSingleton();
 
     QSharedPointer<Playlist> newPlaylist(const QString &title = QString());
     QSharedPointer<Playlist> clonePlaylist(const QUuid &uuid);
+    // How much memory the undo history of all playlists together may hold
+    // on to.
+    void setUndoBudget(qint64 bytes);
     void removePlaylist(const QUuid &uuid);
     void removePlaylist(const QSharedPointer<Playlist> &p);
     QSharedPointer<Playlist> playlistAt(int col) const;
-    QSharedPointer<Playlist> playlistOf(const QUuid &uuid) const;
+    // Loads the playlist first if it was deferred.
+    QSharedPointer<Playlist> playlistOf(const QUuid &uuid);
+    // Null for a playlist which is still deferred.
+    QSharedPointer<Playlist> playlistIfLoaded(const QUuid &uuid) const;
     QSharedPointer<QueuePlaylist> queuePlaylist() const;
+    // Loads every deferred playlist, since all of them are searched.
+    QList<SearchResult> search(const QString &text, int limit);
+
+    // Playlists saved by an earlier session can be left on disk until
+    // something first asks for them by uuid, whichever thread that is on.
+    // The loader then reads them in, one at a time; a playlist it cannot
+    // read comes back empty.
+    void setLoader(const Loader &loader);
+    void addDeferred(const QUuid &uuid);
+    bool isDeferred(const QUuid &uuid) const;
 
     void addPlaylist(const QSharedPointer<Playlist> &playlist);
 
 private:
-    QList<QSharedPointer<Playlist>> playlists;
-    QHash<QUuid, QSharedPointer<Playlist>> playlistsByUuid;
+    // There are only ever a handful of playlists and they seldom change, so
+    // writers copy the whole registry and publish the copy, and readers take
+    // whichever copy is current without waiting on them.
+    struct Registry {
+        QList<QSharedPointer<Playlist>> playlists;
+        QHash<QUuid, QSharedPointer<Playlist>> playlistsByUuid;
+        QSet<QUuid> deferred;
+    };
+
+    std::shared_ptr<const Registry> registry() const;
+    void publish(const std::shared_ptr<const Registry> &fresh);
+
+    QSharedPointer<Playlist> load(const QUuid &uuid);
+
+    QMutex registryLock;
+    QMutex loadLock;
+    Loader loader;
+    std::shared_ptr<const Registry> registry_;
     QSharedPointer<QueuePlaylist> queuePlaylist_;
 
     QSharedPointer<Playlist> doNewPlaylist(const QString &title,
                                            const QUuid &uuid);
 };
 
+// Filters a playlist off the gui thread.  A pass is split into chunks of
+// rows which the searcher works through together with the global thread
+// pool, and the visible rows of each chunk are handed out in order as soon
+// as they are known, so the view fills from the top while the rest is still
+// being worked on.  What a pass finds lives only in the rows it hands out;
+// items are shared between tabs, so nothing is marked on them.  Every
+// request is tagged with a generation from bump(); starting a new one
+// cancels the old at its next chunk boundary.
 class PlaylistSearcher : public QObject {
     Q_OBJECT
 public:
+    PlaylistSearcher();
+    int bump();
+    bool cancelled(int generation) const;
 
-    PlaylistSearcher() : QObject() {}
-    void bump();
-    void unbump();
-    int bumps();
+    void filterPlaylist(QSharedPointer<Playlist> list, QString text,
+                        int generation);
 
     static QStringList textToNeedles(QString text);
-    static bool itemMatchesFilter(const QSharedPointer<Item> &item,
+    static bool itemMatchesFilter(const ItemPointer &item,
                                   const QStringList &needles);
 
 signals:
-    void playlistFiltered(QUuid playlist);
-
-public slots:
-    void filterPlaylist(QSharedPointer<Playlist> list, QString text);
-    void clearPlaylistFilter(QSharedPointer<Playlist> &list);
+    // chunk 0 replaces whatever was shown before, later chunks append.
+    void rowsFiltered(int generation, int chunk,
+                      QVector<ItemPointer> rows);
+    void filterFinished(int generation);
 
 private:
-    static void findNeedles(const QString &text, const QStringList &needles,
-                            QSet<QString> &found);
+    void clearPlaylistFilter(const QSharedPointer<Playlist> &list,
+                             int generation);
 
-    QReadWriteLock bumpLock;
-    volatile int bumps_ = 0;
+    QSharedPointer<QAtomicInt> generation_;
 };
 
 
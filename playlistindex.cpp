@@ -0,0 +1,469 @@
+#include <QSet>
+#include <QVector>
+#include <utility>
+#include "playlistindex.h"
+#include "playlist.h"
+
+PlaylistIndex::PlaylistIndex() : seed(0x9e3779b9u)
+{
+
+}
+
+PlaylistIndex::~PlaylistIndex()
+{
+    clear();
+}
+
+int PlaylistIndex::count() const
+{
+    return sizeOf(root);
+}
+
+int PlaylistIndex::size() const
+{
+    return sizeOf(root);
+}
+
+bool PlaylistIndex::isEmpty() const
+{
+    return root == nullptr;
+}
+
+bool PlaylistIndex::contains(const ItemPointer &item) const
+{
+    return nodes.contains(item.data());
+}
+
+ItemPointer PlaylistIndex::at(int index) const
+{
+    return nodeAt(index)->item;
+}
+
+ItemPointer PlaylistIndex::value(int index) const
+{
+    if (index < 0 || index >= count())
+        return ItemPointer();
+    return nodeAt(index)->item;
+}
+
+ItemPointer PlaylistIndex::first() const
+{
+    const Node *n = root;
+    if (!n)
+        return ItemPointer();
+    while (n->left)
+        n = n->left;
+    return n->item;
+}
+
+ItemPointer PlaylistIndex::last() const
+{
+    const Node *n = root;
+    if (!n)
+        return ItemPointer();
+    while (n->right)
+        n = n->right;
+    return n->item;
+}
+
+int PlaylistIndex::indexOf(const ItemPointer &item) const
+{
+    return indexOf(item.data());
+}
+
+int PlaylistIndex::indexOf(const Item *item) const
+{
+    const Node *n = nodes.value(item, nullptr);
+    return n ? positionOf(n) : -1;
+}
+
+ItemPointer PlaylistIndex::after(const ItemPointer &item) const
+{
+    const Node *n = nodes.value(item.data(), nullptr);
+    if (!n || !(n = successor(n)))
+        return ItemPointer();
+    return n->item;
+}
+
+ItemPointer PlaylistIndex::before(const ItemPointer &item) const
+{
+    const Node *n = nodes.value(item.data(), nullptr);
+    if (!n || !(n = predecessor(n)))
+        return ItemPointer();
+    return n->item;
+}
+
+void PlaylistIndex::append(const ItemPointer &item)
+{
+    insert(count(), item);
+}
+
+void PlaylistIndex::insert(int index, const ItemPointer &item)
+{
+    if (item.isNull())
+        return;
+    insert(index, QList<ItemPointer>() << item);
+}
+
+void PlaylistIndex::insert(int index, const QList<ItemPointer> &items)
+{
+    QList<ItemPointer> fresh;
+    QSet<const Item *> seen;
+    fresh.reserve(items.count());
+    for (const ItemPointer &item : items) {
+        if (item.isNull() || seen.contains(item.data()))
+            continue;
+        seen.insert(item.data());
+        if (nodes.contains(item.data())) {
+            // An item may only occupy one position, so inserting it again
+            // moves it.  Removing it ahead of the insertion point shifts the
+            // insertion point left.
+            int position = indexOf(item);
+            if (position < index)
+                --index;
+            removeOne(item);
+        }
+        fresh.append(item);
+    }
+    if (fresh.isEmpty())
+        return;
+    index = qBound(0, index, count());
+
+    Node *l, *r;
+    split(root, index, l, r);
+    setRoot(merge(merge(l, build(fresh)), r));
+}
+
+bool PlaylistIndex::removeOne(const ItemPointer &item)
+{
+    Node *n = nodes.take(item.data());
+    if (!n)
+        return false;
+    unlink(n);
+    delete n;
+    return true;
+}
+
+ItemPointer PlaylistIndex::takeAt(int index)
+{
+    Node *n = nodeAt(index);
+    ItemPointer item = n->item;
+    nodes.remove(item.data());
+    unlink(n);
+    delete n;
+    return item;
+}
+
+ItemPointer PlaylistIndex::takeFirst()
+{
+    return takeAt(0);
+}
+
+void PlaylistIndex::moveRange(int from, int count, int to)
+{
+    // Move the items [from, from+count) so that the first of them ends up at
+    // position `to` in the resulting sequence.
+    int total = this->count();
+    if (from < 0 || count <= 0 || from + count > total)
+        return;
+    to = qBound(0, to, total - count);
+    if (to == from)
+        return;
+
+    Node *head, *middle, *tail, *rest;
+    split(root, from, head, rest);
+    split(rest, count, middle, tail);
+    rest = merge(head, tail);
+    split(rest, to, head, tail);
+    setRoot(merge(merge(head, middle), tail));
+}
+
+QList<ItemPointer> PlaylistIndex::removeMany(const QList<int> &indices)
+{
+    // One pass over the sequence, no matter how many items go.
+    QList<ItemPointer> removed;
+    QVector<Node*> run = flatten();
+    QVector<bool> doomed(run.count(), false);
+    for (int index : indices)
+        if (index >= 0 && index < run.count())
+            doomed[index] = true;
+
+    QVector<Node*> kept;
+    kept.reserve(run.count());
+    for (int index = 0; index < run.count(); ++index) {
+        Node *n = run[index];
+        if (!doomed[index]) {
+            kept.append(n);
+            continue;
+        }
+        removed.append(n->item);
+        nodes.remove(n->item.data());
+        delete n;
+    }
+    setRoot(assemble(kept));
+    return removed;
+}
+
+bool PlaylistIndex::reorder(const QVector<int> &permutation)
+{
+    // The item at position permutation[i] moves to position i.
+    QVector<Node*> run = flatten();
+    if (permutation.count() != run.count())
+        return false;
+
+    QVector<Node*> reordered(run.count(), nullptr);
+    for (int index = 0; index < permutation.count(); ++index) {
+        int source = permutation[index];
+        if (source < 0 || source >= run.count() || !run[source])
+            return false;
+        reordered[index] = run[source];
+        run[source] = nullptr;
+    }
+    setRoot(assemble(reordered));
+    return true;
+}
+
+void PlaylistIndex::clear()
+{
+    destroy(root);
+    root = nullptr;
+    nodes.clear();
+}
+
+void PlaylistIndex::swap(PlaylistIndex &other)
+{
+    std::swap(root, other.root);
+    nodes.swap(other.nodes);
+    std::swap(seed, other.seed);
+}
+
+QList<ItemPointer> PlaylistIndex::toList() const
+{
+    QList<ItemPointer> list;
+    list.reserve(count());
+    for (const ItemPointer &item : *this)
+        list.append(item);
+    return list;
+}
+
+int PlaylistIndex::nodeSize()
+{
+    // The hash entry pointing at the node is counted as well.
+    return int(sizeof(Node) + 2 * sizeof(void *));
+}
+
+PlaylistIndex::const_iterator PlaylistIndex::begin() const
+{
+    const Node *n = root;
+    while (n && n->left)
+        n = n->left;
+    return const_iterator(n);
+}
+
+PlaylistIndex::const_iterator PlaylistIndex::end() const
+{
+    return const_iterator(nullptr);
+}
+
+int PlaylistIndex::sizeOf(const Node *n)
+{
+    return n ? n->size : 0;
+}
+
+void PlaylistIndex::update(Node *n)
+{
+    n->size = 1 + sizeOf(n->left) + sizeOf(n->right);
+    if (n->left)
+        n->left->parent = n;
+    if (n->right)
+        n->right->parent = n;
+}
+
+const PlaylistIndex::Node *PlaylistIndex::successor(const Node *n)
+{
+    if (n->right) {
+        n = n->right;
+        while (n->left)
+            n = n->left;
+        return n;
+    }
+    while (n->parent && n->parent->right == n)
+        n = n->parent;
+    return n->parent;
+}
+
+const PlaylistIndex::Node *PlaylistIndex::predecessor(const Node *n)
+{
+    if (n->left) {
+        n = n->left;
+        while (n->right)
+            n = n->right;
+        return n;
+    }
+    while (n->parent && n->parent->left == n)
+        n = n->parent;
+    return n->parent;
+}
+
+void PlaylistIndex::destroy(Node *n)
+{
+    if (!n)
+        return;
+    destroy(n->left);
+    destroy(n->right);
+    delete n;
+}
+
+quint32 PlaylistIndex::nextPriority()
+{
+    // xorshift32; the treap only needs priorities that look random.
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+PlaylistIndex::Node *PlaylistIndex::newNode(const ItemPointer &item)
+{
+    Node *n = new Node;
+    n->item = item;
+    n->priority = nextPriority();
+    nodes.insert(item.data(), n);
+    return n;
+}
+
+PlaylistIndex::Node *PlaylistIndex::nodeAt(int index) const
+{
+    Node *n = root;
+    while (n) {
+        int leftSize = sizeOf(n->left);
+        if (index < leftSize) {
+            n = n->left;
+        } else if (index == leftSize) {
+            return n;
+        } else {
+            index -= leftSize + 1;
+            n = n->right;
+        }
+    }
+    Q_ASSERT_X(false, "PlaylistIndex::nodeAt", "index out of range");
+    return nullptr;
+}
+
+int PlaylistIndex::positionOf(const Node *n) const
+{
+    int position = sizeOf(n->left);
+    while (n->parent) {
+        if (n->parent->right == n)
+            position += sizeOf(n->parent->left) + 1;
+        n = n->parent;
+    }
+    return position;
+}
+
+void PlaylistIndex::split(Node *t, int k, Node *&l, Node *&r)
+{
+    // Split t so that l holds its first k elements and r holds the rest.
+    if (!t) {
+        l = r = nullptr;
+        return;
+    }
+    if (sizeOf(t->left) < k) {
+        split(t->right, k - sizeOf(t->left) - 1, t->right, r);
+        l = t;
+    } else {
+        split(t->left, k, l, t->left);
+        r = t;
+    }
+    update(t);
+}
+
+PlaylistIndex::Node *PlaylistIndex::merge(Node *l, Node *r)
+{
+    if (!l)
+        return r;
+    if (!r)
+        return l;
+    if (l->priority > r->priority) {
+        l->right = merge(l->right, r);
+        update(l);
+        return l;
+    }
+    r->left = merge(l, r->left);
+    update(r);
+    return r;
+}
+
+QVector<PlaylistIndex::Node*> PlaylistIndex::flatten() const
+{
+    QVector<Node*> run;
+    run.reserve(count());
+    Node *n = root;
+    while (n && n->left)
+        n = n->left;
+    for (; n; n = const_cast<Node*>(successor(n)))
+        run.append(n);
+    return run;
+}
+
+PlaylistIndex::Node *PlaylistIndex::build(const QList<ItemPointer> &items)
+{
+    QVector<Node*> run;
+    run.reserve(items.count());
+    for (const ItemPointer &item : items)
+        run.append(newNode(item));
+    return assemble(run);
+}
+
+PlaylistIndex::Node *PlaylistIndex::assemble(const QVector<Node*> &run)
+{
+    // Build a treap from an already-ordered run in linear time, using the
+    // usual stack construction of a cartesian tree over the priorities.
+    QVector<Node*> spine;
+    spine.reserve(64);
+    for (Node *n : run) {
+        n->left = n->right = n->parent = nullptr;
+        Node *lastPopped = nullptr;
+        while (!spine.isEmpty() && spine.last()->priority < n->priority) {
+            lastPopped = spine.takeLast();
+            // Everything popped is now final, so its size can be settled.
+            update(lastPopped);
+        }
+        n->left = lastPopped;
+        if (!spine.isEmpty())
+            spine.last()->right = n;
+        spine.append(n);
+    }
+    while (spine.count() > 1)
+        update(spine.takeLast());
+    if (spine.isEmpty())
+        return nullptr;
+    update(spine.first());
+    spine.first()->parent = nullptr;
+    return spine.first();
+}
+
+void PlaylistIndex::unlink(Node *n)
+{
+    Node *parent = n->parent;
+    Node *child = merge(n->left, n->right);
+    if (child)
+        child->parent = parent;
+    if (!parent) {
+        root = child;
+        return;
+    }
+    if (parent->left == n)
+        parent->left = child;
+    else
+        parent->right = child;
+    for (Node *p = parent; p; p = p->parent)
+        p->size = 1 + sizeOf(p->left) + sizeOf(p->right);
+}
+
+void PlaylistIndex::setRoot(Node *n)
+{
+    root = n;
+    if (root)
+        root->parent = nullptr;
+}
@@ -0,0 +1,115 @@
+#ifndef PLAYLISTINDEX_H
+#define PLAYLISTINDEX_H
+// An ordered sequence of playlist items with logarithmic positional access.
+//
+// Internally this is an implicit treap (an order-statistic tree where the
+// key is the in-order position) with parent links, plus a hash from item to
+// tree node.  The parent links let us answer "where is this item" by walking
+// up to the root instead of scanning the whole list, which is what made
+// next/previous stall on large playlists.
+
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <cstddef>
+#include <iterator>
+#include "itempool.h"
+
+class Item;
+
+class PlaylistIndex {
+    struct Node {
+        ItemPointer item;
+        Node *left = nullptr;
+        Node *right = nullptr;
+        Node *parent = nullptr;
+        int size = 1;
+        quint32 priority = 0;
+    };
+
+public:
+    class const_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef ItemPointer value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const ItemPointer *pointer;
+        typedef const ItemPointer &reference;
+
+        const_iterator(const Node *n = nullptr) : node(n) {}
+        reference operator*() const { return node->item; }
+        pointer operator->() const { return &node->item; }
+        const_iterator &operator++() { node = successor(node); return *this; }
+        const_iterator operator++(int) { auto i = *this; ++*this; return i; }
+        bool operator==(const const_iterator &o) const { return node == o.node; }
+        bool operator!=(const const_iterator &o) const { return node != o.node; }
+
+    private:
+        const Node *node;
+    };
+    typedef const_iterator iterator;
+
+    PlaylistIndex();
+    ~PlaylistIndex();
+
+    int count() const;
+    int size() const;
+    bool isEmpty() const;
+    bool contains(const ItemPointer &item) const;
+
+    ItemPointer at(int index) const;
+    ItemPointer value(int index) const;
+    ItemPointer first() const;
+    ItemPointer last() const;
+    int indexOf(const ItemPointer &item) const;
+    int indexOf(const Item *item) const;
+    ItemPointer after(const ItemPointer &item) const;
+    ItemPointer before(const ItemPointer &item) const;
+
+    void append(const ItemPointer &item);
+    void insert(int index, const ItemPointer &item);
+    void insert(int index, const QList<ItemPointer> &items);
+    bool removeOne(const ItemPointer &item);
+    ItemPointer takeAt(int index);
+    ItemPointer takeFirst();
+    void moveRange(int from, int count, int to);
+    QList<ItemPointer> removeMany(const QList<int> &indices);
+    bool reorder(const QVector<int> &permutation);
+    void clear();
+    // Trades contents with another index, without copying either.
+    void swap(PlaylistIndex &other);
+
+    QList<ItemPointer> toList() const;
+    // What the tree spends on each item, for estimates of memory use.
+    static int nodeSize();
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+private:
+    Q_DISABLE_COPY(PlaylistIndex)
+
+    static int sizeOf(const Node *n);
+    static void update(Node *n);
+    static const Node *successor(const Node *n);
+    static const Node *predecessor(const Node *n);
+    static void destroy(Node *n);
+
+    quint32 nextPriority();
+    Node *newNode(const ItemPointer &item);
+    Node *nodeAt(int index) const;
+    int positionOf(const Node *n) const;
+    void split(Node *t, int k, Node *&l, Node *&r);
+    Node *merge(Node *l, Node *r);
+    QVector<Node*> flatten() const;
+    Node *build(const QList<ItemPointer> &items);
+    static Node *assemble(const QVector<Node*> &run);
+    void unlink(Node *n);
+    void setRoot(Node *n);
+
+    Node *root = nullptr;
+    QHash<const Item *, Node *> nodes;
+    quint32 seed;
+};
+
+#endif // PLAYLISTINDEX_H
@@ -0,0 +1,265 @@
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+#include <QTextStream>
+#include <QUrl>
+#include <QXmlStreamReader>
+#include "playlistreader.h"
+#include "metadatacache.h"
+#include "playlist.h"
+
+// Gathers what a reader finds into batches, and hands each one out once it
+// is full.
+class ReaderFeed {
+public:
+    ReaderFeed(PlaylistReader *reader, int generation, QFile *file)
+        : reader(reader), generation(generation), file(file),
+          base(QFileInfo(file->fileName()).absoluteDir()),
+          cache(MetadataCache::getSingleton()), useCache(!cache->isEmpty()) {}
+
+    // False once the request has been cancelled.
+    bool add(const QUrl &url, const QVariantMap &metadata)
+    {
+        if (url.isEmpty())
+            return true;
+        ItemPointer item(new Item(url));
+        // What the playlist says goes over what is known of the file.
+        QVariantMap known;
+        if (url.isLocalFile() && useCache)
+            cache->lookup(url.toLocalFile(), &known);
+        for (auto it = metadata.constBegin(); it != metadata.constEnd(); ++it)
+            known.insert(it.key(), it.value());
+        if (!known.isEmpty())
+            item->setMetadata(known);
+        batch.append(item);
+        if (batch.count() < PlaylistReader::batchSize)
+            return true;
+        return flush();
+    }
+
+    bool add(const QString &location, const QVariantMap &metadata)
+    {
+        return add(resolve(location), metadata);
+    }
+
+    bool flush()
+    {
+        if (reader->cancelled(generation))
+            return false;
+        if (batch.isEmpty())
+            return true;
+        qint64 size = file->size();
+        int progress = size > 0 ? int(qMin(file->pos(), size) * 1000 / size)
+                                : 1000;
+        emit reader->itemsRead(generation, batch, progress);
+        batch.clear();
+        return true;
+    }
+
+    // Paths may be absolute, relative to the playlist, or urls.  A single
+    // letter before the colon is a drive rather than a scheme.
+    QUrl resolve(const QString &location) const
+    {
+        QUrl url(location);
+        if (url.isValid() && url.scheme().length() > 1)
+            return url;
+        QString path = QDir::fromNativeSeparators(location);
+        if (QDir::isRelativePath(path))
+            path = base.absoluteFilePath(path);
+        return QUrl::fromLocalFile(QDir::cleanPath(path));
+    }
+
+    // The same for the uris of XSPF, which are relative to the playlist's
+    // own uri.
+    QUrl resolveUri(const QString &uri) const
+    {
+        QUrl url(uri);
+        if (url.isRelative())
+            return QUrl::fromLocalFile(base.absolutePath() + "/").resolved(url);
+        return url;
+    }
+
+private:
+    PlaylistReader *reader;
+    int generation;
+    QFile *file;
+    QDir base;
+    QSharedPointer<MetadataCache> cache;
+    bool useCache;
+    QVector<ItemPointer> batch;
+};
+
+// What follows the colon of an #EXTINF line: the duration in seconds, any
+// attributes, and after the first comma outside quotes, the title.
+static QVariantMap extinfMetadata(const QString &info)
+{
+    int comma = -1;
+    bool quoted = false;
+    for (int i = 0; i < info.length() && comma < 0; ++i) {
+        if (info[i] == '"')
+            quoted = !quoted;
+        else if (info[i] == ',' && !quoted)
+            comma = i;
+    }
+    QVariantMap metadata;
+    QString head = comma < 0 ? info : info.left(comma);
+    bool ok = false;
+    double duration = head.section(' ', 0, 0, QString::SectionSkipEmpty).toDouble(&ok);
+    if (ok && duration > 0)
+        metadata.insert("duration", duration);
+    QString title = comma < 0 ? QString() : info.mid(comma + 1).trimmed();
+    if (!title.isEmpty())
+        metadata.insert("title", title);
+    return metadata;
+}
+
+static void readM3U(QFile &file, ReaderFeed &feed, bool utf8)
+{
+    QTextStream in(&file);
+    if (utf8)
+        in.setCodec("UTF-8");
+    QVariantMap metadata;
+    QString line;
+    while (in.readLineInto(&line)) {
+        line = line.trimmed();
+        if (line.isEmpty())
+            continue;
+        if (line.startsWith('#')) {
+            if (line.startsWith("#EXTINF:", Qt::CaseInsensitive))
+                metadata = extinfMetadata(line.mid(8));
+            continue;
+        }
+        if (!feed.add(line, metadata))
+            return;
+        metadata.clear();
+    }
+}
+
+// Entries are numbered, and each one's keys usually come together.  An
+// entry is handed out once a key of another turns up, so a key coming back
+// to an entry already handed out is ignored.
+static void readPLS(QFile &file, ReaderFeed &feed)
+{
+    QTextStream in(&file);
+    in.setCodec("UTF-8");
+    int current = -1;
+    QString location;
+    QVariantMap metadata;
+    auto handOut = [&]() {
+        bool going = location.isEmpty() || feed.add(location, metadata);
+        location.clear();
+        metadata.clear();
+        return going;
+    };
+
+    QString line;
+    while (in.readLineInto(&line)) {
+        int equals = line.indexOf('=');
+        if (equals < 0)
+            continue;
+        QString key = line.left(equals).trimmed().toLower();
+        QString value = line.mid(equals + 1).trimmed();
+        int digits = key.length();
+        while (digits > 0 && key[digits - 1].isDigit())
+            --digits;
+        bool ok = false;
+        int index = key.mid(digits).toInt(&ok);
+        if (!ok)
+            continue;
+        if (index != current) {
+            if (!handOut())
+                return;
+            current = index;
+        }
+        key.truncate(digits);
+        if (key == "file") {
+            location = value;
+        } else if (key == "title" && !value.isEmpty()) {
+            metadata.insert("title", value);
+        } else if (key == "length") {
+            double duration = value.toDouble(&ok);
+            if (ok && duration > 0)
+                metadata.insert("duration", duration);
+        }
+    }
+    handOut();
+}
+
+static void readXSPF(QFile &file, ReaderFeed &feed)
+{
+    QXmlStreamReader xml(&file);
+    while (!xml.atEnd()) {
+        xml.readNext();
+        if (!xml.isStartElement() || xml.name() != QLatin1String("track"))
+            continue;
+        QString location;
+        QVariantMap metadata;
+        while (xml.readNextStartElement()) {
+            QStringRef name = xml.name();
+            if (name == QLatin1String("location") && location.isEmpty()) {
+                location = xml.readElementText().trimmed();
+            } else if (name == QLatin1String("title")) {
+                metadata.insert("title", xml.readElementText().trimmed());
+            } else if (name == QLatin1String("creator")) {
+                metadata.insert("artist", xml.readElementText().trimmed());
+            } else if (name == QLatin1String("album")) {
+                metadata.insert("album", xml.readElementText().trimmed());
+            } else if (name == QLatin1String("duration")) {
+                bool ok = false;
+                qint64 ms = xml.readElementText().trimmed().toLongLong(&ok);
+                if (ok && ms > 0)
+                    metadata.insert("duration", ms / 1000.0);
+            } else {
+                xml.skipCurrentElement();
+            }
+        }
+        if (!location.isEmpty() && !feed.add(feed.resolveUri(location), metadata))
+            return;
+    }
+}
+
+
+
+PlaylistReader::PlaylistReader() : QObject(),
+    generation_(new QAtomicInt(0))
+{
+    qRegisterMetaType<QVector<ItemPointer>>("QVector<ItemPointer>");
+}
+
+int PlaylistReader::bump()
+{
+    return generation_->fetchAndAddOrdered(1) + 1;
+}
+
+bool PlaylistReader::cancelled(int generation) const
+{
+    return generation_->load() != generation;
+}
+
+void PlaylistReader::read(const QString &fileName, int generation)
+{
+    QFile file(fileName);
+    if (cancelled(generation) || !file.open(QIODevice::ReadOnly)) {
+        emit finished(generation);
+        return;
+    }
+
+    // Go by what the file starts with before its name, as playlists found
+    // on the web are often named for the script that served them.
+    QByteArray start = file.peek(256).trimmed().toLower();
+    QString suffix = QFileInfo(fileName).suffix().toLower();
+    ReaderFeed feed(this, generation, &file);
+    if (start.startsWith("[playlist]"))
+        readPLS(file, feed);
+    else if (start.startsWith("<?xml") || start.startsWith("<playlist"))
+        readXSPF(file, feed);
+    else if (suffix == "pls")
+        readPLS(file, feed);
+    else if (suffix == "xspf")
+        readXSPF(file, feed);
+    else
+        readM3U(file, feed, suffix == "m3u8");
+    feed.flush();
+    emit finished(generation);
+}
@@ -0,0 +1,47 @@
+#ifndef PLAYLISTREADER_H
+#define PLAYLISTREADER_H
+// Reads playlist files off the gui thread.
+//
+// M3U and M3U8, PLS and XSPF files are read a line or an element at a time,
+// and the items they name are handed out in batches as they are read, so a
+// long playlist starts filling its tab straight away.  Whatever the file
+// says about an item, such as the title and duration of an #EXTINF line,
+// goes into the item's metadata, so that it shows up without having to
+// probe the file.  Relative locations are taken relative to the playlist.
+//
+// Like PlaylistSorter, requests are tagged with a generation from bump(),
+// and a new request cancels the previous one at its next batch.
+
+#include <QAtomicInt>
+#include <QObject>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+#include "itempool.h"
+
+class Item;
+
+class PlaylistReader : public QObject {
+    Q_OBJECT
+public:
+    static const int batchSize = 1000;
+
+    PlaylistReader();
+    int bump();
+    bool cancelled(int generation) const;
+
+    // May be called from any thread.
+    void read(const QString &fileName, int generation);
+
+signals:
+    // The items are not in the item collection or any playlist yet.
+    // progress is how far through the file the reader is, out of 1000.
+    void itemsRead(int generation, QVector<ItemPointer> items,
+                   int progress);
+    void finished(int generation);
+
+private:
+    QSharedPointer<QAtomicInt> generation_;
+};
+
+#endif // PLAYLISTREADER_H
@@ -0,0 +1,144 @@
+#include <QCollator>
+#include <QThreadPool>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include "playlistsorter.h"
+#include "playlist.h"
+#include "paralleljobs.h"
+
+// Below this many items per job, handing work to the pool costs more than
+// it saves.
+static const int minimumRun = 4096;
+
+// Splits count items into ranges for parallel jobs to work on.
+static QVector<int> rangesFor(int count)
+{
+    int jobs = std::min(QThreadPool::globalInstance()->maxThreadCount() * 2,
+                        count / minimumRun);
+    jobs = std::max(jobs, 1);
+    QVector<int> bounds;
+    bounds.reserve(jobs + 1);
+    for (int job = 0; job <= jobs; ++job)
+        bounds.append(int(qint64(count) * job / jobs));
+    return bounds;
+}
+
+// The order of indices which sorts count items by less.  Runs of the order
+// are sorted in parallel, and neighbouring runs are then merged in parallel
+// rounds until there is one left.  Both steps are stable, and a merge takes
+// from the earlier run on ties, so equal items keep their order.
+template<class Less>
+static QVector<int> sortedOrder(int count, const Less &less)
+{
+    QVector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    QVector<int> bounds = rangesFor(count);
+    ParallelJobs::run(bounds.count() - 1, [&order, &bounds, &less](int run) {
+        std::stable_sort(order.begin() + bounds[run],
+                         order.begin() + bounds[run + 1], less);
+    });
+
+    QVector<int> merged(count);
+    while (bounds.count() > 2) {
+        int runs = bounds.count() - 1;
+        int jobs = (runs + 1) / 2;
+        ParallelJobs::run(jobs, [&order, &merged, &bounds, &less, runs](int job) {
+            int first = bounds[2 * job];
+            int middle = bounds[std::min(2 * job + 1, runs)];
+            int last = bounds[std::min(2 * job + 2, runs)];
+            std::merge(order.begin() + first, order.begin() + middle,
+                       order.begin() + middle, order.begin() + last,
+                       merged.begin() + first, less);
+        });
+        order.swap(merged);
+
+        QVector<int> fewer;
+        fewer.reserve(jobs + 1);
+        for (int index = 0; index < bounds.count(); index += 2)
+            fewer.append(bounds[index]);
+        if (fewer.last() != count)
+            fewer.append(count);
+        bounds.swap(fewer);
+    }
+    return order;
+}
+
+
+
+PlaylistSorter::PlaylistSorter() : QObject(),
+    generation_(new QAtomicInt(0))
+{
+
+}
+
+int PlaylistSorter::bump()
+{
+    return generation_->fetchAndAddOrdered(1) + 1;
+}
+
+bool PlaylistSorter::cancelled(int generation) const
+{
+    return generation_->load() != generation;
+}
+
+void PlaylistSorter::sortByText(QSharedPointer<Playlist> list, TextKey key,
+                                int generation)
+{
+    if (cancelled(generation) || list.isNull())
+        return;
+    auto snapshot = list->snapshot();
+    const QVector<ItemPointer> &items = snapshot->items();
+
+    // QCollatorSortKey cannot be default constructed, so each job fills a
+    // vector of its own, and the vectors are joined afterwards.
+    QVector<int> bounds = rangesFor(items.count());
+    std::vector<std::vector<QCollatorSortKey>> parts(bounds.count() - 1);
+    ParallelJobs::run(int(parts.size()), [&items, &bounds, &parts, &key](int job) {
+        // A collator sets itself up on first use, so jobs cannot share one.
+        QCollator collator;
+        collator.setNumericMode(true);
+        collator.setCaseSensitivity(Qt::CaseInsensitive);
+        std::vector<QCollatorSortKey> &part = parts[job];
+        part.reserve(bounds[job + 1] - bounds[job]);
+        for (int index = bounds[job]; index < bounds[job + 1]; ++index)
+            part.push_back(collator.sortKey(key(items[index])));
+    });
+    if (cancelled(generation))
+        return;
+
+    std::vector<QCollatorSortKey> keys;
+    keys.reserve(items.count());
+    for (std::vector<QCollatorSortKey> &part : parts) {
+        keys.insert(keys.end(), part.begin(), part.end());
+        part.clear();
+    }
+    QVector<int> permutation = sortedOrder(items.count(), [&keys](int a, int b) {
+        return keys[a].compare(keys[b]) < 0;
+    });
+    if (cancelled(generation))
+        return;
+    emit sorted(generation, snapshot->version(), permutation);
+}
+
+void PlaylistSorter::sortByNumber(QSharedPointer<Playlist> list, NumberKey key,
+                                  int generation)
+{
+    if (cancelled(generation) || list.isNull())
+        return;
+    auto snapshot = list->snapshot();
+    const QVector<ItemPointer> &items = snapshot->items();
+
+    QVector<qint64> keys(items.count());
+    QVector<int> bounds = rangesFor(items.count());
+    ParallelJobs::run(bounds.count() - 1, [&items, &bounds, &keys, &key](int job) {
+        for (int index = bounds[job]; index < bounds[job + 1]; ++index)
+            keys[index] = key(items[index]);
+    });
+    QVector<int> permutation = sortedOrder(items.count(), [&keys](int a, int b) {
+        return keys[a] < keys[b];
+    });
+    if (cancelled(generation))
+        return;
+    emit sorted(generation, snapshot->version(), permutation);
+}
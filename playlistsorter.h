@@ -0,0 +1,53 @@
+#ifndef PLAYLISTSORTER_H
+#define PLAYLISTSORTER_H
+// Sorts a playlist off the gui thread.
+//
+// Every item's key is worked out once, up front and in parallel; text is
+// turned into a collation key for the current locale in which runs of
+// digits compare by their value, so that "track 2" comes before "track 10"
+// and comparing two keys is little more than a memcmp.  The items' indices
+// are then put in order by a merge sort whose runs and merges are spread
+// over the global thread pool.  What comes out is the permutation to hand
+// to Playlist::reorder, so the playlist itself is only touched once, on the
+// gui thread.
+//
+// Like PlaylistSearcher, requests are tagged with a generation from bump(),
+// and a new request cancels the previous one.
+
+#include <QAtomicInt>
+#include <QObject>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+#include <functional>
+#include "itempool.h"
+
+class Item;
+class Playlist;
+
+class PlaylistSorter : public QObject {
+    Q_OBJECT
+public:
+    typedef std::function<QString(const ItemPointer &)> TextKey;
+    typedef std::function<qint64(const ItemPointer &)> NumberKey;
+
+    PlaylistSorter();
+    int bump();
+    bool cancelled(int generation) const;
+
+    // Both may be called from any thread, and may call their key function
+    // from several at once.
+    void sortByText(QSharedPointer<Playlist> list, TextKey key,
+                    int generation);
+    void sortByNumber(QSharedPointer<Playlist> list, NumberKey key,
+                      int generation);
+
+signals:
+    // version is that of the playlist the permutation was worked out for.
+    void sorted(int generation, int version, QVector<int> permutation);
+
+private:
+    QSharedPointer<QAtomicInt> generation_;
+};
+
+#endif // PLAYLISTSORTER_H
@@ -0,0 +1,299 @@
+#include <QDataStream>
+#include <QHash>
+#include <QReadLocker>
+#include <QSaveFile>
+#include <QVector>
+#include <climits>
+#include <cstring>
+#include "itempool.h"
+#include "playlist.h"
+#include "playliststore.h"
+
+// 'MPQL' when read in the byte order it was written in.
+static const quint32 storeMagic = 0x4d50514c;
+
+struct StoreHeader {
+    quint32 magic;
+    quint32 version;
+    quint32 recordSize;
+    quint32 stringEntrySize;
+    quint64 itemCount;
+    quint64 stringCount;
+    quint64 recordsAt;
+    quint64 stringIndexAt;
+    quint64 stringDataAt;
+    quint64 metadataAt;
+    quint64 extrasAt;
+    quint64 fileSize;
+};
+
+struct StoreRecord {
+    enum Flags { Named = 1, LocalFile = 2 };
+
+    quint8 uuid[16];
+    quint64 metadataOffset;
+    quint32 metadataSize;
+    quint32 prefix;
+    quint32 name;
+    quint32 flags;
+};
+
+struct StoreString {
+    // In bytes from the start of the text block, and in characters.
+    quint64 offset;
+    quint64 length;
+};
+
+// Keeps every section after the header on an eight byte boundary, so that
+// records and the string index can be read in place.
+static_assert(sizeof(StoreHeader) % 8 == 0, "header breaks alignment");
+static_assert(sizeof(StoreRecord) % 8 == 0, "record breaks alignment");
+static_assert(sizeof(StoreString) % 8 == 0, "string entry breaks alignment");
+
+static void padTo8(QByteArray &block)
+{
+    while (block.size() % 8)
+        block.append('\0');
+}
+
+PlaylistImage::~PlaylistImage()
+{
+    if (mapped)
+        file.unmap(mapped);
+}
+
+const char *PlaylistImage::data() const
+{
+    return mapped ? reinterpret_cast<const char *>(mapped) : bytes.constData();
+}
+
+qint64 PlaylistImage::size() const
+{
+    return size_;
+}
+
+
+
+bool PlaylistStore::save(const QString &fileName,
+                         const QSharedPointer<Playlist> &playlist)
+{
+    QByteArray records;
+    QByteArray stringIndex;
+    QByteArray stringData;
+    QByteArray metadata;
+    QByteArray extras;
+    QHash<QString, quint32> stringIds;
+    auto stringId = [&](const QString &text) -> quint32 {
+        auto it = stringIds.constFind(text);
+        if (it != stringIds.constEnd())
+            return *it;
+        StoreString entry;
+        entry.offset = quint64(stringData.size());
+        entry.length = quint64(text.size());
+        stringIndex.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+        stringData.append(reinterpret_cast<const char *>(text.constData()),
+                          text.size() * int(sizeof(QChar)));
+        quint32 id = quint32(stringIds.count());
+        stringIds.insert(text, id);
+        return id;
+    };
+
+    // Only the list is copied under the lock, so that writers wait on a
+    // pass over the pointers rather than on encoding every item.
+    QVector<ItemPointer> items;
+    QVariantMap qvm;
+    {
+        QReadLocker locker(&playlist->listLock);
+        qvm.insert("title", playlist->title_);
+        qvm.insert("shuffle", playlist->shuffle_);
+        if (playlist->shuffle_)
+            qvm.insert("shuffleState", playlist->shuffler.toVMap(playlist->items,
+                                                                 playlist->itemsById));
+        qvm.insert("uuid", playlist->uuid_);
+        items.reserve(playlist->items.count());
+        for (const ItemPointer &item : playlist->items)
+            items.append(item);
+    }
+    extras = encodeMetadata(qvm);
+
+    records.reserve(items.count() * int(sizeof(StoreRecord)));
+    for (const ItemPointer &item : items) {
+        StoreRecord record;
+        std::memset(&record, 0, sizeof(record));
+        if (const QUuid *named = item->uuid_.loadAcquire()) {
+            std::memcpy(record.uuid, named->toRfc4122().constData(),
+                        sizeof(record.uuid));
+            record.flags |= StoreRecord::Named;
+        }
+        if (item->localFile_)
+            record.flags |= StoreRecord::LocalFile;
+        record.prefix = stringId(item->urlPrefix_);
+        record.name = stringId(item->urlName_);
+        QByteArray encoded = item->encodedMetadata();
+        record.metadataOffset = quint64(metadata.size());
+        record.metadataSize = quint32(encoded.size());
+        metadata.append(encoded);
+        records.append(reinterpret_cast<const char *>(&record), sizeof(record));
+    }
+    padTo8(stringData);
+    padTo8(metadata);
+
+    StoreHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = storeMagic;
+    header.version = version;
+    header.recordSize = sizeof(StoreRecord);
+    header.stringEntrySize = sizeof(StoreString);
+    header.itemCount = quint64(records.size()) / sizeof(StoreRecord);
+    header.stringCount = quint64(stringIds.count());
+    header.recordsAt = sizeof(StoreHeader);
+    header.stringIndexAt = header.recordsAt + quint64(records.size());
+    header.stringDataAt = header.stringIndexAt + quint64(stringIndex.size());
+    header.metadataAt = header.stringDataAt + quint64(stringData.size());
+    header.extrasAt = header.metadataAt + quint64(metadata.size());
+    header.fileSize = header.extrasAt + quint64(extras.size());
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(records);
+    file.write(stringIndex);
+    file.write(stringData);
+    file.write(metadata);
+    file.write(extras);
+    return file.commit();
+}
+
+QSharedPointer<Playlist> PlaylistStore::load(const QString &fileName)
+{
+    QExplicitlySharedDataPointer<PlaylistImage> image(new PlaylistImage);
+    image->file.setFileName(fileName);
+    if (!image->file.open(QIODevice::ReadOnly))
+        return QSharedPointer<Playlist>();
+    image->size_ = image->file.size();
+#ifndef Q_OS_WIN
+    // Windows will not rename a file over one that is mapped, which is how
+    // the next save replaces it.
+    image->mapped = image->file.map(0, image->size_);
+#endif
+    if (!image->mapped) {
+        image->bytes = image->file.readAll();
+        image->file.close();
+        if (image->bytes.size() != image->size_)
+            return QSharedPointer<Playlist>();
+    }
+
+    const char *data = image->data();
+    quint64 size = quint64(image->size_);
+    StoreHeader header;
+    if (size < sizeof(header))
+        return QSharedPointer<Playlist>();
+    std::memcpy(&header, data, sizeof(header));
+    if (header.magic != storeMagic || header.version != version
+            || header.recordSize != sizeof(StoreRecord)
+            || header.stringEntrySize != sizeof(StoreString)
+            || header.fileSize != size
+            || header.itemCount > size / sizeof(StoreRecord)
+            || header.stringCount > size / sizeof(StoreString)
+            || header.recordsAt != sizeof(StoreHeader)
+            || header.stringIndexAt != header.recordsAt
+                                       + header.itemCount * sizeof(StoreRecord)
+            || header.stringDataAt != header.stringIndexAt
+                                      + header.stringCount * sizeof(StoreString)
+            || header.metadataAt < header.stringDataAt
+            || header.extrasAt < header.metadataAt
+            || header.fileSize < header.extrasAt)
+        return QSharedPointer<Playlist>();
+
+    // Everything is checked before any item is made, so that a damaged file
+    // leaves nothing behind.
+    auto records = reinterpret_cast<const StoreRecord *>(data + header.recordsAt);
+    auto strings = reinterpret_cast<const StoreString *>(data + header.stringIndexAt);
+    quint64 textSize = header.metadataAt - header.stringDataAt;
+    quint64 metadataSize = header.extrasAt - header.metadataAt;
+    for (quint64 i = 0; i < header.stringCount; ++i) {
+        const StoreString &s = strings[i];
+        if (s.offset % sizeof(QChar) || s.offset > textSize
+                || s.length > (textSize - s.offset) / sizeof(QChar)
+                || s.length > quint64(INT_MAX))
+            return QSharedPointer<Playlist>();
+    }
+    for (quint64 i = 0; i < header.itemCount; ++i) {
+        const StoreRecord &r = records[i];
+        if (r.prefix >= header.stringCount || r.name >= header.stringCount
+                || r.metadataOffset > metadataSize
+                || r.metadataSize > metadataSize - r.metadataOffset
+                || r.metadataSize > quint32(INT_MAX))
+            return QSharedPointer<Playlist>();
+    }
+    QVariantMap extras = decodeMetadata(data + header.extrasAt,
+                                        int(header.fileSize - header.extrasAt));
+
+    auto stringAt = [&](quint32 index) {
+        const StoreString &s = strings[index];
+        return QString(reinterpret_cast<const QChar *>(data + header.stringDataAt
+                                                       + s.offset),
+                       int(s.length));
+    };
+    QVector<QString> prefixes(int(header.stringCount));
+    QSharedPointer<Playlist> playlist(new Playlist);
+    {
+        Playlist::WriteLocker locker(playlist.data());
+        playlist->title_ = extras.value("title").toString();
+        playlist->shuffle_ = extras.value("shuffle").toBool();
+        // The quick playlist's uuid is null, and stays that way.
+        if (extras.contains("uuid"))
+            playlist->uuid_ = extras.value("uuid").toUuid();
+
+        QList<ItemPointer> newItems;
+        newItems.reserve(int(header.itemCount));
+        for (quint64 i = 0; i < header.itemCount; ++i) {
+            const StoreRecord &r = records[i];
+            ItemPointer item(new Item());
+            item->setPlaylistUuid(playlist->uuid_);
+            QString &prefix = prefixes[int(r.prefix)];
+            if (prefix.isNull())
+                prefix = StringPool::intern(stringAt(r.prefix));
+            item->urlPrefix_ = prefix;
+            item->urlName_ = stringAt(r.name);
+            item->localFile_ = r.flags & StoreRecord::LocalFile;
+            if (r.flags & StoreRecord::Named)
+                item->setUuid(QUuid::fromRfc4122(QByteArray::fromRawData(
+                        reinterpret_cast<const char *>(r.uuid), sizeof(r.uuid))));
+            if (r.metadataSize) {
+                item->metadataImage_ = image;
+                item->metadataOffset_ = header.metadataAt + r.metadataOffset;
+                item->metadataSize_ = r.metadataSize;
+            }
+            newItems.append(item);
+        }
+        playlist->adopt_(newItems, extras.value("shuffleState").toMap());
+    }
+    return playlist;
+}
+
+QByteArray PlaylistStore::encodeMetadata(const QVariantMap &qvm)
+{
+    QByteArray bytes;
+    if (qvm.isEmpty())
+        return bytes;
+    QDataStream stream(&bytes, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << qvm;
+    return bytes;
+}
+
+QVariantMap PlaylistStore::decodeMetadata(const char *data, int size)
+{
+    QVariantMap qvm;
+    if (size <= 0)
+        return qvm;
+    QByteArray bytes = QByteArray::fromRawData(data, size);
+    QDataStream stream(bytes);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream >> qvm;
+    if (stream.status() != QDataStream::Ok)
+        return QVariantMap();
+    return qvm;
+}
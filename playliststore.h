@@ -0,0 +1,63 @@
+#ifndef PLAYLISTSTORE_H
+#define PLAYLISTSTORE_H
+// The binary form playlists are saved in.
+//
+// A file starts with a fixed header, followed by one fixed-size record per
+// item, a string table and the items' metadata.  A record refers to its
+// url's prefix and name by their index in the string table, and to its
+// metadata by offset and length; the table itself is an index of offsets
+// into a block of UTF-16 text, each distinct string stored once.  So loading
+// a playlist is mapping the file into memory and walking the records, with
+// no parsing: each prefix is turned into a string once however many items
+// share it, and an item's metadata is only decoded when something first
+// asks for it.  Until then the item holds on to the mapped file, which is
+// unmapped once the last item loaded from it has let go.
+//
+// Everything is written in the byte order of the machine writing it, and a
+// file from another is refused, as is one from a version this does not
+// know.  JSON, through Playlist::toVMap and fromVMap, remains the form
+// playlists are exchanged and migrated in.
+
+#include <QByteArray>
+#include <QFile>
+#include <QSharedData>
+#include <QSharedPointer>
+#include <QString>
+#include <QVariantMap>
+
+class Playlist;
+
+// The bytes of a saved playlist, mapped if the platform allows replacing a
+// file while it is mapped, or otherwise read into memory.  Shared by the
+// items loaded from it through QExplicitlySharedDataPointer, which keeps
+// their hold on it to one pointer each.
+class PlaylistImage : public QSharedData {
+public:
+    ~PlaylistImage();
+
+    const char *data() const;
+    qint64 size() const;
+
+private:
+    QFile file;
+    uchar *mapped = nullptr;
+    QByteArray bytes;
+    qint64 size_ = 0;
+
+    friend class PlaylistStore;
+};
+
+class PlaylistStore {
+public:
+    static const quint32 version = 1;
+
+    static bool save(const QString &fileName,
+                     const QSharedPointer<Playlist> &playlist);
+    // Null if the file is missing, damaged or of a version not understood.
+    static QSharedPointer<Playlist> load(const QString &fileName);
+
+    static QByteArray encodeMetadata(const QVariantMap &qvm);
+    static QVariantMap decodeMetadata(const char *data, int size);
+};
+
+#endif // PLAYLISTSTORE_H
@@ -1,16 +1,26 @@
 #include <QAction>
 #include <QClipboard>
+#include <QCursor>
 #include <QDragEnterEvent>
 #include <QGuiApplication>
 #include <QMimeData>
 #include <QInputDialog>
 #include <QFileDialog>
 #include <QMenu>
+#include <QProgressDialog>
 #include <QThread>
+#include <QTimer>
+#include <algorithm>
+#include <numeric>
 #include "playlistwindow.h"
 #include "ui_playlistwindow.h"
+#include "directoryscanner.h"
 #include "drawnplaylist.h"
+#include "mediaprobe.h"
+#include "metadatacache.h"
 #include "playlist.h"
+#include "playlistreader.h"
+#include "thumbnailer.h"
 #include "platform/unify.h"
 
 PlaylistWindow::PlaylistWindow(QWidget *parent) :
@@ -21,6 +31,16 @@ PlaylistWindow::PlaylistWindow(QWidget *parent) :
     randomGenerator(randomDevice())
 {
     clipboard = new PlaylistSelection;
+    // Reads and scans run on the shared pool and may outlive the window, so
+    // these go away once the last of them lets go.
+    reader = QSharedPointer<PlaylistReader>(new PlaylistReader(),
+                                            &QObject::deleteLater);
+    scanner = QSharedPointer<DirectoryScanner>(new DirectoryScanner(),
+                                               &QObject::deleteLater);
+    probe = QSharedPointer<MediaProbe>(new MediaProbe(), &QObject::deleteLater);
+    thumbnailer = QSharedPointer<Thumbnailer>(new Thumbnailer(),
+                                              &QObject::deleteLater);
+    thumbnails = new ThumbnailCache;
 
     ui->setupUi(this);
     setObjectName("playlistWindow");
@@ -37,8 +57,13 @@ PlaylistWindow::PlaylistWindow(QWidget *parent) :
 
 PlaylistWindow::~PlaylistWindow()
 {
+    reader->bump();
+    scanner->cancelAll();
+    probe->stop();
+    thumbnailer->stop();
     delete ui;
     delete clipboard;
+    delete thumbnails;
 }
 
 void PlaylistWindow::setCurrentPlaylist(QUuid what)
@@ -59,15 +84,40 @@ void PlaylistWindow::clearPlaylist(QUuid what)
 
 QPair<QUuid, QUuid> PlaylistWindow::addToPlaylist(const QUuid &playlist, const QList<QUrl> &what)
 {
-    QList<QUrl> filtered = Helpers::filterUrls(what);
     QPair<QUuid, QUuid> info;
     auto qdp = widgets.contains(playlist) ? widgets.value(playlist) : widgets[QUuid()];
+    if (DirectoryScanner::needsWalking(what)) {
+        int scan = scanner->nextScan();
+        scanTargets.insert(scan, qdp->uuid());
+        if (!scanProgress)
+            scanProgress = makeProgressDialog(tr("Scanning folders..."),
+                                              &PlaylistWindow::cancelScans);
+        if (scanTargets.count() == 1) {
+            scanProgress->reset();
+            scanProgress->setValue(0);
+        }
+        QSharedPointer<DirectoryScanner> scanner = this->scanner;
+        scanQueue.post([scanner, what, scan]() {
+            scanner->scan(what, scan);
+        });
+        info.first = qdp->uuid();
+        return info;
+    }
+
+    // With no folders to walk, this is only a look at each name.
+    QList<QUrl> filtered = Helpers::filterUrls(what);
+    auto pl = qdp->playlist();
+    if (pl)
+        pl->openUndoGroup();
     for (QUrl &url : filtered) {
         QPair<QUuid,QUuid> itemInfo = qdp->importUrl(url);
         if (info.second.isNull())
             info = itemInfo;
     }
+    if (pl)
+        pl->closeUndoGroup();
     updatePlaylistHasItems();
+    probePlaylist(qdp);
     return info;
 }
 
@@ -78,19 +128,31 @@ QPair<QUuid, QUuid> PlaylistWindow::addToCurrentPlaylist(QList<QUrl> what)
 
 QPair<QUuid, QUuid> PlaylistWindow::urlToQuickPlaylist(QUrl what)
 {
-    auto pl = PlaylistCollection::getSingleton()->playlistOf(QUuid());
-    pl->clear();
-    widgets[QUuid()]->clear();
+    widgets[QUuid()]->removeAll();
     ui->tabWidget->setCurrentWidget(widgets[QUuid()]);
     return addToCurrentPlaylist(QList<QUrl>() << what);
 }
 
+bool PlaylistWindow::isScanning(const QUuid &playlist) const
+{
+    for (const QUuid &target : scanTargets)
+        if (target == playlist)
+            return true;
+    return false;
+}
+
 bool PlaylistWindow::isCurrentPlaylistEmpty()
 {
     auto pl = PlaylistCollection::getSingleton()->playlistOf(currentPlaylist);
     return pl ? pl->isEmpty() : true;
 }
 
+QUuid PlaylistWindow::currentPlaylistUuid()
+{
+    auto qdp = currentPlaylistWidget();
+    return qdp ? qdp->uuid() : QUuid();
+}
+
 bool PlaylistWindow::isPlaylistSingularFile(QUuid list)
 {
     auto pl = PlaylistCollection::getSingleton()->playlistOf(list);
@@ -117,13 +179,11 @@ QPair<QUuid,QUuid> PlaylistWindow::getItemAfter(QUuid list, QUuid item)
     QPair<QUuid, QUuid> next = qpl->takeFirst();
     if (!next.second.isNull())
         return next;
-    QSharedPointer<Item> after;
-    if (pl->shuffle() && !pl->isEmpty()) {
-        std::uniform_int_distribution<> itemDistribution(0, pl->count()-1);
-        after = pl->itemAt(itemDistribution(randomGenerator));
-    } else {
+    ItemPointer after;
+    if (pl->shuffle())
+        after = pl->shuffledItemAfter(item);
+    else
         after = pl->itemAfter(item);
-    }
     if (!after)
         return { QUuid(), QUuid() };
     return { pl->uuid(), after->uuid() };
@@ -134,7 +194,12 @@ QUuid PlaylistWindow::getItemBefore(QUuid list, QUuid item)
     auto pl = PlaylistCollection::getSingleton()->playlistOf(list);
     if (!pl)
         return QUuid();
-    QSharedPointer<Item> before = pl->itemBefore(item);
+    ItemPointer before;
+    if (pl->shuffle())
+        before = pl->shuffledItemBefore(item);
+    // At the start of the shuffle history, go by position instead.
+    if (!before)
+        before = pl->itemBefore(item);
     if (!before)
         return QUuid();
     return before->uuid();
@@ -168,12 +233,29 @@ void PlaylistWindow::setMetadata(QUuid list, QUuid item, const QVariantMap &map)
     auto i = pl->itemOf(item);
     if (!i)
         return;
-    i->setMetadata(map);
-
-    auto qdp = currentPlaylistWidget();
-    if (qdp->uuid() == list)
-        qdp->viewport()->update();
+    // Playing a file tells us its tags, but not what a probe found out.
+    QVariantMap merged = i->metadata();
+    for (auto it = map.constBegin(); it != map.constEnd(); ++it)
+        merged.insert(it.key(), it.value());
+    i->setMetadata(merged);
+    QUrl url = i->url();
+    if (url.isLocalFile()) {
+        // Added to what is kept, as the item may not know what a probe of
+        // the file found.
+        auto cache = MetadataCache::getSingleton();
+        QVariantMap kept;
+        cache->lookup(url.toLocalFile(), &kept);
+        for (auto it = merged.constBegin(); it != merged.constEnd(); ++it)
+            kept.insert(it.key(), it.value());
+        cache->store(url.toLocalFile(), kept);
+    }
+    pl->reindexItem(i);
+    PlaylistCollection::getSingleton()->queuePlaylist()->reindexItem(i);
 
+    auto qdp = widgets.value(list, nullptr);
+    if (qdp)
+        qdp->refreshItem(item);
+    queueWidget->refreshItem(item);
 }
 
 void PlaylistWindow::replaceItem(QUuid list, QUuid item, const QList<QUrl> &urls)
@@ -198,6 +280,8 @@ void PlaylistWindow::replaceItem(QUuid list, QUuid item, const QList<QUrl> &urls
         qdp->viewport()->update();
 
     updatePlaylistHasItems();
+    if (listWidget)
+        probePlaylist(listWidget);
 }
 
 int PlaylistWindow::extraPlayTimes(QUuid list, QUuid item)
@@ -242,13 +326,13 @@ void PlaylistWindow::tabsFromVList(const QVariantList &qvl)
                 this, &PlaylistWindow::itemDesired);
         connect(qdp, &DrawnPlaylist::contextMenuRequested,
                 this, &PlaylistWindow::playlist_contextMenuRequested);
-        auto pl = PlaylistCollection::getSingleton()->playlistOf(qdp->uuid());
-        ui->tabWidget->addTab(qdp, pl->title());
-        widgets.insert(pl->uuid(), qdp);
+        ui->tabWidget->addTab(qdp, qdp->title());
+        widgets.insert(qdp->uuid(), qdp);
     }
     if (widgets.count() < 1)
         addNewTab(QUuid(), tr("Quick Playlist"));
     updatePlaylistHasItems();
+    QTimer::singleShot(prefetchDelay, this, &PlaylistWindow::prefetchTabs);
 }
 
 bool PlaylistWindow::eventFilter(QObject *obj, QEvent *event)
@@ -308,6 +392,18 @@ void PlaylistWindow::connectSignalsToSlots()
 {
     connect(this, &PlaylistWindow::visibilityChanged,
             this, &PlaylistWindow::self_visibilityChanged);
+    connect(reader.data(), &PlaylistReader::itemsRead,
+            this, &PlaylistWindow::reader_itemsRead, Qt::QueuedConnection);
+    connect(reader.data(), &PlaylistReader::finished,
+            this, &PlaylistWindow::reader_finished, Qt::QueuedConnection);
+    connect(scanner.data(), &DirectoryScanner::itemsFound,
+            this, &PlaylistWindow::scanner_itemsFound, Qt::QueuedConnection);
+    connect(scanner.data(), &DirectoryScanner::finished,
+            this, &PlaylistWindow::scanner_finished, Qt::QueuedConnection);
+    connect(probe.data(), &MediaProbe::probed,
+            this, &PlaylistWindow::probe_probed, Qt::QueuedConnection);
+    connect(thumbnailer.data(), &Thumbnailer::thumbnailed,
+            this, &PlaylistWindow::thumbnailer_thumbnailed, Qt::QueuedConnection);
     connect(this, &PlaylistWindow::dockLocationChanged,
             this, &PlaylistWindow::self_dockLocationChanged);
     connect(this->toggleViewAction(), &QAction::toggled,
@@ -343,6 +439,7 @@ void PlaylistWindow::updateCurrentPlaylist()
     setTabOrder(ui->tabWidget->focusProxy(), qdp);
     setTabOrder(qdp, ui->searchField);
     updatePlaylistHasItems();
+    probePlaylist(qdp);
 }
 
 void PlaylistWindow::updatePlaylistHasItems()
@@ -350,9 +447,16 @@ void PlaylistWindow::updatePlaylistHasItems()
     auto qdp = currentPlaylistWidget();
     if (!qdp)
         return;
+    qdp->populate();
     emit currentPlaylistHasItems(qdp->count() > 0);
 }
 
+void PlaylistWindow::probePlaylist(DrawnPlaylist *qdp)
+{
+    if (auto pl = qdp->playlist())
+        probe->request(qdp->uuid(), pl->snapshot()->items());
+}
+
 void PlaylistWindow::setPlaylistFilters(QString filterText)
 {
     for (auto &widget : widgets) {
@@ -365,15 +469,49 @@ void PlaylistWindow::addNewTab(QUuid playlist, QString title)
 {
     auto qdp = new DrawnPlaylist();
     qdp->setDisplayParser(&displayParser);
+    qdp->setThumbnails(showThumbnails ? thumbnails : nullptr);
     qdp->setUuid(playlist);
     connect(qdp, &DrawnPlaylist::itemDesired, this, &PlaylistWindow::itemDesired);
     connect(qdp, &DrawnPlaylist::contextMenuRequested,
             this, &PlaylistWindow::playlist_contextMenuRequested);
+    connect(qdp, &DrawnPlaylist::visibleRowsChanged,
+            this, &PlaylistWindow::playlist_visibleRowsChanged);
     widgets.insert(playlist, qdp);
     ui->tabWidget->addTab(qdp, title);
     ui->tabWidget->setCurrentWidget(qdp);
 }
 
+void PlaylistWindow::prefetchTabs()
+{
+    auto collection = PlaylistCollection::getSingleton();
+    QList<DrawnPlaylist*> waiting;
+    for (DrawnPlaylist *qdp : widgets)
+        if (qdp->lastUsed() > 0 && collection->isDeferred(qdp->uuid()))
+            waiting.append(qdp);
+    std::sort(waiting.begin(), waiting.end(),
+              [](DrawnPlaylist *a, DrawnPlaylist *b) {
+        return a->lastUsed() > b->lastUsed();
+    });
+    for (int i = 0; i < waiting.count() && i < prefetchCount; ++i) {
+        QUuid uuid = waiting[i]->uuid();
+        prefetchQueue.post([uuid]() {
+            PlaylistCollection::getSingleton()->playlistOf(uuid);
+        });
+    }
+}
+
+QProgressDialog *PlaylistWindow::makeProgressDialog(const QString &label,
+                                                   void (PlaylistWindow::*cancel)())
+{
+    // It shows itself if the work looks like taking more than a moment.
+    auto dialog = new QProgressDialog(label, tr("Cancel"), 0, 1000, this);
+    dialog->setWindowModality(Qt::NonModal);
+    dialog->setAutoClose(false);
+    dialog->setAutoReset(false);
+    connect(dialog, &QProgressDialog::canceled, this, cancel);
+    return dialog;
+}
+
 void PlaylistWindow::addQuickQueue()
 {
     queueWidget = new DrawnQueue();
@@ -417,18 +555,222 @@ void PlaylistWindow::changePlaylistSelection( QUrl itemUrl, QUuid playlistUuid,
     }
 }
 
-void PlaylistWindow::addSimplePlaylist(QStringList data)
+void PlaylistWindow::importPlaylistFile(const QString &fileName)
 {
-
+    // Starting another import cancels this one, and whatever was read of
+    // it stays in its tab.
     auto pl = PlaylistCollection::getSingleton()->newPlaylist(tr("New Playlist"));
-    pl->fromStringList(data);
     addNewTab(pl->uuid(), pl->title());
+    importTarget = pl->uuid();
+    importGeneration = reader->bump();
+    if (!importProgress)
+        importProgress = makeProgressDialog(tr("Importing playlist..."),
+                                            &PlaylistWindow::cancelImport);
+    importProgress->setMaximum(1000);
+    importProgress->reset();
+    importProgress->setValue(0);
+
+    QSharedPointer<PlaylistReader> reader = this->reader;
+    int generation = importGeneration;
+    importQueue.post([reader, fileName, generation]() {
+        reader->read(fileName, generation);
+    });
+}
+
+void PlaylistWindow::addSimplePlaylist(const QUuid &playlistUuid,
+                                       const QVector<ItemPointer> &items)
+{
+    auto pl = PlaylistCollection::getSingleton()->playlistOf(playlistUuid);
+    if (!pl)
+        return;
+    auto collection = ItemCollection::getSingleton();
+    QList<ItemPointer> list = items.toList();
+    for (const ItemPointer &item : list)
+        collection->storeItem(item);
+    pl->insertMany(pl->count(), list);
+    auto qdp = widgets.value(playlistUuid, nullptr);
+    if (qdp)
+        qdp->appendItems(list);
+    updatePlaylistHasItems();
+    // Only what just arrived, as asking for the whole playlist after every
+    // batch would go over it again each time.
+    probe->append(playlistUuid, items);
+}
+
+void PlaylistWindow::cancelImport()
+{
+    importGeneration = reader->bump();
+    importProgress->reset();
+}
+
+void PlaylistWindow::reader_itemsRead(int generation,
+                                      const QVector<ItemPointer> &items,
+                                      int progress)
+{
+    if (generation != importGeneration)
+        return;
+    addSimplePlaylist(importTarget, items);
+    importProgress->setValue(progress);
+}
+
+void PlaylistWindow::reader_finished(int generation)
+{
+    if (generation != importGeneration)
+        return;
+    importProgress->reset();
+}
+
+void PlaylistWindow::cancelScans()
+{
+    scanner->cancelAll();
+    scanTargets.clear();
+    scanProgress->reset();
+}
+
+void PlaylistWindow::scanner_itemsFound(int scan,
+                                        const QVector<ItemPointer> &items,
+                                        int foldersDone, int foldersFound)
+{
+    if (!scanTargets.contains(scan))
+        return;
+    QUuid target = scanTargets.value(scan);
+    if (!widgets.contains(target))
+        return;
+    addSimplePlaylist(target, items);
+    scanProgress->setMaximum(foldersFound);
+    scanProgress->setValue(foldersDone);
+    emit itemsScanned(target, items.first());
+}
+
+void PlaylistWindow::scanner_finished(int scan)
+{
+    scanTargets.remove(scan);
+    if (scanTargets.isEmpty() && scanProgress)
+        scanProgress->reset();
+}
+
+void PlaylistWindow::probe_probed(const QUuid &playlistUuid,
+                                  const ItemPointer &item,
+                                  const QVariantMap &metadata)
+{
+    // What the item already knows, say from playing it or from the playlist
+    // file it came in, stays as it is.
+    QVariantMap merged = metadata;
+    QVariantMap known = item->metadata();
+    for (auto it = known.constBegin(); it != known.constEnd(); ++it)
+        merged.insert(it.key(), it.value());
+    item->setMetadata(merged);
+
+    // Looked up by id, so that an item is never named just to find it.
+    auto pl = PlaylistCollection::getSingleton()->playlistIfLoaded(playlistUuid);
+    if (pl && pl->itemOf(item->id()) == item)
+        pl->reindexItem(item);
+    auto queue = PlaylistCollection::getSingleton()->queuePlaylist();
+    if (queue->itemOf(item->id()) == item)
+        queue->reindexItem(item);
+    auto qdp = widgets.value(playlistUuid, nullptr);
+    if (qdp)
+        qdp->refreshItem(item.data());
+    queueWidget->refreshItem(item.data());
+}
+
+void PlaylistWindow::playlist_visibleRowsChanged(const QUuid &playlistUuid)
+{
+    auto qdp = widgets.value(playlistUuid, nullptr);
+    if (!qdp || playlistUuid != currentPlaylist)
+        return;
+    QVector<ItemPointer> items = qdp->visibleItems();
+    probe->prioritise(playlistUuid, items);
+    if (!showThumbnails)
+        return;
+    // Asking for just the rows on screen drops those scrolled past.
+    QStringList fileNames;
+    for (const ItemPointer &item : items) {
+        QUrl url = item->url();
+        if (url.isLocalFile() && !thumbnails->contains(url.toLocalFile()))
+            fileNames.append(url.toLocalFile());
+    }
+    thumbnailer->request(fileNames);
+}
+
+void PlaylistWindow::thumbnailer_thumbnailed(const QString &fileName,
+                                             const QImage &image)
+{
+    if (!showThumbnails)
+        return;
+    thumbnails->insert(fileName, image);
+    if (image.isNull())
+        return;
+    if (auto qdp = currentPlaylistWidget())
+        qdp->viewport()->update();
+}
+
+void PlaylistWindow::setUndoBudget(int megabytes)
+{
+    PlaylistCollection::getSingleton()->setUndoBudget(qint64(megabytes) * 1024 * 1024);
+}
+
+void PlaylistWindow::setShowThumbnails(bool yes)
+{
+    if (showThumbnails == yes)
+        return;
+    showThumbnails = yes;
+    if (!yes) {
+        thumbnailer->request(QStringList());
+        thumbnails->clear();
+    }
+    for (DrawnPlaylist *qdp : widgets)
+        qdp->setThumbnails(yes ? thumbnails : nullptr);
+}
+
+bool PlaylistWindow::undoPlaylist(const QUuid &playlistUuid)
+{
+    auto qdp = widgets.value(playlistUuid, nullptr);
+    if (!qdp || !qdp->undo())
+        return false;
+    queueWidget->viewport()->update();
+    updatePlaylistHasItems();
+    probePlaylist(qdp);
+    return true;
+}
+
+bool PlaylistWindow::redoPlaylist(const QUuid &playlistUuid)
+{
+    auto qdp = widgets.value(playlistUuid, nullptr);
+    if (!qdp || !qdp->redo())
+        return false;
+    queueWidget->viewport()->update();
+    updatePlaylistHasItems();
+    probePlaylist(qdp);
+    return true;
+}
+
+bool PlaylistWindow::undoQueue()
+{
+    if (!queueWidget->undo())
+        return false;
+    if (auto qdp = currentPlaylistWidget())
+        qdp->viewport()->update();
+    return true;
+}
+
+bool PlaylistWindow::redoQueue()
+{
+    if (!queueWidget->redo())
+        return false;
+    if (auto qdp = currentPlaylistWidget())
+        qdp->viewport()->update();
+    return true;
 }
 
 void PlaylistWindow::setDisplayFormatSpecifier(QString fmt)
 {
+    displayFormat = fmt;
     displayParser.takeFormatString(fmt);
-    ui->tabWidget->currentWidget()->update();
+    for (DrawnPlaylist *qdp : widgets)
+        qdp->invalidateDisplay();
+    if (queueWidget)
+        queueWidget->invalidateDisplay();
 }
 
 void PlaylistWindow::newTab()
@@ -464,7 +806,7 @@ void PlaylistWindow::importTab()
 {
     QString file;
     file = QFileDialog::getOpenFileName(this, tr("Import File"), QString(),
-                                        tr("Playlist files (*.m3u *.m3u8)"));
+                                        tr("Playlist files (*.m3u *.m3u8 *.pls *.xspf)"));
     if (!file.isEmpty())
         emit importPlaylist(file);
 }
@@ -535,11 +877,8 @@ void PlaylistWindow::selectPrevious()
 void PlaylistWindow::incExtraPlayTimes()
 {
     auto qdp = currentPlaylistWidget();
-    auto pl = PlaylistCollection::getSingleton()->playlistOf(qdp->uuid());
-    auto incrementer = [pl](QUuid uuid) {
-        auto item = pl->itemOf(uuid);
-        if (Q_LIKELY(!item.isNull()))
-            item->incExtraPlayTimes();
+    auto incrementer = [](ItemPointer item) {
+        item->incExtraPlayTimes();
     };
     qdp->traverseSelected(incrementer);
     qdp->viewport()->update();
@@ -548,11 +887,8 @@ void PlaylistWindow::incExtraPlayTimes()
 void PlaylistWindow::decExtraPlayTimes()
 {
     auto qdp = currentPlaylistWidget();
-    auto pl = PlaylistCollection::getSingleton()->playlistOf(qdp->uuid());
-    auto decrementer = [pl](QUuid uuid) {
-        auto item = pl->itemOf(uuid);
-        if (Q_LIKELY(!item.isNull()))
-            item->decExtraPlayTimes();
+    auto decrementer = [](ItemPointer item) {
+        item->decExtraPlayTimes();
     };
     qdp->traverseSelected(decrementer);
     qdp->viewport()->update();
@@ -561,11 +897,8 @@ void PlaylistWindow::decExtraPlayTimes()
 void PlaylistWindow::zeroExtraPlayTimes()
 {
     auto qdp = currentPlaylistWidget();
-    auto pl = PlaylistCollection::getSingleton()->playlistOf(qdp->uuid());
-    auto zeroer = [pl](QUuid uuid) {
-        auto item = pl->itemOf(uuid);
-        if (Q_LIKELY(!item.isNull()))
-            item->setExtraPlayTimes(0);
+    auto zeroer = [](ItemPointer item) {
+        item->setExtraPlayTimes(0);
     };
     qdp->traverseSelected(zeroer);
     qdp->viewport()->update();
@@ -658,6 +991,48 @@ void PlaylistWindow::finishSearch()
     ui->searchHost->setVisible(false);
 }
 
+void PlaylistWindow::searchAllPlaylists()
+{
+    bool ok;
+    QString text = QInputDialog::getText(this, tr("Search All Playlists"),
+                                         tr("Search for"), QLineEdit::Normal,
+                                         QString(), &ok);
+    if (!ok || text.isEmpty())
+        return;
+
+    auto collection = PlaylistCollection::getSingleton();
+    QMenu *m = new QMenu(this);
+    for (const PlaylistCollection::SearchResult &r : collection->search(text, 50)) {
+        auto pl = collection->playlistOf(r.playlist);
+        auto item = pl ? pl->itemOf(r.item) : ItemPointer();
+        if (!item)
+            continue;
+        QString label = displayParser.parseMetadata(item->metadata(),
+                                                    item->toDisplayString(),
+                                                    Helpers::VideoFile);
+        QAction *a = m->addAction(QString("%1\t%2").arg(label, pl->title()));
+        QUuid playlistUuid = r.playlist;
+        QUuid itemUuid = r.item;
+        connect(a, &QAction::triggered, this, [this, playlistUuid, itemUuid]() {
+            revealItem(playlistUuid, itemUuid);
+        });
+    }
+    if (m->isEmpty())
+        m->addAction(tr("No matches"))->setEnabled(false);
+    m->exec(QCursor::pos());
+    m->deleteLater();
+}
+
+void PlaylistWindow::revealItem(QUuid playlistUuid, QUuid itemUuid)
+{
+    if (!widgets.contains(playlistUuid))
+        return;
+    // A filter left over from a tab search could be hiding the item.
+    finishSearch();
+    setCurrentPlaylist(playlistUuid);
+    widgets[playlistUuid]->revealItem(itemUuid);
+}
+
 void PlaylistWindow::savePlaylist(const QUuid &playlistUuid)
 {
     QString file;
@@ -673,13 +1048,13 @@ void PlaylistWindow::sortPlaylistByLabel(const QUuid &playlistUuid)
     auto qdp = widgets.value(playlistUuid, nullptr);
     if (!qdp)
         return;
-    auto converter = [this](QSharedPointer<Item> i) {
-        return displayParser.parseMetadata(i->metadata(), i->toDisplayString(), Helpers::VideoFile);
-    };
-    auto lessThan = [](const QString &a, const QString &b) {
-        return a < b;
-    };
-    qdp->sort<QString>(converter, lessThan);
+    // Labels are worked out off the gui thread, so they get a parser of
+    // their own rather than one the format can change under.
+    auto parser = QSharedPointer<DisplayParser>::create();
+    parser->takeFormatString(displayFormat);
+    qdp->sortByText([parser](const ItemPointer &i) {
+        return parser->parseMetadata(i->metadata(), i->toDisplayString(), Helpers::VideoFile);
+    });
 }
 
 void PlaylistWindow::sortPlaylistByUrl(const QUuid &playlistUuid)
@@ -687,13 +1062,9 @@ void PlaylistWindow::sortPlaylistByUrl(const QUuid &playlistUuid)
     auto qdp = widgets.value(playlistUuid, nullptr);
     if (!qdp)
         return;
-    auto converter = [](QSharedPointer<Item> i) {
+    qdp->sortByText([](const ItemPointer &i) {
         return i->url().toDisplayString();
-    };
-    auto lessThan = [](const QString &a, const QString &b) {
-        return a < b;
-    };
-    qdp->sort<QString>(converter, lessThan);
+    });
 }
 
 void PlaylistWindow::randomizePlaylist(const QUuid &playlistUuid)
@@ -701,14 +1072,13 @@ void PlaylistWindow::randomizePlaylist(const QUuid &playlistUuid)
     auto qdp = widgets.value(playlistUuid, nullptr);
     if (!qdp)
         return;
-    std::uniform_int_distribution<> itemDistribution(0, qdp->count()-1);
-    auto converter = [&](QSharedPointer<Item> i) {
-        return itemDistribution(randomGenerator);
-    };
-    auto lessThan = [](const int &a, const int &b) {
-        return a < b;
-    };
-    qdp->sort<int>(converter, lessThan);
+    auto pl = qdp->playlist();
+    if (!pl)
+        return;
+    QVector<int> permutation(pl->count());
+    std::iota(permutation.begin(), permutation.end(), 0);
+    std::shuffle(permutation.begin(), permutation.end(), randomGenerator);
+    qdp->reorder(permutation);
 }
 
 void PlaylistWindow::restorePlaylist(const QUuid &playlistUuid)
@@ -716,13 +1086,9 @@ void PlaylistWindow::restorePlaylist(const QUuid &playlistUuid)
     auto qdp = widgets.value(playlistUuid, nullptr);
     if (!qdp)
         return;
-    auto converter = [&](QSharedPointer<Item> i) {
+    qdp->sortByNumber([](const ItemPointer &i) {
         return i->originalPosition();
-    };
-    auto lessThan = [](const int &a, const int &b) {
-        return a < b;
-    };
-    qdp->sort<int>(converter, lessThan);
+    });
 }
 
 void PlaylistWindow::self_visibilityChanged()
@@ -747,7 +1113,7 @@ void PlaylistWindow::playlist_removeItemRequested()
     if (!qdp)
         return;
 
-    qdp->traverseSelected([qdp](QUuid uuid) { qdp->removeItem(uuid); });
+    qdp->removeSelected();
     updatePlaylistHasItems();
 }
 
@@ -766,10 +1132,9 @@ void PlaylistWindow::playlist_copySelectionToClipboard(const QUuid &playlistUuid
     auto qdp = widgets.value(playlistUuid, nullptr);
     if (!qdp)
         return;
-    auto pl = qdp->playlist();
     QList<QUrl> urls;
-    qdp->traverseSelected([&pl,&urls](QUuid itemUuid) {
-        urls.append(pl->itemOf(itemUuid)->url());
+    qdp->traverseSelected([&urls](ItemPointer item) {
+        urls.append(item->url());
     });
     QMimeData *mimeData = new QMimeData();
     mimeData->setUrls(urls);
@@ -822,6 +1187,26 @@ void PlaylistWindow::playlist_contextMenuRequested(const QPoint &p, const QUuid
 
     m->addSeparator();
 
+    a = new QAction(m);
+    a->setText(tr("Undo"));
+    a->setEnabled(listWidget->playlist()->canUndo());
+    connect(a, &QAction::triggered,
+            this, [this,playlistUuid]() {
+        undoPlaylist(playlistUuid);
+    });
+    m->addAction(a);
+
+    a = new QAction(m);
+    a->setText(tr("Redo"));
+    a->setEnabled(listWidget->playlist()->canRedo());
+    connect(a, &QAction::triggered,
+            this, [this,playlistUuid]() {
+        redoPlaylist(playlistUuid);
+    });
+    m->addAction(a);
+
+    m->addSeparator();
+
     a = new QAction(m);
     a->setText(tr("Copy To clipboard"));
     connect(a, &QAction::triggered,
@@ -914,6 +1299,7 @@ void PlaylistWindow::on_tabWidget_tabCloseRequested(int index)
         qdp->removeAll();
     } else {
         PlaylistCollection::getSingleton()->removePlaylist(qdp->uuid());
+        probe->forget(qdp->uuid());
         widgets.remove(qdp->uuid());
         ui->tabWidget->removeTab(index);
     }
@@ -953,6 +1339,8 @@ void PlaylistWindow::on_tabWidget_customContextMenuRequested(const QPoint &pos)
     m->addAction(tr("&Duplicate Playlist"), this, SLOT(duplicateTab()));
     m->addAction(tr("&Import Playlist"), this, SLOT(importTab()));
     m->addAction(tr("&Export Playlist"), this, SLOT(exportTab()));
+    m->addSeparator();
+    m->addAction(tr("&Search All Playlists..."), this, SLOT(searchAllPlaylists()));
     m->exec(ui->tabWidget->mapToGlobal(pos));
 }
 
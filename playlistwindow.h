@@ -3,18 +3,30 @@
 
 #include <QDockWidget>
 #include <QHash>
+#include <QImage>
+#include <QSharedPointer>
 #include <QUuid>
+#include <QVector>
 #include <random>
 #include "helpers.h"
+#include "itempool.h"
+#include "serialqueue.h"
 
 namespace Ui {
 class PlaylistWindow;
 }
 
+class DirectoryScanner;
 class DrawnPlaylist;
+class Item;
+class MediaProbe;
+class PlaylistReader;
+class QProgressDialog;
 class PlaylistSelection;
 class QThread;
 class PlaylistSearcher;
+class ThumbnailCache;
+class Thumbnailer;
 class PlaylistWindow : public QDockWidget
 {
     Q_OBJECT
@@ -25,10 +37,15 @@ public:
 
     void setCurrentPlaylist(QUuid what);
     void clearPlaylist(QUuid what);
+    // Folders among the urls are walked in the background, and the pair
+    // then names the playlist with no item yet; itemsScanned() follows.
     QPair<QUuid, QUuid> addToPlaylist(const QUuid &playlist, const QList<QUrl> &what);
     QPair<QUuid, QUuid> addToCurrentPlaylist(QList<QUrl> what);
     QPair<QUuid, QUuid> urlToQuickPlaylist(QUrl what);
+    // Whether folders are still being walked into the playlist.
+    bool isScanning(const QUuid &playlist) const;
     bool isCurrentPlaylistEmpty();
+    QUuid currentPlaylistUuid();
     bool isPlaylistSingularFile(QUuid list);
     bool isPlaylistShuffle(QUuid list);
     QPair<QUuid, QUuid> getItemAfter(QUuid list, QUuid item);
@@ -57,15 +74,25 @@ private:
     DrawnPlaylist *currentPlaylistWidget();
     void updateCurrentPlaylist();
     void updatePlaylistHasItems();
+    // Probes the whole of a tab's playlist, for when it is shown or edited
+    // by hand.  Files arriving in batches are queued as they come instead.
+    void probePlaylist(DrawnPlaylist *qdp);
     void setPlaylistFilters(QString filterText);
     void addNewTab(QUuid playlist, QString title);
     void addQuickQueue();
+    // Loads the playlists of the most recently used tabs which have not
+    // been shown yet, in the background.
+    void prefetchTabs();
+    QProgressDialog *makeProgressDialog(const QString &label,
+                                        void (PlaylistWindow::*cancel)());
 
 signals:
     void windowDocked();
     void viewActionChanged(bool visible);
     void currentPlaylistHasItems(bool yes);
     void itemDesired(QUuid playlistUuid, QUuid itemUuid);
+    // Items from a folder walk were added, starting with item.
+    void itemsScanned(QUuid playlistUuid, ItemPointer item);
     void importPlaylist(QString fname);
     void exportPlaylist(QString fname, QStringList items);
     void quickQueueMode(bool yes);
@@ -79,8 +106,18 @@ public slots:
 
     bool activateItem(QUuid playlistUuid, QUuid itemUuid);
     void changePlaylistSelection(QUrl itemUrl, QUuid playlistUuid, QUuid itemUuid);
-    void addSimplePlaylist(QStringList data);
+    // Reads a playlist file into a new tab in the background.
+    void importPlaylistFile(const QString &fileName);
+    void addSimplePlaylist(const QUuid &playlistUuid,
+                           const QVector<ItemPointer> &items);
     void setDisplayFormatSpecifier(QString fmt);
+    void setUndoBudget(int megabytes);
+    void setShowThumbnails(bool yes);
+
+    bool undoPlaylist(const QUuid &playlistUuid);
+    bool redoPlaylist(const QUuid &playlistUuid);
+    bool undoQueue();
+    bool redoQueue();
 
     void newTab();
     void closeTab();
@@ -111,9 +148,24 @@ public slots:
 
     void revealSearch();
     void finishSearch();
+    void searchAllPlaylists();
+    void revealItem(QUuid playlistUuid, QUuid itemUuid);
 
 private slots:
     void savePlaylist(const QUuid &playlistUuid);
+    void cancelImport();
+    void reader_itemsRead(int generation,
+                          const QVector<ItemPointer> &items,
+                          int progress);
+    void reader_finished(int generation);
+    void cancelScans();
+    void scanner_itemsFound(int scan, const QVector<ItemPointer> &items,
+                            int foldersDone, int foldersFound);
+    void scanner_finished(int scan);
+    void probe_probed(const QUuid &playlistUuid, const ItemPointer &item,
+                      const QVariantMap &metadata);
+    void playlist_visibleRowsChanged(const QUuid &playlistUuid);
+    void thumbnailer_thumbnailed(const QString &fileName, const QImage &image);
     void sortPlaylistByLabel(const QUuid &playlistUuid);
     void sortPlaylistByUrl(const QUuid &playlistUuid);
     void randomizePlaylist(const QUuid &playlistUuid);
@@ -144,11 +196,28 @@ private:
     IconThemer themer;
     QUuid currentPlaylist;
     DisplayParser displayParser;
+    QString displayFormat;
     bool showSearch = false;
     bool hideFullscreen = false;
 
     QHash<QUuid, DrawnPlaylist*> widgets;
     DrawnPlaylist* queueWidget = nullptr;
+    SerialQueue prefetchQueue;
+    QSharedPointer<PlaylistReader> reader;
+    SerialQueue importQueue;
+    QProgressDialog *importProgress = nullptr;
+    QUuid importTarget;
+    int importGeneration = 0;
+    QSharedPointer<DirectoryScanner> scanner;
+    SerialQueue scanQueue;
+    QProgressDialog *scanProgress = nullptr;
+    QHash<int, QUuid> scanTargets;
+    QSharedPointer<MediaProbe> probe;
+    QSharedPointer<Thumbnailer> thumbnailer;
+    ThumbnailCache *thumbnails = nullptr;
+    bool showThumbnails = false;
+    static const int prefetchDelay = 2000;
+    static const int prefetchCount = 4;
     PlaylistSelection *clipboard = nullptr;
     std::random_device randomDevice;
     std::mt19937 randomGenerator;
@@ -0,0 +1,347 @@
+#include <QMutexLocker>
+#include <QVariant>
+#include <algorithm>
+#include "searchindex.h"
+#include "playlist.h"
+
+// Joins the texts of a haystack.  Needles come from a single line of text
+// split on spaces, so they never contain it and cannot match across texts.
+static const QChar haystackSeparator(0);
+
+SearchIndex::SearchIndex()
+{
+
+}
+
+void SearchIndex::insert(const ItemPointer &item)
+{
+    QMutexLocker locker(&mutex);
+    pending.append({ Inserted, item });
+}
+
+void SearchIndex::insert(const QList<ItemPointer> &items)
+{
+    QMutexLocker locker(&mutex);
+    pending.reserve(pending.count() + items.count());
+    for (const ItemPointer &item : items)
+        pending.append({ Inserted, item });
+}
+
+void SearchIndex::remove(const ItemPointer &item)
+{
+    QMutexLocker locker(&mutex);
+    pending.append({ Removed, item });
+}
+
+void SearchIndex::remove(const QList<ItemPointer> &items)
+{
+    QMutexLocker locker(&mutex);
+    pending.reserve(pending.count() + items.count());
+    for (const ItemPointer &item : items)
+        pending.append({ Removed, item });
+}
+
+void SearchIndex::refresh(const ItemPointer &item)
+{
+    QMutexLocker locker(&mutex);
+    pending.append({ Refreshed, item });
+}
+
+void SearchIndex::clear()
+{
+    QMutexLocker locker(&mutex);
+    pending.clear();
+    cleared = true;
+}
+
+QSet<const Item *> SearchIndex::find(const QStringList &needles)
+{
+    QMutexLocker locker(&mutex);
+    applyChanges();
+
+    QSet<const Item *> found;
+    QVector<const QVector<int> *> lists;
+    for (const QString &needle : needles) {
+        for (quint64 trigram : trigramsOf(needle)) {
+            auto it = postings.constFind(trigram);
+            if (it == postings.constEnd())
+                return found;
+            lists.append(&it.value());
+        }
+    }
+    std::sort(lists.begin(), lists.end(),
+              [](const QVector<int> *a, const QVector<int> *b) {
+        return a->count() < b->count();
+    });
+
+    QVector<int> candidates;
+    if (lists.isEmpty()) {
+        // Needles this short have no trigrams, so every item is a candidate.
+        candidates.reserve(slots.count());
+        for (int slot = 0; slot < entries.count(); ++slot)
+            if (entries[slot].item)
+                candidates.append(slot);
+    } else {
+        const QVector<int> &shortest = *lists.first();
+        QVector<int> hits(entries.count(), 0);
+        for (int slot : shortest)
+            hits[slot] = 1;
+        int round = 1;
+        for (int i = 1; i < lists.count(); ++i) {
+            // Past some point, walking a long list costs more than checking
+            // the candidates there already are.
+            if (lists[i]->count() > 8 * shortest.count())
+                break;
+            for (int slot : *lists[i])
+                if (hits[slot] == round)
+                    hits[slot] = round + 1;
+            ++round;
+        }
+        for (int slot : shortest) {
+            if (hits[slot] != round)
+                continue;
+            hits[slot] = 0;
+            candidates.append(slot);
+        }
+    }
+
+    found.reserve(candidates.count());
+    for (int slot : candidates) {
+        const Entry &e = entries[slot];
+        if (e.item && matches(e.haystack, needles))
+            found.insert(e.item);
+    }
+    return found;
+}
+
+QVector<SearchIndex::Match> SearchIndex::fuzzyFind(const QString &text,
+                                                   int limit)
+{
+    QString pattern;
+    for (QChar c : text.toLower())
+        if (!c.isSpace())
+            pattern += c;
+
+    QVector<Match> best;
+    if (pattern.isEmpty() || limit <= 0)
+        return best;
+
+    QMutexLocker locker(&mutex);
+    applyChanges();
+
+    // best is kept as a heap with the weakest match on top, so that it only
+    // ever holds limit entries.
+    auto stronger = [](const Match &a, const Match &b) {
+        return a.score > b.score;
+    };
+    quint64 wanted = charactersOf(pattern);
+    best.reserve(limit);
+    for (const Entry &e : entries) {
+        if (!e.item || (wanted & ~e.characters))
+            continue;
+        int score = fuzzyScore(e.haystack, pattern);
+        if (score < 0)
+            continue;
+        if (best.count() == limit) {
+            if (score <= best.first().score)
+                continue;
+            std::pop_heap(best.begin(), best.end(), stronger);
+            best.removeLast();
+        }
+        best.append({ score, e.item->id() });
+        std::push_heap(best.begin(), best.end(), stronger);
+    }
+    std::sort_heap(best.begin(), best.end(), stronger);
+    return best;
+}
+
+QString SearchIndex::haystackOf(const Item *item)
+{
+    QString haystack = item->toDisplayString().toLower();
+    for (const QVariant &v : item->metadata()) {
+        QString text = v.toString();
+        if (text.isEmpty())
+            continue;
+        haystack += haystackSeparator;
+        haystack += text.toLower();
+    }
+    return haystack;
+}
+
+bool SearchIndex::matches(const QString &haystack, const QStringList &needles)
+{
+    for (const QString &needle : needles)
+        if (!haystack.contains(needle))
+            return false;
+    return true;
+}
+
+int SearchIndex::fuzzyScore(const QString &haystack, const QString &pattern)
+{
+    // Find the first place the pattern ends as a subsequence, then walk back
+    // from there for the latest place it can start, which gives the tightest
+    // window around that end.  This is cheaper than trying every alignment
+    // and usually lands on the same one.
+    const QChar *h = haystack.constData();
+    const QChar *p = pattern.constData();
+    int hLength = haystack.length();
+    int pLength = pattern.length();
+    if (!pLength)
+        return -1;
+
+    int hi = 0;
+    for (int pi = 0; pi < pLength; ++pi, ++hi) {
+        while (hi < hLength && h[hi] != p[pi])
+            ++hi;
+        if (hi == hLength)
+            return -1;
+    }
+    int start = hi - 1;
+    for (int pi = pLength - 1; pi >= 0; --pi, --start)
+        while (h[start] != p[pi])
+            --start;
+    ++start;
+
+    // Reward matches that run together or begin words, and charge a little
+    // for every character skipped in between.
+    int score = 0;
+    int previous = -1;
+    hi = start;
+    for (int pi = 0; pi < pLength; ++pi, ++hi) {
+        while (h[hi] != p[pi])
+            ++hi;
+        score += 16;
+        if (previous >= 0 && hi == previous + 1)
+            score += 12;
+        else if (previous >= 0)
+            score -= std::min(hi - previous - 1, 8);
+        if (hi == 0 || !h[hi - 1].isLetterOrNumber())
+            score += 10;
+        previous = hi;
+    }
+    // Among equals, prefer the item that says less besides.
+    return score * 4 - std::min(hLength / 16, 3);
+}
+
+void SearchIndex::applyChanges()
+{
+    if (cleared) {
+        entries.clear();
+        freeSlots.clear();
+        slots.clear();
+        postings.clear();
+        livePostings = 0;
+        stalePostings = 0;
+        cleared = false;
+    }
+    for (const QPair<Change, ItemPointer> &change : pending) {
+        switch (change.first) {
+        case Inserted:
+            index(change.second);
+            break;
+        case Removed:
+            unindex(change.second.data());
+            break;
+        case Refreshed:
+            if (slots.contains(change.second.data()))
+                index(change.second);
+            break;
+        }
+    }
+    pending.clear();
+
+    // Removal leaves its postings behind to be skipped over, which is cheap
+    // until they outnumber the live ones.
+    if (stalePostings > 65536 && stalePostings > livePostings)
+        compact();
+}
+
+void SearchIndex::index(const ItemPointer &item)
+{
+    unindex(item.data());
+    int slot;
+    if (freeSlots.isEmpty()) {
+        slot = entries.count();
+        entries.append(Entry());
+    } else {
+        slot = freeSlots.takeLast();
+    }
+    Entry &e = entries[slot];
+    e.item = item.data();
+    e.haystack = haystackOf(item.data());
+    e.characters = charactersOf(e.haystack);
+    slots.insert(e.item, slot);
+    post(slot);
+}
+
+void SearchIndex::unindex(const Item *item)
+{
+    int slot = slots.value(item, -1);
+    if (slot < 0)
+        return;
+    slots.remove(item);
+    livePostings -= entries[slot].trigrams;
+    stalePostings += entries[slot].trigrams;
+    entries[slot] = Entry();
+    freeSlots.append(slot);
+}
+
+void SearchIndex::post(int slot)
+{
+    // A reused slot may still be listed under its old trigrams; find() copes
+    // with that by checking every candidate against its haystack.
+    QVector<quint64> trigrams = trigramsOf(entries[slot].haystack);
+    for (quint64 trigram : trigrams)
+        postings[trigram].append(slot);
+    entries[slot].trigrams = trigrams.count();
+    livePostings += trigrams.count();
+}
+
+void SearchIndex::compact()
+{
+    postings.clear();
+    livePostings = 0;
+    stalePostings = 0;
+    for (int slot = 0; slot < entries.count(); ++slot)
+        if (entries[slot].item)
+            post(slot);
+}
+
+quint64 SearchIndex::charactersOf(const QString &text)
+{
+    // One bit each for latin letters and digits, everything else shares the
+    // remaining bits by its code point.
+    quint64 mask = 0;
+    for (QChar c : text) {
+        ushort u = c.unicode();
+        if (u >= 'a' && u <= 'z')
+            mask |= quint64(1) << (u - 'a');
+        else if (u >= '0' && u <= '9')
+            mask |= quint64(1) << (26 + u - '0');
+        else if (c != haystackSeparator)
+            mask |= quint64(1) << (36 + u % 28);
+    }
+    return mask;
+}
+
+QVector<quint64> SearchIndex::trigramsOf(const QString &text)
+{
+    QVector<quint64> trigrams;
+    const QChar *c = text.constData();
+    int length = text.length();
+    if (length < 3)
+        return trigrams;
+    trigrams.reserve(length - 2);
+    for (int i = 0; i + 2 < length; ++i) {
+        if (c[i] == haystackSeparator || c[i+1] == haystackSeparator
+                || c[i+2] == haystackSeparator)
+            continue;
+        trigrams.append(quint64(c[i].unicode()) << 32
+                        | quint64(c[i+1].unicode()) << 16
+                        | quint64(c[i+2].unicode()));
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()),
+                   trigrams.end());
+    return trigrams;
+}
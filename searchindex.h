@@ -0,0 +1,89 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+// A per-playlist index for the playlist filter.
+//
+// Every item is reduced once to a lowercase haystack (its display string and
+// metadata values), and every trigram of that haystack gets a posting list
+// of the items containing it.  A filter intersects the posting lists of its
+// needles' trigrams and then confirms the few candidates left against their
+// haystacks, so nothing is lowercased or scanned per keystroke.
+//
+// The same haystacks serve ranked fuzzy lookups, where the pattern only has
+// to appear as a subsequence.  Each item carries a bitmask of the characters
+// in its haystack, so most items are turned away by a single AND before any
+// matching is done.
+//
+// Playlists report changes as they happen; the work of indexing them is put
+// off until the next search, which runs off the gui thread.
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+#include "itempool.h"
+
+class Item;
+
+class SearchIndex {
+public:
+    struct Match {
+        int score;
+        quint64 item;
+    };
+
+    SearchIndex();
+
+    void insert(const ItemPointer &item);
+    void insert(const QList<ItemPointer> &items);
+    void remove(const ItemPointer &item);
+    void remove(const QList<ItemPointer> &items);
+    void refresh(const ItemPointer &item);
+    void clear();
+
+    // The items which contain every one of the needles.  Needles are
+    // expected to be lowercase, as PlaylistSearcher::textToNeedles makes them.
+    QSet<const Item *> find(const QStringList &needles);
+
+    // The best scoring items the text fuzzily matches, best first.  Case and
+    // spaces in the text are ignored.
+    QVector<Match> fuzzyFind(const QString &text, int limit);
+
+    static QString haystackOf(const Item *item);
+    static bool matches(const QString &haystack, const QStringList &needles);
+    static int fuzzyScore(const QString &haystack, const QString &pattern);
+
+private:
+    Q_DISABLE_COPY(SearchIndex)
+
+    enum Change { Inserted, Removed, Refreshed };
+    struct Entry {
+        const Item *item = nullptr;
+        QString haystack;
+        quint64 characters = 0;
+        int trigrams = 0;
+    };
+
+    void applyChanges();
+    void index(const ItemPointer &item);
+    void unindex(const Item *item);
+    void post(int slot);
+    void compact();
+    static QVector<quint64> trigramsOf(const QString &text);
+    static quint64 charactersOf(const QString &text);
+
+    QMutex mutex;
+    QVector<QPair<Change, ItemPointer>> pending;
+    bool cleared = false;
+
+    QVector<Entry> entries;
+    QVector<int> freeSlots;
+    QHash<const Item *, int> slots;
+    QHash<quint64, QVector<int>> postings;
+    int livePostings = 0;
+    int stalePostings = 0;
+};
+
+#endif // SEARCHINDEX_H
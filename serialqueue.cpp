@@ -0,0 +1,76 @@
+#include <QMutex>
+#include <QMutexLocker>
+#include <QQueue>
+#include <QRunnable>
+#include <QThreadPool>
+#include "serialqueue.h"
+
+class SerialQueueState {
+public:
+    QThreadPool *pool = nullptr;
+    QMutex mutex;
+    QQueue<std::function<void()>> tasks;
+    bool scheduled = false;
+};
+
+// Runs a single task and, if more are waiting, queues itself up again
+// behind whatever other queues have pending, so that a busy tab cannot keep
+// a pool thread to itself.
+class SerialQueueRunner : public QRunnable {
+public:
+    explicit SerialQueueRunner(const QSharedPointer<SerialQueueState> &d)
+        : d(d) {}
+
+    void run()
+    {
+        std::function<void()> task;
+        {
+            QMutexLocker locker(&d->mutex);
+            if (d->tasks.isEmpty()) {
+                d->scheduled = false;
+                return;
+            }
+            task = d->tasks.dequeue();
+        }
+        task();
+
+        QMutexLocker locker(&d->mutex);
+        if (d->tasks.isEmpty())
+            d->scheduled = false;
+        else
+            d->pool->start(new SerialQueueRunner(d));
+    }
+
+private:
+    QSharedPointer<SerialQueueState> d;
+};
+
+
+
+SerialQueue::SerialQueue(QThreadPool *pool)
+    : d(new SerialQueueState)
+{
+    d->pool = pool ? pool : QThreadPool::globalInstance();
+}
+
+SerialQueue::~SerialQueue()
+{
+    // A task already running holds on to the state and finishes by itself.
+    clear();
+}
+
+void SerialQueue::post(const std::function<void()> &task)
+{
+    QMutexLocker locker(&d->mutex);
+    d->tasks.enqueue(task);
+    if (d->scheduled)
+        return;
+    d->scheduled = true;
+    d->pool->start(new SerialQueueRunner(d));
+}
+
+void SerialQueue::clear()
+{
+    QMutexLocker locker(&d->mutex);
+    d->tasks.clear();
+}
@@ -0,0 +1,29 @@
+#ifndef SERIALQUEUE_H
+#define SERIALQUEUE_H
+// Runs tasks one after another, in the order they were posted, on a shared
+// thread pool.  Each playlist tab has one of these instead of a thread of
+// its own, so an idle tab costs nothing and however many tabs are open, no
+// more background threads run than the pool allows.  The global pool is
+// sized to the number of cores.
+
+#include <QSharedPointer>
+#include <functional>
+
+class QThreadPool;
+class SerialQueueState;
+
+class SerialQueue {
+public:
+    explicit SerialQueue(QThreadPool *pool = nullptr);
+    ~SerialQueue();
+
+    void post(const std::function<void()> &task);
+    void clear();
+
+private:
+    Q_DISABLE_COPY(SerialQueue)
+
+    QSharedPointer<SerialQueueState> d;
+};
+
+#endif // SERIALQUEUE_H
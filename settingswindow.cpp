@@ -757,6 +757,8 @@ void SettingsWindow::sendSignals()
     }
 
     emit playlistFormat(WIDGET_PLACEHOLD_LOOKUP(ui->playlistFormat));
+    emit playlistUndoBudget(WIDGET_LOOKUP(ui->playlistUndoBudget).toInt());
+    emit playlistThumbnails(WIDGET_LOOKUP(ui->playlistThumbnails).toBool());
     emit option("sub-gray", WIDGET_LOOKUP(ui->subtitlesForceGrayscale).toBool());
 
     emit option("sub-font", WIDGET_LOOKUP(ui->fontComboBox).toString());
@@ -127,6 +127,8 @@ signals:
     void playbackRewinds(bool yes);
     void playbackLoopImages(bool yes);
     void playlistFormat(const QString &fmt);
+    void playlistUndoBudget(int megabytes);
+    void playlistThumbnails(bool yes);
 
     // does mpv even *need* this?
     void subsPreferDefault(bool yes);
@@ -0,0 +1,129 @@
+#ifndef SHARDEDHASH_H
+#define SHARDEDHASH_H
+// A hash table which may be used from any thread.
+//
+// Keys are spread over a fixed number of shards, each a QHash behind its own
+// read-write lock.  Lookups only take the read side of one shard, so readers
+// never wait on each other, and a writer only holds up the readers and
+// writers which happen to land on the same shard.
+
+#include <QHash>
+#include <QList>
+#include <QReadWriteLock>
+
+template <typename Key, typename T>
+class ShardedHash {
+public:
+    static const int shardCount = 64;
+
+    ShardedHash() {}
+
+    T value(const Key &key, const T &defaultValue = T()) const
+    {
+        const Shard &s = shardOf(key);
+        QReadLocker locker(&s.lock);
+        return s.hash.value(key, defaultValue);
+    }
+
+    bool contains(const Key &key) const
+    {
+        const Shard &s = shardOf(key);
+        QReadLocker locker(&s.lock);
+        return s.hash.contains(key);
+    }
+
+    void insert(const Key &key, const T &value)
+    {
+        Shard &s = shardOf(key);
+        QWriteLocker locker(&s.lock);
+        s.hash.insert(key, value);
+    }
+
+    // Inserts the value unless the key is already present, and returns
+    // whatever the key maps to afterwards.
+    T insertIfAbsent(const Key &key, const T &value)
+    {
+        Shard &s = shardOf(key);
+        QWriteLocker locker(&s.lock);
+        auto it = s.hash.find(key);
+        if (it == s.hash.end())
+            it = s.hash.insert(key, value);
+        return it.value();
+    }
+
+    bool remove(const Key &key)
+    {
+        Shard &s = shardOf(key);
+        QWriteLocker locker(&s.lock);
+        return s.hash.remove(key) > 0;
+    }
+
+    T take(const Key &key)
+    {
+        Shard &s = shardOf(key);
+        QWriteLocker locker(&s.lock);
+        return s.hash.take(key);
+    }
+
+    void clear()
+    {
+        for (Shard &s : shards) {
+            QWriteLocker locker(&s.lock);
+            s.hash.clear();
+        }
+    }
+
+    // Not a consistent count while writers are busy, only a close one.
+    int count() const
+    {
+        int total = 0;
+        for (const Shard &s : shards) {
+            QReadLocker locker(&s.lock);
+            total += s.hash.count();
+        }
+        return total;
+    }
+
+    QList<T> values() const
+    {
+        QList<T> all;
+        for (const Shard &s : shards) {
+            QReadLocker locker(&s.lock);
+            all.append(s.hash.values());
+        }
+        return all;
+    }
+
+private:
+    Q_DISABLE_COPY(ShardedHash)
+
+    struct Shard {
+        mutable QReadWriteLock lock;
+        QHash<Key, T> hash;
+    };
+
+    static int shardIndexOf(const Key &key)
+    {
+        // Mix the hash again, so that the shards and each shard's buckets
+        // do not select on the same bits.
+        uint h = qHash(key);
+        h ^= h >> 16;
+        h *= 0x45d9f3bu;
+        h ^= h >> 16;
+        return int(h % shardCount);
+    }
+
+    Shard &shardOf(const Key &key)
+    {
+        return shards[shardIndexOf(key)];
+    }
+
+    const Shard &shardOf(const Key &key) const
+    {
+        return shards[shardIndexOf(key)];
+    }
+
+    Shard shards[shardCount];
+};
+
+#endif // SHARDEDHASH_H
@@ -0,0 +1,229 @@
+#include <QMutexLocker>
+#include <QVariantList>
+#include "shuffleengine.h"
+#include "playlistindex.h"
+#include "playlist.h"
+
+ShuffleEngine::ShuffleEngine() : randomGenerator(std::random_device()())
+{
+
+}
+
+ItemPointer ShuffleEngine::next(const PlaylistIndex &items,
+                                         const ItemsById &itemsById,
+                                         quint64 current)
+{
+    QMutexLocker locker(&mutex);
+    follow(current);
+
+    // Having gone back, go forward the same way again.
+    while (cursor + 1 < history.count()) {
+        ItemPointer item = itemsById.value(history[cursor + 1]);
+        if (item) {
+            ++cursor;
+            return item;
+        }
+        history.remove(cursor + 1);
+    }
+    ItemPointer item = draw(items, itemsById, current);
+    if (item)
+        record(item->id());
+    return item;
+}
+
+ItemPointer ShuffleEngine::previous(const ItemsById &itemsById,
+                                             quint64 current)
+{
+    QMutexLocker locker(&mutex);
+    follow(current);
+    while (cursor > 0) {
+        --cursor;
+        ItemPointer item = itemsById.value(history[cursor]);
+        if (item)
+            return item;
+        history.remove(cursor);
+    }
+    return ItemPointer();
+}
+
+void ShuffleEngine::insert(const ItemPointer &item)
+{
+    QMutexLocker locker(&mutex);
+    if (gathered)
+        remainder.append(item->id());
+}
+
+void ShuffleEngine::insert(const QList<ItemPointer> &items)
+{
+    QMutexLocker locker(&mutex);
+    if (!gathered)
+        return;
+    remainder.reserve(remainder.count() + items.count());
+    for (const ItemPointer &item : items)
+        remainder.append(item->id());
+}
+
+void ShuffleEngine::remove(quint64 id)
+{
+    // Whatever else refers to the item skips over it when it gets there.
+    QMutexLocker locker(&mutex);
+    played.remove(id);
+}
+
+void ShuffleEngine::remove(const QList<ItemPointer> &items)
+{
+    QMutexLocker locker(&mutex);
+    for (const ItemPointer &item : items)
+        played.remove(item->id());
+}
+
+void ShuffleEngine::clear()
+{
+    QMutexLocker locker(&mutex);
+    reset();
+}
+
+QVariantMap ShuffleEngine::toVMap(const PlaylistIndex &items,
+                                  const ItemsById &itemsById)
+{
+    QMutexLocker locker(&mutex);
+    auto positionOf = [&items, &itemsById](quint64 id) {
+        return items.indexOf(itemsById.value(id).data());
+    };
+
+    QVariantList playedList;
+    for (quint64 id : played) {
+        int position = positionOf(id);
+        if (position >= 0)
+            playedList.append(position);
+    }
+    QVariantList historyList;
+    int savedCursor = -1;
+    for (int index = 0; index < history.count(); ++index) {
+        int position = positionOf(history[index]);
+        if (position < 0)
+            continue;
+        if (index <= cursor)
+            savedCursor = historyList.count();
+        historyList.append(position);
+    }
+
+    QVariantMap qvm;
+    qvm.insert("played", playedList);
+    qvm.insert("history", historyList);
+    qvm.insert("cursor", savedCursor);
+    return qvm;
+}
+
+void ShuffleEngine::fromVMap(const QVariantMap &qvm,
+                             const QList<ItemPointer> &items)
+{
+    QMutexLocker locker(&mutex);
+    reset();
+    auto idAt = [&items](const QVariant &v) -> quint64 {
+        bool ok = false;
+        int position = v.toInt(&ok);
+        if (!ok || position < 0 || position >= items.count())
+            return 0;
+        return items[position]->id();
+    };
+
+    for (const QVariant &v : qvm.value("played").toList()) {
+        quint64 id = idAt(v);
+        if (id)
+            played.insert(id);
+    }
+    for (const QVariant &v : qvm.value("history").toList()) {
+        quint64 id = idAt(v);
+        if (id)
+            history.append(id);
+    }
+    cursor = qBound(-1, qvm.value("cursor", -1).toInt(), history.count() - 1);
+}
+
+void ShuffleEngine::reset()
+{
+    played.clear();
+    remainder.clear();
+    gathered = false;
+    history.clear();
+    cursor = -1;
+}
+
+void ShuffleEngine::follow(quint64 current)
+{
+    if (!current || (cursor >= 0 && history[cursor] == current))
+        return;
+    history.resize(cursor + 1);
+    record(current);
+}
+
+ItemPointer ShuffleEngine::draw(const PlaylistIndex &items,
+                                         const ItemsById &itemsById,
+                                         quint64 current)
+{
+    int count = items.count();
+    if (!count)
+        return ItemPointer();
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (played.count() >= count)
+            startRun(count, current);
+
+        if (!gathered && played.count() * 2 < count) {
+            // At least half of the positions hold an unplayed item, so this
+            // rarely takes more than a couple of tries.
+            std::uniform_int_distribution<int> position(0, count - 1);
+            for (int tries = 0; tries < 64; ++tries) {
+                ItemPointer item = items.at(position(randomGenerator));
+                if (!played.contains(item->id()))
+                    return item;
+            }
+        }
+
+        if (!gathered)
+            gatherRemainder(items);
+        while (!remainder.isEmpty()) {
+            std::uniform_int_distribution<int> slot(0, remainder.count() - 1);
+            int index = slot(randomGenerator);
+            quint64 id = remainder[index];
+            remainder[index] = remainder.last();
+            remainder.removeLast();
+            ItemPointer item = itemsById.value(id);
+            if (item && !played.contains(id))
+                return item;
+        }
+        // Everything has been played, whatever the count said.
+        startRun(0, current);
+    }
+    return ItemPointer();
+}
+
+void ShuffleEngine::gatherRemainder(const PlaylistIndex &items)
+{
+    remainder.clear();
+    for (const ItemPointer &item : items)
+        if (!played.contains(item->id()))
+            remainder.append(item->id());
+    gathered = true;
+}
+
+void ShuffleEngine::startRun(int itemCount, quint64 current)
+{
+    // The item playing now counts as played in the new run, so that a run
+    // never starts by repeating it.
+    played.clear();
+    remainder.clear();
+    gathered = false;
+    if (current && itemCount != 1)
+        played.insert(current);
+}
+
+void ShuffleEngine::record(quint64 id)
+{
+    played.insert(id);
+    history.append(id);
+    if (history.count() > 2 * historyLimit)
+        history.remove(0, history.count() - historyLimit);
+    cursor = history.count() - 1;
+}
@@ -0,0 +1,81 @@
+#ifndef SHUFFLEENGINE_H
+#define SHUFFLEENGINE_H
+// The order a shuffled playlist plays in.
+//
+// Each run through the playlist plays every item once, in an order drawn as
+// it goes: this is Fisher-Yates shuffling, one step per advance, so nothing
+// is drawn up front.  While most of the playlist is still unplayed, an item
+// is drawn by picking positions at random until an unplayed one turns up;
+// once half of it has played, the rest is gathered into a list to draw from
+// directly.  Either way the memory used grows with the number of items
+// played, not the size of the playlist.
+//
+// Items added during a run join the unplayed remainder, and removed ones
+// simply drop out of it.  The items played are also kept in a bounded
+// history, so that going back retraces the run and going forward again
+// replays it.
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSet>
+#include <QVariantMap>
+#include <QVector>
+#include <random>
+#include "itempool.h"
+
+class Item;
+class PlaylistIndex;
+
+class ShuffleEngine {
+public:
+    typedef QHash<quint64, ItemPointer> ItemsById;
+
+    ShuffleEngine();
+
+    // current is the id of the item playing now, or 0 if there is none.
+    // Should it not be where the history says, it is taken to have been
+    // picked by hand, and the history continues from there.
+    ItemPointer next(const PlaylistIndex &items,
+                              const ItemsById &itemsById, quint64 current);
+    ItemPointer previous(const ItemsById &itemsById,
+                                  quint64 current);
+
+    void insert(const ItemPointer &item);
+    void insert(const QList<ItemPointer> &items);
+    void remove(quint64 id);
+    void remove(const QList<ItemPointer> &items);
+    void clear();
+
+    // Items are saved by their position in the playlist, which is what
+    // identifies them once it is loaded again.
+    QVariantMap toVMap(const PlaylistIndex &items,
+                       const ItemsById &itemsById);
+    void fromVMap(const QVariantMap &qvm,
+                  const QList<ItemPointer> &items);
+
+private:
+    Q_DISABLE_COPY(ShuffleEngine)
+
+    static const int historyLimit = 1024;
+
+    void reset();
+    void follow(quint64 current);
+    ItemPointer draw(const PlaylistIndex &items,
+                              const ItemsById &itemsById, quint64 current);
+    void gatherRemainder(const PlaylistIndex &items);
+    void startRun(int itemCount, quint64 current);
+    void record(quint64 id);
+
+    QMutex mutex;
+    std::mt19937 randomGenerator;
+
+    QSet<quint64> played;
+    QVector<quint64> remainder;
+    bool gathered = false;
+
+    QVector<quint64> history;
+    int cursor = -1;
+};
+
+#endif // SHUFFLEENGINE_H
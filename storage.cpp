@@ -5,13 +5,18 @@
 #include <QJsonArray>
 #include <QDir>
 #include <QFileInfo>
+#include <QSaveFile>
 #include <QTextStream>
 #include <QUrl>
 #include "storage.h"
+#include "playlist.h"
+#include "playliststore.h"
 #include "platform/unify.h"
 
 QString Storage::configPath;
 
+static const char quickPlaylistName[] = "quick";
+
 Storage::Storage(QObject *parent) :
     QObject(parent)
 {
@@ -53,21 +58,52 @@ QVariantList Storage::readVList(QString name)
     return doc.array().toVariantList();
 }
 
-QStringList Storage::readM3U(const QString &where)
+void Storage::writePlaylist(const QUuid &uuid, const QSharedPointer<Playlist> &playlist)
 {
-    QStringList items;
-    QFile file(where);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
-        return QStringList();
-    items = QTextStream(&file).readAll().split("\n");
-    for (int i = 0; i < items.count(); ++i) {
-        items[i] = items[i].trimmed();
-        if (items[i].isEmpty() || items[i].startsWith("#")) {
-            items.removeAt(i);
-            --i;
-        }
+    QDir().mkpath(playlistsPath());
+    if (PlaylistStore::save(playlistFile(uuid), playlist))
+        QFile::remove(QDir(configPath).absoluteFilePath(playlistName(uuid) + ".json"));
+}
+
+QSharedPointer<Playlist> Storage::readPlaylist(const QUuid &uuid, bool *migrated)
+{
+    if (migrated)
+        *migrated = false;
+    QSharedPointer<Playlist> playlist = PlaylistStore::load(playlistFile(uuid));
+    if (playlist)
+        return playlist;
+    QVariantMap qvm = readVMap(playlistName(uuid));
+    if (qvm.isEmpty())
+        return playlist;
+    playlist.reset(new Playlist);
+    playlist->fromVMap(qvm);
+    if (migrated)
+        *migrated = true;
+    return playlist;
+}
+
+bool Storage::isPlaylistStored(const QUuid &uuid)
+{
+    return QFile::exists(playlistFile(uuid));
+}
+
+void Storage::removePlaylist(const QUuid &uuid)
+{
+    QFile::remove(playlistFile(uuid));
+    QFile::remove(QDir(configPath).absoluteFilePath(playlistName(uuid) + ".json"));
+}
+
+void Storage::prunePlaylists(const QSet<QUuid> &keep)
+{
+    QDir dir(playlistsPath());
+    const QStringList files = dir.entryList({ "*.json", "*.mpcpl" }, QDir::Files);
+    for (const QString &file : files) {
+        QString name = QFileInfo(file).completeBaseName();
+        QUuid uuid(name);
+        bool quick = name == quickPlaylistName;
+        if ((quick || !uuid.isNull()) && !keep.contains(uuid))
+            dir.remove(file);
     }
-    return items;
 }
 
 void Storage::writeM3U(const QString &where, QStringList items)
@@ -80,17 +116,40 @@ void Storage::writeM3U(const QString &where, QStringList items)
 
 void Storage::writeJsonObject(QString fname, const QJsonDocument &doc)
 {
-    QFile file(QDir(configPath).absoluteFilePath(fname + ".json"));
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    // QSaveFile writes to a temporary file, syncs it to disk and renames it
+    // over the old one, so a crash part way through leaves the old file as
+    // it was rather than a truncated one.
+    QSaveFile file(QDir(configPath).absoluteFilePath(fname + ".json"));
+    if (!file.open(QIODevice::WriteOnly))
         return;
-    QTextStream(&file) << doc.toJson();
+    file.write(doc.toJson());
+    file.commit();
 }
 
 QJsonDocument Storage::readJsonObject(QString fname)
 {
     QFile file(QDir(configPath).absoluteFilePath(fname + ".json"));
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    if (!file.open(QIODevice::ReadOnly))
         return QJsonDocument();
-    QJsonDocument doc = QJsonDocument::fromJson(QTextStream(&file).readAll().toUtf8());
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll());
     return doc;
 }
+
+QString Storage::playlistsPath()
+{
+    return QDir(fetchConfigPath()).absoluteFilePath("playlists");
+}
+
+QString Storage::playlistName(const QUuid &uuid)
+{
+    // Named by the playlist's uuid, without the braces.  The quick playlist
+    // has none.
+    if (uuid.isNull())
+        return QString("playlists/") + quickPlaylistName;
+    return "playlists/" + uuid.toString().mid(1, 36);
+}
+
+QString Storage::playlistFile(const QUuid &uuid)
+{
+    return QDir(fetchConfigPath()).absoluteFilePath(playlistName(uuid) + ".mpcpl");
+}
@@ -2,6 +2,11 @@
 #define STORAGE_H
 
 #include <QObject>
+#include <QSet>
+#include <QSharedPointer>
+#include <QUuid>
+
+class Playlist;
 
 class Storage : public QObject
 {
@@ -16,12 +21,28 @@ public:
     void writeVList(QString name, const QVariantList &qvl);
     QVariantList readVList(QString name);
 
-    QStringList readM3U(const QString &where);
+    // Each playlist is kept in a file of its own, so that saving one does
+    // not mean rewriting the rest.  They are written in PlaylistStore's
+    // binary form.  A playlist only found as JSON, as older versions saved
+    // them, is read from that instead, with migrated set; the JSON is
+    // removed once the playlist has been written again.  The quick playlist
+    // is the one with the null uuid.
+    void writePlaylist(const QUuid &uuid, const QSharedPointer<Playlist> &playlist);
+    QSharedPointer<Playlist> readPlaylist(const QUuid &uuid, bool *migrated = nullptr);
+    // Whether the playlist is saved in the binary form.
+    bool isPlaylistStored(const QUuid &uuid);
+    void removePlaylist(const QUuid &uuid);
+    // Removes the file of every playlist not in keep.
+    void prunePlaylists(const QSet<QUuid> &keep);
+
     void writeM3U(const QString &where, QStringList items);
 
 private:
     void writeJsonObject(QString fname, const QJsonDocument &doc);
     QJsonDocument readJsonObject(QString fname);
+    static QString playlistsPath();
+    static QString playlistName(const QUuid &uuid);
+    static QString playlistFile(const QUuid &uuid);
 
 signals:
 
@@ -0,0 +1,17 @@
+include(../tests.pri)
+
+# Storage says where playlists are saved, and pulls in the platform header.
+QT       += gui widgets
+
+TARGET = tst_autosaver
+
+SOURCES += \
+    tst_autosaver.cpp \
+    $$PWD/../../autosaver.cpp \
+    $$PWD/../../serialqueue.cpp \
+    $$PWD/../../storage.cpp
+
+HEADERS += \
+    $$PWD/../../autosaver.h \
+    $$PWD/../../serialqueue.h \
+    $$PWD/../../storage.h
@@ -0,0 +1,150 @@
+#include <QtTest>
+#include <QDir>
+#include <QStandardPaths>
+#include "autosaver.h"
+#include "playlist.h"
+#include "storage.h"
+#include "platform/unify.h"
+#include "tests/fixtures.h"
+
+// What the saver leaves on disk is what the next session starts from, so
+// each test saves and then reads back what a restart would.
+
+// Stands in for the platform layer, which the test is not built with.
+QString Platform::fixedConfigPath(QString configPath)
+{
+    return configPath;
+}
+
+static QList<QUrl> urlsOf(const QSharedPointer<Playlist> &playlist)
+{
+    QList<QUrl> urls;
+    for (const ItemPointer &item : contentsOf(playlist))
+        urls.append(item->url());
+    return urls;
+}
+
+// A tab as DrawnPlaylist writes it.
+static QVariantMap tabOf(const QSharedPointer<Playlist> &playlist)
+{
+    return { { "playlist", playlist->uuid() }, { "title", playlist->title() } };
+}
+
+class TestAutoSaver : public QObject {
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void cleanup();
+
+    void firstSave();
+    void quickPlaylistEdited();
+    void quickPlaylistKept();
+    void quickPlaylistClosed();
+
+private:
+    QSharedPointer<Playlist> quick();
+    void save(const QVariantList &tabs, bool playlistsStored);
+
+    Storage *storage = nullptr;
+};
+
+void TestAutoSaver::initTestCase()
+{
+    // Keeps the playlists out of the real configuration folder.
+    QStandardPaths::setTestModeEnabled(true);
+    storage = new Storage(this);
+    QVERIFY(QDir(Storage::fetchConfigPath()).exists());
+    cleanup();
+}
+
+void TestAutoSaver::cleanup()
+{
+    QDir(Storage::fetchConfigPath() + "/playlists").removeRecursively();
+    quick()->clear();
+    quick()->clearUndoHistory();
+}
+
+QSharedPointer<Playlist> TestAutoSaver::quick()
+{
+    return PlaylistCollection::getSingleton()->playlistOf(QUuid());
+}
+
+void TestAutoSaver::save(const QVariantList &tabs, bool playlistsStored)
+{
+    AutoSaver saver(storage);
+    saver.setTabs([tabs]() { return QVariant(tabs); });
+    saver.start(playlistsStored);
+    saver.flush();
+}
+
+void TestAutoSaver::firstSave()
+{
+    // As after upgrading, when every playlist is written out.
+    auto collection = PlaylistCollection::getSingleton();
+    auto other = collection->newPlaylist("Other");
+    for (int i = 0; i < 3; ++i) {
+        quick()->addItem(trackUrl(i));
+        other->addItem(trackUrl(10 + i));
+    }
+    save({ tabOf(quick()), tabOf(other) }, false);
+
+    QVERIFY(storage->isPlaylistStored(QUuid()));
+    auto loaded = storage->readPlaylist(QUuid());
+    QVERIFY(loaded);
+    QVERIFY(loaded->uuid().isNull());
+    QCOMPARE(urlsOf(loaded), urlsOf(quick()));
+
+    loaded = storage->readPlaylist(other->uuid());
+    QVERIFY(loaded);
+    QCOMPARE(loaded->uuid(), other->uuid());
+    QCOMPARE(urlsOf(loaded), urlsOf(other));
+    collection->removePlaylist(other->uuid());
+}
+
+void TestAutoSaver::quickPlaylistEdited()
+{
+    // Saved as it was, then changed while the saver watches.
+    QVariantList tabs { tabOf(quick()) };
+    save(tabs, false);
+    auto loaded = storage->readPlaylist(QUuid());
+    QVERIFY(loaded);
+    QVERIFY(loaded->isEmpty());
+
+    AutoSaver saver(storage);
+    saver.setTabs([tabs]() { return QVariant(tabs); });
+    saver.start(true);
+    quick()->addItem(trackUrl(0));
+    quick()->addItem(trackUrl(1));
+    saver.flush();
+
+    loaded = storage->readPlaylist(QUuid());
+    QVERIFY(loaded);
+    QCOMPARE(urlsOf(loaded), QList<QUrl>({ trackUrl(0), trackUrl(1) }));
+}
+
+void TestAutoSaver::quickPlaylistKept()
+{
+    // Starting up prunes the files no tab names, which the quick
+    // playlist's tab does.
+    quick()->addItem(trackUrl(0));
+    QVariantList tabs { tabOf(quick()) };
+    save(tabs, false);
+    save(tabs, true);
+    QVERIFY(storage->isPlaylistStored(QUuid()));
+    auto loaded = storage->readPlaylist(QUuid());
+    QVERIFY(loaded);
+    QCOMPARE(urlsOf(loaded), QList<QUrl>({ trackUrl(0) }));
+}
+
+void TestAutoSaver::quickPlaylistClosed()
+{
+    quick()->addItem(trackUrl(0));
+    save({ tabOf(quick()) }, false);
+    QVERIFY(storage->isPlaylistStored(QUuid()));
+    save(QVariantList(), true);
+    QVERIFY(!storage->isPlaylistStored(QUuid()));
+}
+
+QTEST_GUILESS_MAIN(TestAutoSaver)
+
+#include "tst_autosaver.moc"
@@ -0,0 +1,5 @@
+include(../tests.pri)
+
+TARGET = tst_editjournal
+
+SOURCES += tst_editjournal.cpp
@@ -0,0 +1,326 @@
+#include <QtTest>
+#include "editjournal.h"
+#include "playlist.h"
+#include "tests/fixtures.h"
+
+// The journal on its own, and then through Playlist, which is what applies
+// its edits backwards and forwards.
+
+static EditJournal::Step movedStep(int from, int count, int to)
+{
+    EditJournal::Step step;
+    step.kind = EditJournal::Step::Moved;
+    step.from = from;
+    step.count = count;
+    step.to = to;
+    return step;
+}
+
+class TestEditJournal : public QObject {
+    Q_OBJECT
+private slots:
+    void cleanup();
+
+    void commitAndTake();
+    void groups();
+    void recordingForgetsRedo();
+    void budget();
+    void budgetIsShared();
+
+    void undoInsert();
+    void undoRemove();
+    void undoMove();
+    void undoReorder();
+    void undoClear();
+    void undoGroup();
+    void historyCleared();
+    void dequeuedThenRemoved();
+};
+
+void TestEditJournal::cleanup()
+{
+    EditJournal::setBudget(EditJournal::defaultBudget);
+}
+
+void TestEditJournal::commitAndTake()
+{
+    EditJournal journal;
+    QVERIFY(!journal.canUndo());
+    journal.commit();
+    QVERIFY(!journal.canUndo());
+
+    journal.record(movedStep(0, 1, 2));
+    journal.record(movedStep(3, 1, 4));
+    journal.commit();
+    QVERIFY(journal.canUndo());
+    QVERIFY(!journal.canRedo());
+
+    EditJournal::Edit edit = journal.takeUndo();
+    QCOMPARE(edit.count(), 2);
+    QCOMPARE(edit[0].from, 0);
+    QCOMPARE(edit[1].from, 3);
+    QVERIFY(!journal.canUndo());
+    QVERIFY(journal.canRedo());
+
+    edit = journal.takeRedo();
+    QCOMPARE(edit.count(), 2);
+    QVERIFY(journal.canUndo());
+    QVERIFY(!journal.canRedo());
+}
+
+void TestEditJournal::groups()
+{
+    EditJournal journal;
+    journal.open();
+    journal.record(movedStep(0, 1, 2));
+    journal.commit();
+    journal.open();
+    journal.record(movedStep(1, 1, 2));
+    journal.commit();
+    journal.close();
+    QVERIFY(!journal.canUndo());
+    journal.record(movedStep(2, 1, 3));
+    journal.close();
+    QVERIFY(journal.canUndo());
+    QCOMPARE(journal.takeUndo().count(), 3);
+    QVERIFY(!journal.canUndo());
+}
+
+void TestEditJournal::recordingForgetsRedo()
+{
+    EditJournal journal;
+    journal.record(movedStep(0, 1, 2));
+    journal.commit();
+    journal.record(movedStep(1, 1, 2));
+    journal.commit();
+    journal.takeUndo();
+    QVERIFY(journal.canRedo());
+
+    journal.record(movedStep(2, 1, 3));
+    QVERIFY(!journal.canRedo());
+    journal.commit();
+    QCOMPARE(journal.takeUndo().first().from, 2);
+    QCOMPARE(journal.takeUndo().first().from, 0);
+    QVERIFY(!journal.canUndo());
+}
+
+void TestEditJournal::budget()
+{
+    EditJournal journal;
+    for (int i = 0; i < 10; ++i) {
+        journal.record(movedStep(i, 1, i + 1));
+        journal.commit();
+    }
+    QVERIFY(journal.canUndo());
+
+    // Room for three edits of this size, so the oldest seven go.
+    qint64 oneEdit = sizeof(EditJournal::Edit) + sizeof(EditJournal::Step);
+    EditJournal::setBudget(3 * oneEdit);
+    QCOMPARE(EditJournal::budget(), 3 * oneEdit);
+    int undone = 0;
+    while (journal.canUndo()) {
+        QCOMPARE(journal.takeUndo().first().from, 9 - undone);
+        ++undone;
+    }
+    QCOMPARE(undone, 3);
+
+    EditJournal::setBudget(0);
+    journal.record(movedStep(0, 1, 1));
+    journal.commit();
+    QVERIFY(!journal.canUndo());
+    QVERIFY(journal.takeUndo().isEmpty());
+}
+
+void TestEditJournal::budgetIsShared()
+{
+    EditJournal older;
+    EditJournal newer;
+    older.record(movedStep(0, 1, 1));
+    older.commit();
+    qint64 oneEdit = sizeof(EditJournal::Edit) + sizeof(EditJournal::Step);
+    EditJournal::setBudget(4 * oneEdit);
+    QVERIFY(older.canUndo());
+
+    // Another journal's edits push this one's out.
+    for (int i = 0; i < 10; ++i) {
+        newer.record(movedStep(i, 1, i + 1));
+        newer.commit();
+    }
+    QVERIFY(!older.canUndo());
+    QVERIFY(newer.canUndo());
+}
+
+void TestEditJournal::undoInsert()
+{
+    Playlist list;
+    QList<ItemPointer> first = makeItems(5);
+    QList<ItemPointer> second = makeItems(3);
+    list.insertMany(0, first);
+    list.insertMany(2, second);
+    QList<ItemPointer> both = first;
+    for (int i = 0; i < second.count(); ++i)
+        both.insert(2 + i, second.at(i));
+    QCOMPARE(contentsOf(list), both);
+
+    QVERIFY(list.undo());
+    QCOMPARE(contentsOf(list), first);
+    QVERIFY(list.itemOf(second.first()->id()).isNull());
+    QVERIFY(list.undo());
+    QVERIFY(list.isEmpty());
+    QVERIFY(!list.undo());
+
+    QVERIFY(list.redo());
+    QVERIFY(list.redo());
+    QCOMPARE(contentsOf(list), both);
+    QCOMPARE(list.itemOf(second.first()->id()), second.first());
+    QVERIFY(!list.redo());
+}
+
+void TestEditJournal::undoRemove()
+{
+    Playlist list;
+    QList<ItemPointer> items = makeItems(10);
+    list.insertMany(0, items);
+    list.clearUndoHistory();
+
+    list.removeMany(QList<int> { 8, 1, 4, 4 });
+    QList<ItemPointer> kept = items;
+    kept.removeAt(8);
+    kept.removeAt(4);
+    kept.removeAt(1);
+    QCOMPARE(contentsOf(list), kept);
+
+    QVERIFY(list.undo());
+    QCOMPARE(contentsOf(list), items);
+    QCOMPARE(list.itemOf(items.at(4)->id()), items.at(4));
+    QVERIFY(list.redo());
+    QCOMPARE(contentsOf(list), kept);
+}
+
+void TestEditJournal::undoMove()
+{
+    Playlist list;
+    QList<ItemPointer> items = makeItems(8);
+    list.insertMany(0, items);
+    list.clearUndoHistory();
+
+    list.moveRange(1, 3, 5);
+    QVERIFY(contentsOf(list) != items);
+    QVERIFY(list.undo());
+    QCOMPARE(contentsOf(list), items);
+    QVERIFY(list.redo());
+    QCOMPARE(contentsOf(list).at(5), items.at(1));
+}
+
+void TestEditJournal::undoReorder()
+{
+    Playlist list;
+    QList<ItemPointer> items = makeItems(6);
+    list.insertMany(0, items);
+    list.clearUndoHistory();
+
+    // A permutation worked out for an earlier version is turned away.
+    QVector<int> permutation { 3, 5, 0, 1, 4, 2 };
+    int version = list.snapshot()->version();
+    list.addItem(QUrl("file:///late.mkv"));
+    list.removeMany(QList<int> { 6 });
+    QVERIFY(!list.reorder(permutation, version));
+    QCOMPARE(contentsOf(list), items);
+    list.clearUndoHistory();
+
+    version = list.snapshot()->version();
+    QVERIFY(list.reorder(permutation, version));
+    QList<ItemPointer> sorted;
+    for (int source : permutation)
+        sorted.append(items.at(source));
+    QCOMPARE(contentsOf(list), sorted);
+    QVERIFY(list.undo());
+    QCOMPARE(contentsOf(list), items);
+    QVERIFY(list.redo());
+    QCOMPARE(contentsOf(list), sorted);
+}
+
+void TestEditJournal::undoClear()
+{
+    Playlist list;
+    QList<ItemPointer> items = makeItems(100);
+    list.insertMany(0, items);
+    list.clearUndoHistory();
+    auto collection = ItemCollection::getSingleton();
+    for (const ItemPointer &item : items)
+        collection->storeItem(item);
+
+    // The items leave the collection whichever way the list was cleared.
+    list.clear();
+    QVERIFY(list.isEmpty());
+    QVERIFY(list.itemOf(items.first()->id()).isNull());
+    QVERIFY(collection->itemOf(items.first()->id()).isNull());
+    QVERIFY(list.undo());
+    QCOMPARE(contentsOf(list), items);
+    QCOMPARE(list.itemOf(items.last()->id()), items.last());
+    QCOMPARE(collection->itemOf(items.last()->id()), items.last());
+    QCOMPARE(list.search({ "track 42" }).count(), 1);
+    QVERIFY(list.redo());
+    QVERIFY(list.isEmpty());
+    QVERIFY(collection->itemOf(items.last()->id()).isNull());
+    QVERIFY(list.undo());
+    QCOMPARE(contentsOf(list), items);
+}
+
+void TestEditJournal::undoGroup()
+{
+    Playlist list;
+    QList<ItemPointer> items = makeItems(4);
+    list.openUndoGroup();
+    for (const ItemPointer &item : items)
+        list.insertMany(list.count(), { item });
+    list.moveRange(0, 1, 3);
+    list.closeUndoGroup();
+
+    QVERIFY(list.undo());
+    QVERIFY(list.isEmpty());
+    QVERIFY(!list.canUndo());
+    QVERIFY(list.redo());
+    QCOMPARE(contentsOf(list).last(), items.first());
+}
+
+void TestEditJournal::historyCleared()
+{
+    Playlist list;
+    list.insertMany(0, makeItems(3));
+    QVERIFY(list.canUndo());
+    list.clearUndoHistory();
+    QVERIFY(!list.canUndo());
+    QVERIFY(!list.undo());
+}
+
+void TestEditJournal::dequeuedThenRemoved()
+{
+    auto queue = PlaylistCollection::getSingleton()->queuePlaylist();
+    Playlist list;
+    QList<ItemPointer> items = makeItems(4);
+    list.insertMany(0, items);
+    queue->addItems(QUuid(), items.mid(0, 3));
+    queue->removeItem(items.at(1)->id());
+    QVERIFY(queue->canUndo());
+
+    // Gone from its playlist, the item is not the queue's to put back.
+    list.removeMany(QList<int> { 1 });
+    QVERIFY(!queue->canUndo());
+    QCOMPARE(queue->count(), 2);
+
+    // Whereas one the queue's history never held leaves it alone.
+    queue->removeItem(items.at(0)->id());
+    QVERIFY(queue->canUndo());
+    list.removeMany(QList<int> { 2 });
+    QVERIFY(queue->canUndo());
+    QVERIFY(queue->undo());
+    QCOMPARE(queue->count(), 2);
+
+    queue->clear();
+    queue->clearUndoHistory();
+}
+
+QTEST_GUILESS_MAIN(TestEditJournal)
+
+#include "tst_editjournal.moc"
@@ -0,0 +1,41 @@
+#ifndef FIXTURES_H
+#define FIXTURES_H
+// What the tests build playlists from and read them back with.
+
+#include <QList>
+#include <QSharedPointer>
+#include <QString>
+#include <QUrl>
+#include "playlist.h"
+
+// Ten tracks to an album, as a library usually comes.
+inline QUrl trackUrl(int i)
+{
+    return QUrl::fromLocalFile(QString("/music/album %1/track %2.flac")
+                               .arg(i / 10).arg(i));
+}
+
+// Items of their own, not in the collection or any playlist.
+inline QList<ItemPointer> makeItems(int count)
+{
+    QList<ItemPointer> items;
+    for (int i = 0; i < count; ++i)
+        items.append(ItemPointer(new Item(trackUrl(i))));
+    return items;
+}
+
+inline QList<ItemPointer> contentsOf(Playlist &list)
+{
+    QList<ItemPointer> contents;
+    list.iterateItems([&contents](ItemPointer item) {
+        contents.append(item);
+    });
+    return contents;
+}
+
+inline QList<ItemPointer> contentsOf(const QSharedPointer<Playlist> &list)
+{
+    return contentsOf(*list);
+}
+
+#endif // FIXTURES_H
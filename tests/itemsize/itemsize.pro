@@ -0,0 +1,5 @@
+include(../tests.pri)
+
+TARGET = tst_itemsize
+
+SOURCES += tst_itemsize.cpp
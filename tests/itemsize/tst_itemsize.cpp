@@ -0,0 +1,136 @@
+#include <QtTest>
+#include "playlist.h"
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// What an item costs on the heap, on its own and once it is in a playlist,
+// counted from what the allocator has handed out.  Only glibc is asked.
+
+static qint64 heapInUse()
+{
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 33)
+    struct mallinfo2 info = mallinfo2();
+    return qint64(info.uordblks) + qint64(info.hblkhd);
+#else
+    struct mallinfo info = mallinfo();
+    return qint64(uint(info.uordblks)) + qint64(uint(info.hblkhd));
+#endif
+#else
+    return -1;
+#endif
+}
+
+// Ten tracks to an album, as a library usually comes, so most of the url
+// is a prefix shared with the neighbours.
+static QUrl urlFor(int i)
+{
+    return QUrl::fromLocalFile(QString("/music/artist %1/album %2/%3 - track.flac")
+                               .arg(i / 1000).arg(i / 10).arg(i));
+}
+
+class TestItemSize : public QObject {
+    Q_OBJECT
+private slots:
+    void initTestCase();
+
+    void itemsAlone_data();
+    void itemsAlone();
+    void itemsInPlaylist_data();
+    void itemsInPlaylist();
+
+private:
+    void addCounts();
+};
+
+void TestItemSize::initTestCase()
+{
+    if (heapInUse() < 0)
+        QSKIP("The allocator cannot be asked what it has handed out here.");
+
+    // The collection, the string pool and the journal set themselves up
+    // on first use, which is not what is being measured.
+    Playlist warmUp;
+    warmUp.insertMany(0, { ItemCollection::getSingleton()->addItem(urlFor(0)) });
+    ItemCollection::getSingleton()->removeItem(warmUp.itemAt(0)->id());
+}
+
+void TestItemSize::addCounts()
+{
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("100k") << 100000;
+    QTest::newRow("1M") << 1000000;
+}
+
+void TestItemSize::itemsAlone_data()
+{
+    addCounts();
+}
+
+void TestItemSize::itemsAlone()
+{
+    QFETCH(int, count);
+
+    qint64 before = heapInUse();
+    qint64 perItem;
+    {
+        QVector<ItemPointer> items;
+        items.reserve(count);
+        for (int i = 0; i < count; ++i)
+            items.append(ItemPointer(new Item(urlFor(i))));
+        perItem = (heapInUse() - before) / count;
+        QCOMPARE(items.last()->url(), urlFor(count - 1));
+    }
+    QTest::setBenchmarkResult(perItem, QTest::BytesAllocated);
+
+    // The item, its name and the pointer holding it.
+    QVERIFY2(perItem < 256, qPrintable(QString::number(perItem)));
+}
+
+void TestItemSize::itemsInPlaylist_data()
+{
+    addCounts();
+}
+
+void TestItemSize::itemsInPlaylist()
+{
+    QFETCH(int, count);
+
+    auto collection = ItemCollection::getSingleton();
+    qint64 before = heapInUse();
+    qint64 perItem;
+    QList<quint64> ids;
+    {
+        // Loaded as a whole, with nothing to undo afterwards, as a playlist
+        // is after being read from disk.
+        Playlist list;
+        {
+            QList<ItemPointer> items;
+            items.reserve(count);
+            for (int i = 0; i < count; ++i)
+                items.append(collection->addItem(urlFor(i)));
+            list.insertMany(0, items);
+            list.clearUndoHistory();
+        }
+        perItem = (heapInUse() - before) / count;
+        QCOMPARE(list.count(), count);
+
+        list.iterateItems([&ids](ItemPointer item) {
+            ids.append(item->id());
+        });
+    }
+    for (quint64 id : ids)
+        collection->removeItem(id);
+
+    QTest::setBenchmarkResult(perItem, QTest::BytesAllocated);
+
+    // The item, and its place in the collection, the playlist's order, its
+    // lookup by id and its search index.
+    QVERIFY2(perItem < 768, qPrintable(QString::number(perItem)));
+}
+
+QTEST_GUILESS_MAIN(TestItemSize)
+
+#include "tst_itemsize.moc"
@@ -0,0 +1,15 @@
+include(../tests.pri)
+
+# Storage says where the cache lives, and pulls in the platform header.
+QT       += gui widgets
+
+TARGET = tst_metadatacache
+
+SOURCES += \
+    tst_metadatacache.cpp \
+    $$PWD/../../metadatacache.cpp \
+    $$PWD/../../storage.cpp
+
+HEADERS += \
+    $$PWD/../../metadatacache.h \
+    $$PWD/../../storage.h
@@ -0,0 +1,254 @@
+#include <QtTest>
+#include <QProcess>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <cstdio>
+#include "metadatacache.h"
+#include "storage.h"
+#include "platform/unify.h"
+
+// The cache is a singleton that opens its log once, so what a later session
+// would see is checked by running this program again as a child, which
+// looks every file up and prints what it found.
+
+// Stands in for the platform layer, which the test is not built with.
+QString Platform::fixedConfigPath(QString configPath)
+{
+    return configPath;
+}
+
+static const char lookupSwitch[] = "--lookup";
+
+static QString logPath()
+{
+    return QDir(Storage::fetchConfigPath()).absoluteFilePath("metadata.log");
+}
+
+static QString indexPath()
+{
+    return QDir(Storage::fetchConfigPath()).absoluteFilePath("metadata.index");
+}
+
+static qint64 sizeOf(const QString &fileName)
+{
+    return QFileInfo(fileName).size();
+}
+
+static bool writeFile(const QString &fileName, const QByteArray &bytes)
+{
+    QFile file(fileName);
+    return file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+            && file.write(bytes) == bytes.size();
+}
+
+// A title, or "?" for a file the cache does not know.
+static QString describe(const QString &fileName)
+{
+    QVariantMap metadata;
+    if (!MetadataCache::getSingleton()->lookup(fileName, &metadata))
+        return "?";
+    return "=" + metadata.value("title").toString();
+}
+
+// Run as the child: one line per file in the folder.
+static int lookupAll(const QString &folder)
+{
+    QTextStream out(stdout);
+    QDir dir(folder);
+    for (const QString &name : dir.entryList(QDir::Files, QDir::Name))
+        out << name << '\t' << describe(dir.absoluteFilePath(name)) << '\n';
+    return 0;
+}
+
+class TestMetadataCache : public QObject {
+    Q_OBJECT
+private slots:
+    void initTestCase();
+
+    void storeAndLookup();
+    void replayWithoutIndex();
+    void index();
+    void tornTail();
+    void staleIndex();
+    void unreadableLog();
+
+private:
+    QString media(const QString &name);
+    QMap<QString, QString> lookupInChild();
+    QMap<QString, QString> lookupHere();
+
+    QTemporaryDir dir;
+};
+
+QString TestMetadataCache::media(const QString &name)
+{
+    return dir.filePath(name);
+}
+
+QMap<QString, QString> TestMetadataCache::lookupInChild()
+{
+    QMap<QString, QString> found;
+    QProcess child;
+    child.start(QCoreApplication::applicationFilePath(),
+                { lookupSwitch, dir.path() });
+    if (!child.waitForFinished(30000) || child.exitCode() != 0)
+        return found;
+    for (const QString &line : QString::fromUtf8(child.readAllStandardOutput())
+                                   .split('\n', QString::SkipEmptyParts)) {
+        QStringList parts = line.split('\t');
+        if (parts.count() == 2)
+            found.insert(parts[0], parts[1]);
+    }
+    return found;
+}
+
+QMap<QString, QString> TestMetadataCache::lookupHere()
+{
+    QMap<QString, QString> found;
+    QDir media(dir.path());
+    for (const QString &name : media.entryList(QDir::Files, QDir::Name))
+        found.insert(name, describe(media.absoluteFilePath(name)));
+    return found;
+}
+
+void TestMetadataCache::initTestCase()
+{
+    QVERIFY(dir.isValid());
+    QVERIFY(QDir().mkpath(Storage::fetchConfigPath()));
+    QFile::remove(logPath());
+    QFile::remove(indexPath());
+    for (const QString &name : { "a.mkv", "b.mkv", "c.mkv", "d.mkv", "e.mkv" })
+        QVERIFY(writeFile(media(name), name.toUtf8().repeated(100)));
+}
+
+void TestMetadataCache::storeAndLookup()
+{
+    auto cache = MetadataCache::getSingleton();
+    QVERIFY(cache->isEmpty());
+
+    cache->store(media("a.mkv"), { { "title", "A" } });
+    QCOMPARE(describe(media("a.mkv")), QString("=A"));
+    QVERIFY(!cache->isEmpty());
+
+    // Playing a file again tells the cache nothing new.
+    qint64 logSize = sizeOf(logPath());
+    cache->store(media("a.mkv"), { { "title", "A" } });
+    QCOMPARE(sizeOf(logPath()), logSize);
+
+    // Something new supersedes what there was.
+    cache->store(media("a.mkv"), { { "title", "A2" } });
+    QVERIFY(sizeOf(logPath()) > logSize);
+    QCOMPARE(describe(media("a.mkv")), QString("=A2"));
+
+    // Known to have nothing, which is not the same as unknown.
+    cache->store(media("b.mkv"), QVariantMap());
+    QCOMPARE(describe(media("b.mkv")), QString("="));
+    QCOMPARE(describe(media("c.mkv")), QString("?"));
+    QCOMPARE(describe(media("nowhere.mkv")), QString("?"));
+
+    // A file changed in place is another file.
+    cache->store(media("d.mkv"), { { "title", "D" } });
+    QVERIFY(writeFile(media("d.mkv"), QByteArray("changed")));
+    QCOMPARE(describe(media("d.mkv")), QString("?"));
+
+#ifndef Q_OS_WIN
+    // One moved on the same disk is the same file.
+    cache->store(media("e.mkv"), { { "title", "E" } });
+    QVERIFY(QFile::rename(media("e.mkv"), media("f.mkv")));
+    QCOMPARE(describe(media("f.mkv")), QString("=E"));
+#endif
+}
+
+void TestMetadataCache::replayWithoutIndex()
+{
+    // Nothing has been saved, so the next session has only the log.
+    QVERIFY(!QFile::exists(indexPath()));
+    QCOMPARE(lookupInChild(), lookupHere());
+}
+
+void TestMetadataCache::index()
+{
+    MetadataCache::getSingleton()->save();
+    QVERIFY(QFile::exists(indexPath()));
+    QCOMPARE(lookupInChild(), lookupHere());
+
+    // What is learnt after the index was written is replayed from the log.
+    MetadataCache::getSingleton()->store(media("c.mkv"), { { "title", "C" } });
+    QMap<QString, QString> found = lookupInChild();
+    QCOMPARE(found.value("c.mkv"), QString("=C"));
+    QCOMPARE(found, lookupHere());
+}
+
+void TestMetadataCache::tornTail()
+{
+    // A write cut short leaves part of an entry, which the next session
+    // drops and truncates away.
+    qint64 logSize = sizeOf(logPath());
+    // The entry's magic and a length of 64, its identity, and less of the
+    // metadata than the length says.
+    QByteArray torn("MENT");
+    torn.append("\x40\0\0\0", 4);
+    torn.append(QByteArray(32, '\x01'));
+    torn.append("partial");
+    QFile log(logPath());
+    QVERIFY(log.open(QIODevice::Append));
+    QCOMPARE(log.write(torn), qint64(torn.size()));
+    log.close();
+
+    QCOMPARE(lookupInChild(), lookupHere());
+    QCOMPARE(sizeOf(logPath()), logSize);
+}
+
+void TestMetadataCache::staleIndex()
+{
+    // An index that does not belong to the log is ignored, and the whole
+    // log replayed instead.
+    QByteArray bytes;
+    {
+        QFile index(indexPath());
+        QVERIFY(index.open(QIODevice::ReadOnly));
+        bytes = index.readAll();
+    }
+    QVERIFY(bytes.size() > 16);
+    bytes[8] = char(bytes[8] ^ 0xff);
+    QVERIFY(writeFile(indexPath(), bytes));
+    QCOMPARE(lookupInChild(), lookupHere());
+
+    QVERIFY(writeFile(indexPath(), QByteArray("nonsense")));
+    QCOMPARE(lookupInChild(), lookupHere());
+}
+
+void TestMetadataCache::unreadableLog()
+{
+    // A log of a kind not understood is started afresh.  Last, as the
+    // cache in this process still has the old one open.
+    QByteArray bytes;
+    {
+        QFile log(logPath());
+        QVERIFY(log.open(QIODevice::ReadOnly));
+        bytes = log.readAll();
+    }
+    bytes[0] = char(bytes[0] ^ 0xff);
+    QVERIFY(writeFile(logPath(), bytes));
+
+    QMap<QString, QString> found = lookupInChild();
+    QVERIFY(!found.isEmpty());
+    for (const QString &value : found)
+        QCOMPARE(value, QString("?"));
+    QCOMPARE(sizeOf(logPath()), qint64(16));
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    // Keeps the cache out of the real configuration folder.
+    QStandardPaths::setTestModeEnabled(true);
+    if (argc == 3 && qstrcmp(argv[1], lookupSwitch) == 0)
+        return lookupAll(QString::fromLocal8Bit(argv[2]));
+
+    TestMetadataCache test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_metadatacache.moc"
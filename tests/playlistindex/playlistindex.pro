@@ -0,0 +1,5 @@
+include(../tests.pri)
+
+TARGET = tst_playlistindex
+
+SOURCES += tst_playlistindex.cpp
@@ -0,0 +1,249 @@
+#include <QtTest>
+#include <random>
+#include "playlist.h"
+#include "playlistindex.h"
+#include "tests/fixtures.h"
+
+// Every operation is checked against a QList doing the same thing the slow
+// way, so that positions are known to survive the splits and merges the
+// tree does underneath.
+
+static bool sameAs(const PlaylistIndex &index, const QList<ItemPointer> &model)
+{
+    if (index.count() != model.count())
+        return false;
+    int position = 0;
+    for (const ItemPointer &item : index)
+        if (item != model.at(position++))
+            return false;
+    for (int i = 0; i < model.count(); ++i)
+        if (index.at(i) != model.at(i) || index.indexOf(model.at(i)) != i)
+            return false;
+    return true;
+}
+
+class TestPlaylistIndex : public QObject {
+    Q_OBJECT
+private slots:
+    void empty();
+    void appendAndInsert();
+    void positionOf();
+    void neighbours();
+    void takeAndRemove();
+    void moveRange_data();
+    void moveRange();
+    void removeMany();
+    void reorder();
+    void swap();
+    void randomEdits();
+};
+
+void TestPlaylistIndex::empty()
+{
+    PlaylistIndex index;
+    QVERIFY(index.isEmpty());
+    QCOMPARE(index.count(), 0);
+    QVERIFY(index.first().isNull());
+    QVERIFY(index.last().isNull());
+    QVERIFY(index.value(0).isNull());
+    QVERIFY(index.begin() == index.end());
+    QList<ItemPointer> stranger = makeItems(1);
+    QCOMPARE(index.indexOf(stranger.first()), -1);
+    QVERIFY(!index.contains(stranger.first()));
+}
+
+void TestPlaylistIndex::appendAndInsert()
+{
+    QList<ItemPointer> model = makeItems(8);
+    PlaylistIndex index;
+    for (const ItemPointer &item : model)
+        index.append(item);
+    QVERIFY(sameAs(index, model));
+
+    QList<ItemPointer> more = makeItems(5);
+    index.insert(0, more.at(0));
+    model.insert(0, more.at(0));
+    index.insert(index.count(), more.at(1));
+    model.append(more.at(1));
+    index.insert(4, more.mid(2));
+    for (int i = 2; i < more.count(); ++i)
+        model.insert(4 + i - 2, more.at(i));
+    QVERIFY(sameAs(index, model));
+    QCOMPARE(index.toList(), model);
+}
+
+void TestPlaylistIndex::positionOf()
+{
+    QList<ItemPointer> model = makeItems(1000);
+    PlaylistIndex index;
+    index.insert(0, model);
+    for (int i = 0; i < model.count(); ++i) {
+        QCOMPARE(index.indexOf(model.at(i)), i);
+        QCOMPARE(index.indexOf(model.at(i).data()), i);
+    }
+    QList<ItemPointer> stranger = makeItems(1);
+    QCOMPARE(index.indexOf(stranger.first()), -1);
+    QCOMPARE(index.indexOf(stranger.first().data()), -1);
+}
+
+void TestPlaylistIndex::neighbours()
+{
+    QList<ItemPointer> model = makeItems(3);
+    PlaylistIndex index;
+    index.insert(0, model);
+    QCOMPARE(index.first(), model.first());
+    QCOMPARE(index.last(), model.last());
+    QCOMPARE(index.after(model.at(0)), model.at(1));
+    QCOMPARE(index.before(model.at(2)), model.at(1));
+    QVERIFY(index.after(model.at(2)).isNull());
+    QVERIFY(index.before(model.at(0)).isNull());
+}
+
+void TestPlaylistIndex::takeAndRemove()
+{
+    QList<ItemPointer> model = makeItems(10);
+    PlaylistIndex index;
+    index.insert(0, model);
+
+    QCOMPARE(index.takeAt(3), model.takeAt(3));
+    QCOMPARE(index.takeFirst(), model.takeFirst());
+    QVERIFY(index.removeOne(model.last()));
+    QList<ItemPointer> gone;
+    gone.append(model.takeLast());
+    QVERIFY(!index.removeOne(gone.first()));
+    QVERIFY(!index.contains(gone.first()));
+    QCOMPARE(index.indexOf(gone.first()), -1);
+    QVERIFY(sameAs(index, model));
+}
+
+void TestPlaylistIndex::moveRange_data()
+{
+    QTest::addColumn<int>("from");
+    QTest::addColumn<int>("count");
+    QTest::addColumn<int>("to");
+
+    QTest::newRow("forwards") << 1 << 3 << 5;
+    QTest::newRow("backwards") << 6 << 2 << 0;
+    QTest::newRow("to the end") << 0 << 4 << 6;
+    QTest::newRow("past the end") << 2 << 2 << 99;
+    QTest::newRow("in place") << 4 << 3 << 4;
+    QTest::newRow("everything") << 0 << 10 << 0;
+}
+
+void TestPlaylistIndex::moveRange()
+{
+    QFETCH(int, from);
+    QFETCH(int, count);
+    QFETCH(int, to);
+
+    QList<ItemPointer> model = makeItems(10);
+    PlaylistIndex index;
+    index.insert(0, model);
+
+    index.moveRange(from, count, to);
+    QList<ItemPointer> moved = model.mid(from, count);
+    for (int i = 0; i < count; ++i)
+        model.removeAt(from);
+    to = qBound(0, to, model.count());
+    for (int i = 0; i < moved.count(); ++i)
+        model.insert(to + i, moved.at(i));
+    QVERIFY(sameAs(index, model));
+}
+
+void TestPlaylistIndex::removeMany()
+{
+    QList<ItemPointer> model = makeItems(20);
+    PlaylistIndex index;
+    index.insert(0, model);
+
+    QList<int> doomed { 19, 0, 7, 7, 8, 42, -1 };
+    QList<ItemPointer> removed = index.removeMany(doomed);
+    QList<ItemPointer> expected { model.at(0), model.at(7), model.at(8), model.at(19) };
+    QCOMPARE(removed, expected);
+    for (const ItemPointer &item : expected)
+        model.removeOne(item);
+    QVERIFY(sameAs(index, model));
+}
+
+void TestPlaylistIndex::reorder()
+{
+    QList<ItemPointer> model = makeItems(6);
+    PlaylistIndex index;
+    index.insert(0, model);
+
+    QVERIFY(!index.reorder({ 0, 1, 2 }));
+    QVERIFY(!index.reorder({ 0, 0, 1, 2, 3, 4 }));
+    QVERIFY(!index.reorder({ 0, 1, 2, 3, 4, 6 }));
+    QVERIFY(sameAs(index, model));
+
+    QVector<int> permutation { 5, 3, 1, 0, 2, 4 };
+    QVERIFY(index.reorder(permutation));
+    QList<ItemPointer> reordered;
+    for (int source : permutation)
+        reordered.append(model.at(source));
+    QVERIFY(sameAs(index, reordered));
+}
+
+void TestPlaylistIndex::swap()
+{
+    QList<ItemPointer> ours = makeItems(5);
+    QList<ItemPointer> theirs = makeItems(2);
+    PlaylistIndex a;
+    PlaylistIndex b;
+    a.insert(0, ours);
+    b.insert(0, theirs);
+    a.swap(b);
+    QVERIFY(sameAs(a, theirs));
+    QVERIFY(sameAs(b, ours));
+    QVERIFY(!a.contains(ours.first()));
+}
+
+void TestPlaylistIndex::randomEdits()
+{
+    std::mt19937 generator(20241016);
+    QList<ItemPointer> pool = makeItems(2000);
+    QList<ItemPointer> model;
+    PlaylistIndex index;
+    int next = 0;
+
+    for (int round = 0; round < 4000; ++round) {
+        int count = model.count();
+        switch (generator() % 4) {
+        case 0:
+        case 1:
+            if (next < pool.count()) {
+                int at = int(generator() % uint(count + 1));
+                index.insert(at, pool.at(next));
+                model.insert(at, pool.at(next));
+                ++next;
+            }
+            break;
+        case 2:
+            if (count > 0) {
+                int at = int(generator() % uint(count));
+                QCOMPARE(index.takeAt(at), model.takeAt(at));
+            }
+            break;
+        case 3:
+            if (count > 1) {
+                int from = int(generator() % uint(count));
+                int span = 1 + int(generator() % uint(count - from));
+                int to = int(generator() % uint(count - span + 1));
+                index.moveRange(from, span, to);
+                QList<ItemPointer> moved = model.mid(from, span);
+                for (int i = 0; i < span; ++i)
+                    model.removeAt(from);
+                for (int i = 0; i < span; ++i)
+                    model.insert(to + i, moved.at(i));
+            }
+            break;
+        }
+        if (round % 250 == 0)
+            QVERIFY(sameAs(index, model));
+    }
+    QVERIFY(sameAs(index, model));
+}
+
+QTEST_APPLESS_MAIN(TestPlaylistIndex)
+
+#include "tst_playlistindex.moc"
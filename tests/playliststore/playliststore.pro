@@ -0,0 +1,5 @@
+include(../tests.pri)
+
+TARGET = tst_playliststore
+
+SOURCES += tst_playliststore.cpp
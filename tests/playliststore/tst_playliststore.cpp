@@ -0,0 +1,260 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include <cstring>
+#include <random>
+#include "playlist.h"
+#include "playliststore.h"
+#include "tests/fixtures.h"
+
+// Where things are in a saved file, as PlaylistStore lays it out.
+static const int headerSize = 80;
+static const int headerVersionAt = 4;
+static const int headerFileSizeAt = 72;
+static const int recordSize = 40;
+static const int recordPrefixAt = 28;
+
+static QSharedPointer<Playlist> makePlaylist()
+{
+    QSharedPointer<Playlist> playlist(new Playlist("Road trip"));
+    for (int i = 0; i < 20; ++i) {
+        ItemPointer item = playlist->addItem(QUrl::fromLocalFile(
+                QString("/music/album %1/track %2.flac").arg(i / 5).arg(i)));
+        if (i % 3 == 0)
+            item->setMetadata({ { "title", QString("Track %1").arg(i) },
+                                { "artist", "Someone" },
+                                { "length", i * 60.5 } });
+    }
+    playlist->addItem(QUrl("https://example.com/radio/stream.m3u8?token=a%20b"));
+    playlist->itemAt(4)->setUuid(QUuid::createUuid());
+    playlist->itemAt(20)->uuid();
+    return playlist;
+}
+
+static void verifySame(const QSharedPointer<Playlist> &loaded,
+                       const QSharedPointer<Playlist> &original)
+{
+    QVERIFY(loaded);
+    QCOMPARE(loaded->title(), original->title());
+    QCOMPARE(loaded->uuid(), original->uuid());
+    QList<ItemPointer> theirs = contentsOf(original);
+    QList<ItemPointer> ours = contentsOf(loaded);
+    QCOMPARE(ours.count(), theirs.count());
+    for (int i = 0; i < ours.count(); ++i) {
+        // The url, the metadata, and the uuid if the item had been named.
+        QCOMPARE(ours.at(i)->toVMap(), theirs.at(i)->toVMap());
+        QCOMPARE(ours.at(i)->playlistUuid(), loaded->uuid());
+    }
+}
+
+static QByteArray readFile(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
+}
+
+static bool writeFile(const QString &fileName, const QByteArray &bytes)
+{
+    QFile file(fileName);
+    return file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+            && file.write(bytes) == bytes.size();
+}
+
+template <typename T>
+static void poke(QByteArray &bytes, int at, T value)
+{
+    std::memcpy(bytes.data() + at, &value, sizeof(value));
+}
+
+class TestPlaylistStore : public QObject {
+    Q_OBJECT
+private slots:
+    void initTestCase();
+
+    void metadataCoding();
+    void roundTrip();
+    void empty();
+    void resaveUndecoded();
+    void namedItems();
+    void missing();
+    void truncated_data();
+    void truncated();
+    void corrupt_data();
+    void corrupt();
+    void randomDamage();
+
+private:
+    QTemporaryDir dir;
+    QString saved;
+    QByteArray savedBytes;
+};
+
+void TestPlaylistStore::initTestCase()
+{
+    QVERIFY(dir.isValid());
+    saved = dir.filePath("saved.mpcpl");
+    QVERIFY(PlaylistStore::save(saved, makePlaylist()));
+    savedBytes = readFile(saved);
+    QVERIFY(savedBytes.size() > headerSize);
+}
+
+void TestPlaylistStore::metadataCoding()
+{
+    QVariantMap qvm { { "title", "Blue Monday" }, { "track", 3 } };
+    QByteArray bytes = PlaylistStore::encodeMetadata(qvm);
+    QCOMPARE(PlaylistStore::decodeMetadata(bytes.constData(), bytes.size()), qvm);
+    QVERIFY(PlaylistStore::encodeMetadata(QVariantMap()).isEmpty());
+    QVERIFY(PlaylistStore::decodeMetadata(nullptr, 0).isEmpty());
+    QVERIFY(PlaylistStore::decodeMetadata(bytes.constData(), bytes.size() / 2).isEmpty());
+}
+
+void TestPlaylistStore::roundTrip()
+{
+    QSharedPointer<Playlist> original = makePlaylist();
+    QString fileName = dir.filePath("roundtrip.mpcpl");
+    QVERIFY(PlaylistStore::save(fileName, original));
+    verifySame(PlaylistStore::load(fileName), original);
+}
+
+void TestPlaylistStore::empty()
+{
+    QSharedPointer<Playlist> original(new Playlist("Nothing yet"));
+    QString fileName = dir.filePath("empty.mpcpl");
+    QVERIFY(PlaylistStore::save(fileName, original));
+    QSharedPointer<Playlist> loaded = PlaylistStore::load(fileName);
+    verifySame(loaded, original);
+    QVERIFY(loaded->isEmpty());
+}
+
+void TestPlaylistStore::resaveUndecoded()
+{
+    // A loaded item's metadata is copied straight from the file it came
+    // from, which is replaced while it is still mapped.
+    QSharedPointer<Playlist> original = makePlaylist();
+    QString fileName = dir.filePath("resave.mpcpl");
+    QVERIFY(PlaylistStore::save(fileName, original));
+    QSharedPointer<Playlist> loaded = PlaylistStore::load(fileName);
+    QVERIFY(loaded);
+    QVERIFY(PlaylistStore::save(fileName, loaded));
+    QCOMPARE(readFile(fileName).size(), readFile(saved).size());
+    verifySame(PlaylistStore::load(fileName), original);
+    verifySame(loaded, original);
+}
+
+void TestPlaylistStore::namedItems()
+{
+    // Items are named as they are read, before the collection has them, and
+    // are found by uuid once it does, until they are gone again.
+    auto collection = ItemCollection::getSingleton();
+    ItemPointer item(new Item(QUrl::fromLocalFile("/music/named.flac")));
+    QUuid uuid = QUuid::createUuid();
+    item->setUuid(uuid);
+    item->setUuid(QUuid::createUuid());
+    QCOMPARE(item->uuid(), uuid);
+    QCOMPARE(collection->idOf(uuid), quint64(0));
+
+    QSharedPointer<Playlist> original(new Playlist("Named"));
+    original->insertMany(0, { item });
+    QString fileName = dir.filePath("named.mpcpl");
+    QVERIFY(PlaylistStore::save(fileName, original));
+    QSharedPointer<Playlist> loaded = PlaylistStore::load(fileName);
+    QVERIFY(loaded);
+    QCOMPARE(collection->itemOf(uuid), loaded->itemAt(0));
+    QVERIFY(loaded->itemAt(0) != item);
+
+    loaded->clear();
+    QCOMPARE(collection->idOf(uuid), quint64(0));
+}
+
+void TestPlaylistStore::missing()
+{
+    QVERIFY(PlaylistStore::load(dir.filePath("nowhere.mpcpl")).isNull());
+}
+
+void TestPlaylistStore::truncated_data()
+{
+    QTest::addColumn<int>("length");
+
+    QTest::newRow("nothing") << 0;
+    QTest::newRow("part of the header") << headerSize / 2;
+    QTest::newRow("just the header") << headerSize;
+    QTest::newRow("part of the records") << headerSize + recordSize + 3;
+    QTest::newRow("half") << savedBytes.size() / 2;
+    QTest::newRow("all but a byte") << savedBytes.size() - 1;
+}
+
+void TestPlaylistStore::truncated()
+{
+    QFETCH(int, length);
+
+    QString fileName = dir.filePath("truncated.mpcpl");
+    QVERIFY(writeFile(fileName, savedBytes.left(length)));
+    QVERIFY(PlaylistStore::load(fileName).isNull());
+}
+
+void TestPlaylistStore::corrupt_data()
+{
+    QTest::addColumn<QByteArray>("bytes");
+
+    QByteArray bytes = savedBytes;
+    bytes[0] = bytes[0] ^ 0x20;
+    QTest::newRow("magic") << bytes;
+
+    bytes = savedBytes;
+    poke<quint32>(bytes, headerVersionAt, PlaylistStore::version + 1);
+    QTest::newRow("version") << bytes;
+
+    bytes = savedBytes;
+    bytes.append(QByteArray(8, '\0'));
+    QTest::newRow("longer than it says") << bytes;
+
+    bytes = savedBytes;
+    poke<quint64>(bytes, headerFileSizeAt, quint64(-1));
+    QTest::newRow("size") << bytes;
+
+    bytes = savedBytes;
+    poke<quint32>(bytes, headerSize + recordPrefixAt, 0xffffffffu);
+    QTest::newRow("string out of range") << bytes;
+
+    bytes = savedBytes;
+    poke<quint32>(bytes, headerSize + 3 * recordSize + recordPrefixAt, 1u << 30);
+    QTest::newRow("a later record") << bytes;
+}
+
+void TestPlaylistStore::corrupt()
+{
+    QFETCH(QByteArray, bytes);
+
+    QString fileName = dir.filePath("corrupt.mpcpl");
+    QVERIFY(writeFile(fileName, bytes));
+    QVERIFY(PlaylistStore::load(fileName).isNull());
+}
+
+void TestPlaylistStore::randomDamage()
+{
+    // Whatever is damaged, loading either refuses the file or gives back
+    // items which can be read in full.
+    std::mt19937 generator(18);
+    for (int round = 0; round < 500; ++round) {
+        // A file of its own each time, as items loaded from the last may
+        // still have it mapped.
+        QString fileName = dir.filePath(QString("damaged %1.mpcpl").arg(round));
+        QByteArray bytes = savedBytes;
+        int damage = 1 + int(generator() % 4);
+        for (int i = 0; i < damage; ++i)
+            bytes[int(generator() % uint(bytes.size()))] = char(generator());
+        QVERIFY(writeFile(fileName, bytes));
+        QSharedPointer<Playlist> loaded = PlaylistStore::load(fileName);
+        if (!loaded)
+            continue;
+        for (const ItemPointer &item : contentsOf(loaded)) {
+            item->url();
+            item->metadata();
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(TestPlaylistStore)
+
+#include "tst_playliststore.moc"
@@ -0,0 +1,5 @@
+include(../tests.pri)
+
+TARGET = tst_searchindex
+
+SOURCES += tst_searchindex.cpp
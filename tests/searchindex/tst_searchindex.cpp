@@ -0,0 +1,172 @@
+#include <QtTest>
+#include "playlist.h"
+#include "searchindex.h"
+
+// find() is checked against matching every haystack in turn, which is what
+// the filter did before there was an index.
+
+static ItemPointer makeItem(const QString &fileName, const QString &artist = QString())
+{
+    ItemPointer item(new Item(QUrl::fromLocalFile("/music/" + fileName)));
+    if (!artist.isEmpty())
+        item->setMetadata({ { "artist", artist } });
+    return item;
+}
+
+static QList<ItemPointer> library()
+{
+    return {
+        makeItem("Blue Monday.flac", "New Order"),
+        makeItem("Bizarre Love Triangle.flac", "New Order"),
+        makeItem("Love Will Tear Us Apart.mp3", "Joy Division"),
+        makeItem("Transmission.mp3", "Joy Division"),
+        makeItem("Monday Monday.ogg", "The Mamas & the Papas"),
+        makeItem("Blue.opus"),
+        makeItem("untitled.wav"),
+    };
+}
+
+static QSet<const Item *> scan(const QList<ItemPointer> &items,
+                               const QStringList &needles)
+{
+    QSet<const Item *> found;
+    for (const ItemPointer &item : items)
+        if (SearchIndex::matches(SearchIndex::haystackOf(item.data()), needles))
+            found.insert(item.data());
+    return found;
+}
+
+class TestSearchIndex : public QObject {
+    Q_OBJECT
+private slots:
+    void haystack();
+    void find_data();
+    void find();
+    void removeAndRefresh();
+    void clear();
+    void fuzzyScore();
+    void fuzzyFind();
+};
+
+void TestSearchIndex::haystack()
+{
+    ItemPointer item = makeItem("Blue Monday.flac", "New Order");
+    QString haystack = SearchIndex::haystackOf(item.data());
+    QVERIFY(haystack.startsWith("blue monday"));
+    QVERIFY(haystack.contains("new order"));
+    QVERIFY(!haystack.contains(".flac"));
+    // Needles never contain the separator, so they cannot span two texts.
+    QVERIFY(!SearchIndex::matches(haystack, { "monday new" }));
+}
+
+void TestSearchIndex::find_data()
+{
+    QTest::addColumn<QStringList>("needles");
+
+    QTest::newRow("one word") << QStringList { "monday" };
+    QTest::newRow("two words") << QStringList { "love", "order" };
+    QTest::newRow("metadata") << QStringList { "joy" };
+    QTest::newRow("short") << QStringList { "bl" };
+    QTest::newRow("single letter") << QStringList { "u" };
+    QTest::newRow("nothing") << QStringList { "zzz" };
+    QTest::newRow("partly") << QStringList { "blue", "zzz" };
+    QTest::newRow("within a word") << QStringList { "ansmiss" };
+    QTest::newRow("across texts") << QStringList { "triangle new" };
+}
+
+void TestSearchIndex::find()
+{
+    QFETCH(QStringList, needles);
+
+    QList<ItemPointer> items = library();
+    SearchIndex index;
+    index.insert(items);
+    QCOMPARE(index.find(needles), scan(items, needles));
+}
+
+void TestSearchIndex::removeAndRefresh()
+{
+    QList<ItemPointer> items = library();
+    SearchIndex index;
+    index.insert(items);
+    QCOMPARE(index.find({ "order" }).count(), 2);
+
+    index.remove(items.first());
+    QList<ItemPointer> kept = items.mid(1);
+    QCOMPARE(index.find({ "order" }), scan(kept, { "order" }));
+
+    // The freed slot is reused, and may still be posted under the trigrams
+    // of what it held before.
+    ItemPointer newcomer = makeItem("Ceremony.flac", "New Order");
+    index.insert(newcomer);
+    kept.append(newcomer);
+    QCOMPARE(index.find({ "blue" }), scan(kept, { "blue" }));
+    QCOMPARE(index.find({ "order" }), scan(kept, { "order" }));
+
+    newcomer->setMetadata({ { "artist", "Joy Division" } });
+    index.refresh(newcomer);
+    QCOMPARE(index.find({ "order" }), scan(kept, { "order" }));
+    QCOMPARE(index.find({ "joy" }), scan(kept, { "joy" }));
+
+    // Refreshing what is not indexed does not add it.
+    index.refresh(items.first());
+    QVERIFY(!index.find({ "blue monday" }).contains(items.first().data()));
+}
+
+void TestSearchIndex::clear()
+{
+    QList<ItemPointer> items = library();
+    SearchIndex index;
+    index.insert(items);
+    index.clear();
+    QVERIFY(index.find({ "blue" }).isEmpty());
+    QVERIFY(index.find({ "b" }).isEmpty());
+
+    index.insert(items.first());
+    QCOMPARE(index.find({ "blue" }), QSet<const Item *> { items.first().data() });
+}
+
+void TestSearchIndex::fuzzyScore()
+{
+    QCOMPARE(SearchIndex::fuzzyScore("blue monday", "xyz"), -1);
+    QCOMPARE(SearchIndex::fuzzyScore("blue monday", "yadnom"), -1);
+    QCOMPARE(SearchIndex::fuzzyScore("blue monday", ""), -1);
+    QVERIFY(SearchIndex::fuzzyScore("blue monday", "bm") >= 0);
+    // A run beats the same letters scattered.
+    QVERIFY(SearchIndex::fuzzyScore("monday", "mon")
+            > SearchIndex::fuzzyScore("my own name", "mon"));
+    // The start of a word beats the middle of one.
+    QVERIFY(SearchIndex::fuzzyScore("a love song", "lo")
+            > SearchIndex::fuzzyScore("a glove box", "lo"));
+}
+
+void TestSearchIndex::fuzzyFind()
+{
+    QList<ItemPointer> items = library();
+    SearchIndex index;
+    index.insert(items);
+
+    QVERIFY(index.fuzzyFind("", 10).isEmpty());
+    QVERIFY(index.fuzzyFind("blue", 0).isEmpty());
+
+    QVector<SearchIndex::Match> all = index.fuzzyFind("Mon Day", 10);
+    QVERIFY(!all.isEmpty());
+    for (int i = 1; i < all.count(); ++i)
+        QVERIFY(all[i - 1].score >= all[i].score);
+    QSet<quint64> ids;
+    for (const SearchIndex::Match &m : all)
+        ids.insert(m.item);
+    for (const ItemPointer &item : items) {
+        bool expected = SearchIndex::fuzzyScore(
+                SearchIndex::haystackOf(item.data()), "monday") >= 0;
+        QCOMPARE(ids.contains(item->id()), expected);
+    }
+
+    QVector<SearchIndex::Match> best = index.fuzzyFind("monday", 1);
+    QCOMPARE(best.count(), 1);
+    QCOMPARE(best.first().score, all.first().score);
+}
+
+QTEST_APPLESS_MAIN(TestSearchIndex)
+
+#include "tst_searchindex.moc"
@@ -0,0 +1,5 @@
+include(../tests.pri)
+
+TARGET = tst_shardedhash
+
+SOURCES += tst_shardedhash.cpp
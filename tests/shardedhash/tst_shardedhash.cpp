@@ -0,0 +1,134 @@
+#include <QtTest>
+#include <QRunnable>
+#include <QThreadPool>
+#include <algorithm>
+#include "shardedhash.h"
+
+class TestShardedHash : public QObject {
+    Q_OBJECT
+private slots:
+    void insertAndLookup();
+    void insertIfAbsent();
+    void takeAndRemove();
+    void countAndValues();
+    void threads();
+};
+
+void TestShardedHash::insertAndLookup()
+{
+    ShardedHash<QString, int> hash;
+    QVERIFY(!hash.contains("one"));
+    QCOMPARE(hash.value("one"), 0);
+    QCOMPARE(hash.value("one", -1), -1);
+
+    hash.insert("one", 1);
+    hash.insert("two", 2);
+    QVERIFY(hash.contains("one"));
+    QCOMPARE(hash.value("one"), 1);
+    QCOMPARE(hash.value("two"), 2);
+
+    hash.insert("one", 11);
+    QCOMPARE(hash.value("one"), 11);
+    QCOMPARE(hash.count(), 2);
+}
+
+void TestShardedHash::insertIfAbsent()
+{
+    ShardedHash<quint64, QString> hash;
+    QCOMPARE(hash.insertIfAbsent(7, "first"), QString("first"));
+    QCOMPARE(hash.insertIfAbsent(7, "second"), QString("first"));
+    QCOMPARE(hash.value(7), QString("first"));
+    QCOMPARE(hash.count(), 1);
+}
+
+void TestShardedHash::takeAndRemove()
+{
+    ShardedHash<quint64, QString> hash;
+    hash.insert(1, "a");
+    hash.insert(2, "b");
+    QCOMPARE(hash.take(1), QString("a"));
+    QVERIFY(!hash.contains(1));
+    QCOMPARE(hash.take(1), QString());
+    QVERIFY(hash.remove(2));
+    QVERIFY(!hash.remove(2));
+    QCOMPARE(hash.count(), 0);
+
+    hash.insert(3, "c");
+    hash.clear();
+    QCOMPARE(hash.count(), 0);
+    QVERIFY(!hash.contains(3));
+}
+
+void TestShardedHash::countAndValues()
+{
+    // Enough keys to land in every shard.
+    ShardedHash<quint64, quint64> hash;
+    const quint64 total = 10000;
+    for (quint64 key = 1; key <= total; ++key)
+        hash.insert(key, key * 2);
+    QCOMPARE(hash.count(), int(total));
+
+    QList<quint64> values = hash.values();
+    QCOMPARE(values.count(), int(total));
+    std::sort(values.begin(), values.end());
+    for (quint64 i = 0; i < total; ++i)
+        QCOMPARE(values.at(int(i)), (i + 1) * 2);
+}
+
+class HashWorker : public QRunnable {
+public:
+    HashWorker(ShardedHash<quint64, quint64> *hash, quint64 first, quint64 count)
+        : hash(hash), first(first), count(count) {}
+
+    void run()
+    {
+        // Everything written is read back at once, by a thread which may
+        // share its shard with another writing.
+        for (quint64 key = first; key < first + count; ++key) {
+            hash->insert(key, key);
+            if (hash->value(key) != key)
+                ++failures;
+            if (hash->insertIfAbsent(key, 0) != key)
+                ++failures;
+        }
+        for (quint64 key = first; key < first + count; key += 2)
+            if (!hash->remove(key))
+                ++failures;
+    }
+
+    QAtomicInt failures;
+
+private:
+    ShardedHash<quint64, quint64> *hash;
+    quint64 first;
+    quint64 count;
+};
+
+void TestShardedHash::threads()
+{
+    const int workers = 8;
+    const quint64 perWorker = 20000;
+    ShardedHash<quint64, quint64> hash;
+    QThreadPool pool;
+    pool.setMaxThreadCount(workers);
+    QList<HashWorker*> started;
+    for (int i = 0; i < workers; ++i) {
+        HashWorker *worker = new HashWorker(&hash, 1 + i * perWorker, perWorker);
+        worker->setAutoDelete(false);
+        started.append(worker);
+        pool.start(worker);
+    }
+    pool.waitForDone();
+
+    for (HashWorker *worker : started) {
+        QCOMPARE(worker->failures.load(), 0);
+        delete worker;
+    }
+    QCOMPARE(hash.count(), int(workers * perWorker / 2));
+    for (quint64 key = 1; key <= workers * perWorker; ++key)
+        QCOMPARE(hash.contains(key), key % 2 == 0);
+}
+
+QTEST_APPLESS_MAIN(TestShardedHash)
+
+#include "tst_shardedhash.moc"
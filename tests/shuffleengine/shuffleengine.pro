@@ -0,0 +1,5 @@
+include(../tests.pri)
+
+TARGET = tst_shuffleengine
+
+SOURCES += tst_shuffleengine.cpp
@@ -0,0 +1,240 @@
+#include <QtTest>
+#include "playlist.h"
+#include "playlistindex.h"
+#include "shuffleengine.h"
+
+// A playlist as the engine sees it: the items in order, and by id.
+class Shuffled {
+public:
+    explicit Shuffled(int count)
+    {
+        for (int i = 0; i < count; ++i)
+            add();
+    }
+
+    ItemPointer add()
+    {
+        ItemPointer item(new Item(QUrl::fromLocalFile(
+                QString("/music/track %1.flac").arg(items.count()))));
+        items.append(item);
+        byId.insert(item->id(), item);
+        return item;
+    }
+
+    void remove(const ItemPointer &item)
+    {
+        items.removeOne(item);
+        byId.remove(item->id());
+        engine.remove(item->id());
+    }
+
+    // Advances from whatever was played last, as the player does.
+    ItemPointer next()
+    {
+        ItemPointer item = engine.next(items, byId, current);
+        current = item ? item->id() : 0;
+        return item;
+    }
+
+    ItemPointer previous()
+    {
+        ItemPointer item = engine.previous(byId, current);
+        if (item)
+            current = item->id();
+        return item;
+    }
+
+    PlaylistIndex items;
+    ShuffleEngine::ItemsById byId;
+    ShuffleEngine engine;
+    quint64 current = 0;
+};
+
+class TestShuffleEngine : public QObject {
+    Q_OBJECT
+private slots:
+    void empty();
+    void single();
+    void runPlaysEverythingOnce_data();
+    void runPlaysEverythingOnce();
+    void nextRunDoesNotRepeat();
+    void backAndForth();
+    void pickedByHand();
+    void insertedDuringRun();
+    void removedDuringRun();
+    void saveAndRestore();
+};
+
+void TestShuffleEngine::empty()
+{
+    Shuffled list(0);
+    QVERIFY(list.next().isNull());
+    QVERIFY(list.previous().isNull());
+}
+
+void TestShuffleEngine::single()
+{
+    Shuffled list(1);
+    ItemPointer only = list.items.first();
+    for (int i = 0; i < 3; ++i)
+        QCOMPARE(list.next(), only);
+}
+
+void TestShuffleEngine::runPlaysEverythingOnce_data()
+{
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("two") << 2;
+    QTest::newRow("a few") << 7;
+    QTest::newRow("many") << 5000;
+}
+
+void TestShuffleEngine::runPlaysEverythingOnce()
+{
+    QFETCH(int, count);
+
+    // Both ways of drawing are used: by probing positions while most of the
+    // list is unplayed, and from the gathered remainder after that.
+    Shuffled list(count);
+    QSet<quint64> seen;
+    for (int i = 0; i < count; ++i) {
+        ItemPointer item = list.next();
+        QVERIFY(item);
+        QVERIFY(!seen.contains(item->id()));
+        seen.insert(item->id());
+    }
+    QCOMPARE(seen.count(), count);
+}
+
+void TestShuffleEngine::nextRunDoesNotRepeat()
+{
+    const int count = 20;
+    Shuffled list(count);
+    ItemPointer last;
+    for (int i = 0; i < count; ++i)
+        last = list.next();
+
+    // The item playing as a run ends counts as played in the next.
+    QSet<quint64> seen;
+    for (int i = 0; i < count - 1; ++i) {
+        ItemPointer item = list.next();
+        QVERIFY(item != last);
+        QVERIFY(!seen.contains(item->id()));
+        seen.insert(item->id());
+    }
+}
+
+void TestShuffleEngine::backAndForth()
+{
+    Shuffled list(50);
+    QList<ItemPointer> played;
+    for (int i = 0; i < 10; ++i)
+        played.append(list.next());
+
+    for (int i = played.count() - 2; i >= 0; --i)
+        QCOMPARE(list.previous(), played.at(i));
+    QVERIFY(list.previous().isNull());
+
+    for (int i = 1; i < played.count(); ++i)
+        QCOMPARE(list.next(), played.at(i));
+    QVERIFY(!played.contains(list.next()));
+}
+
+void TestShuffleEngine::pickedByHand()
+{
+    Shuffled list(50);
+    ItemPointer first = list.next();
+    list.next();
+    list.previous();
+
+    // Going back to the first, then picking another by hand, forgets what
+    // came after the first and continues from the one picked.
+    ItemPointer picked;
+    for (const ItemPointer &item : list.items)
+        if (item != first) {
+            picked = item;
+            break;
+        }
+    list.current = picked->id();
+    ItemPointer after = list.next();
+    QVERIFY(after != picked);
+    QCOMPARE(list.previous(), picked);
+    QCOMPARE(list.previous(), first);
+}
+
+void TestShuffleEngine::insertedDuringRun()
+{
+    const int count = 10;
+    Shuffled list(count);
+    QSet<quint64> seen;
+    // Past half way, so the remainder has been gathered.
+    for (int i = 0; i < count - 2; ++i)
+        seen.insert(list.next()->id());
+
+    ItemPointer added = list.add();
+    list.engine.insert(added);
+    for (int i = 0; i < 3; ++i)
+        seen.insert(list.next()->id());
+    QVERIFY(seen.contains(added->id()));
+    QCOMPARE(seen.count(), count + 1);
+}
+
+void TestShuffleEngine::removedDuringRun()
+{
+    const int count = 10;
+    Shuffled list(count);
+    QSet<quint64> seen;
+    for (int i = 0; i < count - 3; ++i)
+        seen.insert(list.next()->id());
+
+    ItemPointer doomed;
+    for (const ItemPointer &item : list.items)
+        if (!seen.contains(item->id())) {
+            doomed = item;
+            break;
+        }
+    list.remove(doomed);
+    for (int i = 0; i < 2; ++i) {
+        ItemPointer item = list.next();
+        QVERIFY(item != doomed);
+        QVERIFY(!seen.contains(item->id()));
+        seen.insert(item->id());
+    }
+    QCOMPARE(seen.count(), count - 1);
+}
+
+void TestShuffleEngine::saveAndRestore()
+{
+    const int count = 30;
+    Shuffled list(count);
+    QList<ItemPointer> played;
+    for (int i = 0; i < 12; ++i)
+        played.append(list.next());
+    list.previous();
+    list.previous();
+
+    // Saved by position, so a fresh engine over the same list reads it.
+    QVariantMap saved = list.engine.toVMap(list.items, list.byId);
+    ShuffleEngine restored;
+    restored.fromVMap(saved, list.items.toList());
+
+    quint64 current = list.current;
+    QCOMPARE(restored.next(list.items, list.byId, current), played.at(10));
+    QCOMPARE(restored.next(list.items, list.byId, played.at(10)->id()), played.at(11));
+    current = played.at(11)->id();
+
+    QSet<quint64> seen;
+    for (const ItemPointer &item : played)
+        seen.insert(item->id());
+    for (int i = 0; i < count - played.count(); ++i) {
+        ItemPointer item = restored.next(list.items, list.byId, current);
+        QVERIFY(!seen.contains(item->id()));
+        seen.insert(item->id());
+        current = item->id();
+    }
+    QCOMPARE(seen.count(), count);
+}
+
+QTEST_APPLESS_MAIN(TestShuffleEngine)
+
+#include "tst_shuffleengine.moc"
@@ -0,0 +1,37 @@
+# What every test is built with: the playlist model, from the same sources
+# the player is built from, without the gui or mpv.
+
+QT       += core testlib
+QT       -= gui
+
+QMAKE_CXXFLAGS += -Wall
+
+TEMPLATE = app
+
+CONFIG += c++14 console testcase
+CONFIG -= app_bundle
+
+INCLUDEPATH += $$PWD/..
+DEPENDPATH += $$PWD/..
+
+SOURCES += \
+    $$PWD/../playlist.cpp \
+    $$PWD/../playliststore.cpp \
+    $$PWD/../editjournal.cpp \
+    $$PWD/../playlistindex.cpp \
+    $$PWD/../itempool.cpp \
+    $$PWD/../paralleljobs.cpp \
+    $$PWD/../searchindex.cpp \
+    $$PWD/../shuffleengine.cpp
+
+HEADERS += \
+    $$PWD/../playlist.h \
+    $$PWD/../playliststore.h \
+    $$PWD/../editjournal.h \
+    $$PWD/../playlistindex.h \
+    $$PWD/../itempool.h \
+    $$PWD/../paralleljobs.h \
+    $$PWD/../searchindex.h \
+    $$PWD/../shardedhash.h \
+    $$PWD/../shuffleengine.h \
+    $$PWD/fixtures.h
@@ -0,0 +1,17 @@
+# Tests for the playlist model, each its own QtTest program.
+#
+# Build and run with qmake+make from this folder:
+#   qmake && make -j *threads* && make check
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    playlistindex \
+    searchindex \
+    shardedhash \
+    shuffleengine \
+    editjournal \
+    playliststore \
+    metadatacache \
+    autosaver \
+    itemsize
@@ -0,0 +1,434 @@
+#include <QCryptographicHash>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSaveFile>
+#include <functional>
+#include <mpv/qthelper.hpp>
+#include <mpv/render.h>
+#include "metadatacache.h"
+#include "storage.h"
+#include "thumbnailer.h"
+
+// One headless mpv handle, and the software render context that draws its
+// frames into memory.
+class ThumbnailRenderer {
+public:
+    enum Result { Rendered, NoPicture, Failed };
+
+    ThumbnailRenderer();
+    ~ThumbnailRenderer();
+    bool isValid() const { return render != nullptr; }
+    // Leaves the frame in image when Rendered.  NoPicture means the file
+    // would not open or has no video, and Failed that it was cut short.
+    Result renderFile(const QString &fileName, QImage *image,
+                      const std::function<bool()> &cancelled);
+
+private:
+    static void wakeOnFrame(void *ctx);
+    mpv_event_id waitFor(mpv_event_id wanted,
+                         const std::function<bool()> &cancelled);
+    bool waitForFrame(const std::function<bool()> &cancelled);
+    void stopPlayback(const std::function<bool()> &cancelled);
+
+    mpv::qt::Handle mpv;
+    mpv_render_context *render = nullptr;
+};
+
+// Renders until there is nothing left, then hands its renderer back.
+class ThumbnailerRunner : public QRunnable {
+public:
+    explicit ThumbnailerRunner(const QSharedPointer<Thumbnailer> &thumbnailer)
+        : thumbnailer(thumbnailer) {}
+
+    void run()
+    {
+        thumbnailer->work();
+    }
+
+private:
+    QSharedPointer<Thumbnailer> thumbnailer;
+};
+
+static QVariant propertyOf(mpv_handle *mpv, const char *name)
+{
+    mpv_node node;
+    if (mpv_get_property(mpv, name, MPV_FORMAT_NODE, &node) < 0)
+        return QVariant();
+    QVariant v = mpv::qt::node_to_variant(&node);
+    mpv_free_node_contents(&node);
+    return v;
+}
+
+static bool hasVideo(mpv_handle *mpv)
+{
+    for (const QVariant &v : propertyOf(mpv, "track-list").toList())
+        if (v.toMap().value("type").toString() == "video")
+            return true;
+    return false;
+}
+
+// Where the thumbnail of a file is kept, or nothing if the file is not
+// there.  Files are named for their identity, as in the MetadataCache, and
+// spread over 256 folders so that none grows too large.
+static QString thumbnailFile(const QString &fileName)
+{
+    FileIdentity id;
+    if (!identifyFile(fileName, &id))
+        return QString();
+    QByteArray hash = QCryptographicHash::hash(
+            QByteArray::fromRawData(reinterpret_cast<const char *>(&id), sizeof(id)),
+            QCryptographicHash::Sha1).toHex();
+    return QDir(Storage::fetchConfigPath()).absoluteFilePath(
+            QString("thumbnails/%1/%2.png").arg(QString::fromLatin1(hash.left(2)),
+                                                QString::fromLatin1(hash.mid(2))));
+}
+
+// A file with no picture is kept as an empty file, so that it is not opened
+// again.
+static void keepThumbnail(const QString &thumbnail, const QImage &image)
+{
+    if (MetadataCache::getSingleton()->isReadOnly())
+        return;
+    QDir().mkpath(QFileInfo(thumbnail).absolutePath());
+    QSaveFile file(thumbnail);
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+    if (!image.isNull() && !image.save(&file, "PNG"))
+        return;
+    file.commit();
+}
+
+
+
+ThumbnailRenderer::ThumbnailRenderer()
+{
+    mpv_handle *raw = mpv_create();
+    if (!raw)
+        return;
+    mpv = mpv::qt::Handle::FromRawHandle(raw);
+    // Nothing is heard or looked for besides the file, and the picture is
+    // taken from a tenth of the way in, at the nearest keyframe.
+    static const char *options[][2] = {
+        { "config", "no" }, { "terminal", "no" }, { "idle", "yes" },
+        { "pause", "yes" }, { "vo", "libmpv" }, { "ao", "null" },
+        { "aid", "no" }, { "sid", "no" }, { "hwdec", "no" },
+        { "start", "10%" }, { "hr-seek", "no" }, { "osd-level", "0" },
+        { "load-scripts", "no" }, { "ytdl", "no" }, { "osc", "no" },
+        { "input-default-bindings", "no" }, { "sub-auto", "no" },
+        { "audio-file-auto", "no" }, { "cache", "no" },
+    };
+    for (auto &option : options)
+        mpv_set_option_string(mpv, option[0], option[1]);
+    if (mpv_initialize(mpv) < 0)
+        return;
+#ifdef MPV_RENDER_API_TYPE_SW
+    mpv_render_param params[] {
+        { MPV_RENDER_PARAM_API_TYPE, const_cast<char *>(MPV_RENDER_API_TYPE_SW) },
+        { MPV_RENDER_PARAM_INVALID, nullptr }
+    };
+    if (mpv_render_context_create(&render, mpv, params) < 0) {
+        render = nullptr;
+        return;
+    }
+    mpv_render_context_set_update_callback(render, ThumbnailRenderer::wakeOnFrame,
+                                           static_cast<mpv_handle *>(mpv));
+#endif
+}
+
+ThumbnailRenderer::~ThumbnailRenderer()
+{
+    // The render context has to go before the handle it draws from.
+    if (render) {
+        mpv_render_context_set_update_callback(render, nullptr, nullptr);
+        mpv_render_context_free(render);
+    }
+}
+
+ThumbnailRenderer::Result ThumbnailRenderer::renderFile(const QString &fileName,
+        QImage *image, const std::function<bool()> &cancelled)
+{
+#ifndef MPV_RENDER_API_TYPE_SW
+    Q_UNUSED(fileName);
+    Q_UNUSED(image);
+    Q_UNUSED(cancelled);
+    return Failed;
+#else
+    if (!render)
+        return Failed;
+    // Whatever is left over from the last file goes first.
+    while (mpv_wait_event(mpv, 0)->event_id != MPV_EVENT_NONE) {}
+
+    QByteArray file = fileName.toUtf8();
+    const char *load[] = { "loadfile", file.constData(), nullptr };
+    if (mpv_command(mpv, load) < 0)
+        return NoPicture;
+    mpv_event_id id = waitFor(MPV_EVENT_FILE_LOADED, cancelled);
+    if (id == MPV_EVENT_END_FILE)
+        return NoPicture;
+    if (id != MPV_EVENT_FILE_LOADED) {
+        stopPlayback(cancelled);
+        return Failed;
+    }
+    if (!hasVideo(mpv)) {
+        stopPlayback(cancelled);
+        return NoPicture;
+    }
+    if (!waitForFrame(cancelled)) {
+        stopPlayback(cancelled);
+        return Failed;
+    }
+
+    // mpv scales the frame down as it draws it, and keeps its shape.
+    QSize video(propertyOf(mpv, "dwidth").toInt(), propertyOf(mpv, "dheight").toInt());
+    if (video.isEmpty()) {
+        stopPlayback(cancelled);
+        return NoPicture;
+    }
+    QSize size = video;
+    if (size.width() > Thumbnailer::width || size.height() > Thumbnailer::height)
+        size.scale(Thumbnailer::width, Thumbnailer::height, Qt::KeepAspectRatio);
+    size = size.expandedTo(QSize(1, 1));
+
+    // Rows of a multiple of 64 bytes keep the scaler on its fast paths.
+    QImage frame((size.width() + 15) & ~15, size.height(), QImage::Format_RGB32);
+    int frameSize[2] = { size.width(), size.height() };
+    size_t stride = size_t(frame.bytesPerLine());
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    char format[] = "bgr0";
+#else
+    char format[] = "0rgb";
+#endif
+    mpv_render_param params[] {
+        { MPV_RENDER_PARAM_SW_SIZE, frameSize },
+        { MPV_RENDER_PARAM_SW_FORMAT, format },
+        { MPV_RENDER_PARAM_SW_STRIDE, &stride },
+        { MPV_RENDER_PARAM_SW_POINTER, frame.bits() },
+        { MPV_RENDER_PARAM_INVALID, nullptr }
+    };
+    int result = mpv_render_context_render(render, params);
+    stopPlayback(cancelled);
+    if (result < 0)
+        return NoPicture;
+    // The padding byte is left as it falls, and RGB32 wants it set.
+    *image = frame.copy(0, 0, size.width(), size.height());
+    for (int y = 0; y < image->height(); ++y) {
+        auto line = reinterpret_cast<quint32 *>(image->scanLine(y));
+        for (int x = 0; x < image->width(); ++x)
+            line[x] |= 0xff000000;
+    }
+    return Rendered;
+#endif
+}
+
+void ThumbnailRenderer::wakeOnFrame(void *ctx)
+{
+    mpv_wakeup(static_cast<mpv_handle *>(ctx));
+}
+
+// Waits for an event, returning it, or MPV_EVENT_NONE if the time runs out
+// or the file is no longer wanted.  END_FILE ends the wait too, as the file
+// is not going to load after that.
+mpv_event_id ThumbnailRenderer::waitFor(mpv_event_id wanted,
+                                        const std::function<bool()> &cancelled)
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+    while (!cancelled() && elapsed.elapsed() < Thumbnailer::timeout) {
+        mpv_event_id id = mpv_wait_event(mpv, 0.1)->event_id;
+        if (id == wanted || id == MPV_EVENT_SHUTDOWN
+                || (id == MPV_EVENT_END_FILE && wanted == MPV_EVENT_FILE_LOADED))
+            return id;
+    }
+    return MPV_EVENT_NONE;
+}
+
+bool ThumbnailRenderer::waitForFrame(const std::function<bool()> &cancelled)
+{
+    // The update callback wakes the wait as soon as a frame is ready.
+    QElapsedTimer elapsed;
+    elapsed.start();
+    while (!cancelled() && elapsed.elapsed() < Thumbnailer::timeout) {
+        if (mpv_render_context_update(render) & MPV_RENDER_UPDATE_FRAME)
+            return true;
+        mpv_event_id id = mpv_wait_event(mpv, 0.1)->event_id;
+        if (id == MPV_EVENT_END_FILE || id == MPV_EVENT_SHUTDOWN)
+            return false;
+    }
+    return false;
+}
+
+void ThumbnailRenderer::stopPlayback(const std::function<bool()> &cancelled)
+{
+    const char *stop[] = { "stop", nullptr };
+    mpv_command(mpv, stop);
+    waitFor(MPV_EVENT_IDLE, cancelled);
+}
+
+
+
+Thumbnailer::Thumbnailer() : QObject()
+{
+    pool.setMaxThreadCount(handleCount);
+}
+
+void Thumbnailer::request(const QStringList &fileNames)
+{
+    QMutexLocker locker(&mutex);
+    wanted = fileNames;
+    wantedSet = fileNames.toSet();
+    schedule();
+}
+
+void Thumbnailer::stop()
+{
+    stopping.storeRelease(1);
+    QMutexLocker locker(&mutex);
+    wanted.clear();
+    wantedSet.clear();
+    idle.clear();
+}
+
+void Thumbnailer::work()
+{
+    QString fileName;
+    QSharedPointer<ThumbnailRenderer> renderer;
+    {
+        QMutexLocker locker(&mutex);
+        if (!idle.isEmpty())
+            renderer = idle.takeLast();
+    }
+    auto cancelled = [this, &fileName]() {
+        return stopping.loadAcquire() || !isWanted(fileName);
+    };
+
+    while (takeNext(fileName, renderer)) {
+        QString thumbnail = thumbnailFile(fileName);
+        if (thumbnail.isEmpty()) {
+            emit thumbnailed(fileName, QImage());
+            continue;
+        }
+        QImage image;
+        QFileInfo kept(thumbnail);
+        if (kept.exists()) {
+            if (kept.size() > 0)
+                image.load(thumbnail, "PNG");
+            emit thumbnailed(fileName, image);
+            continue;
+        }
+
+        // Files known to have no video are not opened.
+        QVariantMap metadata;
+        if (MetadataCache::getSingleton()->lookup(fileName, &metadata)
+                && metadata.contains("video-tracks")
+                && !metadata.value("video-tracks").toInt()) {
+            keepThumbnail(thumbnail, QImage());
+            emit thumbnailed(fileName, QImage());
+            continue;
+        }
+
+        if (!renderer)
+            renderer.reset(new ThumbnailRenderer);
+        auto result = renderer->renderFile(fileName, &image, cancelled);
+        if (result == ThumbnailRenderer::Failed && cancelled())
+            continue;
+        // A file that took too long may be quicker another time, so it is
+        // only passed over until the program is next started.
+        if (result != ThumbnailRenderer::Failed)
+            keepThumbnail(thumbnail, image);
+        emit thumbnailed(fileName, image);
+    }
+}
+
+void Thumbnailer::schedule()
+{
+    // Called with the mutex held.
+    if (stopping.loadAcquire() || wanted.isEmpty() || running >= handleCount)
+        return;
+    ++running;
+    pool.start(new ThumbnailerRunner(sharedFromThis()));
+}
+
+bool Thumbnailer::takeNext(QString &fileName,
+                           QSharedPointer<ThumbnailRenderer> &renderer)
+{
+    QMutexLocker locker(&mutex);
+    rendering.remove(fileName);
+    if (!stopping.loadAcquire()) {
+        while (!wanted.isEmpty()) {
+            fileName = wanted.takeFirst();
+            // Asked for again while another runner is on it.
+            if (rendering.contains(fileName))
+                continue;
+            rendering.insert(fileName);
+            schedule();
+            return true;
+        }
+    }
+    // Out of work.  The renderer is kept for next time, unless stopping.
+    if (renderer && renderer->isValid() && !stopping.loadAcquire())
+        idle.append(renderer);
+    renderer.reset();
+    --running;
+    return false;
+}
+
+bool Thumbnailer::isWanted(const QString &fileName)
+{
+    QMutexLocker locker(&mutex);
+    return wantedSet.contains(fileName);
+}
+
+
+
+ThumbnailCache::ThumbnailCache()
+{
+    entries.setMaxCost(budget);
+}
+
+static int costOf(const QImage &image, const QPixmap &scaled)
+{
+    return 1 + (image.byteCount() + scaled.width() * scaled.height() * 4) / 1024;
+}
+
+bool ThumbnailCache::contains(const QString &fileName) const
+{
+    return entries.contains(fileName);
+}
+
+void ThumbnailCache::insert(const QString &fileName, const QImage &image)
+{
+    Entry *entry = new Entry;
+    entry->image = image;
+    entries.insert(fileName, entry, costOf(image, QPixmap()));
+}
+
+const QPixmap *ThumbnailCache::find(const QString &fileName, const QSize &box,
+                                    qreal ratio)
+{
+    Entry *entry = entries.object(fileName);
+    if (!entry || entry->image.isNull())
+        return nullptr;
+    QSize device = box * ratio;
+    if (entry->box != device) {
+        // Scaled once for the row size, with Qt's smooth scaler, and put
+        // back at its new cost.
+        entry = entries.take(fileName);
+        entry->scaled = QPixmap::fromImage(entry->image.scaled(
+                device, Qt::KeepAspectRatio, Qt::SmoothTransformation));
+        entry->scaled.setDevicePixelRatio(ratio);
+        entry->box = device;
+        entries.insert(fileName, entry, costOf(entry->image, entry->scaled));
+        entry = entries.object(fileName);
+        if (!entry)
+            return nullptr;
+    }
+    return &entry->scaled;
+}
+
+void ThumbnailCache::clear()
+{
+    entries.clear();
+}
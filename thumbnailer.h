@@ -0,0 +1,94 @@
+#ifndef THUMBNAILER_H
+#define THUMBNAILER_H
+// Pictures of what a playlist's files look like, for showing beside them.
+//
+// A few headless mpv handles render a frame from a tenth of the way into
+// each file through the software render API, so no GPU or window is needed,
+// on a pool of their own, as MediaProbe's are.  The frame is scaled down by
+// mpv as it is rendered and written to a disk cache, one file per video,
+// spread across folders by the first byte of a hash of the file's identity.
+// Only the rows on screen are asked for, and a new request replaces the
+// last, so files scrolled past are dropped, even mid-render.
+//
+// ThumbnailCache is the tier in memory, which the painter draws from.
+
+#include <QAtomicInt>
+#include <QCache>
+#include <QEnableSharedFromThis>
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QPixmap>
+#include <QSet>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QThreadPool>
+
+class ThumbnailRenderer;
+
+class Thumbnailer : public QObject, public QEnableSharedFromThis<Thumbnailer> {
+    Q_OBJECT
+public:
+    static const int handleCount = 2;
+    // How long a file may take to show its first frame, in ms.
+    static const int timeout = 10000;
+    // The box thumbnails are rendered to fit, in pixels.
+    static const int width = 256;
+    static const int height = 144;
+
+    Thumbnailer();
+
+    // Makes thumbnails of these files, in order, in place of those asked
+    // for before.
+    void request(const QStringList &fileNames);
+    // Finishes up with the files being rendered, and leaves the rest.
+    void stop();
+
+    // Called on the pool.
+    void work();
+
+signals:
+    // A null image if the file has no picture to show.
+    void thumbnailed(QString fileName, QImage image);
+
+private:
+    void schedule();
+    bool takeNext(QString &fileName, QSharedPointer<ThumbnailRenderer> &renderer);
+    bool isWanted(const QString &fileName);
+
+    QThreadPool pool;
+    QMutex mutex;
+    QStringList wanted;
+    QSet<QString> wantedSet;
+    QSet<QString> rendering;
+    QList<QSharedPointer<ThumbnailRenderer>> idle;
+    int running = 0;
+    QAtomicInt stopping;
+};
+
+class ThumbnailCache {
+public:
+    // In KiB.
+    static const int budget = 32768;
+
+    ThumbnailCache();
+
+    bool contains(const QString &fileName) const;
+    void insert(const QString &fileName, const QImage &image);
+    // The thumbnail scaled to fit the box, in device pixels, or nullptr if
+    // there is none, yet or at all.
+    const QPixmap *find(const QString &fileName, const QSize &box, qreal ratio);
+    void clear();
+
+private:
+    struct Entry {
+        QImage image;
+        QPixmap scaled;
+        QSize box;
+    };
+
+    QCache<QString, Entry> entries;
+};
+
+#endif // THUMBNAILER_H